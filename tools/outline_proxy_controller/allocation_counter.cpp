@@ -0,0 +1,58 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdlib>
+#include <new>
+
+#include "allocation_counter.h"
+
+#if defined(OUTLINE_COUNT_ALLOCATIONS)
+
+static thread_local size_t thread_heap_allocations = 0;
+
+// The array and nothrow forms of libstdc++ call these, the aligned ones are
+// left alone
+void *operator new(std::size_t size) {
+  thread_heap_allocations++;
+  for (;;) {
+    if (auto memory = std::malloc(size > 0 ? size : 1)) {
+      return memory;
+    }
+    auto handler = std::get_new_handler();
+    if (handler == nullptr) {
+      throw std::bad_alloc{};
+    }
+    handler();
+  }
+}
+
+void operator delete(void *memory) noexcept {
+  std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+  std::free(memory);
+}
+
+size_t outline::ThreadHeapAllocations() {
+  return thread_heap_allocations;
+}
+
+#else  // defined(OUTLINE_COUNT_ALLOCATIONS)
+
+size_t outline::ThreadHeapAllocations() {
+  return 0;
+}
+
+#endif  // defined(OUTLINE_COUNT_ALLOCATIONS)
@@ -0,0 +1,29 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+
+namespace outline {
+
+/**
+ * @brief The number of heap allocations the calling thread has made so far.
+ *
+ * They are only counted when built with `OUTLINE_COUNT_ALLOCATIONS`, which
+ * replaces the global `operator new`; always 0 otherwise.
+ */
+size_t ThreadHeapAllocations();
+
+}  // namespace outline
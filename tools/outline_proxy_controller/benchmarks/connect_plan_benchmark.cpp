@@ -0,0 +1,156 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// How long switching the routes of a connection to the tun device, and back,
+// takes: with one `ip route` process per change as the full connection path
+// does, with a RouteBatch serialized on every commit, and with the prebuilt
+// CompiledRouteBatch of a connect plan. Runs as root in a network namespace
+// of its own, with veth pairs standing for the uplink and the tun device.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <net/if.h>
+#include <sched.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include "routing_table.h"
+
+using namespace outline;
+using Clock = std::chrono::steady_clock;
+
+extern char **environ;
+
+static const char *const kIpCommand = "/usr/sbin/ip";
+static const char *const kGatewayAddress = "192.0.2.1";
+static const char *const kTunRouterAddress = "10.0.85.2";
+static const char *const kServerAddress = "203.0.113.1";
+static const int kRounds = 200;
+// forking a process per route change is much slower
+static const int kIpCommandRounds = 20;
+
+static void Ip(std::vector<std::string> arguments) {
+  arguments.insert(arguments.begin(), kIpCommand);
+  std::vector<char *> argv;
+  for (auto &argument : arguments) {
+    argv.push_back(argument.data());
+  }
+  argv.push_back(nullptr);
+  pid_t pid;
+  if (::posix_spawn(&pid, kIpCommand, nullptr, nullptr, argv.data(), environ) != 0) {
+    throw std::runtime_error("failed to run ip");
+  }
+  int status;
+  ::waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    throw std::runtime_error("ip " + arguments[1] + " " + arguments[2] + " failed");
+  }
+}
+
+static void SetUpNetwork() {
+  if (::unshare(CLONE_NEWNET) != 0) {
+    throw std::system_error{errno, std::generic_category(),
+                            "failed to enter a network namespace of our own"};
+  }
+  for (const auto &[name, address] : {std::pair{"bench-up", "192.0.2.2/24"},
+                                      std::pair{"bench-tun", "10.0.85.1/24"}}) {
+    auto peer = std::string{name} + "-peer";
+    Ip({"link", "add", name, "type", "veth", "peer", "name", peer});
+    Ip({"addr", "add", address, "dev", name});
+    Ip({"link", "set", name, "up"});
+    Ip({"link", "set", peer, "up"});
+  }
+  Ip({"route", "add", "default", "via", kGatewayAddress});
+}
+
+struct Timing {
+  double connect_us;
+  double disconnect_us;
+};
+
+static double Median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+static Timing Measure(int rounds, const std::function<void()> &connect,
+                      const std::function<void()> &disconnect) {
+  std::vector<double> connects;
+  std::vector<double> disconnects;
+  for (int i = 0; i < rounds; i++) {
+    auto start = Clock::now();
+    connect();
+    auto connected = Clock::now();
+    disconnect();
+    auto disconnected = Clock::now();
+    connects.push_back(std::chrono::duration<double, std::micro>(connected - start).count());
+    disconnects.push_back(
+        std::chrono::duration<double, std::micro>(disconnected - connected).count());
+  }
+  return {Median(connects), Median(disconnects)};
+}
+
+int main() {
+  try {
+    SetUpNetwork();
+    NetlinkSocket rtnl{NETLINK_ROUTE};
+    auto uplink_index = static_cast<int>(::if_nametoindex("bench-up"));
+
+    // what OutlineProxyController::connectBatch builds
+    RouteBatch connect;
+    connect.Add({kServerAddress, 32, kGatewayAddress, uplink_index, 5});
+    for (const auto &route : DumpDefaultRoutes(rtnl)) {
+      connect.Delete(route);
+    }
+    connect.Add({"", 0, kTunRouterAddress, 0, 10});
+    auto disconnect = connect.Inverse();
+
+    std::printf("median time of %zu route changes, in microseconds\n", connect.size());
+    std::printf("%-28s %12s %12s\n", "path", "connect", "disconnect");
+    auto report = [](const char *name, Timing timing) {
+      std::printf("%-28s %12.1f %12.1f\n", name, timing.connect_us, timing.disconnect_us);
+    };
+
+    report("ip route, one per change",
+           Measure(kIpCommandRounds,
+                   [] {
+                     Ip({"route", "add", kServerAddress, "via", kGatewayAddress, "metric", "5"});
+                     Ip({"route", "del", "default"});
+                     Ip({"route", "add", "default", "via", kTunRouterAddress, "metric", "10"});
+                   },
+                   [] {
+                     Ip({"route", "del", "default"});
+                     Ip({"route", "add", "default", "via", kGatewayAddress});
+                     Ip({"route", "del", kServerAddress});
+                   }));
+    report("RouteBatch", Measure(kRounds, [&] { connect.Commit(rtnl); },
+                                 [&] { disconnect.Commit(rtnl); }));
+    CompiledRouteBatch compiled_connect{connect};
+    CompiledRouteBatch compiled_disconnect{disconnect};
+    report("CompiledRouteBatch (plan)", Measure(kRounds, [&] { compiled_connect.Commit(rtnl); },
+                                                [&] { compiled_disconnect.Commit(rtnl); }));
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
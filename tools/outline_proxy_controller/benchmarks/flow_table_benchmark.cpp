@@ -0,0 +1,161 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The cost of accounting the packets of the native data plane in a
+// FlowTable of one shard, as TunPump does, with 64k concurrent flows (the
+// capacity of the pump) and with 1M: creating the flows, accounting packets
+// of existing flows in random order and in the order of creation, a batch
+// at a time or one by one, the getTopFlows scan and a full expiry.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "flow_table.h"
+
+using namespace outline;
+using Clock = std::chrono::steady_clock;
+
+static const uint32_t kPacketSize = 1200;
+static const uint32_t kIdleTimeoutSeconds = 120;
+static const int kLookupRounds = 3;
+
+static double Seconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/**
+ * @brief `count` TCP flows from 10.0.0.2 to port 443 of random addresses, in
+ *        batches of parsed packets.
+ */
+static std::vector<FlowTuples> Flows(size_t count, std::mt19937_64 &random) {
+  std::vector<FlowTuples> batches((count + FlowTuples::kCapacity - 1) / FlowTuples::kCapacity);
+  for (size_t i = 0; i < count; i++) {
+    auto &batch = batches[i / FlowTuples::kCapacity];
+    auto j = i % FlowTuples::kCapacity;
+    batch.count = j + 1;
+    batch.version[j] = 4;
+    batch.protocol[j] = IPPROTO_TCP;
+    batch.source_v4[j] = 0x0a000002;
+    batch.destination_v4[j] = static_cast<uint32_t>(random());
+    batch.source_port[j] = static_cast<uint16_t>(random());
+    batch.destination_port[j] = 443;
+  }
+  return batches;
+}
+
+static FlowKey Key(const FlowTuples &batch, size_t j) {
+  FlowKey key;
+  key.version = 4;
+  key.protocol = batch.protocol[j];
+  key.local_address = {10, 0, 0, 2};
+  auto destination = batch.destination_v4[j];
+  key.remote_address = {static_cast<uint8_t>(destination >> 24),
+                        static_cast<uint8_t>(destination >> 16),
+                        static_cast<uint8_t>(destination >> 8), static_cast<uint8_t>(destination)};
+  key.local_port = batch.source_port[j];
+  key.remote_port = batch.destination_port[j];
+  return key;
+}
+
+static void Run(size_t count, std::mt19937_64 &random) {
+  // a quarter of headroom, as a table is sized for its busiest time
+  FlowTable table{count * 5 / 4, 1, kIdleTimeoutSeconds};
+  auto &shard = table.GetShard(0);
+  auto batches = Flows(count, random);
+  std::vector<uint32_t> bytes(FlowTuples::kCapacity, kPacketSize);
+  uint32_t now = 10;
+
+  auto report = [](const char *name, double seconds, size_t operations) {
+    std::printf("  %-36s %10.1f M/s %10.1f ns\n", name, operations / seconds / 1e6,
+                seconds * 1e9 / operations);
+  };
+
+  std::printf("%zu flows\n", count);
+  auto start = Clock::now();
+  for (const auto &batch : batches) {
+    shard.AccountBatch(batch, bytes.data(), FlowDirection::kSent, now);
+  }
+  report("creating the flows", Seconds(start), count);
+
+  // the packets of random existing flows, read from the tun device as well
+  auto shuffled = batches;
+  for (auto &batch : shuffled) {
+    for (size_t j = 0; j < batch.count; j++) {
+      const auto &other = batches[random() % batches.size()];
+      auto k = random() % other.count;
+      batch.destination_v4[j] = other.destination_v4[k];
+      batch.source_port[j] = other.source_port[k];
+    }
+  }
+  start = Clock::now();
+  for (int round = 0; round < kLookupRounds; round++) {
+    for (const auto &batch : shuffled) {
+      shard.AccountBatch(batch, bytes.data(), FlowDirection::kSent, now);
+    }
+  }
+  report("accounting, random flows", Seconds(start), kLookupRounds * count);
+
+  start = Clock::now();
+  for (int round = 0; round < kLookupRounds; round++) {
+    for (const auto &batch : batches) {
+      shard.AccountBatch(batch, bytes.data(), FlowDirection::kSent, now);
+    }
+  }
+  report("accounting, in order", Seconds(start), kLookupRounds * count);
+
+  std::vector<FlowKey> keys;
+  for (const auto &batch : shuffled) {
+    for (size_t j = 0; j < batch.count; j++) {
+      keys.push_back(Key(batch, j));
+    }
+  }
+  start = Clock::now();
+  for (int round = 0; round < kLookupRounds; round++) {
+    for (const auto &key : keys) {
+      shard.Account(key, FlowDirection::kSent, kPacketSize, now);
+    }
+  }
+  report("accounting, random flows, one by one", Seconds(start), kLookupRounds * count);
+
+  auto stats = table.Stats();
+  if (stats.created_flows != count || stats.untracked_packets != 0) {
+    std::printf("  unexpected: %lu flows created, %lu packets untracked\n",
+                static_cast<unsigned long>(stats.created_flows),
+                static_cast<unsigned long>(stats.untracked_packets));
+  }
+
+  start = Clock::now();
+  table.TopFlows(10, FlowOrder::kBytes, FlowGrouping::kFlow, now);
+  std::printf("  %-36s %10.1f ms\n", "top 10 flows", Seconds(start) * 1e3);
+  start = Clock::now();
+  table.TopFlows(10, FlowOrder::kBytes, FlowGrouping::kDestination, now);
+  std::printf("  %-36s %10.1f ms\n", "top 10 destinations", Seconds(start) * 1e3);
+
+  start = Clock::now();
+  shard.Expire(now + kIdleTimeoutSeconds + 1);
+  report("expiring every flow", Seconds(start), count);
+}
+
+int main() {
+  std::mt19937_64 random{1};
+  for (size_t count : {size_t{64} * 1024, size_t{1'000'000}}) {
+    Run(count, random);
+  }
+  return 0;
+}
@@ -0,0 +1,160 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The heap allocations the io thread makes to serve each kind of client
+// request, in steady state: a client session is served over a socketpair to
+// a client on a thread of its own, and the counter of the counting operator
+// new of OUTLINE_COUNT_ALLOCATIONS is read on the io thread before writing a
+// request and after reading its response. The work the routing commands hand
+// over to the operation worker is not counted. Runs as root in a network
+// namespace of its own, where the controller creates its tun device.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sched.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <boost/asio.hpp>
+
+#include "allocation_counter.h"
+#include "logger.h"
+#include "outline_controller_server.h"
+#include "outline_proxy_controller.h"
+
+using namespace outline;
+
+static const int kWarmUpRounds = 10;
+static const int kRounds = 1000;
+
+static const struct {
+  const char *name;
+  const char *request;
+} kRequests[] = {
+  {"getDeviceName", R"({"action":"getDeviceName","parameters":{}})"},
+  {"classifyDestinations",
+   R"({"action":"classifyDestinations","parameters":{"destinations":["1.1.1.1","10.0.85.7","127.0.0.1"]}})"},
+  {"abortRouting", R"({"action":"abortRouting","parameters":{}})"},
+  {"unknown action", R"({"action":"nope","parameters":{}})"},
+};
+
+/**
+ * @brief The heap allocations the thread running `io_context` has made so far.
+ */
+static size_t IoThreadAllocations(boost::asio::io_context &io_context) {
+  std::atomic<size_t> allocations{SIZE_MAX};
+  boost::asio::post(io_context, [&allocations] { allocations = ThreadHeapAllocations(); });
+  while (allocations == SIZE_MAX) {
+    std::this_thread::yield();
+  }
+  return allocations;
+}
+
+static void WriteRequest(int fd, std::string_view request) {
+  while (!request.empty()) {
+    auto written = ::write(fd, request.data(), request.size());
+    if (written <= 0) {
+      throw std::system_error{errno, std::generic_category(), "failed to write a request"};
+    }
+    request.remove_prefix(static_cast<size_t>(written));
+  }
+}
+
+static void ReadResponse(int fd) {
+  // a response has no nested object, it ends at its first '}'
+  char buffer[4096];
+  for (;;) {
+    auto length = ::read(fd, buffer, sizeof(buffer));
+    if (length <= 0) {
+      throw std::system_error{errno, std::generic_category(), "failed to read a response"};
+    }
+    if (std::memchr(buffer, '}', static_cast<size_t>(length)) != nullptr) {
+      return;
+    }
+  }
+}
+
+static void RunClient(int fd, boost::asio::io_context &io_context) {
+  std::vector<size_t> allocations(std::size(kRequests));
+  for (int round = 0; round < kWarmUpRounds + kRounds; round++) {
+    for (size_t i = 0; i < std::size(kRequests); i++) {
+      auto before = IoThreadAllocations(io_context);
+      WriteRequest(fd, kRequests[i].request);
+      ReadResponse(fd);
+      if (round >= kWarmUpRounds) {
+        allocations[i] += IoThreadAllocations(io_context) - before;
+      }
+    }
+  }
+
+  std::printf("%-24s %24s\n", "request", "heap allocations");
+  for (size_t i = 0; i < std::size(kRequests); i++) {
+    std::printf("%-24s %24.2f\n", kRequests[i].name,
+                static_cast<double>(allocations[i]) / kRounds);
+  }
+}
+
+int main() {
+  using namespace boost::asio;
+
+  try {
+    if (::unshare(CLONE_NEWNET) != 0) {
+      throw std::system_error{errno, std::generic_category(),
+                              "failed to enter a network namespace of our own"};
+    }
+    // the unknown action is logged as an error on every round
+    logger.set_threshold(ABORT);
+
+    io_context io_context;
+    // the networks are only cached in memory
+    auto controller = std::make_shared<OutlineProxyController>();
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+      throw std::system_error{errno, std::generic_category(), "failed to create a socketpair"};
+    }
+    local::stream_protocol::socket server{io_context, local::stream_protocol{}, fds[0]};
+    auto session = std::make_shared<OutlineClientSession>(std::move(server), controller, nullptr,
+                                                          nullptr, nullptr);
+    co_spawn(io_context, [session]() { return session->Start(); }, detached);
+
+    std::exception_ptr client_failure;
+    std::thread client{[&] {
+      try {
+        RunClient(fds[1], io_context);
+      } catch (...) {
+        client_failure = std::current_exception();
+      }
+      ::close(fds[1]);
+      io_context.stop();
+    }};
+    io_context.run();
+    client.join();
+    if (client_failure) {
+      std::rethrow_exception(client_failure);
+    }
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,106 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Lookups per second of the classifyDestinations mirror of the routing
+// table, for routing tables of growing size, answering requests of 4096
+// destinations.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+
+#include "route_classifier.h"
+
+using namespace outline;
+
+static const size_t kDestinations = 1 << 20;
+static const size_t kRequestSize = 4096;
+static const int kRounds = 20;
+static const int kTunInterfaceIndex = 1;
+
+static std::string FormatAddress(uint32_t address) {
+  in_addr parsed{htonl(address)};
+  char buffer[INET_ADDRSTRLEN];
+  ::inet_ntop(AF_INET, &parsed, buffer, sizeof(buffer));
+  return buffer;
+}
+
+/**
+ * @brief A default route into the tunnel and `count` random routes from /8
+ *        to /32, most of them longer than /16 as bypass lists are.
+ */
+static std::vector<RouteEntry> RandomRoutes(size_t count, std::mt19937 &random) {
+  std::vector<RouteEntry> routes{{"", 0, "10.0.85.2", kTunInterfaceIndex, 10}};
+  for (size_t i = 0; i < count; i++) {
+    auto length = static_cast<uint8_t>(8 + random() % 25);
+    auto network = static_cast<uint32_t>(random()) & (~uint32_t{0} << (32 - length));
+    routes.push_back({FormatAddress(network), length, "192.0.2.1",
+                      static_cast<int>(1 + random() % 3), 100});
+  }
+  return routes;
+}
+
+template <typename Fn>
+static double LookupsPerSecond(Fn &&lookup_all) {
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < kRounds; round++) {
+    lookup_all();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return kRounds * kDestinations / elapsed.count();
+}
+
+int main() {
+  std::mt19937 random{1};
+  std::vector<AddressEntry> addresses{{2, "192.0.2.2", 24}, {kTunInterfaceIndex, "10.0.85.1", 24}};
+
+  std::printf("%10s %16s %16s %10s\n", "routes", "batched M/s", "one by one M/s", "ns/lookup");
+  for (size_t count : {16, 1000, 10000, 100000}) {
+    auto routes = RandomRoutes(count, random);
+    RouteClassifier classifier;
+    classifier.Rebuild(routes, addresses, kTunInterfaceIndex);
+
+    // half of the destinations inside a route, as the sites of a bypass list
+    std::vector<uint32_t> destinations(kDestinations);
+    for (size_t i = 0; i < kDestinations; i++) {
+      const auto &route = routes[random() % routes.size()];
+      in_addr network{};
+      ::inet_pton(AF_INET, route.destination.empty() ? "0.0.0.0" : route.destination.c_str(),
+                  &network);
+      destinations[i] = i % 2 ? static_cast<uint32_t>(random())
+                              : ntohl(network.s_addr) | (random() & 0xff);
+    }
+    std::vector<RoutePath> paths(kDestinations);
+
+    auto batched = LookupsPerSecond([&] {
+      for (size_t first = 0; first < kDestinations; first += kRequestSize) {
+        classifier.Classify(&destinations[first], &paths[first], kRequestSize);
+      }
+    });
+    auto one_by_one = LookupsPerSecond([&] {
+      for (size_t i = 0; i < kDestinations; i++) {
+        classifier.Classify(&destinations[i], &paths[i], 1);
+      }
+    });
+
+    std::printf("%10zu %16.1f %16.1f %10.2f\n", count, batched / 1e6, one_by_one / 1e6,
+                1e9 / batched);
+  }
+  return 0;
+}
@@ -0,0 +1,131 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// How long the connect and disconnect graphs of OutlineProxyController take
+// when their stages run one at a time, as they did before StageGraph, and
+// when the ready ones run concurrently on 4 workers like the stage workers
+// of the controller. Each stub stage sleeps as long as the `ip` and `sysctl`
+// processes the real stage runs (50 ms each by default, or the milliseconds
+// given as the first argument, a slow embedded device); the netlink batches
+// and the file writes are left out as they take microseconds.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/thread_pool.hpp>
+
+#include "stage_graph.h"
+
+using namespace outline;
+using Clock = std::chrono::steady_clock;
+
+static const int kRounds = 5;
+
+static std::chrono::milliseconds process_delay{50};
+
+/**
+ * @brief A stage running `processes` child processes.
+ */
+static StageGraph::Action Processes(int processes) {
+  return [processes] { std::this_thread::sleep_for(processes * process_delay); };
+}
+
+// routeThroughOutline on a network seen for the first time
+static void DetectionConnect(StageGraph &graph) {
+  // ip route get, ip route add
+  auto serverRoute = graph.Add("adding the route to the outline server", Processes(2));
+  auto snapshot = graph.Add("querying the default routes", Processes(0));
+  // ip route, ip route del, ip route
+  auto gatewayRoute =
+      graph.Add("deleting the default routes", Processes(3), {}, {serverRoute, snapshot});
+  auto tunRoute =
+      graph.Add("routing the traffic through the tun device", Processes(1), {}, {gatewayRoute});
+  graph.Add("disabling IPv6", Processes(1));
+  graph.Add("setting the outline DNS server", Processes(0), {}, {tunRoute});
+}
+
+// routeThroughOutline with the connect plan or a cached network profile
+static void BatchConnect(StageGraph &graph) {
+  auto tunRoute = graph.Add("routing the traffic through the tun device", Processes(0));
+  graph.Add("disabling IPv6", Processes(1));
+  graph.Add("setting the outline DNS server", Processes(0), {}, {tunRoute});
+}
+
+// routeDirectly without a connect plan
+static void FullDisconnect(StageGraph &graph) {
+  auto tunRoute = graph.Add("deleting the default routes", Processes(3));
+  auto gatewayRoute =
+      graph.Add("restoring the default route", Processes(1), {}, {tunRoute});
+  // ip route, ip route del
+  auto serverRoute =
+      graph.Add("deleting the route to the outline server", Processes(2), {}, {gatewayRoute});
+  graph.Add("enabling IPv6", Processes(1));
+  graph.Add("restoring the DNS setting", Processes(0));
+  graph.Add("emptying the bypass routing table", Processes(0), {}, {serverRoute});
+  graph.Add("restoring the steering of the tun queues", Processes(0));
+}
+
+// routeDirectly with the connect plan
+static void BatchDisconnect(StageGraph &graph) {
+  graph.Add("enabling IPv6", Processes(1));
+  graph.Add("restoring the DNS setting", Processes(0));
+  graph.Add("emptying the bypass routing table", Processes(0));
+  graph.Add("restoring the steering of the tun queues", Processes(0));
+}
+
+static double MedianMilliseconds(const std::function<void(StageGraph &)> &build,
+                                 size_t workers) {
+  boost::asio::thread_pool pool{workers};
+  std::vector<double> times;
+  for (int round = 0; round < kRounds; round++) {
+    StageGraph graph;
+    build(graph);
+    auto start = Clock::now();
+    graph.Run(pool);
+    times.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+  }
+  pool.join();
+  std::sort(times.begin(), times.end());
+  return times[times.size() / 2];
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1) {
+    process_delay = std::chrono::milliseconds{std::atoi(argv[1])};
+  }
+
+  std::printf("median time of the stages, with %lld ms per child process, in milliseconds\n",
+              static_cast<long long>(process_delay.count()));
+  std::printf("%-36s %12s %12s\n", "graph", "sequential", "concurrent");
+  const struct {
+    const char *name;
+    void (*build)(StageGraph &);
+  } kGraphs[] = {
+    {"connect, detecting the network", DetectionConnect},
+    {"connect, plan or cached network", BatchConnect},
+    {"disconnect", FullDisconnect},
+    {"disconnect, plan", BatchDisconnect},
+  };
+  for (const auto &graph : kGraphs) {
+    std::printf("%-36s %12.1f %12.1f\n", graph.name, MedianMilliseconds(graph.build, 1),
+                MedianMilliseconds(graph.build, 4));
+  }
+  return 0;
+}
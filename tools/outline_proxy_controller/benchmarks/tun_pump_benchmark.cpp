@@ -0,0 +1,292 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Packets per second and CPU time per Gbit of the native data plane: UDP
+// packets of 1400 bytes are flooded into a tun device for a few seconds and
+// moved to a local UDP reflector, whose echoes are written back to the tun
+// device, by the io_uring TunPump and then by a plain poll() loop of read()
+// and send() calls, the way a userspace tunnel usually does it. Only the CPU
+// time of the thread moving the packets is counted, the flood and the
+// reflector run on threads of their own. Runs as root in a network namespace
+// of its own.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/if_tun.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sched.h>
+#include <spawn.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "tun_pump.h"
+
+using namespace outline;
+using Clock = std::chrono::steady_clock;
+
+extern char **environ;
+
+static const char *const kIpCommand = "/usr/sbin/ip";
+static const char *const kTunName = "bench-tun";
+// routed into the tun device
+static const char *const kFloodDestination = "10.0.85.2";
+static const uint16_t kReflectorPort = 5555;
+static const size_t kPacketSize = 1400;
+// the IPv4 and UDP headers
+static const size_t kPayloadSize = kPacketSize - 28;
+static const unsigned kBatchSize = 32;
+static const std::chrono::seconds kDuration{3};
+
+static void Ip(std::vector<std::string> arguments) {
+  arguments.insert(arguments.begin(), kIpCommand);
+  std::vector<char *> argv;
+  for (auto &argument : arguments) {
+    argv.push_back(argument.data());
+  }
+  argv.push_back(nullptr);
+  pid_t pid;
+  if (::posix_spawn(&pid, kIpCommand, nullptr, nullptr, argv.data(), environ) != 0) {
+    throw std::runtime_error("failed to run ip");
+  }
+  int status;
+  ::waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    throw std::runtime_error("ip " + arguments[1] + " " + arguments[2] + " failed");
+  }
+}
+
+static void SetUpNetwork() {
+  if (::unshare(CLONE_NEWNET) != 0) {
+    throw std::system_error{errno, std::generic_category(),
+                            "failed to enter a network namespace of our own"};
+  }
+  Ip({"link", "set", "lo", "up"});
+  Ip({"tuntap", "add", "dev", kTunName, "mode", "tun"});
+  Ip({"addr", "add", "10.0.85.1/24", "dev", kTunName});
+  Ip({"link", "set", kTunName, "up"});
+}
+
+static int UdpSocket() {
+  int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    throw std::system_error{errno, std::generic_category(), "failed to create a UDP socket"};
+  }
+  return fd;
+}
+
+static sockaddr_in Address(const char *address, uint16_t port) {
+  sockaddr_in result{};
+  result.sin_family = AF_INET;
+  result.sin_port = htons(port);
+  ::inet_pton(AF_INET, address, &result.sin_addr);
+  return result;
+}
+
+/**
+ * @brief Echoes every datagram back to its sender until `stop` is set.
+ */
+static void Reflect(int fd, const std::atomic<bool> &stop) {
+  std::vector<char> buffer(2048);
+  while (!stop) {
+    sockaddr_in peer{};
+    socklen_t peer_length = sizeof(peer);
+    auto length = ::recvfrom(fd, buffer.data(), buffer.size(), 0,
+                             reinterpret_cast<sockaddr *>(&peer), &peer_length);
+    if (length > 0) {
+      ::sendto(fd, buffer.data(), static_cast<size_t>(length), MSG_DONTWAIT,
+               reinterpret_cast<sockaddr *>(&peer), peer_length);
+    }
+  }
+}
+
+/**
+ * @brief Sends datagrams routed into the tun device, a batch at a time, as
+ *        fast as the socket lets it until `stop` is set.
+ */
+static void Flood(const std::atomic<bool> &stop) {
+  int fd = UdpSocket();
+  auto destination = Address(kFloodDestination, 9);
+  if (::connect(fd, reinterpret_cast<sockaddr *>(&destination), sizeof(destination)) != 0) {
+    throw std::system_error{errno, std::generic_category(), "failed to connect the flood"};
+  }
+  std::vector<char> payload(kPayloadSize, 'x');
+  std::vector<iovec> iovecs(kBatchSize, {payload.data(), payload.size()});
+  std::vector<mmsghdr> messages(kBatchSize);
+  for (unsigned i = 0; i < kBatchSize; i++) {
+    messages[i].msg_hdr.msg_iov = &iovecs[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+  while (!stop) {
+    // the tun device drops what does not fit in its queue, ENOBUFS is fine
+    ::sendmmsg(fd, messages.data(), kBatchSize, 0);
+  }
+  ::close(fd);
+}
+
+static int OpenTunQueue() {
+  int fd = ::open("/dev/net/tun", O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::system_error{errno, std::generic_category(), "failed to open /dev/net/tun"};
+  }
+  ifreq request{};
+  std::strncpy(request.ifr_name, kTunName, IFNAMSIZ - 1);
+  request.ifr_flags = IFF_TUN | IFF_NO_PI;
+  if (::ioctl(fd, TUNSETIFF, &request) < 0) {
+    throw std::system_error{errno, std::generic_category(), "failed to attach to the tun device"};
+  }
+  return fd;
+}
+
+static double ThreadCpuSeconds() {
+  timespec time;
+  ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+  return static_cast<double>(time.tv_sec) + time.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Moves the packets between the tun device and the reflector with
+ *        poll(), read() and send() until `stop` is set.
+ */
+static TunPumpStats RunReadSendLoop(const std::atomic<bool> &stop) {
+  int tun = OpenTunQueue();
+  int upstream = UdpSocket();
+  auto reflector = Address("127.0.0.1", kReflectorPort);
+  if (::connect(upstream, reinterpret_cast<sockaddr *>(&reflector), sizeof(reflector)) != 0) {
+    throw std::system_error{errno, std::generic_category(), "failed to connect the upstream"};
+  }
+
+  TunPumpStats stats;
+  auto cpu_start = ThreadCpuSeconds();
+  std::vector<char> buffer(2048);
+  pollfd fds[] = {{tun, POLLIN, 0}, {upstream, POLLIN, 0}};
+  while (!stop) {
+    if (::poll(fds, 2, 100) <= 0) {
+      continue;
+    }
+    if (fds[0].revents & POLLIN) {
+      auto length = ::read(tun, buffer.data(), buffer.size());
+      if (length > 0 && ::send(upstream, buffer.data(), static_cast<size_t>(length), 0) > 0) {
+        stats.upstream_packets++;
+        stats.upstream_bytes += static_cast<uint64_t>(length);
+      } else {
+        stats.dropped_packets++;
+      }
+    }
+    if (fds[1].revents & POLLIN) {
+      auto length = ::recv(upstream, buffer.data(), buffer.size(), 0);
+      if (length > 0 && ::write(tun, buffer.data(), static_cast<size_t>(length)) > 0) {
+        stats.downstream_packets++;
+        stats.downstream_bytes += static_cast<uint64_t>(length);
+      } else {
+        stats.dropped_packets++;
+      }
+    }
+  }
+  stats.cpu_seconds = ThreadCpuSeconds() - cpu_start;
+  ::close(upstream);
+  ::close(tun);
+  return stats;
+}
+
+static void Report(const char *name, const TunPumpStats &stats, double seconds) {
+  auto gbits = static_cast<double>(stats.upstream_bytes) * 8 / 1e9;
+  std::printf("%-24s %10.1f %10.2f %10.1f %12.1f %14.3f\n", name,
+              static_cast<double>(stats.upstream_packets) / seconds / 1e3, gbits / seconds,
+              static_cast<double>(stats.downstream_packets) / seconds / 1e3,
+              stats.cpu_seconds / seconds * 100, gbits > 0 ? stats.cpu_seconds / gbits : 0);
+}
+
+/**
+ * @brief Flood the tun device for kDuration while `run` moves the packets,
+ *        returning its stats.
+ */
+static TunPumpStats Measure(const std::function<TunPumpStats(const std::atomic<bool> &)> &run) {
+  std::atomic<bool> stop{false};
+  TunPumpStats stats;
+  std::thread mover{[&] { stats = run(stop); }};
+  // let the mover attach its queue
+  std::this_thread::sleep_for(std::chrono::milliseconds{100});
+  std::thread flood{[&] { Flood(stop); }};
+  std::this_thread::sleep_for(kDuration);
+  stop = true;
+  flood.join();
+  mover.join();
+  return stats;
+}
+
+int main() {
+  try {
+    SetUpNetwork();
+    logger.set_threshold(WARN);
+
+    int reflector_fd = UdpSocket();
+    auto reflector = Address("127.0.0.1", kReflectorPort);
+    if (::bind(reflector_fd, reinterpret_cast<sockaddr *>(&reflector), sizeof(reflector)) != 0) {
+      throw std::system_error{errno, std::generic_category(), "failed to bind the reflector"};
+    }
+    timeval timeout{0, 100'000};
+    ::setsockopt(reflector_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    std::atomic<bool> stop_reflector{false};
+    std::thread reflector_thread{[&] { Reflect(reflector_fd, stop_reflector); }};
+
+    std::printf("%zu-byte packets flooded into %s for %lld s\n", kPacketSize, kTunName,
+                static_cast<long long>(kDuration.count()));
+    std::printf("%-24s %10s %10s %10s %12s %14s\n", "mover", "kpps", "Gbit/s", "echo kpps",
+                "CPU %", "CPU-s/Gbit");
+
+    auto pump_stats = Measure([](const std::atomic<bool> &stop) {
+      TunPump pump{kTunName, "127.0.0.1:" + std::to_string(kReflectorPort)};
+      pump.Start();
+      auto start = pump.Stats();
+      while (!stop) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+      }
+      auto end = pump.Stats();
+      pump.Stop();
+      end.upstream_packets -= start.upstream_packets;
+      end.upstream_bytes -= start.upstream_bytes;
+      end.downstream_packets -= start.downstream_packets;
+      end.downstream_bytes -= start.downstream_bytes;
+      end.cpu_seconds -= start.cpu_seconds;
+      return end;
+    });
+    Report("io_uring TunPump", pump_stats, kDuration.count());
+    Report("poll, read() and send()", Measure(RunReadSendLoop), kDuration.count());
+
+    stop_reflector = true;
+    reflector_thread.join();
+    ::close(reflector_fd);
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
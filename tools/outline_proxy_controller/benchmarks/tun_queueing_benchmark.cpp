@@ -0,0 +1,232 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The latency a saturating flow adds to the other flows through a tun
+// device, for each queueing profile. Runs as root in a network namespace of
+// its own: a bulk UDP flow and a UDP probe every 10 ms are sent into a tun
+// device whose reader, standing for tun2socks behind a slow uplink, only
+// reads at a fixed rate. The probes carry their send time, the reader
+// reports how long they queued.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/if_tun.h>
+#include <net/if.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "traffic_control.h"
+
+using namespace outline;
+using Clock = std::chrono::steady_clock;
+
+static const char *const kTunName = "bench-tun0";
+static const char *const kTunAddress = "10.0.85.1";
+static const char *const kPeerAddress = "10.0.85.2";
+static const uint16_t kBulkPort = 5001;
+static const uint16_t kProbePort = 5002;
+static const size_t kBulkPayload = 1400;
+// what the reader forwards, in bits per second
+static const uint64_t kUplinkRate = 20'000'000;
+static const std::chrono::milliseconds kProbeInterval{10};
+static const std::chrono::seconds kRunTime{4};
+// the queue is left to fill up before measuring
+static const std::chrono::seconds kWarmUpTime{1};
+
+static void Check(bool ok, const char *what) {
+  if (!ok) {
+    throw std::system_error{errno, std::generic_category(), what};
+  }
+}
+
+static int CreateTunDevice() {
+  int fd = ::open("/dev/net/tun", O_RDWR | O_CLOEXEC);
+  Check(fd >= 0, "failed to open /dev/net/tun");
+  ifreq request{};
+  std::strncpy(request.ifr_name, kTunName, IFNAMSIZ - 1);
+  request.ifr_flags = IFF_TUN | IFF_NO_PI;
+  Check(::ioctl(fd, TUNSETIFF, &request) == 0, "failed to create the tun device");
+
+  int control = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  auto address = reinterpret_cast<sockaddr_in *>(&request.ifr_addr);
+  address->sin_family = AF_INET;
+  ::inet_pton(AF_INET, kTunAddress, &address->sin_addr);
+  Check(::ioctl(control, SIOCSIFADDR, &request) == 0, "failed to set the tun address");
+  ::inet_pton(AF_INET, "255.255.255.0", &address->sin_addr);
+  Check(::ioctl(control, SIOCSIFNETMASK, &request) == 0, "failed to set the tun netmask");
+  Check(::ioctl(control, SIOCGIFFLAGS, &request) == 0, "failed to get the tun flags");
+  request.ifr_flags |= IFF_UP;
+  Check(::ioctl(control, SIOCSIFFLAGS, &request) == 0, "failed to bring the tun device up");
+  ::close(control);
+  return fd;
+}
+
+static int ConnectUdp(uint16_t port) {
+  int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  Check(fd >= 0, "failed to create a UDP socket");
+  // enough to keep the queue of the device full
+  int buffer = 16 << 20;
+  ::setsockopt(fd, SOL_SOCKET, SO_SNDBUFFORCE, &buffer, sizeof(buffer));
+  sockaddr_in peer{};
+  peer.sin_family = AF_INET;
+  peer.sin_port = htons(port);
+  ::inet_pton(AF_INET, kPeerAddress, &peer.sin_addr);
+  Check(::connect(fd, reinterpret_cast<sockaddr *>(&peer), sizeof(peer)) == 0,
+        "failed to connect a UDP socket");
+  return fd;
+}
+
+struct Result {
+  std::vector<double> probe_delays_ms;
+  uint64_t bulk_bytes = 0;
+  uint64_t lost_probes = 0;
+};
+
+static Result Measure(int tun_fd) {
+  Result result;
+  std::atomic<bool> running{true};
+  std::atomic<bool> measuring{false};
+  auto bulk_fd = ConnectUdp(kBulkPort);
+  auto probe_fd = ConnectUdp(kProbePort);
+
+  std::thread bulk([&] {
+    std::vector<char> payload(kBulkPayload, 'b');
+    while (running.load(std::memory_order_relaxed)) {
+      ::send(bulk_fd, payload.data(), payload.size(), 0);
+    }
+  });
+
+  uint64_t sent_probes = 0;
+  std::thread probes([&] {
+    auto next = Clock::now();
+    while (running.load(std::memory_order_relaxed)) {
+      next += kProbeInterval;
+      std::this_thread::sleep_until(next);
+      int64_t sent_at = Clock::now().time_since_epoch().count();
+      if (measuring.load(std::memory_order_relaxed)) {
+        sent_probes++;
+      }
+      ::send(probe_fd, &sent_at, sizeof(sent_at), 0);
+    }
+  });
+
+  // the reader forwards kUplinkRate, whatever arrives
+  auto start = Clock::now();
+  auto budget_start = start;
+  uint64_t budget_bytes = 0;
+  std::vector<uint8_t> packet(65536);
+  while (Clock::now() - start < kWarmUpTime + kRunTime) {
+    if (!measuring && Clock::now() - start >= kWarmUpTime) {
+      measuring = true;
+    }
+    auto length = ::read(tun_fd, packet.data(), packet.size());
+    if (length < 28 || (packet[0] >> 4) != 4) {
+      continue;
+    }
+    auto header_length = static_cast<size_t>(packet[0] & 0x0f) * 4;
+    uint16_t port = static_cast<uint16_t>(packet[header_length + 2] << 8 |
+                                          packet[header_length + 3]);
+    if (measuring && port == kProbePort &&
+        static_cast<size_t>(length) >= header_length + 8 + sizeof(int64_t)) {
+      int64_t sent_at;
+      std::memcpy(&sent_at, &packet[header_length + 8], sizeof(sent_at));
+      auto delay = Clock::now() - Clock::time_point{Clock::duration{sent_at}};
+      result.probe_delays_ms.push_back(std::chrono::duration<double, std::milli>(delay).count());
+    } else if (measuring && port == kBulkPort) {
+      result.bulk_bytes += static_cast<uint64_t>(length);
+    }
+
+    budget_bytes += static_cast<uint64_t>(length);
+    auto due = budget_start + std::chrono::nanoseconds{budget_bytes * 8 * 1'000'000'000 /
+                                                       kUplinkRate};
+    std::this_thread::sleep_until(due);
+  }
+
+  running = false;
+  bulk.join();
+  probes.join();
+  ::close(bulk_fd);
+  ::close(probe_fd);
+  result.lost_probes = sent_probes > result.probe_delays_ms.size()
+                           ? sent_probes - result.probe_delays_ms.size()
+                           : 0;
+  return result;
+}
+
+static double Percentile(std::vector<double> values, double percentile) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  return values[static_cast<size_t>(percentile * (values.size() - 1))];
+}
+
+int main() {
+  try {
+    Check(::unshare(CLONE_NEWNET) == 0, "failed to enter a network namespace of our own");
+    NetlinkSocket rtnl{NETLINK_ROUTE};
+
+    struct Profile {
+      const char *name;
+      QueueingProfile profile;
+    };
+    const Profile profiles[] = {
+      {"kernel default", {0, "", 0}},
+      {"fq_codel", {0, "fq_codel", 0}},
+      {"cake", {0, "cake", 0}},
+      {"cake, shaped to 95%", {0, "cake", kUplinkRate * 95 / 100}},
+      {"txqueuelen 64", {64, "", 0}},
+      {"txqueuelen 64, fq_codel", {64, "fq_codel", 0}},
+    };
+
+    std::printf("uplink of %lu Mbit/s, a probe every %lld ms\n", kUplinkRate / 1'000'000,
+                static_cast<long long>(kProbeInterval.count()));
+    std::printf("%-26s %10s %10s %10s %12s\n", "profile", "p50 ms", "p99 ms", "lost", "bulk Mbit/s");
+    for (const auto &[name, profile] : profiles) {
+      // a new device for each profile, gone once its file descriptor is closed
+      auto tun_fd = CreateTunDevice();
+      try {
+        ApplyQueueingProfile(rtnl, static_cast<int>(::if_nametoindex(kTunName)), profile);
+      } catch (const std::exception &e) {
+        std::printf("%-26s %s\n", name, e.what());
+        ::close(tun_fd);
+        continue;
+      }
+      auto result = Measure(tun_fd);
+      ::close(tun_fd);
+      std::printf("%-26s %10.1f %10.1f %10lu %12.1f\n", name,
+                  Percentile(result.probe_delays_ms, 0.5), Percentile(result.probe_delays_ms, 0.99),
+                  result.lost_probes,
+                  result.bulk_bytes * 8 / 1e6 / std::chrono::duration<double>(kRunTime).count());
+    }
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,157 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+
+#include "command_line.h"
+
+using namespace outline::command_line;
+
+// the column where the descriptions start in the help text
+static const size_t kDescriptionColumn = 40;
+
+//#region options_description Implementation
+
+options_description::easy_init &options_description::easy_init::operator()(
+    const char *name, const char *description) {
+  return (*this)(name, nullptr, description);
+}
+
+options_description::easy_init &options_description::easy_init::operator()(
+    const char *name, value_semantic *value, const char *description) {
+  std::shared_ptr<value_semantic> owned{value};
+  std::string long_name = name;
+  char alias = '\0';
+  auto comma = long_name.find(',');
+  if (comma != std::string::npos) {
+    if (long_name.size() != comma + 2) {
+      throw std::invalid_argument("invalid option name \"" + long_name + "\"");
+    }
+    alias = long_name[comma + 1];
+    long_name.resize(comma);
+  }
+  owner_->options_.push_back({long_name, alias, std::move(owned), description});
+  return *this;
+}
+
+const options_description::Option &options_description::Find(const std::string &name) const {
+  auto option = std::find_if(options_.begin(), options_.end(),
+                             [&name](const Option &option) { return option.name == name; });
+  if (option == options_.end()) {
+    throw std::invalid_argument("unrecognised option '--" + name + "'");
+  }
+  return *option;
+}
+
+const options_description::Option &options_description::Find(char alias) const {
+  auto option = std::find_if(options_.begin(), options_.end(),
+                             [alias](const Option &option) { return option.alias == alias; });
+  if (alias == '\0' || option == options_.end()) {
+    throw std::invalid_argument(std::string{"unrecognised option '-"} + alias + "'");
+  }
+  return *option;
+}
+
+std::ostream &outline::command_line::operator<<(std::ostream &out,
+                                               const options_description &description) {
+  for (const auto &option : description.options_) {
+    std::string usage = "  ";
+    if (option.alias != '\0') {
+      usage.append("-").append(1, option.alias).append(" [ --").append(option.name).append(" ]");
+    } else {
+      usage.append("--").append(option.name);
+    }
+    if (option.value) {
+      usage.append(" arg");
+      if (option.value->default_any().has_value()) {
+        usage.append(" (=").append(option.value->default_text()).append(")");
+      }
+    }
+    if (usage.size() >= kDescriptionColumn) {
+      out << usage << '\n' << std::string(kDescriptionColumn, ' ');
+    } else {
+      out << usage << std::string(kDescriptionColumn - usage.size(), ' ');
+    }
+    out << option.description << '\n';
+  }
+  return out;
+}
+
+//#endregion options_description Implementation
+
+//#region Parsing Implementation
+
+parsed_options outline::command_line::parse_command_line(int argc, char *argv[],
+                                                         const options_description &description) {
+  parsed_options parsed{&description, {}};
+  for (int i = 1; i < argc; i++) {
+    std::string argument = argv[i];
+    const options_description::Option *option;
+    std::string text;
+    bool has_text = false;
+    if (argument.rfind("--", 0) == 0 && argument.size() > 2) {
+      auto equals = argument.find('=');
+      option = &description.Find(argument.substr(2, equals - 2));
+      if (equals != std::string::npos) {
+        text = argument.substr(equals + 1);
+        has_text = true;
+      }
+    } else if (argument.size() > 1 && argument[0] == '-' && argument[1] != '-') {
+      option = &description.Find(argument[1]);
+      if (argument.size() > 2) {
+        text = argument.substr(2);
+        has_text = true;
+      }
+    } else {
+      throw std::invalid_argument("unexpected argument \"" + argument + "\"");
+    }
+
+    bool repeated =
+        std::any_of(parsed.values.begin(), parsed.values.end(),
+                    [option](const auto &value) { return value.first == option->name; });
+    if (repeated) {
+      throw std::invalid_argument("option '--" + option->name +
+                                  "' cannot be specified more than once");
+    }
+
+    if (!option->value) {
+      if (has_text) {
+        throw std::invalid_argument("option '--" + option->name + "' does not take a value");
+      }
+      parsed.values.emplace_back(option->name, std::any{});
+      continue;
+    }
+    if (!has_text) {
+      if (i + 1 == argc) {
+        throw std::invalid_argument("option '--" + option->name + "' is missing its value");
+      }
+      text = argv[++i];
+    }
+    parsed.values.emplace_back(option->name, option->value->parse(option->name, text));
+  }
+  return parsed;
+}
+
+void outline::command_line::store(const parsed_options &parsed, variables_map &map) {
+  for (const auto &[name, value] : parsed.values) {
+    map.insert_or_assign(name, variable_value{value});
+  }
+  for (const auto &option : parsed.description->options_) {
+    if (option.value && option.value->default_any().has_value()) {
+      map.try_emplace(option.name, option.value->default_any());
+    }
+  }
+}
+
+//#endregion Parsing Implementation
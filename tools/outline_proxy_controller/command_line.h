@@ -0,0 +1,173 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <any>
+#include <charconv>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief The subset of boost::program_options the daemon uses, so that the
+ *        lean build does not link any compiled Boost library: long options
+ *        with an optional one letter alias, flags, typed values with defaults
+ *        and the help text. The names follow boost::program_options, so the
+ *        daemon switches between both with a namespace alias.
+ *
+ * Values are given as `--name value`, `--name=value`, `-n value` or
+ * `-nvalue`. Unknown options, repeated options, missing or malformed values
+ * and positional arguments throw std::invalid_argument.
+ */
+namespace outline::command_line {
+
+class value_semantic {
+public:
+  virtual ~value_semantic() = default;
+
+  virtual std::any parse(const std::string &option, const std::string &text) const = 0;
+
+  const std::any &default_any() const { return default_; }
+  const std::string &default_text() const { return default_text_; }
+
+protected:
+  std::any default_;
+  std::string default_text_;
+};
+
+template <typename T>
+class typed_value : public value_semantic {
+  static_assert(std::is_same_v<T, std::string> || std::is_unsigned_v<T>,
+                "only strings and unsigned integers are supported");
+
+public:
+  typed_value *default_value(const T &value) {
+    default_ = value;
+    if constexpr (std::is_same_v<T, std::string>) {
+      default_text_ = value;
+    } else {
+      default_text_ = std::to_string(value);
+    }
+    return this;
+  }
+
+  std::any parse(const std::string &option, const std::string &text) const override {
+    if constexpr (std::is_same_v<T, std::string>) {
+      return text;
+    } else {
+      // like boost::lexical_cast, a negative number wraps around (e.g. -u -1)
+      bool negative = !text.empty() && text[0] == '-';
+      const char *begin = text.data() + (negative ? 1 : 0);
+      const char *end = text.data() + text.size();
+      T value{};
+      auto [parsed, error] = std::from_chars(begin, end, value);
+      if (begin == end || error != std::errc{} || parsed != end) {
+        throw std::invalid_argument("invalid value \"" + text + "\" for option --" + option);
+      }
+      return negative ? static_cast<T>(0 - value) : value;
+    }
+  }
+};
+
+class variables_map;
+struct parsed_options;
+
+template <typename T>
+typed_value<T> *value() {
+  return new typed_value<T>;
+}
+
+class options_description {
+public:
+  class easy_init {
+  public:
+    explicit easy_init(options_description *owner) : owner_{owner} {}
+
+    /**
+     * @brief Add a flag; `name` is "long" or "long,l".
+     */
+    easy_init &operator()(const char *name, const char *description);
+
+    /**
+     * @brief Add an option taking a value, owning `value`.
+     */
+    easy_init &operator()(const char *name, value_semantic *value, const char *description);
+
+  private:
+    options_description *owner_;
+  };
+
+  easy_init add_options() { return easy_init{this}; }
+
+  friend std::ostream &operator<<(std::ostream &out, const options_description &description);
+
+private:
+  struct Option {
+    std::string name;
+    char alias;
+    std::shared_ptr<value_semantic> value;
+    std::string description;
+  };
+
+  const Option &Find(const std::string &name) const;
+  const Option &Find(char alias) const;
+
+  std::vector<Option> options_;
+
+  friend class easy_init;
+  friend parsed_options parse_command_line(int argc, char *argv[],
+                                           const options_description &description);
+  friend void store(const parsed_options &parsed, variables_map &map);
+};
+
+std::ostream &operator<<(std::ostream &out, const options_description &description);
+
+class variable_value {
+public:
+  variable_value() = default;
+  explicit variable_value(std::any value) : value_{std::move(value)} {}
+
+  template <typename T>
+  const T &as() const {
+    return std::any_cast<const T &>(value_);
+  }
+
+private:
+  std::any value_;
+};
+
+class variables_map : public std::map<std::string, variable_value> {};
+
+struct parsed_options {
+  const options_description *description;
+  std::vector<std::pair<std::string, std::any>> values;
+};
+
+parsed_options parse_command_line(int argc, char *argv[], const options_description &description);
+
+/**
+ * @brief Store the parsed values and the defaults of the options which were
+ *        not given into `map`.
+ */
+void store(const parsed_options &parsed, variables_map &map);
+
+inline void notify(variables_map &) {}
+
+}  // namespace outline::command_line
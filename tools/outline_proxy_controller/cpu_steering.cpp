@@ -0,0 +1,163 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+#include <dirent.h>
+
+#include "cpu_steering.h"
+#include "logger.h"
+
+using namespace outline;
+
+// large enough for any CPU number the kernel accepts (NR_CPUS)
+static const unsigned kMaxCpu = 8192;
+
+static unsigned ParseCpu(const std::string &list, const std::string &number) {
+  if (number.empty() || number.find_first_not_of("0123456789") != std::string::npos ||
+      number.size() > 5 || std::stoul(number) >= kMaxCpu) {
+    throw std::invalid_argument("invalid CPU list \"" + list + "\"");
+  }
+  return static_cast<unsigned>(std::stoul(number));
+}
+
+/**
+ * @brief The indexes of the `<prefix><index>` entries of a queues directory, in order.
+ */
+static std::vector<unsigned> ListQueues(const std::string &directory, const std::string &prefix) {
+  std::vector<unsigned> queues;
+  auto dir = ::opendir(directory.c_str());
+  if (dir == nullptr) {
+    throw std::system_error{errno, std::generic_category(), "failed to list " + directory};
+  }
+  while (auto entry = ::readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name.compare(0, prefix.size(), prefix) == 0 && name.size() > prefix.size()) {
+      queues.push_back(static_cast<unsigned>(std::stoul(name.substr(prefix.size()))));
+    }
+  }
+  ::closedir(dir);
+  std::sort(queues.begin(), queues.end());
+  return queues;
+}
+
+namespace outline {
+
+std::vector<unsigned> ParseCpuList(const std::string &list) {
+  std::vector<unsigned> cpus;
+  size_t start = 0;
+  while (start <= list.size()) {
+    auto end = std::min(list.find(',', start), list.size());
+    auto range = list.substr(start, end - start);
+    auto dash = range.find('-');
+    auto first = ParseCpu(list, range.substr(0, dash));
+    auto last = dash == std::string::npos ? first : ParseCpu(list, range.substr(dash + 1));
+    if (last < first) {
+      throw std::invalid_argument("invalid CPU list \"" + list + "\"");
+    }
+    for (auto cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+    start = end + 1;
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return cpus;
+}
+
+std::string FormatCpuMask(const std::vector<unsigned> &cpus) {
+  std::vector<uint32_t> words(1);
+  for (auto cpu : cpus) {
+    if (cpu / 32 >= words.size()) {
+      words.resize(cpu / 32 + 1);
+    }
+    words[cpu / 32] |= uint32_t{1} << (cpu % 32);
+  }
+
+  std::string mask;
+  for (auto it = words.rbegin(); it != words.rend(); ++it) {
+    char word[9];
+    std::snprintf(word, sizeof(word), "%08x", *it);
+    mask += (mask.empty() ? "" : ",") + std::string{word};
+  }
+  return mask;
+}
+
+}  // namespace outline
+
+//#region CpuSteering Implementation
+
+CpuSteering::CpuSteering(std::string interface_name, CpuSteeringProfile profile)
+  : interface_name_{std::move(interface_name)},
+    profile_{std::move(profile)}
+{}
+
+size_t CpuSteering::Apply() {
+  auto queues_directory = "/sys/class/net/" + interface_name_ + "/queues/";
+  size_t steered = 0;
+
+  auto steer = [&](const std::vector<unsigned> &cpus, const std::string &prefix,
+                   const std::string &file) {
+    if (cpus.empty()) {
+      return;
+    }
+    auto queues = ListQueues(queues_directory, prefix);
+    for (size_t i = 0; i < queues.size(); i++) {
+      auto mask = profile_.align_queues ? FormatCpuMask({cpus[i % cpus.size()]})
+                                        : FormatCpuMask(cpus);
+      WriteMask(queues_directory + prefix + std::to_string(queues[i]) + "/" + file, mask);
+    }
+    steered = std::max(steered, queues.size());
+  };
+  steer(profile_.receive_cpus, "rx-", "rps_cpus");
+  steer(profile_.transmit_cpus, "tx-", "xps_cpus");
+  return steered;
+}
+
+void CpuSteering::Restore() {
+  for (const auto &[path, mask] : previous_masks_) {
+    std::ofstream output{path};
+    // a queue whose reader is gone has no file to restore anymore
+    if (output && !(output << mask << std::flush)) {
+      logger.warn("failed to restore " + path);
+    }
+  }
+  previous_masks_.clear();
+}
+
+void CpuSteering::WriteMask(const std::string &path, const std::string &mask) {
+  if (!previous_masks_.count(path)) {
+    std::ifstream input{path};
+    std::string previous;
+    if (!std::getline(input, previous)) {
+      throw std::runtime_error("failed to read " + path);
+    }
+    previous_masks_.emplace(path, previous);
+  }
+
+  std::ofstream output{path};
+  if (!(output << mask << std::flush)) {
+    // e.g. a CPU which is not online, or a kernel without CONFIG_RPS
+    throw std::runtime_error("failed to write " + mask + " to " + path);
+  }
+}
+
+//#endregion CpuSteering Implementation
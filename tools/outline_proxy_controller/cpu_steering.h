@@ -0,0 +1,87 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace outline {
+
+/**
+ * @brief Which CPUs process the packets of the queues of an interface. A tun
+ *        device is otherwise handled wherever its reader happens to run, and
+ *        the softirq work of a multi-gigabit tunnel piles up on one core.
+ */
+struct CpuSteeringProfile {
+  // CPUs the received packets are steered to (RPS), empty to keep the current setting
+  std::vector<unsigned> receive_cpus;
+  // CPUs whose sends use the transmit queues (XPS), empty to keep the current setting
+  std::vector<unsigned> transmit_cpus;
+  // Give queue N the N-th CPU of each list only, matching a multi-queue reader
+  // whose thread N serves queue N and is pinned to that CPU
+  bool align_queues = false;
+};
+
+/**
+ * @brief Parse a CPU list such as "0-3,6" (the format of `taskset -c`).
+ *
+ * @throw std::invalid_argument The list is malformed.
+ */
+std::vector<unsigned> ParseCpuList(const std::string &list);
+
+/**
+ * @brief Format CPUs as the comma separated 32-bit hex words of a sysfs CPU
+ *        mask, e.g. "00000001,0000000f".
+ */
+std::string FormatCpuMask(const std::vector<unsigned> &cpus);
+
+/**
+ * @brief Writes the `rps_cpus` and `xps_cpus` of the queues of an interface
+ *        and puts the values found there back when asked to.
+ */
+class CpuSteering {
+public:
+  CpuSteering(std::string interface_name, CpuSteeringProfile profile);
+
+  const CpuSteeringProfile &profile() const { return profile_; }
+
+  /**
+   * @brief Steer the queues the interface has now. A tun device only has the
+   *        queues its readers attached, so call it again when they change;
+   *        the value a queue had before it was first steered is kept.
+   *
+   * @return size_t The number of queues steered.
+   * @throw std::runtime_error A mask could not be written.
+   */
+  size_t Apply();
+
+  /**
+   * @brief Write the previous masks back to the queues which still exist.
+   */
+  void Restore();
+
+private:
+  void WriteMask(const std::string &path, const std::string &mask);
+
+private:
+  std::string interface_name_;
+  CpuSteeringProfile profile_;
+  // sysfs file -> its content before we first wrote it
+  std::map<std::string, std::string> previous_masks_;
+};
+
+}  // namespace outline
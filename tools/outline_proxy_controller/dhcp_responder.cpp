@@ -0,0 +1,230 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "dhcp_responder.h"
+#include "internet_checksum.h"
+
+using namespace outline;
+using namespace outline::frame;
+
+// The offsets of the fields of a DHCP frame after the Ethernet header: IPv4
+// without options, UDP, then the fixed part of the DHCP message (RFC 2131)
+// and its options.
+static const size_t kIp = kEthHeaderSize;
+static const size_t kIpTotalLength = kIp + 2;
+static const size_t kIpFragment = kIp + 6;
+static const size_t kIpProtocol = kIp + 9;
+static const size_t kIpChecksum = kIp + 10;
+static const size_t kIpSource = kIp + 12;
+static const size_t kIpDestination = kIp + 16;
+static const size_t kUdp = kIp + 20;
+static const size_t kUdpSource = kUdp;
+static const size_t kUdpDestination = kUdp + 2;
+static const size_t kUdpLength = kUdp + 4;
+static const size_t kUdpChecksum = kUdp + 6;
+static const size_t kDhcp = kUdp + 8;
+static const size_t kDhcpOp = kDhcp;
+static const size_t kDhcpHardwareType = kDhcp + 1;
+static const size_t kDhcpHardwareLength = kDhcp + 2;
+static const size_t kDhcpTransaction = kDhcp + 4;
+static const size_t kDhcpClientAddress = kDhcp + 12;
+static const size_t kDhcpYourAddress = kDhcp + 16;
+static const size_t kDhcpServerAddress = kDhcp + 20;
+static const size_t kDhcpClientHardware = kDhcp + 28;
+static const size_t kDhcpMagic = kDhcp + 236;
+static const size_t kDhcpOptions = kDhcp + 240;
+
+static const uint8_t kIpv4NoOptions = 0x45;
+static const uint8_t kUdpProtocol = 17;
+static const uint16_t kIpFragmentOffsetMask = 0x1fff;
+static const uint16_t kServerPort = 67;
+static const uint16_t kClientPort = 68;
+static const uint32_t kDhcpMagicCookie = 0x63825363;
+
+static const uint8_t kBootRequest = 1;
+static const uint8_t kBootReply = 2;
+
+static const uint8_t kOptionPad = 0;
+static const uint8_t kOptionNetmask = 1;
+static const uint8_t kOptionLeaseTime = 51;
+static const uint8_t kOptionMessageType = 53;
+static const uint8_t kOptionServerId = 54;
+static const uint8_t kOptionEnd = 255;
+
+static const int kDhcpDiscover = 1;
+static const int kDhcpOffer = 2;
+static const int kDhcpRequest = 3;
+static const int kDhcpAck = 5;
+static const int kDhcpNak = 6;
+
+// the client is told off after that many requests for another address
+static const int kBadRequestNakThreshold = 3;
+
+// message type, server identifier, lease time, netmask and end
+static const size_t kFixedOptionsSize = 3 + 6 + 6 + 6 + 1;
+
+/**
+ * @brief The type of a DHCP message, from its options, or -1 if missing.
+ */
+static int MessageType(std::span<const uint8_t> options) {
+  for (size_t i = 0; i < options.size();) {
+    auto type = options[i];
+    if (type == kOptionEnd) {
+      return -1;
+    }
+    if (type == kOptionPad) {
+      i++;
+      continue;
+    }
+    if (i + 1 >= options.size()) {
+      return -1;
+    }
+    auto length = options[i + 1];
+    if (type == kOptionMessageType) {
+      return length == 1 && i + 2 < options.size() ? options[i + 2] : -1;
+    }
+    i += 2 + length;
+  }
+  return -1;
+}
+
+//#region DhcpResponder Implementation
+
+DhcpResponder::DhcpResponder(DhcpResponderConfig config) : config_{std::move(config)} {
+  if (config_.extra_options.size() > kOptionsCapacity - kFixedOptionsSize) {
+    throw std::invalid_argument("the extra DHCP options do not fit in a reply");
+  }
+}
+
+DhcpResult DhcpResponder::Handle(std::span<const uint8_t> frame,
+                                 std::span<uint8_t> reply_buffer) {
+  if (reply_buffer.size() < kMaxReplySize) {
+    throw std::invalid_argument("the DHCP reply buffer is too small");
+  }
+
+  // a DHCP request needs at least one option
+  if (frame.size() < kDhcpOptions || Load16(&frame[kEthType]) != kEthTypeIpv4 ||
+      frame[kIp] != kIpv4NoOptions || frame[kIpProtocol] != kUdpProtocol ||
+      Load16(&frame[kUdpDestination]) != kServerPort) {
+    return {};
+  }
+  auto options = frame.subspan(kDhcpOptions);
+  if (options.empty() || Load16(&frame[kIpTotalLength]) != frame.size() - kIp ||
+      (Load16(&frame[kIpFragment]) & kIpFragmentOffsetMask) != 0) {
+    return {DhcpAction::kDrop, {}};
+  }
+
+  // only the requests of the configured client, to us
+  if (!MacEqual(&frame[kEthSource], config_.client_mac) ||
+      !(MacEqual(&frame[kEthDestination], kBroadcastMac) ||
+        MacEqual(&frame[kEthDestination], config_.server_mac)) ||
+      Load16(&frame[kUdpSource]) != kClientPort ||
+      frame[kDhcpHardwareLength] != config_.client_mac.size() ||
+      !MacEqual(&frame[kDhcpClientHardware], config_.client_mac)) {
+    return {};
+  }
+
+  auto type = MessageType(options);
+  if (frame[kDhcpOp] != kBootRequest || (type != kDhcpDiscover && type != kDhcpRequest)) {
+    return {DhcpAction::kDrop, {}};
+  }
+
+  auto client_address = Load32(&frame[kDhcpClientAddress]);
+  auto bad_request = type == kDhcpRequest && client_address != 0 &&
+                     client_address != config_.client_address;
+  int reply_type = type == kDhcpDiscover ? kDhcpOffer : kDhcpAck;
+  if (type == kDhcpRequest &&
+      (bad_request || !received_discover_ || bad_requests_ >= kBadRequestNakThreshold)) {
+    reply_type = kDhcpNak;
+  }
+  if (type == kDhcpDiscover) {
+    received_discover_ = true;
+  }
+  if (bad_request) {
+    bad_requests_++;
+  }
+
+  auto size = BuildReply(frame, reply_type, reply_buffer);
+  return {DhcpAction::kReply, reply_buffer.first(size)};
+}
+
+size_t DhcpResponder::BuildReply(std::span<const uint8_t> frame, int type,
+                                 std::span<uint8_t> reply) const {
+  auto out = reply.data();
+  std::memset(out, 0, kDhcpOptions);
+
+  // the options first, to know the length of the headers
+  auto option = out + kDhcpOptions;
+  auto put_option = [&option](uint8_t code, uint32_t value, size_t length) {
+    option[0] = code;
+    option[1] = static_cast<uint8_t>(length);
+    if (length == 1) {
+      option[2] = static_cast<uint8_t>(value);
+    } else {
+      Store32(option + 2, value);
+    }
+    option += 2 + length;
+  };
+  put_option(kOptionMessageType, static_cast<uint32_t>(type), 1);
+  put_option(kOptionServerId, config_.server_address, 4);
+  if (type == kDhcpOffer || type == kDhcpAck) {
+    put_option(kOptionLeaseTime, config_.lease_seconds, 4);
+    put_option(kOptionNetmask, config_.netmask, 4);
+    option = std::copy(config_.extra_options.begin(), config_.extra_options.end(), option);
+  }
+  *option++ = kOptionEnd;
+  auto size = static_cast<size_t>(option - out);
+
+  // a NAK is broadcast, as the client may not know its address
+  auto broadcast = type == kDhcpNak || MacEqual(&frame[kEthDestination], kBroadcastMac);
+  std::copy_n(broadcast ? kBroadcastMac.data() : &frame[kEthSource], 6, out + kEthDestination);
+  std::copy(config_.server_mac.begin(), config_.server_mac.end(), out + kEthSource);
+  Store16(out + kEthType, kEthTypeIpv4);
+
+  out[kIp] = kIpv4NoOptions;
+  Store16(out + kIpTotalLength, static_cast<uint16_t>(size - kIp));
+  out[kIp + 8] = 16;  // TTL
+  out[kIpProtocol] = kUdpProtocol;
+  Store32(out + kIpSource, config_.server_address);
+  Store32(out + kIpDestination, broadcast ? 0xffffffff : config_.client_address);
+  Store16(out + kIpChecksum, checksum::Compute(out + kIp, kUdp - kIp));
+
+  Store16(out + kUdpSource, kServerPort);
+  Store16(out + kUdpDestination, kClientPort);
+  Store16(out + kUdpLength, static_cast<uint16_t>(size - kUdp));
+
+  out[kDhcpOp] = kBootReply;
+  out[kDhcpHardwareType] = 1;  // Ethernet
+  out[kDhcpHardwareLength] = static_cast<uint8_t>(config_.client_mac.size());
+  std::copy_n(&frame[kDhcpTransaction], 4, out + kDhcpTransaction);
+  Store32(out + kDhcpYourAddress, type == kDhcpNak ? 0 : config_.client_address);
+  Store32(out + kDhcpServerAddress, config_.server_address);
+  std::copy_n(&frame[kEthSource], 6, out + kDhcpClientHardware);
+  Store32(out + kDhcpMagic, kDhcpMagicCookie);
+
+  auto udp_checksum = checksum::Finish(checksum::Accumulate(
+      out + kUdp, size - kUdp,
+      checksum::PseudoHeaderV4(out + kIpSource, out + kIpDestination, kUdpProtocol,
+                               static_cast<uint16_t>(size - kUdp))));
+  // zero means no checksum in UDP over IPv4
+  Store16(out + kUdpChecksum, udp_checksum == 0 ? 0xffff : udp_checksum);
+  return size;
+}
+
+//#endregion DhcpResponder Implementation
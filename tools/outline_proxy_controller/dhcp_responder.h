@@ -0,0 +1,93 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "ethernet_frame.h"
+
+namespace outline {
+
+struct DhcpResponderConfig {
+  // the adapter whose DHCP requests are answered
+  MacAddress client_mac{};
+  // the virtual DHCP server, which does not need to exist on the link
+  MacAddress server_mac{};
+  // IPv4 addresses in host byte order, e.g. 0x0a000002 for 10.0.0.2
+  uint32_t client_address = 0;
+  uint32_t server_address = 0;
+  uint32_t netmask = 0;
+  uint32_t lease_seconds = 365 * 24 * 3600;
+  // encoded DHCP options (type, length, value) appended to the offers and
+  // acknowledgements, e.g. the router or the DNS servers
+  std::vector<uint8_t> extra_options;
+};
+
+enum class DhcpAction {
+  // not a DHCP request to us: let the frame through
+  kPass,
+  // a DHCP request to us which must be dropped, without a reply
+  kDrop,
+  // a DHCP request to us, answered in `reply`
+  kReply,
+};
+
+struct DhcpResult {
+  DhcpAction action = DhcpAction::kPass;
+  // a complete Ethernet frame, within the reply buffer
+  std::span<uint8_t> reply;
+};
+
+/**
+ * @brief The virtual DHCP server of the tap-windows6 driver (its "DHCP
+ *        masquerade" mode), independent from any platform: it leases a single
+ *        configured address to a single adapter, answering DHCPDISCOVER with
+ *        DHCPOFFER and DHCPREQUEST with DHCPACK, or with DHCPNAK when the
+ *        client asks for another address or asks before discovering.
+ *
+ * Frames are Ethernet frames, as read from a TAP device, and `Handle` never
+ * allocates.
+ */
+class DhcpResponder {
+public:
+  // Ethernet, IPv4, UDP and DHCP headers, and the room for the options
+  static constexpr size_t kOptionsCapacity = 256;
+  static constexpr size_t kMaxReplySize = 14 + 20 + 8 + 240 + kOptionsCapacity;
+
+  /**
+   * @throw std::invalid_argument If the extra options do not fit in a reply.
+   */
+  explicit DhcpResponder(DhcpResponderConfig config);
+
+  /**
+   * @brief Answer `frame` if it is a DHCP request from the configured client.
+   *
+   * @param reply_buffer Where to build the reply, of `kMaxReplySize` bytes at
+   *                     least.
+   */
+  DhcpResult Handle(std::span<const uint8_t> frame, std::span<uint8_t> reply_buffer);
+
+private:
+  size_t BuildReply(std::span<const uint8_t> frame, int type, std::span<uint8_t> reply) const;
+
+  const DhcpResponderConfig config_;
+  bool received_discover_ = false;
+  int bad_requests_ = 0;
+};
+
+}  // namespace outline
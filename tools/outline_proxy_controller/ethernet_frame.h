@@ -0,0 +1,68 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace outline {
+
+using MacAddress = std::array<uint8_t, 6>;
+
+inline constexpr MacAddress kBroadcastMac = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+/**
+ * @brief Accessors of the big-endian fields of the frames of a TAP device,
+ *        which hold no alignment guarantee.
+ */
+namespace frame {
+
+inline constexpr size_t kEthDestination = 0;
+inline constexpr size_t kEthSource = 6;
+inline constexpr size_t kEthType = 12;
+inline constexpr size_t kEthHeaderSize = 14;
+
+inline constexpr uint16_t kEthTypeIpv4 = 0x0800;
+inline constexpr uint16_t kEthTypeArp = 0x0806;
+inline constexpr uint16_t kEthTypeIpv6 = 0x86dd;
+
+inline uint16_t Load16(const uint8_t *bytes) {
+  return static_cast<uint16_t>(bytes[0] << 8 | bytes[1]);
+}
+
+inline uint32_t Load32(const uint8_t *bytes) {
+  return static_cast<uint32_t>(bytes[0]) << 24 | static_cast<uint32_t>(bytes[1]) << 16 |
+         static_cast<uint32_t>(bytes[2]) << 8 | bytes[3];
+}
+
+inline void Store16(uint8_t *bytes, uint16_t value) {
+  bytes[0] = static_cast<uint8_t>(value >> 8);
+  bytes[1] = static_cast<uint8_t>(value);
+}
+
+inline void Store32(uint8_t *bytes, uint32_t value) {
+  Store16(bytes, static_cast<uint16_t>(value >> 16));
+  Store16(bytes + 2, static_cast<uint16_t>(value));
+}
+
+inline bool MacEqual(const uint8_t *bytes, const MacAddress &mac) {
+  return std::equal(mac.begin(), mac.end(), bytes);
+}
+
+}  // namespace frame
+
+}  // namespace outline
@@ -0,0 +1,287 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <linux/inet_diag.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "flow_flusher.h"
+#include "logger.h"
+#include "netlink_socket.h"
+
+using namespace outline;
+
+namespace {
+
+/**
+ * @brief An IPv4 subnet in network byte order.
+ */
+struct Subnet {
+  uint32_t network;
+  uint8_t prefix_length;
+
+  bool Contains(uint32_t address) const {
+    if (prefix_length == 0) {
+      return true;
+    }
+    uint32_t mask = htonl(~uint32_t{0} << (32 - prefix_length));
+    return (address & mask) == (network & mask);
+  }
+};
+
+/**
+ * @brief The rules deciding whether a flow is bound to the stale routing path.
+ */
+struct StaleFlowFilter {
+  uint32_t stale_source;
+  std::vector<Subnet> preserved;
+
+  bool IsStale(uint32_t source, uint32_t destination) const {
+    if (source != stale_source) {
+      return false;
+    }
+    for (const auto &subnet : preserved) {
+      if (subnet.Contains(destination)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+/**
+ * @brief A conntrack entry to be deleted, identified by its original tuple.
+ */
+struct ConntrackEntry {
+  std::string original_tuple;
+  std::optional<uint16_t> zone;
+};
+
+uint32_t ParseIPv4Address(const std::string &address) {
+  in_addr parsed{};
+  if (::inet_pton(AF_INET, address.c_str(), &parsed) != 1) {
+    throw std::invalid_argument("invalid IPv4 address \"" + address + "\"");
+  }
+  return parsed.s_addr;
+}
+
+/**
+ * @brief Find the on-link subnet `local_address` is configured with; it is still
+ *        reached directly regardless of the default route.
+ */
+std::optional<Subnet> FindOnLinkSubnet(NetlinkSocket &rtnl, uint32_t local_address) {
+  std::optional<Subnet> result;
+
+  NetlinkMessage request{RTM_GETADDR, NLM_F_DUMP};
+  ifaddrmsg header{};
+  header.ifa_family = AF_INET;
+  request.AppendHeader(header);
+
+  rtnl.Request(request, [&](const nlmsghdr &msg) {
+    if (msg.nlmsg_type != RTM_NEWADDR) {
+      return;
+    }
+    auto addr = static_cast<const ifaddrmsg*>(NLMSG_DATA(&msg));
+    ForEachNetlinkAttribute<ifaddrmsg>(msg, [&](uint16_t type, const void *data, size_t length) {
+      if (type == IFA_LOCAL && length == sizeof(uint32_t)) {
+        uint32_t address;
+        std::memcpy(&address, data, sizeof(address));
+        if (address == local_address) {
+          result = Subnet{address, addr->ifa_prefixlen};
+        }
+      }
+    });
+  });
+  return result;
+}
+
+/**
+ * @brief Read the source and destination of a `CTA_TUPLE_ORIG` attribute.
+ */
+bool ParseConntrackTuple(const void *data, size_t length, uint32_t &source, uint32_t &destination) {
+  bool has_source = false, has_destination = false;
+  ForEachNetlinkAttribute(data, length, [&](uint16_t type, const void *data, size_t length) {
+    if (type != CTA_TUPLE_IP) {
+      return;
+    }
+    ForEachNetlinkAttribute(data, length, [&](uint16_t type, const void *data, size_t length) {
+      if (length != sizeof(uint32_t)) {
+        return;
+      }
+      if (type == CTA_IP_V4_SRC) {
+        std::memcpy(&source, data, sizeof(source));
+        has_source = true;
+      } else if (type == CTA_IP_V4_DST) {
+        std::memcpy(&destination, data, sizeof(destination));
+        has_destination = true;
+      }
+    });
+  });
+  return has_source && has_destination;
+}
+
+size_t FlushConntrackEntries(const StaleFlowFilter &filter) {
+  NetlinkSocket ctnl{NETLINK_NETFILTER};
+
+  nfgenmsg header{};
+  header.nfgen_family = AF_INET;
+  header.version = NFNETLINK_V0;
+
+  // We cannot issue deletions while the dump is in progress on the same socket,
+  // so collect the stale entries first.
+  std::vector<ConntrackEntry> stale_entries;
+  NetlinkMessage dump{(NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_GET, NLM_F_DUMP};
+  dump.AppendHeader(header);
+  ctnl.Request(dump, [&](const nlmsghdr &msg) {
+    ConntrackEntry entry;
+    bool is_stale = false;
+    ForEachNetlinkAttribute<nfgenmsg>(msg, [&](uint16_t type, const void *data, size_t length) {
+      if (type == CTA_TUPLE_ORIG) {
+        uint32_t source = 0, destination = 0;
+        is_stale = ParseConntrackTuple(data, length, source, destination) &&
+                   filter.IsStale(source, destination);
+        entry.original_tuple.assign(static_cast<const char*>(data), length);
+      } else if (type == CTA_ZONE && length == sizeof(uint16_t)) {
+        uint16_t zone;
+        std::memcpy(&zone, data, sizeof(zone));
+        entry.zone = zone;
+      }
+    });
+    if (is_stale) {
+      stale_entries.push_back(std::move(entry));
+    }
+  });
+
+  size_t purged = 0;
+  for (const auto &entry : stale_entries) {
+    NetlinkMessage deletion{(NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_DELETE, 0};
+    deletion.AppendHeader(header);
+    deletion.AddAttribute(CTA_TUPLE_ORIG | NLA_F_NESTED,
+                          entry.original_tuple.data(), entry.original_tuple.size());
+    if (entry.zone) {
+      deletion.AddAttribute(CTA_ZONE, *entry.zone);
+    }
+    try {
+      ctnl.Request(deletion);
+      purged++;
+    } catch (const std::system_error &err) {
+      // the entry might have expired in the meantime
+      if (err.code().value() != ENOENT) {
+        throw;
+      }
+    }
+  }
+  return purged;
+}
+
+size_t DestroySockets(const StaleFlowFilter &filter, uint8_t protocol, uint32_t states) {
+  NetlinkSocket diag{NETLINK_SOCK_DIAG};
+
+  std::vector<inet_diag_sockid> stale_sockets;
+  NetlinkMessage dump{SOCK_DIAG_BY_FAMILY, NLM_F_DUMP};
+  inet_diag_req_v2 query{};
+  query.sdiag_family = AF_INET;
+  query.sdiag_protocol = protocol;
+  query.idiag_states = states;
+  dump.AppendHeader(query);
+  diag.Request(dump, [&](const nlmsghdr &msg) {
+    auto socket = static_cast<const inet_diag_msg*>(NLMSG_DATA(&msg));
+    if (filter.IsStale(socket->id.idiag_src[0], socket->id.idiag_dst[0])) {
+      stale_sockets.push_back(socket->id);
+    }
+  });
+
+  size_t destroyed = 0;
+  for (const auto &id : stale_sockets) {
+    NetlinkMessage destroy{SOCK_DESTROY, 0};
+    inet_diag_req_v2 target{};
+    target.sdiag_family = AF_INET;
+    target.sdiag_protocol = protocol;
+    target.idiag_states = ~uint32_t{0};
+    target.id = id;
+    destroy.AppendHeader(target);
+    try {
+      diag.Request(destroy);
+      destroyed++;
+    } catch (const std::system_error &err) {
+      // the socket might have been closed in the meantime
+      if (err.code().value() != ENOENT) {
+        throw;
+      }
+    }
+  }
+  return destroyed;
+}
+
+}  // namespace
+
+namespace outline {
+
+FlowFlushReport FlushStaleFlows(const std::string &stale_source_ip,
+                                const std::string &preserved_peer_ip) {
+  auto started = std::chrono::steady_clock::now();
+
+  StaleFlowFilter filter{ParseIPv4Address(stale_source_ip), {}};
+  if (!preserved_peer_ip.empty()) {
+    filter.preserved.push_back({ParseIPv4Address(preserved_peer_ip), 32});
+  }
+  {
+    NetlinkSocket rtnl{NETLINK_ROUTE};
+    if (auto on_link = FindOnLinkSubnet(rtnl, filter.stale_source)) {
+      filter.preserved.push_back(*on_link);
+    }
+  }
+
+  FlowFlushReport report;
+  try {
+    report.conntrack_entries = FlushConntrackEntries(filter);
+  } catch (const std::system_error &err) {
+    // nf_conntrack might simply not be loaded, which means there is nothing to flush
+    logger.warn("unable to flush conntrack entries: " + std::string(err.what()));
+  }
+
+  try {
+    // Listening and TIME_WAIT sockets are not bound to a path
+    uint32_t tcp_states = ((1u << TCP_CLOSING) << 1) - 1;
+    tcp_states &= ~((1u << TCP_LISTEN) | (1u << TCP_TIME_WAIT) | (1u << TCP_CLOSE));
+    report.sockets += DestroySockets(filter, IPPROTO_TCP, tcp_states);
+    // only connected UDP sockets have a fixed path
+    report.sockets += DestroySockets(filter, IPPROTO_UDP, 1u << TCP_ESTABLISHED);
+  } catch (const std::system_error &err) {
+    if (err.code().value() == EOPNOTSUPP) {
+      logger.warn("unable to destroy sockets, the kernel is built without CONFIG_INET_DIAG_DESTROY");
+    } else {
+      logger.warn("unable to destroy stale sockets: " + std::string(err.what()));
+    }
+  }
+
+  report.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - started);
+  return report;
+}
+
+}  // namespace outline
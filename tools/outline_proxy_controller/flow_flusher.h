@@ -0,0 +1,51 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+namespace outline {
+
+/**
+ * @brief What has been purged by `FlushStaleFlows`.
+ */
+struct FlowFlushReport {
+  size_t conntrack_entries = 0;
+  size_t sockets = 0;
+  std::chrono::microseconds elapsed{0};
+};
+
+/**
+ * @brief Purge the kernel state of IPv4 flows that are still bound to a routing
+ *        path which is no longer in use, so applications fail fast and
+ *        reconnect over the new path instead of waiting for TCP timeouts.
+ *
+ * Conntrack entries originated from `stale_source_ip` are deleted through
+ * ctnetlink, and TCP/UDP sockets bound to it are destroyed through sock_diag
+ * (`SOCK_DESTROY`, requires CONFIG_INET_DIAG_DESTROY). Flows towards the
+ * on-link subnet of `stale_source_ip` are kept because their path did not
+ * change, as well as flows towards `preserved_peer_ip` (if not empty).
+ *
+ * @param stale_source_ip The local address of the previous routing path.
+ * @param preserved_peer_ip A remote address whose flows must survive, e.g. the
+ *                          Outline server that tun2socks is connected to.
+ * @return FlowFlushReport The number of entries purged and the time it took.
+ */
+FlowFlushReport FlushStaleFlows(const std::string &stale_source_ip,
+                                const std::string &preserved_peer_ip);
+
+}  // namespace outline
@@ -0,0 +1,454 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include <arpa/inet.h>
+
+#include "ethernet_frame.h"
+#include "flow_table.h"
+
+using namespace outline;
+
+// an upper bound of the timeout, which sizes the timer wheel
+static const uint32_t kMaxIdleTimeoutSeconds = 24 * 60 * 60;
+// the average flows per bucket at full capacity, out of 7
+static const size_t kFlowsPerBucket = 5;
+
+using KeyWords = std::array<uint64_t, 5>;
+
+static_assert(std::is_trivially_copyable_v<FlowKey> && sizeof(FlowKey) <= sizeof(KeyWords));
+
+static KeyWords PackKey(const FlowKey &key) {
+  KeyWords words{};
+  std::memcpy(words.data(), &key, sizeof(key));
+  return words;
+}
+
+static FlowKey UnpackKey(const KeyWords &words) {
+  FlowKey key;
+  std::memcpy(static_cast<void *>(&key), words.data(), sizeof(key));
+  return key;
+}
+
+static uint64_t HashKey(const KeyWords &words) {
+  uint64_t hash = 0x9e3779b97f4a7c15;
+  for (auto word : words) {
+    hash = (hash ^ word) * 0xff51afd7ed558ccd;
+    hash ^= hash >> 32;
+  }
+  return hash;
+}
+
+static uint32_t Tag(uint64_t hash) {
+  return static_cast<uint32_t>(hash >> 32) | 1;
+}
+
+/**
+ * @brief Add to a counter which only the calling thread writes.
+ */
+static void Add(std::atomic<uint64_t> &counter, uint64_t value) {
+  counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+static uint64_t Weight(const FlowRecord &record, FlowOrder order) {
+  return order == FlowOrder::kBytes ? record.sent_bytes + record.received_bytes
+                                    : record.sent_packets + record.received_packets;
+}
+
+static FlowKey Project(FlowKey key, FlowGrouping grouping) {
+  switch (grouping) {
+    case FlowGrouping::kFlow:
+      break;
+    case FlowGrouping::kDestination:
+      key.local_address = {};
+      key.local_port = key.remote_port = 0;
+      key.protocol = 0;
+      break;
+    case FlowGrouping::kService:
+      key.local_address = key.remote_address = {};
+      key.local_port = 0;
+      key.version = 0;
+      break;
+  }
+  return key;
+}
+
+static std::string FormatAddress(const std::array<uint8_t, 16> &address, uint8_t version) {
+  char text[INET6_ADDRSTRLEN] = "";
+  ::inet_ntop(version == 4 ? AF_INET : AF_INET6, address.data(), text, sizeof(text));
+  return text;
+}
+
+//#region FlowTable::Shard Implementation
+
+FlowTable::Shard::Shard(size_t capacity, uint32_t idle_timeout_seconds)
+    : idle_timeout_{idle_timeout_seconds},
+      bucket_mask_{std::bit_ceil((capacity + kFlowsPerBucket - 1) / kFlowsPerBucket) - 1},
+      buckets_{std::make_unique<Bucket[]>(bucket_mask_ + 1)},
+      flows_{std::make_unique<Flow[]>(capacity)},
+      wheel_(std::bit_ceil(size_t{idle_timeout_seconds} + 2), kNoFlow) {
+  free_flows_.reserve(capacity);
+  for (auto index = capacity; index > 0; index--) {
+    free_flows_.push_back(static_cast<uint32_t>(index - 1));
+  }
+}
+
+void FlowTable::Shard::Account(const FlowKey &key, FlowDirection direction, uint32_t bytes,
+                               uint32_t now) {
+  auto words = PackKey(key);
+  Account(words, HashKey(words), direction, bytes, now);
+}
+
+void FlowTable::Shard::AccountBatch(const FlowTuples &tuples, const uint32_t *bytes,
+                                    FlowDirection direction, uint32_t now) {
+  std::array<KeyWords, FlowTuples::kCapacity> keys;
+  std::array<uint64_t, FlowTuples::kCapacity> hashes;
+  auto sent = direction == FlowDirection::kSent;
+  for (size_t i = 0; i < tuples.count; i++) {
+    if (tuples.version[i] == 0) {
+      continue;
+    }
+    FlowKey key;
+    key.version = tuples.version[i];
+    key.protocol = tuples.protocol[i];
+    key.local_port = sent ? tuples.source_port[i] : tuples.destination_port[i];
+    key.remote_port = sent ? tuples.destination_port[i] : tuples.source_port[i];
+    if (key.version == 4) {
+      frame::Store32(key.local_address.data(),
+                     sent ? tuples.source_v4[i] : tuples.destination_v4[i]);
+      frame::Store32(key.remote_address.data(),
+                     sent ? tuples.destination_v4[i] : tuples.source_v4[i]);
+    } else {
+      key.local_address = sent ? tuples.source_v6[i] : tuples.destination_v6[i];
+      key.remote_address = sent ? tuples.destination_v6[i] : tuples.source_v6[i];
+    }
+    keys[i] = PackKey(key);
+    hashes[i] = HashKey(keys[i]);
+    __builtin_prefetch(&buckets_[hashes[i] & bucket_mask_]);
+  }
+  for (size_t i = 0; i < tuples.count; i++) {
+    if (tuples.version[i] != 0) {
+      Account(keys[i], hashes[i], direction, bytes[i], now);
+    }
+  }
+}
+
+void FlowTable::Shard::Expire(uint32_t now) {
+  if (wheel_second_ == 0 || now <= wheel_second_) {
+    return;
+  }
+  auto wheel_mask = wheel_.size() - 1;
+  // a turn of the wheel visits every flow
+  if (now - wheel_second_ > wheel_.size()) {
+    wheel_second_ = now - static_cast<uint32_t>(wheel_.size());
+  }
+  while (wheel_second_ < now) {
+    auto second = ++wheel_second_;
+    auto index = std::exchange(wheel_[second & wheel_mask], kNoFlow);
+    while (index != kNoFlow) {
+      auto &flow = flows_[index];
+      auto next = flow.next;
+      auto deadline = flow.last_seen.load(std::memory_order_relaxed) + idle_timeout_;
+      if (deadline <= second) {
+        Remove(index);
+      } else {
+        flow.next = wheel_[deadline & wheel_mask];
+        wheel_[deadline & wheel_mask] = index;
+      }
+      index = next;
+    }
+  }
+}
+
+void FlowTable::Shard::Account(const KeyWords &key, uint64_t hash, FlowDirection direction,
+                               uint32_t bytes, uint32_t now) {
+  auto index = Find(key, hash);
+  if (index == kNoFlow) {
+    index = Create(key, hash, now);
+    if (index == kNoFlow) {
+      Add(untracked_packets_, 1);
+      return;
+    }
+  }
+  auto &flow = flows_[index];
+  flow.last_seen.store(now, std::memory_order_relaxed);
+  if (direction == FlowDirection::kSent) {
+    Add(flow.sent_packets, 1);
+    Add(flow.sent_bytes, bytes);
+  } else {
+    Add(flow.received_packets, 1);
+    Add(flow.received_bytes, bytes);
+  }
+}
+
+uint32_t FlowTable::Shard::Find(const KeyWords &key, uint64_t hash) const {
+  auto tag = Tag(hash);
+  auto bucket_index = hash & bucket_mask_;
+  for (size_t probes = 0; probes <= bucket_mask_; probes++) {
+    const auto &bucket = buckets_[bucket_index];
+    for (size_t slot = 0; slot < kBucketSlots; slot++) {
+      if (bucket.tags[slot] != tag) {
+        continue;
+      }
+      const auto &flow = flows_[bucket.flows[slot]];
+      if (std::equal(key.begin(), key.end(), flow.key.begin(), [](auto word, const auto &stored) {
+            return word == stored.load(std::memory_order_relaxed);
+          })) {
+        return bucket.flows[slot];
+      }
+    }
+    if (bucket.overflow == 0) {
+      break;
+    }
+    bucket_index = (bucket_index + 1) & bucket_mask_;
+  }
+  return kNoFlow;
+}
+
+uint32_t FlowTable::Shard::Create(const KeyWords &key, uint64_t hash, uint32_t now) {
+  if (free_flows_.empty()) {
+    return kNoFlow;
+  }
+  auto index = free_flows_.back();
+  free_flows_.pop_back();
+  if (index >= used_flows_.load(std::memory_order_relaxed)) {
+    used_flows_.store(index + 1, std::memory_order_release);
+  }
+  auto &flow = flows_[index];
+  SetKey(flow, key);
+  flow.last_seen.store(now, std::memory_order_relaxed);
+
+  // there is always an empty slot, the buckets holding more than the flows
+  for (auto bucket_index = hash & bucket_mask_;; bucket_index = (bucket_index + 1) & bucket_mask_) {
+    auto &bucket = buckets_[bucket_index];
+    auto empty = std::find(bucket.tags.begin(), bucket.tags.end(), 0u);
+    if (empty != bucket.tags.end()) {
+      *empty = Tag(hash);
+      bucket.flows[empty - bucket.tags.begin()] = index;
+      break;
+    }
+    bucket.overflow++;
+  }
+
+  if (wheel_second_ == 0) {
+    wheel_second_ = now;
+  }
+  auto slot = (now + idle_timeout_) & (wheel_.size() - 1);
+  flow.next = wheel_[slot];
+  wheel_[slot] = index;
+  Add(created_flows_, 1);
+  return index;
+}
+
+void FlowTable::Shard::Remove(uint32_t index) {
+  auto &flow = flows_[index];
+  KeyWords key;
+  for (size_t word = 0; word < kKeyWords; word++) {
+    key[word] = flow.key[word].load(std::memory_order_relaxed);
+  }
+  auto hash = HashKey(key);
+  auto tag = Tag(hash);
+  for (auto bucket_index = hash & bucket_mask_;; bucket_index = (bucket_index + 1) & bucket_mask_) {
+    auto &bucket = buckets_[bucket_index];
+    size_t slot = 0;
+    while (slot < kBucketSlots && (bucket.tags[slot] != tag || bucket.flows[slot] != index)) {
+      slot++;
+    }
+    if (slot < kBucketSlots) {
+      bucket.tags[slot] = 0;
+      break;
+    }
+    bucket.overflow--;
+  }
+  SetKey(flow, {});
+  free_flows_.push_back(index);
+  Add(expired_flows_, 1);
+}
+
+void FlowTable::Shard::SetKey(Flow &flow, const KeyWords &key) {
+  auto sequence = flow.sequence.load(std::memory_order_relaxed);
+  flow.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t word = 0; word < kKeyWords; word++) {
+    flow.key[word].store(key[word], std::memory_order_relaxed);
+  }
+  flow.sent_packets.store(0, std::memory_order_relaxed);
+  flow.sent_bytes.store(0, std::memory_order_relaxed);
+  flow.received_packets.store(0, std::memory_order_relaxed);
+  flow.received_bytes.store(0, std::memory_order_relaxed);
+  flow.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+//#endregion FlowTable::Shard Implementation
+
+//#region FlowTable Implementation
+
+FlowTable::FlowTable(size_t capacity, size_t shard_count, uint32_t idle_timeout_seconds)
+    : idle_timeout_{idle_timeout_seconds} {
+  if (capacity == 0 || shard_count == 0 || idle_timeout_seconds == 0 ||
+      idle_timeout_seconds > kMaxIdleTimeoutSeconds) {
+    throw std::invalid_argument("invalid flow table capacity, shard count or idle timeout");
+  }
+  auto shard_capacity = (capacity + shard_count - 1) / shard_count;
+  if (shard_capacity >= Shard::kNoFlow) {
+    throw std::invalid_argument("too many flows for a flow table shard");
+  }
+  for (size_t i = 0; i < shard_count; i++) {
+    shards_.push_back(std::make_unique<Shard>(shard_capacity, idle_timeout_seconds));
+  }
+}
+
+std::vector<FlowRecord> FlowTable::TopFlows(size_t limit, FlowOrder order, FlowGrouping grouping,
+                                            uint32_t now) const {
+  // a min-heap of the heaviest records so far
+  auto heavier = [order](const FlowRecord &a, const FlowRecord &b) {
+    return Weight(a, order) > Weight(b, order);
+  };
+  std::vector<FlowRecord> top;
+  auto offer = [&](const FlowRecord &record) {
+    if (top.size() < limit) {
+      top.push_back(record);
+      std::push_heap(top.begin(), top.end(), heavier);
+    } else if (limit > 0 && Weight(record, order) > Weight(top.front(), order)) {
+      std::pop_heap(top.begin(), top.end(), heavier);
+      top.back() = record;
+      std::push_heap(top.begin(), top.end(), heavier);
+    }
+  };
+
+  // the projected records, merged once sorted by key
+  std::vector<std::pair<KeyWords, FlowRecord>> grouped;
+
+  for (const auto &shard : shards_) {
+    auto used_flows = shard->used_flows_.load(std::memory_order_acquire);
+    for (uint32_t index = 0; index < used_flows; index++) {
+      const auto &flow = shard->flows_[index];
+      auto sequence = flow.sequence.load(std::memory_order_acquire);
+      if (sequence % 2 != 0) {
+        continue;
+      }
+      KeyWords key;
+      for (size_t word = 0; word < Shard::kKeyWords; word++) {
+        key[word] = flow.key[word].load(std::memory_order_relaxed);
+      }
+      FlowRecord record;
+      record.sent_packets = flow.sent_packets.load(std::memory_order_relaxed);
+      record.sent_bytes = flow.sent_bytes.load(std::memory_order_relaxed);
+      record.received_packets = flow.received_packets.load(std::memory_order_relaxed);
+      record.received_bytes = flow.received_bytes.load(std::memory_order_relaxed);
+      auto last_seen = flow.last_seen.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      // skip the flows being replaced, which are new
+      if (flow.sequence.load(std::memory_order_relaxed) != sequence) {
+        continue;
+      }
+      record.key = UnpackKey(key);
+      record.idle_seconds = now > last_seen ? now - last_seen : 0;
+      // skip the free flows, and those timed out but not expired yet
+      if (record.key.version == 0 || record.idle_seconds >= idle_timeout_) {
+        continue;
+      }
+
+      if (grouping == FlowGrouping::kFlow) {
+        offer(record);
+        continue;
+      }
+      record.key = Project(record.key, grouping);
+      grouped.emplace_back(PackKey(record.key), record);
+    }
+  }
+  std::sort(grouped.begin(), grouped.end(),
+            [](const auto &a, const auto &b) { return a.first < b.first; });
+  for (auto group = grouped.begin(); group != grouped.end();) {
+    auto record = group->second;
+    auto next = group + 1;
+    for (; next != grouped.end() && next->first == group->first; next++) {
+      record.sent_packets += next->second.sent_packets;
+      record.sent_bytes += next->second.sent_bytes;
+      record.received_packets += next->second.received_packets;
+      record.received_bytes += next->second.received_bytes;
+      record.idle_seconds = std::min(record.idle_seconds, next->second.idle_seconds);
+    }
+    offer(record);
+    group = next;
+  }
+  std::sort_heap(top.begin(), top.end(), heavier);
+  return top;
+}
+
+FlowTableStats FlowTable::Stats() const {
+  FlowTableStats stats;
+  for (const auto &shard : shards_) {
+    auto created_flows = shard->created_flows_.load(std::memory_order_relaxed);
+    auto expired_flows = shard->expired_flows_.load(std::memory_order_relaxed);
+    stats.active_flows += created_flows - expired_flows;
+    stats.created_flows += created_flows;
+    stats.expired_flows += expired_flows;
+    stats.untracked_packets += shard->untracked_packets_.load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
+std::string FlowTable::FormatTopFlows(size_t limit, FlowOrder order,
+                                      FlowGrouping grouping) const {
+  std::string result = "\"flows\":[";
+  for (const auto &record : TopFlows(limit, order, grouping, Now())) {
+    const auto &key = record.key;
+    result.append(result.back() == '[' ? "{" : ",{");
+    if (grouping != FlowGrouping::kDestination) {
+      result.append("\"protocol\":").append(std::to_string(key.protocol)).append(",");
+    }
+    if (grouping == FlowGrouping::kFlow) {
+      result.append("\"localAddress\":\"")
+          .append(FormatAddress(key.local_address, key.version))
+          .append("\",\"localPort\":")
+          .append(std::to_string(key.local_port))
+          .append(",");
+    }
+    if (grouping != FlowGrouping::kService) {
+      result.append("\"remoteAddress\":\"")
+          .append(FormatAddress(key.remote_address, key.version))
+          .append("\",");
+    }
+    if (grouping != FlowGrouping::kDestination) {
+      result.append("\"remotePort\":").append(std::to_string(key.remote_port)).append(",");
+    }
+    result.append("\"sentPackets\":" + std::to_string(record.sent_packets) +
+                  ",\"sentBytes\":" + std::to_string(record.sent_bytes) +
+                  ",\"receivedPackets\":" + std::to_string(record.received_packets) +
+                  ",\"receivedBytes\":" + std::to_string(record.received_bytes) +
+                  ",\"idleSeconds\":" + std::to_string(record.idle_seconds) + "}");
+  }
+  auto stats = Stats();
+  return result + "],\"flowTable\":{\"activeFlows\":" + std::to_string(stats.active_flows) +
+         ",\"createdFlows\":" + std::to_string(stats.created_flows) +
+         ",\"expiredFlows\":" + std::to_string(stats.expired_flows) +
+         ",\"untrackedPackets\":" + std::to_string(stats.untracked_packets) + "}";
+}
+
+uint32_t FlowTable::Now() {
+  timespec now{};
+  ::clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  // never 0, which the shards take as before the first packet
+  return static_cast<uint32_t>(now.tv_sec) + 1;
+}
+
+//#endregion FlowTable Implementation
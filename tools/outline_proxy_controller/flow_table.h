@@ -0,0 +1,226 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "packet_classifier.h"
+
+namespace outline {
+
+enum class FlowDirection {
+  // read from the tun device
+  kSent,
+  // written to the tun device
+  kReceived,
+};
+
+enum class FlowOrder {
+  kBytes,
+  kPackets,
+};
+
+enum class FlowGrouping {
+  // one record per 5-tuple
+  kFlow,
+  // one record per remote address
+  kDestination,
+  // one record per protocol and remote port, as close to an application as
+  // the packets tell
+  kService,
+};
+
+/**
+ * @brief The 5-tuple of a flow seen from the local end, whichever direction
+ *        its packets go. IPv4 addresses take the first 4 bytes.
+ */
+struct FlowKey {
+  std::array<uint8_t, 16> local_address{};
+  std::array<uint8_t, 16> remote_address{};
+  uint16_t local_port = 0;
+  uint16_t remote_port = 0;
+  uint8_t protocol = 0;
+  // 4 or 6
+  uint8_t version = 0;
+
+  bool operator==(const FlowKey &) const = default;
+};
+
+struct FlowRecord {
+  FlowKey key;
+  uint64_t sent_packets = 0;
+  uint64_t sent_bytes = 0;
+  uint64_t received_packets = 0;
+  uint64_t received_bytes = 0;
+  uint32_t idle_seconds = 0;
+};
+
+struct FlowTableStats {
+  uint64_t active_flows = 0;
+  uint64_t created_flows = 0;
+  uint64_t expired_flows = 0;
+  // not accounted because the table was full
+  uint64_t untracked_packets = 0;
+};
+
+/**
+ * @brief The packets and bytes of every flow of the native data plane, for
+ *        the top talkers of the tunnel.
+ *
+ * The table is split in shards, each written by a single thread (the pump of
+ * a tun queue) without locking or atomic read-modify-write operations, and
+ * read by any thread through a sequence number per flow. A flow must always
+ * be accounted on the same shard.
+ *
+ * A shard allocates all its memory up front: an open addressing hash table of
+ * 64-byte buckets of 7 tags and flow indices, probed linearly, each bucket
+ * counting the flows stored past it so that lookups stop at the first bucket
+ * nothing overflowed from and removals leave no tombstone; and an array of
+ * flows. A timer wheel of one second slots expires the flows idle for longer
+ * than the timeout, a flow seen again when its slot comes being moved to the
+ * slot of its new deadline instead of on every packet.
+ */
+class FlowTable {
+public:
+  class Shard {
+  public:
+    Shard(size_t capacity, uint32_t idle_timeout_seconds);
+
+    Shard(const Shard &) = delete;
+    Shard &operator=(const Shard &) = delete;
+
+    /**
+     * @brief Add a packet of `bytes` to its flow, creating it if needed.
+     *
+     * @param now The seconds of `FlowTable::Now()`.
+     */
+    void Account(const FlowKey &key, FlowDirection direction, uint32_t bytes, uint32_t now);
+
+    /**
+     * @brief Account the parsed packets of a batch, those which could not be
+     *        parsed being skipped, prefetching the buckets of the whole batch
+     *        before looking any of them up.
+     *
+     * @param bytes The size of each packet.
+     */
+    void AccountBatch(const FlowTuples &tuples, const uint32_t *bytes, FlowDirection direction,
+                      uint32_t now);
+
+    /**
+     * @brief Remove the flows which timed out by `now`; cheap when called
+     *        again within the same second.
+     */
+    void Expire(uint32_t now);
+
+  private:
+    friend class FlowTable;
+
+    static constexpr size_t kBucketSlots = 7;
+    static constexpr uint32_t kNoFlow = UINT32_MAX;
+    // sizeof(FlowKey) rounded up
+    static constexpr size_t kKeyWords = 5;
+    using KeyWords = std::array<uint64_t, kKeyWords>;
+
+    struct alignas(64) Bucket {
+      // 0 when the slot is empty
+      std::array<uint32_t, kBucketSlots> tags;
+      // the flows stored past this bucket
+      uint32_t overflow;
+      std::array<uint32_t, kBucketSlots> flows;
+    };
+
+    struct Flow {
+      // odd while the key changes
+      std::atomic<uint32_t> sequence{0};
+      std::atomic<uint32_t> last_seen{0};
+      // the next flow of the same wheel slot
+      uint32_t next = kNoFlow;
+      // a version of 0 when the flow is free
+      std::array<std::atomic<uint64_t>, kKeyWords> key{};
+      std::atomic<uint64_t> sent_packets{0};
+      std::atomic<uint64_t> sent_bytes{0};
+      std::atomic<uint64_t> received_packets{0};
+      std::atomic<uint64_t> received_bytes{0};
+    };
+
+    void Account(const KeyWords &key, uint64_t hash, FlowDirection direction, uint32_t bytes,
+                 uint32_t now);
+    uint32_t Find(const KeyWords &key, uint64_t hash) const;
+    uint32_t Create(const KeyWords &key, uint64_t hash, uint32_t now);
+    void Remove(uint32_t index);
+    void SetKey(Flow &flow, const KeyWords &key);
+
+    const uint32_t idle_timeout_;
+    const size_t bucket_mask_;
+    std::unique_ptr<Bucket[]> buckets_;
+    std::unique_ptr<Flow[]> flows_;
+    // the free flows, the lowest indices on top
+    std::vector<uint32_t> free_flows_;
+    // the flows ever used, which readers scan
+    std::atomic<uint32_t> used_flows_{0};
+    std::vector<uint32_t> wheel_;
+    // the last second expired, 0 before the first packet
+    uint32_t wheel_second_ = 0;
+
+    std::atomic<uint64_t> created_flows_{0};
+    std::atomic<uint64_t> expired_flows_{0};
+    std::atomic<uint64_t> untracked_packets_{0};
+  };
+
+  /**
+   * @param capacity The flows tracked at most, split evenly among the shards.
+   * @param shard_count One per thread accounting packets.
+   * @param idle_timeout_seconds How long a flow is kept without packets.
+   * @throw std::invalid_argument If any of them is 0 or out of range.
+   */
+  FlowTable(size_t capacity, size_t shard_count, uint32_t idle_timeout_seconds);
+
+  Shard &GetShard(size_t index) { return *shards_.at(index); }
+  size_t ShardCount() const { return shards_.size(); }
+
+  /**
+   * @brief The `limit` records with the most bytes or packets, both directions
+   *        summed, in decreasing order. May run on any thread, concurrently
+   *        with the writers of the shards.
+   */
+  std::vector<FlowRecord> TopFlows(size_t limit, FlowOrder order, FlowGrouping grouping,
+                                   uint32_t now) const;
+
+  FlowTableStats Stats() const;
+
+  /**
+   * @brief The top flows and the stats formatted as the JSON members
+   *        `"flows":[...],"flowTable":{...}`.
+   */
+  std::string FormatTopFlows(size_t limit, FlowOrder order, FlowGrouping grouping) const;
+
+  /**
+   * @brief The seconds of the coarse monotonic clock, what the shards take
+   *        as `now`.
+   */
+  static uint32_t Now();
+
+private:
+  const uint32_t idle_timeout_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+}  // namespace outline
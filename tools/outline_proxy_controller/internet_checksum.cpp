@@ -0,0 +1,276 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "internet_checksum.h"
+
+using namespace outline;
+using checksum::Kernel;
+
+// The kernels add up the data as native 32-bit words into a 64-bit sum: the
+// one's complement sum does not depend on the byte order nor on the word size
+// (RFC 1071), as long as it is folded to 16 bits, and byte swapped on a
+// little-endian CPU, at the end.
+
+using SumFunction = uint64_t (*)(const uint8_t *data, size_t length);
+
+static uint16_t Fold(uint64_t sum) {
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return static_cast<uint16_t>(sum);
+}
+
+static uint64_t SumScalar(const uint8_t *data, size_t length) {
+  uint64_t sum = 0;
+  for (; length >= 16; data += 16, length -= 16) {
+    uint64_t words[2];
+    std::memcpy(words, data, sizeof(words));
+    sum += (words[0] & 0xffffffff) + (words[0] >> 32) + (words[1] & 0xffffffff) +
+           (words[1] >> 32);
+  }
+  for (; length >= 4; data += 4, length -= 4) {
+    uint32_t word;
+    std::memcpy(&word, data, sizeof(word));
+    sum += word;
+  }
+  if (length >= 2) {
+    uint16_t word;
+    std::memcpy(&word, data, sizeof(word));
+    sum += word;
+    data += 2;
+    length -= 2;
+  }
+  if (length > 0) {
+    // the high byte of a big-endian word padded with zero
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    sum += data[0];
+#else
+    sum += static_cast<uint64_t>(data[0]) << 8;
+#endif
+  }
+  return sum;
+}
+
+#if defined(__x86_64__)
+
+static uint64_t SumSse2(const uint8_t *data, size_t length) {
+  const auto zero = _mm_setzero_si128();
+  auto low = zero;
+  auto high = zero;
+  for (; length >= 32; data += 32, length -= 32) {
+    auto first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+    auto second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16));
+    // widen the 32-bit words to 64-bit lanes, which cannot overflow
+    low = _mm_add_epi64(low, _mm_unpacklo_epi32(first, zero));
+    high = _mm_add_epi64(high, _mm_unpackhi_epi32(first, zero));
+    low = _mm_add_epi64(low, _mm_unpacklo_epi32(second, zero));
+    high = _mm_add_epi64(high, _mm_unpackhi_epi32(second, zero));
+  }
+  if (length >= 16) {
+    auto last = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+    low = _mm_add_epi64(low, _mm_unpacklo_epi32(last, zero));
+    high = _mm_add_epi64(high, _mm_unpackhi_epi32(last, zero));
+    data += 16;
+    length -= 16;
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), _mm_add_epi64(low, high));
+  return lanes[0] + lanes[1] + SumScalar(data, length);
+}
+
+__attribute__((target("avx2"))) static uint64_t SumAvx2(const uint8_t *data, size_t length) {
+  const auto zero = _mm256_setzero_si256();
+  auto low = zero;
+  auto high = zero;
+  for (; length >= 64; data += 64, length -= 64) {
+    auto first = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+    auto second = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + 32));
+    low = _mm256_add_epi64(low, _mm256_unpacklo_epi32(first, zero));
+    high = _mm256_add_epi64(high, _mm256_unpackhi_epi32(first, zero));
+    low = _mm256_add_epi64(low, _mm256_unpacklo_epi32(second, zero));
+    high = _mm256_add_epi64(high, _mm256_unpackhi_epi32(second, zero));
+  }
+  if (length >= 32) {
+    auto last = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+    low = _mm256_add_epi64(low, _mm256_unpacklo_epi32(last, zero));
+    high = _mm256_add_epi64(high, _mm256_unpackhi_epi32(last, zero));
+    data += 32;
+    length -= 32;
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), _mm256_add_epi64(low, high));
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + SumScalar(data, length);
+}
+
+#elif defined(__aarch64__)
+
+static uint64_t SumNeon(const uint8_t *data, size_t length) {
+  auto first_sum = vdupq_n_u64(0);
+  auto second_sum = vdupq_n_u64(0);
+  for (; length >= 32; data += 32, length -= 32) {
+    // pairwise add the 32-bit words into the 64-bit lanes
+    first_sum = vpadalq_u32(first_sum, vreinterpretq_u32_u8(vld1q_u8(data)));
+    second_sum = vpadalq_u32(second_sum, vreinterpretq_u32_u8(vld1q_u8(data + 16)));
+  }
+  return vaddvq_u64(vaddq_u64(first_sum, second_sum)) + SumScalar(data, length);
+}
+
+#endif
+
+static SumFunction KernelFunction(Kernel kernel) {
+  switch (kernel) {
+#if defined(__x86_64__)
+  case Kernel::kSse2:
+    return SumSse2;
+  case Kernel::kAvx2:
+    return SumAvx2;
+#elif defined(__aarch64__)
+  case Kernel::kNeon:
+    return SumNeon;
+#endif
+  case Kernel::kScalar:
+    return SumScalar;
+  default:
+    throw std::invalid_argument(std::string{"the "} + checksum::KernelName(kernel) +
+                                " checksum kernel is not supported");
+  }
+}
+
+static Kernel SelectKernel() {
+  for (auto kernel : {Kernel::kAvx2, Kernel::kNeon, Kernel::kSse2}) {
+    if (checksum::IsSupported(kernel)) {
+      return kernel;
+    }
+  }
+  return Kernel::kScalar;
+}
+
+namespace outline::checksum {
+
+Kernel ActiveKernel() {
+  static const Kernel kernel = SelectKernel();
+  return kernel;
+}
+
+bool IsSupported(Kernel kernel) {
+  switch (kernel) {
+  case Kernel::kScalar:
+    return true;
+#if defined(__x86_64__)
+  case Kernel::kSse2:
+    return true;
+  case Kernel::kAvx2:
+    return __builtin_cpu_supports("avx2");
+#elif defined(__aarch64__)
+  case Kernel::kNeon:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+const char *KernelName(Kernel kernel) {
+  switch (kernel) {
+  case Kernel::kScalar:
+    return "scalar";
+  case Kernel::kSse2:
+    return "SSE2";
+  case Kernel::kAvx2:
+    return "AVX2";
+  case Kernel::kNeon:
+    return "NEON";
+  }
+  return "unknown";
+}
+
+static uint32_t AccumulateWith(SumFunction function, const void *data, size_t length,
+                               uint32_t sum) {
+  auto native = Fold(function(static_cast<const uint8_t *>(data), length));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  native = __builtin_bswap16(native);
+#endif
+  // folding first leaves room for any number of further pieces
+  return static_cast<uint32_t>(Fold(sum)) + native;
+}
+
+uint32_t Accumulate(const void *data, size_t length, uint32_t sum) {
+  static const SumFunction function = KernelFunction(ActiveKernel());
+  return AccumulateWith(function, data, length, sum);
+}
+
+uint32_t Accumulate(Kernel kernel, const void *data, size_t length, uint32_t sum) {
+  return AccumulateWith(KernelFunction(kernel), data, length, sum);
+}
+
+static uint32_t Word(const uint8_t *bytes) {
+  return static_cast<uint32_t>(bytes[0] << 8 | bytes[1]);
+}
+
+uint32_t PseudoHeaderV4(const uint8_t source[4], const uint8_t destination[4], uint8_t protocol,
+                        uint16_t length) {
+  return Word(source) + Word(source + 2) + Word(destination) + Word(destination + 2) + protocol +
+         length;
+}
+
+uint32_t PseudoHeaderV6(const uint8_t source[16], const uint8_t destination[16],
+                        uint8_t next_header, uint32_t length) {
+  uint32_t sum = next_header + (length >> 16) + (length & 0xffff);
+  for (int i = 0; i < 16; i += 2) {
+    sum += Word(source + i) + Word(destination + i);
+  }
+  return sum;
+}
+
+uint16_t Finish(uint32_t sum) {
+  return static_cast<uint16_t>(~Fold(sum));
+}
+
+uint16_t Update16(uint16_t checksum, uint16_t old_word, uint16_t new_word) {
+  uint32_t sum = static_cast<uint16_t>(~checksum) + static_cast<uint16_t>(~old_word) + new_word;
+  return Finish(sum);
+}
+
+uint16_t Update32(uint16_t checksum, uint32_t old_value, uint32_t new_value) {
+  checksum = Update16(checksum, static_cast<uint16_t>(old_value >> 16),
+                      static_cast<uint16_t>(new_value >> 16));
+  return Update16(checksum, static_cast<uint16_t>(old_value),
+                  static_cast<uint16_t>(new_value));
+}
+
+uint16_t Update(uint16_t checksum, const uint8_t *old_bytes, const uint8_t *new_bytes,
+                size_t length) {
+  if (length % 2 != 0) {
+    throw std::invalid_argument("only whole 16-bit words can be updated in a checksum");
+  }
+  uint32_t sum = static_cast<uint16_t>(~checksum);
+  for (size_t i = 0; i < length; i += 2) {
+    sum += static_cast<uint16_t>(~Word(old_bytes + i)) + Word(new_bytes + i);
+    sum = Fold(sum);
+  }
+  return Finish(sum);
+}
+
+}  // namespace outline::checksum
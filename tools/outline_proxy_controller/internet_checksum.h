@@ -0,0 +1,102 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief The Internet checksum (RFC 1071) of IPv4, ICMP, UDP and TCP.
+ *
+ * The values are host order numbers: the 16-bit words of the data are read
+ * big-endian, and a checksum must go through `htons` before being stored in a
+ * header. A partial sum is a 32-bit accumulator which can be passed along to
+ * checksum a packet in several pieces; every piece but the last one must have
+ * an even length.
+ *
+ * The bulk of the data is summed by the fastest kernel the CPU supports,
+ * chosen on first use: AVX2 or SSE2 on x86-64, NEON on AArch64, scalar
+ * otherwise.
+ */
+namespace outline::checksum {
+
+enum class Kernel { kScalar, kSse2, kAvx2, kNeon };
+
+/**
+ * @brief The kernel used by `Accumulate`.
+ */
+Kernel ActiveKernel();
+bool IsSupported(Kernel kernel);
+const char *KernelName(Kernel kernel);
+
+/**
+ * @brief Add `length` bytes to the partial sum `sum`.
+ */
+uint32_t Accumulate(const void *data, size_t length, uint32_t sum = 0);
+
+/**
+ * @brief Same as above with a given kernel, which must be supported.
+ */
+uint32_t Accumulate(Kernel kernel, const void *data, size_t length, uint32_t sum = 0);
+
+/**
+ * @brief The partial sum of the IPv4 pseudo header of a UDP or TCP segment of
+ *        `length` bytes.
+ */
+uint32_t PseudoHeaderV4(const uint8_t source[4], const uint8_t destination[4], uint8_t protocol,
+                        uint16_t length);
+
+/**
+ * @brief The partial sum of the IPv6 pseudo header (RFC 8200) of an upper
+ *        layer packet of `length` bytes, e.g. ICMPv6 or UDP.
+ */
+uint32_t PseudoHeaderV6(const uint8_t source[16], const uint8_t destination[16],
+                        uint8_t next_header, uint32_t length);
+
+/**
+ * @brief Fold a partial sum into the checksum: its one's complement.
+ */
+uint16_t Finish(uint32_t sum);
+
+/**
+ * @brief The checksum of `length` bytes, e.g. an IPv4 header whose checksum
+ *        field is zero.
+ */
+inline uint16_t Compute(const void *data, size_t length) {
+  return Finish(Accumulate(data, length));
+}
+
+/**
+ * @brief The checksum after a 16-bit word of the checksummed data changed
+ *        from `old_word` to `new_word`, without going over the data again
+ *        (RFC 1624, eqn. 3: HC' = ~(~HC + ~m + m')).
+ */
+uint16_t Update16(uint16_t checksum, uint16_t old_word, uint16_t new_word);
+
+/**
+ * @brief Same as above for a 32-bit field, e.g. an IPv4 address or a TCP
+ *        sequence number.
+ */
+uint16_t Update32(uint16_t checksum, uint32_t old_value, uint32_t new_value);
+
+/**
+ * @brief Same as above for `length` bytes (even, and starting at an even
+ *        offset of the checksummed data) rewritten from `old_bytes` to
+ *        `new_bytes`, e.g. an IPv6 address.
+ */
+uint16_t Update(uint16_t checksum, const uint8_t *old_bytes, const uint8_t *new_bytes,
+                size_t length);
+
+}  // namespace outline::checksum
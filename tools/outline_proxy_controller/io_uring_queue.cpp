@@ -0,0 +1,201 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "io_uring_queue.h"
+
+using namespace outline;
+
+static void *MapOrThrow(int fd, size_t size, off_t offset, const char *what) {
+  auto address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd, offset);
+  if (address == MAP_FAILED) {
+    throw std::system_error{errno, std::generic_category(), what};
+  }
+  return address;
+}
+
+template <typename T> static T *At(void *base, uint32_t offset) {
+  return reinterpret_cast<T *>(static_cast<uint8_t *>(base) + offset);
+}
+
+//#region IoUringQueue Implementation
+
+IoUringQueue::IoUringQueue(unsigned entries) {
+  io_uring_params params{};
+  // completions are only reaped by the submitting thread, in `Submit`, and an
+  // invalid entry (e.g. an opcode unknown to the kernel) fails alone
+  params.flags = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SUBMIT_ALL;
+  fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+  if (fd_ < 0 && errno == EINVAL) {
+    params = {};
+    fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+  }
+  if (fd_ < 0) {
+    throw std::system_error{errno, std::generic_category(), "failed to set up io_uring"};
+  }
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    ::close(fd_);
+    throw std::system_error{ENOTSUP, std::generic_category(), "io_uring is too old"};
+  }
+
+  try {
+    rings_size_ = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                           params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    rings_ = MapOrThrow(fd_, rings_size_, IORING_OFF_SQ_RING, "failed to map the io_uring rings");
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe *>(
+        MapOrThrow(fd_, sqes_size_, IORING_OFF_SQES, "failed to map the io_uring entries"));
+  } catch (...) {
+    if (rings_ != nullptr) {
+      ::munmap(rings_, rings_size_);
+    }
+    ::close(fd_);
+    throw;
+  }
+
+  sq_head_ = At<unsigned>(rings_, params.sq_off.head);
+  sq_tail_ = At<unsigned>(rings_, params.sq_off.tail);
+  sq_mask_ = At<unsigned>(rings_, params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  sqe_tail_ = *sq_tail_;
+  // entry i of the submission queue is always sqes_[i]
+  auto array = At<unsigned>(rings_, params.sq_off.array);
+  for (unsigned i = 0; i < sq_entries_; i++) {
+    array[i] = i;
+  }
+
+  cq_head_ = At<unsigned>(rings_, params.cq_off.head);
+  cq_tail_ = At<unsigned>(rings_, params.cq_off.tail);
+  cq_mask_ = At<unsigned>(rings_, params.cq_off.ring_mask);
+  cqes_ = At<io_uring_cqe>(rings_, params.cq_off.cqes);
+}
+
+IoUringQueue::~IoUringQueue() {
+  ::munmap(sqes_, sqes_size_);
+  ::munmap(rings_, rings_size_);
+  ::close(fd_);
+}
+
+io_uring_sqe *IoUringQueue::GetSqe() {
+  auto head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sqe_tail_ - head >= sq_entries_) {
+    return nullptr;
+  }
+  auto sqe = &sqes_[sqe_tail_ & *sq_mask_];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe_tail_++;
+  return sqe;
+}
+
+void IoUringQueue::Submit(unsigned wait_for) {
+  __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+  // including the entries a previous call left behind
+  auto to_submit = sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  unsigned flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0;
+  while (::syscall(__NR_io_uring_enter, fd_, to_submit, wait_for, flags, nullptr, 0) < 0) {
+    if (errno != EINTR) {
+      throw std::system_error{errno, std::generic_category(), "failed to enter io_uring"};
+    }
+    // the entries were consumed before the signal
+    to_submit = 0;
+  }
+}
+
+void IoUringQueue::RegisterBuffers(const iovec *buffers, unsigned count) {
+  if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, buffers, count) < 0) {
+    throw std::system_error{errno, std::generic_category(), "failed to register io_uring buffers"};
+  }
+}
+
+//#endregion IoUringQueue Implementation
+
+//#region ProvidedBufferRing Implementation
+
+ProvidedBufferRing::ProvidedBufferRing(IoUringQueue &queue, uint16_t group, uint16_t count,
+                                       size_t buffer_size)
+    : queue_{queue},
+      group_{group},
+      count_{count},
+      buffer_size_{buffer_size},
+      ring_size_{count * sizeof(io_uring_buf)},
+      memory_size_{count * buffer_size} {
+  if (count == 0 || (count & (count - 1)) != 0) {
+    throw std::invalid_argument("the number of provided buffers must be a power of 2");
+  }
+
+  auto ring = ::mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+  if (ring == MAP_FAILED) {
+    throw std::system_error{errno, std::generic_category(), "failed to allocate a buffer ring"};
+  }
+  auto memory = ::mmap(nullptr, memory_size_, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    auto err = errno;
+    ::munmap(ring, ring_size_);
+    throw std::system_error{err, std::generic_category(), "failed to allocate the buffers"};
+  }
+  ring_ = static_cast<io_uring_buf_ring *>(ring);
+  memory_ = static_cast<uint8_t *>(memory);
+
+  io_uring_buf_reg registration{};
+  registration.ring_addr = reinterpret_cast<uint64_t>(ring_);
+  registration.ring_entries = count_;
+  registration.bgid = group_;
+  if (::syscall(__NR_io_uring_register, queue_.fd(), IORING_REGISTER_PBUF_RING,
+                &registration, 1) < 0) {
+    auto err = errno;
+    ::munmap(memory_, memory_size_);
+    ::munmap(ring_, ring_size_);
+    throw std::system_error{err, std::generic_category(), "failed to register a buffer ring"};
+  }
+
+  for (uint16_t id = 0; id < count_; id++) {
+    Recycle(id);
+  }
+  Publish();
+}
+
+ProvidedBufferRing::~ProvidedBufferRing() {
+  io_uring_buf_reg registration{};
+  registration.bgid = group_;
+  ::syscall(__NR_io_uring_register, queue_.fd(), IORING_UNREGISTER_PBUF_RING, &registration, 1);
+  ::munmap(memory_, memory_size_);
+  ::munmap(ring_, ring_size_);
+}
+
+void ProvidedBufferRing::Recycle(uint16_t id) {
+  // not ring_->bufs: in C++ the empty struct of __DECLARE_FLEX_ARRAY shifts it
+  auto &buffer = reinterpret_cast<io_uring_buf *>(ring_)[tail_ & (count_ - 1)];
+  buffer.addr = reinterpret_cast<uint64_t>(Buffer(id));
+  buffer.len = static_cast<uint32_t>(buffer_size_);
+  buffer.bid = id;
+  tail_++;
+}
+
+void ProvidedBufferRing::Publish() {
+  __atomic_store_n(&ring_->tail, tail_, __ATOMIC_RELEASE);
+}
+
+//#endregion ProvidedBufferRing Implementation
@@ -0,0 +1,142 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+namespace outline {
+
+/**
+ * @brief An RAII wrapper of an io_uring instance, talking to the kernel with
+ *        the raw system calls (no liburing), for a single thread.
+ *
+ * Submission queue entries are prepared with `GetSqe` and handed to the kernel
+ * in a single system call by `Submit`, which also waits for completions.
+ * Requires Linux 5.19 or later, for the provided buffer rings.
+ */
+class IoUringQueue {
+public:
+  explicit IoUringQueue(unsigned entries);
+  ~IoUringQueue();
+
+  IoUringQueue(const IoUringQueue &) = delete;
+  IoUringQueue &operator=(const IoUringQueue &) = delete;
+
+  /**
+   * @brief A cleared submission queue entry, or nullptr when the submission
+   *        queue is full (`Submit` the prepared entries first).
+   */
+  io_uring_sqe *GetSqe();
+
+  /**
+   * @brief Submit the prepared entries and wait until at least `wait_for`
+   *        completions are available.
+   */
+  void Submit(unsigned wait_for);
+
+  /**
+   * @brief Call `handler(const io_uring_cqe &)` for every available
+   *        completion, and release them.
+   *
+   * @return unsigned The number of completions handled.
+   */
+  template <typename Handler> unsigned ForEachCompletion(Handler &&handler) {
+    auto head = *cq_head_;
+    auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    unsigned count = 0;
+    for (; head != tail; head++, count++) {
+      handler(cqes_[head & *cq_mask_]);
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    return count;
+  }
+
+  /**
+   * @brief Register `count` buffers for the `*_FIXED` operations, whose
+   *        `buf_index` is the position of the buffer in `buffers`.
+   */
+  void RegisterBuffers(const iovec *buffers, unsigned count);
+
+  int fd() const { return fd_; }
+
+private:
+  int fd_;
+  void *rings_ = nullptr;
+  size_t rings_size_ = 0;
+  io_uring_sqe *sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+
+  unsigned *sq_head_;
+  unsigned *sq_tail_;
+  unsigned *sq_mask_;
+  unsigned sq_entries_;
+  // the tail of the prepared entries, published to the kernel by `Submit`
+  unsigned sqe_tail_ = 0;
+
+  unsigned *cq_head_;
+  unsigned *cq_tail_;
+  unsigned *cq_mask_;
+  io_uring_cqe *cqes_;
+};
+
+/**
+ * @brief A pool of equally sized buffers provided to an `IoUringQueue` through
+ *        a buffer ring: reads and receives flagged with `IOSQE_BUFFER_SELECT`
+ *        pick a free buffer of the group, and the owner gives it back with
+ *        `Recycle` once the data is consumed.
+ */
+class ProvidedBufferRing {
+public:
+  /**
+   * @param count The number of buffers, a power of 2.
+   */
+  ProvidedBufferRing(IoUringQueue &queue, uint16_t group, uint16_t count, size_t buffer_size);
+  ~ProvidedBufferRing();
+
+  ProvidedBufferRing(const ProvidedBufferRing &) = delete;
+  ProvidedBufferRing &operator=(const ProvidedBufferRing &) = delete;
+
+  uint8_t *Buffer(uint16_t id) { return memory_ + static_cast<size_t>(id) * buffer_size_; }
+
+  /**
+   * @brief Give the buffer `id` back to the kernel, visible after `Publish`.
+   */
+  void Recycle(uint16_t id);
+  void Publish();
+
+  /**
+   * @brief The memory of all the buffers, e.g. to register it as a fixed buffer.
+   */
+  iovec Memory() const { return {memory_, memory_size_}; }
+
+  uint16_t group() const { return group_; }
+
+private:
+  IoUringQueue &queue_;
+  uint16_t group_;
+  uint16_t count_;
+  size_t buffer_size_;
+  io_uring_buf_ring *ring_;
+  size_t ring_size_;
+  uint8_t *memory_;
+  size_t memory_size_;
+  uint16_t tail_ = 0;
+};
+
+}  // namespace outline
@@ -0,0 +1,320 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+
+#include "json_value.h"
+
+namespace outline {
+
+//#region JsonValue Implementation
+
+JsonValue::JsonValue(const allocator_type &allocator)
+    : string_(allocator), keys_(allocator), items_(allocator) {}
+
+JsonValue::JsonValue(const JsonValue &other, const allocator_type &allocator)
+    : type_(other.type_), boolean_(other.boolean_), number_(other.number_),
+      string_(other.string_, allocator), keys_(other.keys_, allocator),
+      items_(other.items_, allocator) {}
+
+JsonValue::JsonValue(JsonValue &&other, const allocator_type &allocator)
+    : type_(other.type_), boolean_(other.boolean_), number_(other.number_),
+      string_(std::move(other.string_), allocator), keys_(std::move(other.keys_), allocator),
+      items_(std::move(other.items_), allocator) {}
+
+std::optional<bool> JsonValue::AsBool() const {
+  return type_ == kBool ? std::optional<bool>{boolean_} : std::nullopt;
+}
+
+std::optional<double> JsonValue::AsNumber() const {
+  return type_ == kNumber ? std::optional<double>{number_} : std::nullopt;
+}
+
+std::optional<std::string_view> JsonValue::AsString() const {
+  return type_ == kString ? std::optional<std::string_view>{string_} : std::nullopt;
+}
+
+std::span<const JsonValue> JsonValue::elements() const {
+  return type_ == kArray ? std::span<const JsonValue>{items_} : std::span<const JsonValue>{};
+}
+
+const JsonValue *JsonValue::Find(std::string_view key) const {
+  if (type_ != kObject) {
+    return nullptr;
+  }
+  auto it = std::find(keys_.begin(), keys_.end(), key);
+  return it != keys_.end() ? &items_[it - keys_.begin()] : nullptr;
+}
+
+bool JsonValue::GetBool(std::string_view key, bool fallback) const {
+  auto member = Find(key);
+  return member != nullptr ? member->AsBool().value_or(fallback) : fallback;
+}
+
+double JsonValue::GetNumber(std::string_view key, double fallback) const {
+  auto member = Find(key);
+  return member != nullptr ? member->AsNumber().value_or(fallback) : fallback;
+}
+
+std::string_view JsonValue::GetString(std::string_view key, std::string_view fallback) const {
+  auto member = Find(key);
+  return member != nullptr ? member->AsString().value_or(fallback) : fallback;
+}
+
+void JsonValue::Reset(Type type) {
+  type_ = type;
+  boolean_ = false;
+  number_ = 0;
+  string_.clear();
+  keys_.clear();
+  items_.clear();
+}
+
+//#endregion JsonValue Implementation
+
+//#region JsonParser Implementation
+
+// Deep enough for any request, shallow enough for the stack
+static const int kMaxJsonDepth = 32;
+
+/**
+ * @brief A recursive descent parser of RFC 8259 JSON text.
+ */
+class JsonParser {
+public:
+  explicit JsonParser(std::string_view text) : text_(text) {}
+
+  bool Parse(JsonValue &result) {
+    if (!ParseValue(result, 0)) {
+      return false;
+    }
+    SkipWhitespace();
+    return position_ == text_.size();
+  }
+
+private:
+  void SkipWhitespace() {
+    while (position_ < text_.size() &&
+           (text_[position_] == ' ' || text_[position_] == '\t' ||
+            text_[position_] == '\n' || text_[position_] == '\r')) {
+      position_++;
+    }
+  }
+
+  bool Consume(char expected) {
+    SkipWhitespace();
+    if (position_ < text_.size() && text_[position_] == expected) {
+      position_++;
+      return true;
+    }
+    return false;
+  }
+
+  bool ConsumeLiteral(std::string_view literal) {
+    if (text_.substr(position_, literal.size()) != literal) {
+      return false;
+    }
+    position_ += literal.size();
+    return true;
+  }
+
+  bool ParseValue(JsonValue &value, int depth) {
+    SkipWhitespace();
+    if (position_ == text_.size()) {
+      return false;
+    }
+    switch (text_[position_]) {
+      case '{':
+        return depth < kMaxJsonDepth && ParseObject(value, depth + 1);
+      case '[':
+        return depth < kMaxJsonDepth && ParseArray(value, depth + 1);
+      case '"':
+        value.Reset(JsonValue::kString);
+        return ParseString(value.string_);
+      case 't':
+        value.Reset(JsonValue::kBool);
+        value.boolean_ = true;
+        return ConsumeLiteral("true");
+      case 'f':
+        value.Reset(JsonValue::kBool);
+        return ConsumeLiteral("false");
+      case 'n':
+        value.Reset(JsonValue::kNull);
+        return ConsumeLiteral("null");
+      default:
+        value.Reset(JsonValue::kNumber);
+        return ParseNumber(value.number_);
+    }
+  }
+
+  bool ParseObject(JsonValue &value, int depth) {
+    value.Reset(JsonValue::kObject);
+    position_++;
+    if (Consume('}')) {
+      return true;
+    }
+    do {
+      SkipWhitespace();
+      if (position_ == text_.size() || text_[position_] != '"' ||
+          !ParseString(value.keys_.emplace_back()) || !Consume(':') ||
+          !ParseValue(value.items_.emplace_back(), depth)) {
+        return false;
+      }
+    } while (Consume(','));
+    return Consume('}');
+  }
+
+  bool ParseArray(JsonValue &value, int depth) {
+    value.Reset(JsonValue::kArray);
+    position_++;
+    if (Consume(']')) {
+      return true;
+    }
+    do {
+      if (!ParseValue(value.items_.emplace_back(), depth)) {
+        return false;
+      }
+    } while (Consume(','));
+    return Consume(']');
+  }
+
+  bool ParseNumber(double &number) {
+    // from_chars alone would also take "inf", "nan" or a leading "+"
+    auto start = position_;
+    if (position_ < text_.size() && text_[position_] == '-') {
+      position_++;
+    }
+    if (position_ == text_.size() || text_[position_] < '0' || text_[position_] > '9') {
+      return false;
+    }
+    auto [end, error] = std::from_chars(text_.data() + start, text_.data() + text_.size(), number);
+    if (error != std::errc{}) {
+      return false;
+    }
+    position_ = end - text_.data();
+    return true;
+  }
+
+  bool ParseHex4(uint32_t &code_point) {
+    if (text_.size() - position_ < 4) {
+      return false;
+    }
+    auto begin = text_.data() + position_;
+    auto [end, error] = std::from_chars(begin, begin + 4, code_point, 16);
+    if (error != std::errc{} || end != begin + 4) {
+      return false;
+    }
+    position_ += 4;
+    return true;
+  }
+
+  static void AppendUtf8(std::pmr::string &output, uint32_t code_point) {
+    if (code_point < 0x80) {
+      output.push_back(static_cast<char>(code_point));
+    } else if (code_point < 0x800) {
+      output.push_back(static_cast<char>(0xc0 | (code_point >> 6)));
+      output.push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+    } else if (code_point < 0x10000) {
+      output.push_back(static_cast<char>(0xe0 | (code_point >> 12)));
+      output.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+      output.push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+    } else {
+      output.push_back(static_cast<char>(0xf0 | (code_point >> 18)));
+      output.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3f)));
+      output.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+      output.push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+    }
+  }
+
+  bool ParseEscape(std::pmr::string &output) {
+    if (position_ == text_.size()) {
+      return false;
+    }
+    switch (text_[position_++]) {
+      case '"': output.push_back('"'); return true;
+      case '\\': output.push_back('\\'); return true;
+      case '/': output.push_back('/'); return true;
+      case 'b': output.push_back('\b'); return true;
+      case 'f': output.push_back('\f'); return true;
+      case 'n': output.push_back('\n'); return true;
+      case 'r': output.push_back('\r'); return true;
+      case 't': output.push_back('\t'); return true;
+      case 'u': break;
+      default: return false;
+    }
+
+    uint32_t code_point;
+    if (!ParseHex4(code_point)) {
+      return false;
+    }
+    if (code_point >= 0xd800 && code_point < 0xdc00) {
+      // a high surrogate, the low one must follow
+      uint32_t low;
+      if (!ConsumeLiteral("\\u") || !ParseHex4(low) || low < 0xdc00 || low >= 0xe000) {
+        return false;
+      }
+      code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+    } else if (code_point >= 0xdc00 && code_point < 0xe000) {
+      return false;
+    }
+    AppendUtf8(output, code_point);
+    return true;
+  }
+
+  bool ParseString(std::pmr::string &output) {
+    position_++;
+    while (position_ < text_.size()) {
+      auto c = text_[position_];
+      if (c == '"') {
+        position_++;
+        return true;
+      }
+      if (static_cast<unsigned char>(c) < 0x20) {
+        return false;
+      }
+      if (c == '\\') {
+        position_++;
+        if (!ParseEscape(output)) {
+          return false;
+        }
+        continue;
+      }
+      // copy the run of plain characters at once
+      auto end = text_.find_first_of("\"\\", position_);
+      end = std::min(end, text_.size());
+      auto run = text_.substr(position_, end - position_);
+      auto control = std::find_if(run.begin(), run.end(),
+                                  [](char c) { return static_cast<unsigned char>(c) < 0x20; });
+      output.append(run.begin(), control);
+      position_ += control - run.begin();
+      if (control != run.end()) {
+        return false;
+      }
+    }
+    return false;
+  }
+
+  std::string_view text_;
+  size_t position_ = 0;
+};
+
+bool ParseJson(std::string_view text, JsonValue &result) {
+  return JsonParser{text}.Parse(result);
+}
+
+//#endregion JsonParser Implementation
+
+}  // namespace outline
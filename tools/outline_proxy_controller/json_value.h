@@ -0,0 +1,95 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace outline {
+
+/**
+ * @brief A parsed JSON value. Its strings, arrays and objects are allocated from
+ *        the memory resource it was constructed with, typically the arena of a
+ *        single client request, so that reading a request does not touch the heap.
+ */
+class JsonValue {
+public:
+  using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+  enum Type { kNull, kBool, kNumber, kString, kArray, kObject };
+
+  explicit JsonValue(const allocator_type &allocator = {});
+  JsonValue(const JsonValue &other, const allocator_type &allocator);
+  JsonValue(JsonValue &&other, const allocator_type &allocator);
+  JsonValue(const JsonValue &other) = default;
+  JsonValue(JsonValue &&other) = default;
+  JsonValue &operator=(const JsonValue &other) = default;
+  JsonValue &operator=(JsonValue &&other) = default;
+
+  Type type() const { return type_; }
+
+  std::optional<bool> AsBool() const;
+  std::optional<double> AsNumber() const;
+  std::optional<std::string_view> AsString() const;
+
+  /**
+   * @brief The elements of an array, nothing for other values.
+   */
+  std::span<const JsonValue> elements() const;
+
+  /**
+   * @brief The member `key` of an object, nullptr if there is no such member
+   *        or this is not an object.
+   */
+  const JsonValue *Find(std::string_view key) const;
+
+  /**
+   * @brief The member `key` of an object if it has the expected type, `fallback`
+   *        otherwise.
+   */
+  bool GetBool(std::string_view key, bool fallback) const;
+  double GetNumber(std::string_view key, double fallback) const;
+  std::string_view GetString(std::string_view key, std::string_view fallback) const;
+
+private:
+  friend class JsonParser;
+
+  void Reset(Type type);
+
+  Type type_ = kNull;
+  bool boolean_ = false;
+  double number_ = 0;
+  std::pmr::string string_;
+  // the keys of an object, keys_[i] names items_[i]
+  std::pmr::vector<std::pmr::string> keys_;
+  // the elements of an array or the members of an object
+  std::pmr::vector<JsonValue> items_;
+};
+
+/**
+ * @brief Parse `text` into `result`, allocating from the memory resource of
+ *        `result`. Nesting is limited to 32 levels.
+ *
+ * @return false `text` is not a single valid JSON value, `result` is then in an
+ *         unspecified (but valid) state.
+ */
+bool ParseJson(std::string_view text, JsonValue &result);
+
+}  // namespace outline
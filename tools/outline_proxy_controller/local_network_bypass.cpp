@@ -0,0 +1,103 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <array>
+
+#include <arpa/inet.h>
+
+#include "local_network_bypass.h"
+
+using namespace outline;
+
+struct AddressRange {
+  const char *network;
+  uint8_t prefix_length;
+
+  bool Contains(const std::string &address) const {
+    in_addr parsed_network{}, parsed_address{};
+    if (::inet_pton(AF_INET, network, &parsed_network) != 1 ||
+        ::inet_pton(AF_INET, address.c_str(), &parsed_address) != 1) {
+      return false;
+    }
+    uint32_t mask = prefix_length == 0 ? 0 : ~uint32_t{0} << (32 - prefix_length);
+    return (ntohl(parsed_address.s_addr) & mask) == (ntohl(parsed_network.s_addr) & mask);
+  }
+};
+
+static const AddressRange kLinkLocalRange = {"169.254.0.0", 16};
+
+static const std::array<AddressRange, 3> kPrivateRanges = {{
+  {"10.0.0.0", 8},
+  {"172.16.0.0", 12},
+  {"192.168.0.0", 16},
+}};
+
+namespace outline {
+
+std::vector<RouteEntry> ComputeLocalNetworkRoutes(const std::vector<AddressEntry> &addresses,
+                                                  int interface_index,
+                                                  const std::string &gateway,
+                                                  uint32_t metric) {
+  std::vector<RouteEntry> routes;
+  if (interface_index <= 0) {
+    return routes;
+  }
+
+  bool has_address = false, has_private_address = false;
+  for (const auto &address : addresses) {
+    if (address.interface_index != interface_index) {
+      continue;
+    }
+    has_address = true;
+    has_private_address |= std::any_of(
+        kPrivateRanges.begin(), kPrivateRanges.end(),
+        [&](const auto &range) { return range.Contains(address.address); });
+  }
+  if (!has_address) {
+    // the uplink is down or unconfigured, nothing is reachable through it
+    return routes;
+  }
+
+  RouteEntry link_local_route{kLinkLocalRange.network, kLinkLocalRange.prefix_length, "",
+                              interface_index, metric};
+  link_local_route.scope = RT_SCOPE_LINK;
+  routes.push_back(std::move(link_local_route));
+  if (has_private_address && !gateway.empty()) {
+    for (const auto &range : kPrivateRanges) {
+      routes.push_back({range.network, range.prefix_length, gateway, interface_index, metric});
+    }
+  }
+  return routes;
+}
+
+std::vector<RouteEntry> FilterLocalNetworkRoutes(const std::vector<RouteEntry> &routes,
+                                                 uint32_t metric) {
+  auto is_range = [](const RouteEntry &route, const AddressRange &range) {
+    return route.destination == range.network && route.prefix_length == range.prefix_length;
+  };
+
+  std::vector<RouteEntry> result;
+  for (const auto &route : routes) {
+    if (route.metric == metric &&
+        (is_range(route, kLinkLocalRange) ||
+         std::any_of(kPrivateRanges.begin(), kPrivateRanges.end(),
+                     [&](const auto &range) { return is_range(route, range); }))) {
+      result.push_back(route);
+    }
+  }
+  return result;
+}
+
+}  // namespace outline
@@ -0,0 +1,51 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "routing_table.h"
+
+namespace outline {
+
+/**
+ * @brief Compute the routes keeping the local networks out of the tunnel: the
+ *        link-local range on the uplink, and the private (RFC 1918) ranges via
+ *        the local gateway when the uplink itself has a private address, i.e.
+ *        when we sit behind a router which can reach more of the LAN.
+ *
+ * Directly connected subnets are left to the kernel routes, which are more
+ * specific than any range computed here.
+ *
+ * @param addresses The addresses of all interfaces.
+ * @param interface_index The uplink, which used to carry the default route.
+ * @param gateway The gateway on the uplink, empty for point-to-point links.
+ * @param metric The metric of the routes, which tells them apart from others.
+ */
+std::vector<RouteEntry> ComputeLocalNetworkRoutes(const std::vector<AddressEntry> &addresses,
+                                                  int interface_index,
+                                                  const std::string &gateway,
+                                                  uint32_t metric);
+
+/**
+ * @brief Select the routes of `routes` which ComputeLocalNetworkRoutes may have
+ *        computed with `metric`, i.e. the ones currently installed.
+ */
+std::vector<RouteEntry> FilterLocalNetworkRoutes(const std::vector<RouteEntry> &routes,
+                                                 uint32_t metric);
+
+}  // namespace outline
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <sys/time.h>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
 
@@ -70,83 +71,104 @@ void Logger::set_threshold(log_level_t level) {
 }
 
 // Standard log function. Prints nice colors for each level.
-void Logger::log(log_level_t level, std::string msg, std::string function_name,
-                 std::string user_nick) {
+void Logger::log(log_level_t level, std::string_view msg, std::string_view function_name,
+                 std::string_view user_nick) {
   if (level < SILLY || level > ABORT || level < threshold) {
     return;
   }
 
-  msg = (user_nick.empty()) ? msg : user_nick + ": " + msg;
-  msg = (function_name.empty()) ? msg : function_name + ": " + msg;
-
+  const char *prefix = "";
+  const char *suffix = "";
   switch (level) {
     case SILLY:
-      msg = "\033[1;35;47m[SILLY] " + msg + "\033[0m";
+      prefix = "\033[1;35;47m[SILLY] ";
+      suffix = "\033[0m";
       break;
     case DEBUG:
-      msg = "\033[1;32m[DEBUG]\033[0m " + msg;
+      prefix = "\033[1;32m[DEBUG]\033[0m ";
       break;
     case VERBOSE:
-      msg = "\033[1;37m[VERBOSE]\033[0m " + msg;
+      prefix = "\033[1;37m[VERBOSE]\033[0m ";
       break;
     case INFO:
-      msg = "\033[1;34m[INFO]\033[0m " + msg;
+      prefix = "\033[1;34m[INFO]\033[0m ";
       break;
     case WARN:
-      msg = "\033[90;103m[WARN] " + msg + "\033[0m";
+      prefix = "\033[90;103m[WARN] ";
+      suffix = "\033[0m";
       break;
     case ERROR:
-      msg = "\033[91;40m[ERROR] " + msg + "\033[0m";
+      prefix = "\033[91;40m[ERROR] ";
+      suffix = "\033[0m";
       break;
     case ABORT:
-      msg = "\033[91;40m[ABORT] " + msg + "\033[0m";
+      prefix = "\033[91;40m[ABORT] ";
+      suffix = "\033[0m";
       break;
   }
 
-  // time stamp
-  msg = std::to_string(log_get_timestamp()) + ": " + msg;
+  // time stamp, formatted like std::to_string
+  char timestamp[32];
+  std::snprintf(timestamp, sizeof(timestamp), "%f: ", log_get_timestamp());
+
+  std::lock_guard<std::mutex> lock{log_mutex};
+  log_line.assign(timestamp).append(prefix);
+  if (!function_name.empty()) {
+    log_line.append(function_name).append(": ");
+  }
+  if (!user_nick.empty()) {
+    log_line.append(user_nick).append(": ");
+  }
+  log_line.append(msg).append(suffix);
 
   if (log_to_stderr) {
-    std::cerr << msg << std::endl;
+    std::cerr << log_line << std::endl;
   }
   if (log_to_file && log_file.is_open()) {
-    log_file << msg << std::endl;
+    log_file << log_line << std::endl;
   }
 }
 
 // Convenience methods
 
-void Logger::silly(std::string msg, std::string function_name, std::string user_nick) {
+void Logger::silly(std::string_view msg, std::string_view function_name,
+                   std::string_view user_nick) {
   log(SILLY, msg, function_name, user_nick);
 }
 
-void Logger::debug(std::string msg, std::string function_name, std::string user_nick) {
+void Logger::debug(std::string_view msg, std::string_view function_name,
+                   std::string_view user_nick) {
   log(DEBUG, msg, function_name, user_nick);
 }
 
-void Logger::verbose(std::string msg, std::string function_name, std::string user_nick) {
+void Logger::verbose(std::string_view msg, std::string_view function_name,
+                     std::string_view user_nick) {
   log(VERBOSE, msg, function_name, user_nick);
 }
 
-void Logger::info(std::string msg, std::string function_name, std::string user_nick) {
+void Logger::info(std::string_view msg, std::string_view function_name,
+                  std::string_view user_nick) {
   log(INFO, msg, function_name, user_nick);
 }
 
-void Logger::warn(std::string msg, std::string function_name, std::string user_nick) {
+void Logger::warn(std::string_view msg, std::string_view function_name,
+                  std::string_view user_nick) {
   log(WARN, msg, function_name, user_nick);
 }
 
-void Logger::error(std::string msg, std::string function_name, std::string user_nick) {
+void Logger::error(std::string_view msg, std::string_view function_name,
+                   std::string_view user_nick) {
   log(ERROR, msg, function_name, user_nick);
 }
 
-void Logger::abort(std::string msg, std::string function_name, std::string user_nick) {
+void Logger::abort(std::string_view msg, std::string_view function_name,
+                   std::string_view user_nick) {
   log(ABORT, msg, function_name, user_nick);
   exit(1);
 }
 
-void Logger::assert_or_die(bool expr, std::string failure_message, std::string function_name,
-                           std::string user_nick) {
+void Logger::assert_or_die(bool expr, std::string_view failure_message,
+                           std::string_view function_name, std::string_view user_nick) {
   if (!expr) abort(failure_message, function_name, user_nick);
 }
 
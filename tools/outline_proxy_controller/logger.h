@@ -14,6 +14,9 @@
 
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
 
 #ifndef SRC_LOGGER_H_
 #define SRC_LOGGER_H_
@@ -32,6 +35,11 @@ class Logger {
   bool log_to_file;
   std::string log_filename;
   std::ofstream log_file;
+  // the routing operations log from a worker thread
+  std::mutex log_mutex;
+  // the line being written, reused so logging does not allocate once the
+  // longest line has been seen
+  std::string log_line;
 
   /************************* Time Functions **************************/
 
@@ -78,18 +86,25 @@ class Logger {
 
   void config(bool log_stderr, bool log_file, std::string fname);
   void set_threshold(log_level_t level);
-  void log(log_level_t level, std::string msg, std::string function_name = "",
-           std::string user_nick = "");
-  void silly(std::string msg, std::string function_name = "", std::string user_nick = "");
-  void debug(std::string msg, std::string function_name = "", std::string user_nick = "");
-  void verbose(std::string msg, std::string function_name = "", std::string user_nick = "");
-  void info(std::string msg, std::string function_name = "", std::string user_nick = "");
-  void warn(std::string msg, std::string function_name = "", std::string user_nick = "");
-  void error(std::string msg, std::string function_name = "", std::string user_nick = "");
-  void abort(std::string msg, std::string function_name = "", std::string user_nick = "");
-
-  void assert_or_die(bool expr, std::string failure_message, std::string function_name = "",
-                     std::string user_nick = "");
+  void log(log_level_t level, std::string_view msg, std::string_view function_name = "",
+           std::string_view user_nick = "");
+  void silly(std::string_view msg, std::string_view function_name = "",
+                 std::string_view user_nick = "");
+  void debug(std::string_view msg, std::string_view function_name = "",
+                 std::string_view user_nick = "");
+  void verbose(std::string_view msg, std::string_view function_name = "",
+                   std::string_view user_nick = "");
+  void info(std::string_view msg, std::string_view function_name = "",
+                std::string_view user_nick = "");
+  void warn(std::string_view msg, std::string_view function_name = "",
+                std::string_view user_nick = "");
+  void error(std::string_view msg, std::string_view function_name = "",
+                 std::string_view user_nick = "");
+  void abort(std::string_view msg, std::string_view function_name = "",
+                 std::string_view user_nick = "");
+
+  void assert_or_die(bool expr, std::string_view failure_message,
+                     std::string_view function_name = "", std::string_view user_nick = "");
 };
 
 /**
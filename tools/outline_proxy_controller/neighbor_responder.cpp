@@ -0,0 +1,257 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+
+#include "internet_checksum.h"
+#include "neighbor_responder.h"
+
+using namespace outline;
+using namespace outline::frame;
+
+// The offsets of the fields of an ARP message for IPv4 over Ethernet
+// (RFC 826) after the Ethernet header.
+static const size_t kArpHardwareType = kEthHeaderSize;
+static const size_t kArpProtocolType = kEthHeaderSize + 2;
+static const size_t kArpHardwareLength = kEthHeaderSize + 4;
+static const size_t kArpProtocolLength = kEthHeaderSize + 5;
+static const size_t kArpOperation = kEthHeaderSize + 6;
+static const size_t kArpSenderMac = kEthHeaderSize + 8;
+static const size_t kArpSenderAddress = kEthHeaderSize + 14;
+static const size_t kArpTargetMac = kEthHeaderSize + 18;
+static const size_t kArpTargetAddress = kEthHeaderSize + 24;
+static const size_t kArpSize = kEthHeaderSize + 28;
+
+static const uint16_t kArpEthernet = 1;
+static const uint16_t kArpRequest = 1;
+static const uint16_t kArpReply = 2;
+
+// The offsets of the fields of an IPv6 neighbor solicitation or advertisement
+// (RFC 4861) after the Ethernet header.
+static const size_t kIpv6 = kEthHeaderSize;
+static const size_t kIpv6PayloadLength = kIpv6 + 4;
+static const size_t kIpv6NextHeader = kIpv6 + 6;
+static const size_t kIpv6HopLimit = kIpv6 + 7;
+static const size_t kIpv6Source = kIpv6 + 8;
+static const size_t kIpv6Destination = kIpv6 + 24;
+static const size_t kIcmpv6 = kIpv6 + 40;
+static const size_t kIcmpv6Type = kIcmpv6;
+static const size_t kIcmpv6Code = kIcmpv6 + 1;
+static const size_t kIcmpv6Checksum = kIcmpv6 + 2;
+static const size_t kNdFlags = kIcmpv6 + 4;
+static const size_t kNdTarget = kIcmpv6 + 8;
+static const size_t kNdOptions = kIcmpv6 + 24;
+// a single target link-layer address option
+static const size_t kAdvertisementSize = kNdOptions + 8;
+
+static const uint8_t kIcmpv6Protocol = 58;
+static const uint8_t kNeighborSolicitation = 135;
+static const uint8_t kNeighborAdvertisement = 136;
+static const uint8_t kNdHopLimit = 255;
+static const uint8_t kNdSolicitedFlag = 0x40;
+static const uint8_t kNdOverrideFlag = 0x20;
+static const uint8_t kNdTargetMacOption = 2;
+
+static const Ipv6Address kAllNodes = {0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+
+static bool IsSolicitedNodeAddress(const uint8_t *address, const Ipv6Address &target) {
+  static const uint8_t kPrefix[] = {0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0xff};
+  return std::equal(std::begin(kPrefix), std::end(kPrefix), address) &&
+         std::equal(target.begin() + 13, target.end(), address + 13);
+}
+
+/**
+ * @brief Whether `mac` is the Ethernet multicast address of the IPv6
+ *        multicast address `address` (RFC 2464).
+ */
+static bool IsMulticastMac(const uint8_t *mac, const uint8_t *address) {
+  return mac[0] == 0x33 && mac[1] == 0x33 && std::equal(address + 12, address + 16, mac + 2);
+}
+
+static void CopyMac(const uint8_t *mac, uint8_t *destination) {
+  std::copy_n(mac, std::tuple_size_v<MacAddress>, destination);
+}
+
+//#region NeighborResponder Implementation
+
+NeighborResponder::NeighborResponder(const MacAddress &adapter_mac) : adapter_mac_{adapter_mac} {}
+
+void NeighborResponder::AddIpv4Network(uint32_t network, int prefix_length,
+                                       const MacAddress &mac) {
+  if (prefix_length < 0 || prefix_length > 32) {
+    throw std::invalid_argument("invalid IPv4 prefix length " + std::to_string(prefix_length));
+  }
+  if (ipv4_count_ == ipv4_entries_.size()) {
+    throw std::length_error("too many IPv4 networks to answer ARP requests for");
+  }
+  auto mask = prefix_length == 0 ? 0 : ~uint32_t{0} << (32 - prefix_length);
+  ipv4_entries_[ipv4_count_++] = {network & mask, mask, mac};
+}
+
+void NeighborResponder::AddIpv6Address(const Ipv6Address &address, const MacAddress &mac) {
+  if (address[0] == 0xff) {
+    throw std::invalid_argument("cannot answer neighbor solicitations for a multicast address");
+  }
+  if (ipv6_count_ == ipv6_entries_.size()) {
+    throw std::length_error("too many IPv6 addresses to answer neighbor solicitations for");
+  }
+  ipv6_entries_[ipv6_count_++] = {address, mac};
+}
+
+std::span<uint8_t> NeighborResponder::Handle(std::span<const uint8_t> frame,
+                                             std::span<uint8_t> reply_buffer) const {
+  if (reply_buffer.size() < kMaxReplySize) {
+    throw std::invalid_argument("the neighbor reply buffer is too small");
+  }
+  if (frame.size() < kEthHeaderSize || !MacEqual(&frame[kEthSource], adapter_mac_)) {
+    return {};
+  }
+  switch (Load16(&frame[kEthType])) {
+  case kEthTypeArp:
+    return HandleArp(frame, reply_buffer);
+  case kEthTypeIpv6:
+    return HandleSolicitation(frame, reply_buffer);
+  default:
+    return {};
+  }
+}
+
+std::span<uint8_t> NeighborResponder::HandleArp(std::span<const uint8_t> frame,
+                                                std::span<uint8_t> reply_buffer) const {
+  // Ethernet padding may follow
+  if (frame.size() < kArpSize || Load16(&frame[kArpHardwareType]) != kArpEthernet ||
+      Load16(&frame[kArpProtocolType]) != kEthTypeIpv4 ||
+      frame[kArpHardwareLength] != adapter_mac_.size() || frame[kArpProtocolLength] != 4 ||
+      Load16(&frame[kArpOperation]) != kArpRequest ||
+      !MacEqual(&frame[kArpSenderMac], adapter_mac_)) {
+    return {};
+  }
+  auto sender = Load32(&frame[kArpSenderAddress]);
+  auto target = Load32(&frame[kArpTargetAddress]);
+  // A gratuitous ARP announces the sender's address, and an RFC 5227 probe
+  // (from 0.0.0.0) checks that nobody else holds it: answering either would
+  // make the adapter see its own address in conflict.
+  if (sender == 0 || target == sender) {
+    return {};
+  }
+  auto entries = std::span{ipv4_entries_}.first(ipv4_count_);
+  auto entry = std::find_if(entries.begin(), entries.end(), [target](const Ipv4Entry &entry) {
+    return (target & entry.mask) == entry.network;
+  });
+  // from an address of the network, broadcast, or unicast when refreshing the
+  // neighbor
+  if (entry == entries.end() || (sender & entry->mask) != entry->network ||
+      !(MacEqual(&frame[kEthDestination], kBroadcastMac) ||
+        MacEqual(&frame[kEthDestination], entry->mac))) {
+    return {};
+  }
+
+  auto out = reply_buffer.data();
+  CopyMac(adapter_mac_.data(), out + kEthDestination);
+  CopyMac(entry->mac.data(), out + kEthSource);
+  Store16(out + kEthType, kEthTypeArp);
+  Store16(out + kArpHardwareType, kArpEthernet);
+  Store16(out + kArpProtocolType, kEthTypeIpv4);
+  out[kArpHardwareLength] = static_cast<uint8_t>(adapter_mac_.size());
+  out[kArpProtocolLength] = 4;
+  Store16(out + kArpOperation, kArpReply);
+  CopyMac(entry->mac.data(), out + kArpSenderMac);
+  Store32(out + kArpSenderAddress, target);
+  CopyMac(adapter_mac_.data(), out + kArpTargetMac);
+  Store32(out + kArpTargetAddress, sender);
+  return reply_buffer.first(kArpSize);
+}
+
+std::span<uint8_t> NeighborResponder::HandleSolicitation(std::span<const uint8_t> frame,
+                                                         std::span<uint8_t> reply_buffer) const {
+  // no extension header, and the checks of RFC 4861 section 7.1.1
+  if (frame.size() < kNdOptions || frame[kIpv6] >> 4 != 6 ||
+      frame[kIpv6NextHeader] != kIcmpv6Protocol || frame[kIpv6HopLimit] != kNdHopLimit ||
+      frame[kIcmpv6Type] != kNeighborSolicitation || frame[kIcmpv6Code] != 0) {
+    return {};
+  }
+  auto payload_length = Load16(&frame[kIpv6PayloadLength]);
+  if (payload_length < kNdOptions - kIcmpv6 || payload_length > frame.size() - kIcmpv6) {
+    return {};
+  }
+  auto entries = std::span{ipv6_entries_}.first(ipv6_count_);
+  auto entry = std::find_if(entries.begin(), entries.end(), [&frame](const Ipv6Entry &entry) {
+    return std::equal(entry.address.begin(), entry.address.end(), &frame[kNdTarget]);
+  });
+  if (entry == entries.end()) {
+    return {};
+  }
+  // to the solicited-node multicast address of the target, or to the target
+  // when refreshing the neighbor
+  auto destination = &frame[kIpv6Destination];
+  auto multicast = IsSolicitedNodeAddress(destination, entry->address);
+  if (multicast ? !IsMulticastMac(&frame[kEthDestination], destination)
+                : !(std::equal(entry->address.begin(), entry->address.end(), destination) &&
+                    MacEqual(&frame[kEthDestination], entry->mac))) {
+    return {};
+  }
+  auto sum = checksum::Accumulate(&frame[kIcmpv6], payload_length,
+                                  checksum::PseudoHeaderV6(&frame[kIpv6Source], destination,
+                                                           kIcmpv6Protocol, payload_length));
+  if (checksum::Finish(sum) != 0) {
+    return {};
+  }
+
+  // duplicate address detection solicits from the unspecified address, and
+  // the answer goes to all the nodes, unsolicited
+  auto source = &frame[kIpv6Source];
+  auto detecting_duplicate = std::all_of(source, source + 16, [](uint8_t b) { return b == 0; });
+
+  auto out = reply_buffer.data();
+  std::memset(out, 0, kAdvertisementSize);
+  if (detecting_duplicate) {
+    out[kEthDestination] = 0x33;
+    out[kEthDestination + 1] = 0x33;
+    std::copy(kAllNodes.begin() + 12, kAllNodes.end(), out + kEthDestination + 2);
+  } else {
+    CopyMac(&frame[kEthSource], out + kEthDestination);
+  }
+  CopyMac(entry->mac.data(), out + kEthSource);
+  Store16(out + kEthType, kEthTypeIpv6);
+
+  out[kIpv6] = 0x60;
+  Store16(out + kIpv6PayloadLength, static_cast<uint16_t>(kAdvertisementSize - kIcmpv6));
+  out[kIpv6NextHeader] = kIcmpv6Protocol;
+  out[kIpv6HopLimit] = kNdHopLimit;
+  std::copy(entry->address.begin(), entry->address.end(), out + kIpv6Source);
+  if (detecting_duplicate) {
+    std::copy(kAllNodes.begin(), kAllNodes.end(), out + kIpv6Destination);
+  } else {
+    std::copy_n(source, 16, out + kIpv6Destination);
+  }
+
+  out[kIcmpv6Type] = kNeighborAdvertisement;
+  out[kNdFlags] = detecting_duplicate ? kNdOverrideFlag : kNdSolicitedFlag | kNdOverrideFlag;
+  std::copy(entry->address.begin(), entry->address.end(), out + kNdTarget);
+  out[kNdOptions] = kNdTargetMacOption;
+  out[kNdOptions + 1] = 1;  // in units of 8 bytes
+  CopyMac(entry->mac.data(), out + kNdOptions + 2);
+  Store16(out + kIcmpv6Checksum,
+          checksum::Finish(checksum::Accumulate(
+              out + kIcmpv6, kAdvertisementSize - kIcmpv6,
+              checksum::PseudoHeaderV6(out + kIpv6Source, out + kIpv6Destination,
+                                       kIcmpv6Protocol, kAdvertisementSize - kIcmpv6))));
+  return reply_buffer.first(kAdvertisementSize);
+}
+
+//#endregion NeighborResponder Implementation
@@ -0,0 +1,103 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "ethernet_frame.h"
+
+namespace outline {
+
+using Ipv6Address = std::array<uint8_t, 16>;
+
+/**
+ * @brief Answers the ARP requests and the IPv6 neighbor solicitations of an
+ *        adapter on behalf of virtual neighbors, as the point-to-point mode of
+ *        the tap-windows6 driver does for its gateway, independent from any
+ *        platform: a TAP device can then carry IP packets only, the
+ *        neighbors existing nowhere but in this table.
+ *
+ * The table holds up to `kMaxEntries` IPv4 networks (every address of which
+ * is answered to a sender within the network, but the sender's own) and
+ * `kMaxEntries` IPv6 addresses, each with the MAC address to answer. Nothing is allocated, neither when filling
+ * the table nor when handling frames.
+ */
+class NeighborResponder {
+public:
+  static constexpr size_t kMaxEntries = 16;
+  // an ARP reply is 42 bytes, a neighbor advertisement 86 bytes
+  static constexpr size_t kMaxReplySize = 86;
+
+  /**
+   * @param adapter_mac Only the requests of this adapter are answered.
+   */
+  explicit NeighborResponder(const MacAddress &adapter_mac);
+
+  /**
+   * @brief Answer the ARP requests for the addresses of `network` (in host
+   *        byte order) / `prefix_length` with `mac`.
+   *
+   * @throw std::invalid_argument If the prefix length is above 32.
+   * @throw std::length_error If the table is full.
+   */
+  void AddIpv4Network(uint32_t network, int prefix_length, const MacAddress &mac);
+
+  /**
+   * @brief Answer the neighbor solicitations for `address` with `mac`.
+   *
+   * @throw std::invalid_argument If `address` is multicast.
+   * @throw std::length_error If the table is full.
+   */
+  void AddIpv6Address(const Ipv6Address &address, const MacAddress &mac);
+
+  /**
+   * @brief Answer `frame` if it is an ARP request or a neighbor solicitation
+   *        from the adapter for an address of the table.
+   *
+   * @param reply_buffer Where to build the reply, of `kMaxReplySize` bytes at
+   *                     least.
+   * @return std::span<uint8_t> The reply, an Ethernet frame within
+   *         `reply_buffer`, or empty if `frame` is not answered.
+   */
+  std::span<uint8_t> Handle(std::span<const uint8_t> frame, std::span<uint8_t> reply_buffer) const;
+
+private:
+  struct Ipv4Entry {
+    uint32_t network;
+    uint32_t mask;
+    MacAddress mac;
+  };
+
+  struct Ipv6Entry {
+    Ipv6Address address;
+    MacAddress mac;
+  };
+
+  std::span<uint8_t> HandleArp(std::span<const uint8_t> frame,
+                               std::span<uint8_t> reply_buffer) const;
+  std::span<uint8_t> HandleSolicitation(std::span<const uint8_t> frame,
+                                        std::span<uint8_t> reply_buffer) const;
+
+  const MacAddress adapter_mac_;
+  std::array<Ipv4Entry, kMaxEntries> ipv4_entries_{};
+  size_t ipv4_count_ = 0;
+  std::array<Ipv6Entry, kMaxEntries> ipv6_entries_{};
+  size_t ipv6_count_ = 0;
+};
+
+}  // namespace outline
@@ -0,0 +1,233 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "netlink_socket.h"
+
+using namespace outline;
+
+// Large enough for the biggest dump batch the kernel sends in one datagram
+static const size_t kReceiveBufferSize = 32 * 1024;
+
+//#region NetlinkMessage Implementation
+
+NetlinkMessage::NetlinkMessage(uint16_t type, uint16_t flags)
+  : buffer_(NLMSG_HDRLEN, 0)
+{
+  header()->nlmsg_len = NLMSG_HDRLEN;
+  header()->nlmsg_type = type;
+  header()->nlmsg_flags = flags;
+}
+
+void NetlinkMessage::Append(const void *data, size_t length) {
+  auto offset = buffer_.size();
+  buffer_.resize(offset + NLMSG_ALIGN(length), 0);
+  if (length > 0) {
+    std::memcpy(buffer_.data() + offset, data, length);
+  }
+  header()->nlmsg_len = static_cast<uint32_t>(buffer_.size());
+}
+
+void NetlinkMessage::AddAttribute(uint16_t type, const void *data, size_t length) {
+  nlattr attr{};
+  attr.nla_len = static_cast<uint16_t>(NLA_HDRLEN + length);
+  attr.nla_type = type;
+  auto offset = buffer_.size();
+  buffer_.resize(offset + NLA_HDRLEN + NLA_ALIGN(length), 0);
+  std::memcpy(buffer_.data() + offset, &attr, sizeof(attr));
+  if (length > 0) {
+    std::memcpy(buffer_.data() + offset + NLA_HDRLEN, data, length);
+  }
+  header()->nlmsg_len = static_cast<uint32_t>(buffer_.size());
+}
+
+void NetlinkMessage::AddStringAttribute(uint16_t type, const std::string &value) {
+  // netlink strings are null-terminated
+  AddAttribute(type, value.c_str(), value.size() + 1);
+}
+
+size_t NetlinkMessage::BeginNested(uint16_t type) {
+  auto offset = buffer_.size();
+  AddAttribute(type | NLA_F_NESTED, nullptr, 0);
+  return offset;
+}
+
+void NetlinkMessage::EndNested(size_t offset) {
+  auto attr = reinterpret_cast<nlattr*>(buffer_.data() + offset);
+  attr->nla_len = static_cast<uint16_t>(buffer_.size() - offset);
+}
+
+//#endregion NetlinkMessage Implementation
+
+//#region NetlinkSocket Implementation
+
+NetlinkSocket::NetlinkSocket(int protocol, uint32_t groups)
+  : fd_{::socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol)},
+    next_sequence_{1},
+    receive_buffer_(kReceiveBufferSize)
+{
+  if (fd_ < 0) {
+    throw std::system_error{errno, std::generic_category(), "failed to open netlink socket"};
+  }
+
+  sockaddr_nl local{};
+  local.nl_family = AF_NETLINK;
+  local.nl_groups = groups;
+  if (::bind(fd_, reinterpret_cast<sockaddr*>(&local), sizeof(local)) < 0) {
+    auto err = errno;
+    ::close(fd_);
+    throw std::system_error{err, std::generic_category(), "failed to bind netlink socket"};
+  }
+}
+
+NetlinkSocket::~NetlinkSocket() {
+  ::close(fd_);
+}
+
+void NetlinkSocket::Request(NetlinkMessage &request, const MessageHandler &handler) {
+  auto sequence = next_sequence_++;
+  request.header()->nlmsg_seq = sequence;
+  bool is_dump = (request.header()->nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP;
+  // a dump is terminated by NLMSG_DONE, everything else needs an explicit ack
+  request.header()->nlmsg_flags |= is_dump ? NLM_F_REQUEST : (NLM_F_REQUEST | NLM_F_ACK);
+
+  sockaddr_nl kernel{};
+  kernel.nl_family = AF_NETLINK;
+  if (::sendto(fd_, request.data(), request.size(), 0,
+               reinterpret_cast<sockaddr*>(&kernel), sizeof(kernel)) < 0) {
+    throw std::system_error{errno, std::generic_category(), "failed to send netlink request"};
+  }
+
+  for (;;) {
+    auto received = ::recv(fd_, receive_buffer_.data(), receive_buffer_.size(), 0);
+    if (received < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::system_error{errno, std::generic_category(), "failed to receive netlink response"};
+    }
+
+    auto length = static_cast<size_t>(received);
+    for (auto msg = reinterpret_cast<const nlmsghdr*>(receive_buffer_.data());
+         NLMSG_OK(msg, length);
+         msg = NLMSG_NEXT(msg, length)) {
+      if (msg->nlmsg_seq != sequence) {
+        // a stale reply of an earlier request, or a multicast notification
+        continue;
+      }
+      if (msg->nlmsg_type == NLMSG_DONE) {
+        return;
+      }
+      if (msg->nlmsg_type == NLMSG_ERROR) {
+        auto err = static_cast<const nlmsgerr*>(NLMSG_DATA(msg));
+        if (err->error != 0) {
+          throw std::system_error{-err->error, std::generic_category(), "netlink request failed"};
+        }
+        if (!is_dump) {
+          return;
+        }
+        continue;
+      }
+      if (handler) {
+        handler(*msg);
+      }
+    }
+  }
+}
+
+std::vector<int> NetlinkSocket::RequestBatch(std::vector<NetlinkMessage> &requests) {
+  std::vector<int> results(requests.size(), 0);
+  if (requests.empty()) {
+    return results;
+  }
+
+  auto first_sequence = next_sequence_;
+  std::vector<iovec> iov;
+  iov.reserve(requests.size());
+  for (auto &request : requests) {
+    request.header()->nlmsg_seq = next_sequence_++;
+    request.header()->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+    iov.push_back({const_cast<char*>(request.data()), request.size()});
+  }
+
+  sockaddr_nl kernel{};
+  kernel.nl_family = AF_NETLINK;
+  msghdr batch{};
+  batch.msg_name = &kernel;
+  batch.msg_namelen = sizeof(kernel);
+  batch.msg_iov = iov.data();
+  batch.msg_iovlen = iov.size();
+  if (::sendmsg(fd_, &batch, 0) < 0) {
+    throw std::system_error{errno, std::generic_category(), "failed to send netlink batch"};
+  }
+
+  size_t pending = requests.size();
+  while (pending > 0) {
+    auto received = ::recv(fd_, receive_buffer_.data(), receive_buffer_.size(), 0);
+    if (received < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::system_error{errno, std::generic_category(), "failed to receive netlink response"};
+    }
+
+    auto length = static_cast<size_t>(received);
+    for (auto msg = reinterpret_cast<const nlmsghdr*>(receive_buffer_.data());
+         NLMSG_OK(msg, length);
+         msg = NLMSG_NEXT(msg, length)) {
+      auto index = msg->nlmsg_seq - first_sequence;
+      if (msg->nlmsg_type != NLMSG_ERROR || index >= requests.size()) {
+        continue;
+      }
+      results[index] = -static_cast<const nlmsgerr*>(NLMSG_DATA(msg))->error;
+      pending--;
+    }
+  }
+  return results;
+}
+
+size_t NetlinkSocket::ReceivePending(const MessageHandler &handler) {
+  size_t dispatched = 0;
+  for (;;) {
+    auto received = ::recv(fd_, receive_buffer_.data(), receive_buffer_.size(), MSG_DONTWAIT);
+    if (received < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return dispatched;
+      }
+      throw std::system_error{errno, std::generic_category(), "failed to receive netlink message"};
+    }
+
+    auto length = static_cast<size_t>(received);
+    for (auto msg = reinterpret_cast<const nlmsghdr*>(receive_buffer_.data());
+         NLMSG_OK(msg, length);
+         msg = NLMSG_NEXT(msg, length)) {
+      if (msg->nlmsg_type == NLMSG_DONE || msg->nlmsg_type == NLMSG_ERROR) {
+        continue;
+      }
+      handler(*msg);
+      dispatched++;
+    }
+  }
+}
+
+//#endregion NetlinkSocket Implementation
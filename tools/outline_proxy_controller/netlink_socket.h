@@ -0,0 +1,152 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <linux/netlink.h>
+
+namespace outline {
+
+/**
+ * @brief A single netlink request message under construction.
+ *
+ * The message starts with a `nlmsghdr` and grows as the family specific header
+ * and attributes are appended. The length in the header is kept up to date.
+ */
+class NetlinkMessage {
+public:
+  NetlinkMessage(uint16_t type, uint16_t flags);
+
+  /**
+   * @brief Append a fixed size family header (e.g. `rtmsg`, `nfgenmsg`).
+   */
+  template<typename T> void AppendHeader(const T &header) {
+    Append(&header, sizeof(header));
+  }
+
+  void AddAttribute(uint16_t type, const void *data, size_t length);
+
+  template<typename T> void AddAttribute(uint16_t type, const T &value) {
+    AddAttribute(type, &value, sizeof(value));
+  }
+
+  void AddStringAttribute(uint16_t type, const std::string &value);
+
+  /**
+   * @brief Start a nested attribute; returns the offset to pass to `EndNested`.
+   */
+  size_t BeginNested(uint16_t type);
+  void EndNested(size_t offset);
+
+  nlmsghdr *header() { return reinterpret_cast<nlmsghdr*>(buffer_.data()); }
+  const nlmsghdr *header() const { return reinterpret_cast<const nlmsghdr*>(buffer_.data()); }
+  const char *data() const { return buffer_.data(); }
+  size_t size() const { return buffer_.size(); }
+
+private:
+  void Append(const void *data, size_t length);
+
+  std::vector<char> buffer_;
+};
+
+/**
+ * @brief An RAII wrapper of an `AF_NETLINK` socket, so that we can talk to the
+ *        kernel directly instead of spawning a new process for every query.
+ */
+class NetlinkSocket {
+public:
+  using MessageHandler = std::function<void(const nlmsghdr &)>;
+
+  /**
+   * @brief Open a netlink socket of `protocol` (e.g. `NETLINK_ROUTE`), optionally
+   *        subscribed to the multicast `groups`.
+   */
+  explicit NetlinkSocket(int protocol, uint32_t groups = 0);
+  ~NetlinkSocket();
+
+  NetlinkSocket(const NetlinkSocket&) = delete;
+  NetlinkSocket &operator=(const NetlinkSocket&) = delete;
+
+  int fd() const { return fd_; }
+
+  /**
+   * @brief Send `request` and dispatch every reply to `handler`, until the kernel
+   *        acknowledges the request or finishes the dump.
+   *
+   * @throw std::system_error The kernel rejected the request.
+   */
+  void Request(NetlinkMessage &request, const MessageHandler &handler = {});
+
+  /**
+   * @brief Send all `requests` in a single `sendmsg` and wait for their acks.
+   *        The kernel processes them in order and does not stop at a failure.
+   *
+   * @return std::vector<int> The errno of each request, 0 if it succeeded.
+   */
+  std::vector<int> RequestBatch(std::vector<NetlinkMessage> &requests);
+
+  /**
+   * @brief Receive whatever is currently queued on the socket (e.g. multicast
+   *        notifications) and dispatch it to `handler`. Never blocks.
+   *
+   * @return size_t The number of messages dispatched.
+   */
+  size_t ReceivePending(const MessageHandler &handler);
+
+private:
+  int fd_;
+  uint32_t next_sequence_;
+  std::vector<char> receive_buffer_;
+};
+
+/**
+ * @brief Iterate over the attributes in [data, data + length), calling
+ *        `fn(type, payload, payload_length)` for each of them.
+ */
+template<typename Fn>
+void ForEachNetlinkAttribute(const void *data, size_t length, Fn &&fn) {
+  auto attr = static_cast<const nlattr*>(data);
+  while (length >= sizeof(nlattr) && attr->nla_len >= sizeof(nlattr) && attr->nla_len <= length) {
+    fn(static_cast<uint16_t>(attr->nla_type & NLA_TYPE_MASK),
+       reinterpret_cast<const char*>(attr) + NLA_HDRLEN,
+       static_cast<size_t>(attr->nla_len - NLA_HDRLEN));
+    auto aligned = std::min<size_t>(NLA_ALIGN(attr->nla_len), length);
+    length -= aligned;
+    attr = reinterpret_cast<const nlattr*>(reinterpret_cast<const char*>(attr) + aligned);
+  }
+}
+
+/**
+ * @brief Iterate over the attributes following the family header `T` of `msg`.
+ */
+template<typename T, typename Fn>
+void ForEachNetlinkAttribute(const nlmsghdr &msg, Fn &&fn) {
+  auto offset = NLMSG_LENGTH(sizeof(T));
+  if (msg.nlmsg_len < NLMSG_ALIGN(offset)) {
+    return;
+  }
+  ForEachNetlinkAttribute(reinterpret_cast<const char*>(&msg) + NLMSG_ALIGN(offset),
+                          msg.nlmsg_len - NLMSG_ALIGN(offset),
+                          std::forward<Fn>(fn));
+}
+
+}  // namespace outline
@@ -0,0 +1,80 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <system_error>
+
+#include <linux/rtnetlink.h>
+#include <unistd.h>
+
+#include <boost/asio.hpp>
+
+#include "logger.h"
+#include "netlink_socket.h"
+#include "network_monitor.h"
+
+using namespace outline;
+
+// How long the notifications of a single network change are coalesced
+static const std::chrono::milliseconds kCoalescingDelay{100};
+
+/**
+ * @brief Drain the notifications queued on `monitor`.
+ *
+ * @return true Something has changed, or notifications have been lost.
+ */
+static bool ReceiveNetworkChanges(NetlinkSocket &monitor) {
+  try {
+    return monitor.ReceivePending([](const nlmsghdr&) {}) > 0;
+  } catch (const std::system_error &e) {
+    if (e.code().value() == ENOBUFS) {
+      // the kernel dropped notifications, assume the worst
+      return true;
+    }
+    throw;
+  }
+}
+
+NetworkMonitor::NetworkMonitor(boost::asio::any_io_executor executor,
+                               std::shared_ptr<OutlineProxyController> outline_proxy_controller)
+  : executor_{std::move(executor)},
+    outline_controller_{std::move(outline_proxy_controller)}
+{}
+
+boost::asio::awaitable<void> NetworkMonitor::Start() {
+  using namespace boost::asio;
+
+  try {
+    NetlinkSocket monitor{NETLINK_ROUTE, RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV4_ROUTE};
+
+    // the descriptor takes the ownership of the fd it is given
+    posix::stream_descriptor network_events{executor_, ::dup(monitor.fd())};
+    steady_timer coalescing_timer{executor_};
+    for (;;) {
+      co_await network_events.async_wait(posix::descriptor_base::wait_read, use_awaitable);
+      if (!ReceiveNetworkChanges(monitor)) {
+        continue;
+      }
+
+      coalescing_timer.expires_after(kCoalescingDelay);
+      co_await coalescing_timer.async_wait(use_awaitable);
+      ReceiveNetworkChanges(monitor);
+      co_await outline_controller_->handleNetworkChange();
+    }
+  } catch (const std::exception &e) {
+    logger.error("network monitor stopped: " + std::string(e.what()));
+  }
+}
@@ -0,0 +1,52 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/awaitable.hpp>
+
+#include "outline_proxy_controller.h"
+
+namespace outline {
+
+/**
+ * @brief Tells the controller when the links, IPv4 addresses or routes of the
+ *        system change, e.g. when DHCP renews a lease or an interface goes down.
+ *
+ * Notifications come in bursts (an address change alone brings several
+ * routes along), so they are coalesced for a short while before the
+ * controller is told once.
+ */
+class NetworkMonitor {
+public:
+  NetworkMonitor(boost::asio::any_io_executor executor,
+                 std::shared_ptr<OutlineProxyController> outline_proxy_controller);
+
+public:
+  /**
+   * @brief Start monitoring the network asynchronously.
+   *
+   * @return boost::asio::awaitable<void> A co_awaitable C++20 coroutine.
+   */
+  boost::asio::awaitable<void> Start();
+
+private:
+  boost::asio::any_io_executor executor_;
+  std::shared_ptr<OutlineProxyController> outline_controller_;
+};
+
+}  // namespace outline
@@ -0,0 +1,176 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+#include <sys/stat.h>
+
+#include "logger.h"
+#include "network_profile_cache.h"
+
+using namespace outline;
+
+// First line of the cache file, bump the version when the format changes
+static const std::string kCacheFileHeader = "outline-network-profiles 2";
+// Stands for an empty preferred source address
+static const std::string kNoAddress = "-";
+
+/**
+ * @brief Read a length-prefixed blob written by `WriteBlob`.
+ */
+static std::string ReadBlob(std::istream &input) {
+  size_t length;
+  if (!(input >> length) || input.get() != '\n') {
+    throw std::runtime_error("malformed blob length");
+  }
+  std::string blob(length, '\0');
+  if (!input.read(blob.data(), length)) {
+    throw std::runtime_error("truncated blob");
+  }
+  return blob;
+}
+
+static void WriteBlob(std::ostream &output, const std::string &blob) {
+  output << blob.size() << '\n' << blob << '\n';
+}
+
+NetworkProfileCache::NetworkProfileCache(std::string filename, size_t capacity)
+  : filename_{std::move(filename)},
+    capacity_{capacity}
+{
+  Load();
+}
+
+const NetworkProfile *NetworkProfileCache::FindCurrent(const std::vector<NeighbourEntry> &neighbours) {
+  for (auto it = profiles_.begin(); it != profiles_.end(); ++it) {
+    const auto &fingerprint = it->fingerprint;
+    for (const auto &neighbour : neighbours) {
+      if (neighbour.interface_index == fingerprint.interface_index &&
+          neighbour.address == fingerprint.gateway_ip &&
+          neighbour.link_address == fingerprint.gateway_mac) {
+        profiles_.splice(profiles_.begin(), profiles_, it);
+        return &profiles_.front();
+      }
+    }
+  }
+  return nullptr;
+}
+
+void NetworkProfileCache::Store(NetworkProfile profile) {
+  profiles_.remove_if([&](const auto &cached) { return cached.fingerprint == profile.fingerprint; });
+  profiles_.push_front(std::move(profile));
+  while (profiles_.size() > capacity_) {
+    profiles_.pop_back();
+  }
+  Save();
+}
+
+void NetworkProfileCache::Evict(const NetworkFingerprint &fingerprint) {
+  profiles_.remove_if([&](const auto &cached) { return cached.fingerprint == fingerprint; });
+  Save();
+}
+
+void NetworkProfileCache::Load() {
+  if (filename_.empty()) {
+    return;
+  }
+
+  std::ifstream input{filename_, std::ios::binary};
+  if (!input) {
+    return;
+  }
+
+  try {
+    std::string header;
+    if (!std::getline(input, header) || header != kCacheFileHeader) {
+      throw std::runtime_error("unknown file format");
+    }
+
+    size_t count;
+    input >> count;
+    for (size_t i = 0; i < count && profiles_.size() < capacity_; i++) {
+      NetworkProfile profile;
+      size_t route_count;
+      input >> profile.fingerprint.interface_index >> profile.fingerprint.gateway_ip
+            >> profile.fingerprint.gateway_mac >> profile.interface_name >> profile.local_ip
+            >> route_count;
+      for (size_t r = 0; r < route_count && input; r++) {
+        RouteEntry route;
+        unsigned protocol, scope;
+        input >> route.gateway >> route.interface_index >> route.metric
+              >> route.preferred_source >> protocol >> scope;
+        if (route.preferred_source == kNoAddress) {
+          route.preferred_source.clear();
+        }
+        route.protocol = static_cast<uint8_t>(protocol);
+        route.scope = static_cast<uint8_t>(scope);
+        profile.default_routes.push_back(std::move(route));
+      }
+      if (!input || input.get() != '\n') {
+        throw std::runtime_error("malformed network profile");
+      }
+      profile.resolv_conf = ReadBlob(input);
+      profile.resolv_conf_head = ReadBlob(input);
+      profiles_.push_back(std::move(profile));
+    }
+  } catch (const std::exception &e) {
+    // the cache is only an optimization, start over
+    logger.warn("ignoring network profile cache " + filename_ + ": " + e.what());
+    profiles_.clear();
+  }
+}
+
+void NetworkProfileCache::Save() const {
+  if (filename_.empty()) {
+    return;
+  }
+
+  auto directory_end = filename_.find_last_of('/');
+  if (directory_end != std::string::npos && directory_end > 0) {
+    ::mkdir(filename_.substr(0, directory_end).c_str(), S_IRWXU);
+  }
+
+  // write to a temporary file first so a crash never leaves a truncated cache
+  auto temporary = filename_ + ".tmp";
+  {
+    std::ofstream output{temporary, std::ios::binary | std::ios::trunc};
+    output << kCacheFileHeader << '\n' << profiles_.size() << '\n';
+    for (const auto &profile : profiles_) {
+      output << profile.fingerprint.interface_index << ' ' << profile.fingerprint.gateway_ip << ' '
+             << profile.fingerprint.gateway_mac << ' ' << profile.interface_name << ' '
+             << profile.local_ip << ' ' << profile.default_routes.size();
+      for (const auto &route : profile.default_routes) {
+        output << ' ' << route.gateway << ' ' << route.interface_index << ' ' << route.metric
+               << ' ' << (route.preferred_source.empty() ? kNoAddress : route.preferred_source)
+               << ' ' << static_cast<unsigned>(route.protocol) << ' '
+               << static_cast<unsigned>(route.scope);
+      }
+      output << '\n';
+      WriteBlob(output, profile.resolv_conf);
+      WriteBlob(output, profile.resolv_conf_head);
+    }
+    if (!output) {
+      logger.warn("failed to write network profile cache " + temporary);
+      return;
+    }
+  }
+  if (std::rename(temporary.c_str(), filename_.c_str()) != 0) {
+    logger.warn("failed to update network profile cache " + filename_);
+  }
+}
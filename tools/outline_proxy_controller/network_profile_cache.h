@@ -0,0 +1,95 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "routing_table.h"
+
+namespace outline {
+
+/**
+ * @brief Identifies a network we have been connected to: the uplink interface
+ *        together with the IP and MAC address of its gateway.
+ */
+struct NetworkFingerprint {
+  int interface_index = 0;
+  std::string gateway_ip;
+  std::string gateway_mac;
+
+  bool operator==(const NetworkFingerprint&) const = default;
+};
+
+/**
+ * @brief Everything routeThroughOutline needs to know about a network, so that
+ *        it can be reused without detecting it again.
+ */
+struct NetworkProfile {
+  NetworkFingerprint fingerprint;
+  std::string interface_name;
+  std::string local_ip;
+  // The default routes of the main table before we replaced them
+  std::vector<RouteEntry> default_routes;
+  // The DNS configuration before we overwrote it
+  std::string resolv_conf;
+  std::string resolv_conf_head;
+};
+
+/**
+ * @brief A small LRU cache of the network profiles, persisted to a file so it
+ *        survives restarts of the controller.
+ */
+class NetworkProfileCache {
+public:
+  /**
+   * @param filename Where the cache is persisted, empty to keep it in memory only.
+   * @param capacity The maximum number of networks remembered.
+   */
+  NetworkProfileCache(std::string filename, size_t capacity);
+
+  /**
+   * @brief Find the most recently used profile matching the current neighbour
+   *        table: its gateway must be a valid neighbour with the same MAC on
+   *        the same interface. The profile found becomes the most recent one.
+   *
+   * @return const NetworkProfile* The profile, or nullptr if no network is known.
+   */
+  const NetworkProfile *FindCurrent(const std::vector<NeighbourEntry> &neighbours);
+
+  /**
+   * @brief Insert or replace the profile of a network as the most recent one,
+   *        evicting the least recently used one if the cache is full.
+   */
+  void Store(NetworkProfile profile);
+
+  /**
+   * @brief Forget a network whose cached profile turned out to be wrong.
+   */
+  void Evict(const NetworkFingerprint &fingerprint);
+
+private:
+  void Load();
+  void Save() const;
+
+private:
+  std::string filename_;
+  size_t capacity_;
+  std::list<NetworkProfile> profiles_;
+};
+
+}  // namespace outline
@@ -0,0 +1,44 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <system_error>
+
+#include "operation_deadline.h"
+#include "outline_error.h"
+
+using namespace outline;
+
+OperationDeadline::OperationDeadline(std::chrono::steady_clock::duration timeout)
+  : deadline_{std::chrono::steady_clock::now() + timeout}
+{}
+
+void OperationDeadline::Cancel() noexcept {
+  cancelled_.store(true, std::memory_order_relaxed);
+}
+
+bool OperationDeadline::expired() const noexcept {
+  return cancelled() || std::chrono::steady_clock::now() >= deadline_;
+}
+
+void OperationDeadline::Check(const std::string &stage) const {
+  if (cancelled()) {
+    throw std::system_error{ErrorCode::kConfigureSystemProxyFailure,
+                            "cancelled before " + stage};
+  }
+  if (std::chrono::steady_clock::now() >= deadline_) {
+    throw std::system_error{ErrorCode::kConfigureSystemProxyFailure,
+                            "timed out before " + stage};
+  }
+}
@@ -0,0 +1,58 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace outline {
+
+/**
+ * @brief The deadline and the cancellation of a long controller operation,
+ *        shared between the session awaiting it and the thread running it.
+ *        The operation polls it at its safe points, where everything done so
+ *        far can be rolled back.
+ */
+class OperationDeadline {
+public:
+  explicit OperationDeadline(std::chrono::steady_clock::duration timeout);
+
+  /**
+   * @brief Ask the operation to stop at its next safe point, thread-safe.
+   */
+  void Cancel() noexcept;
+
+  bool cancelled() const noexcept { return cancelled_.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief Whether the operation has been cancelled or ran out of time.
+   */
+  bool expired() const noexcept;
+
+  /**
+   * @brief A safe point of the operation before `stage`.
+   *
+   * @throw std::system_error kConfigureSystemProxyFailure if it has expired.
+   */
+  void Check(const std::string &stage) const;
+
+private:
+  std::chrono::steady_clock::time_point deadline_;
+  std::atomic<bool> cancelled_{false};
+};
+
+}  // namespace outline
@@ -12,20 +12,24 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <initializer_list>
 #include <memory>
+#include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include <grp.h>
 #include <unistd.h>
 #include <pwd.h>
 
 #include <boost/asio.hpp>
-#include <boost/lexical_cast.hpp>
-#include <boost/property_tree/json_parser.hpp>
-#include <boost/property_tree/ptree.hpp>
 
+#include "allocation_counter.h"
 #include "logger.h"
 #include "outline_controller_server.h"
 #include "outline_error.h"
@@ -38,127 +42,417 @@ using namespace outline;
 static const std::string kConfigureRoutingAction = "configureRouting";
 static const std::string kResetRoutingAction = "resetRouting";
 static const std::string kGetDeviceNameAction = "getDeviceName";
+static const std::string kRegisterTunnelProcessAction = "registerTunnelProcess";
+
+// Two-phase routing commands: configureRouting split into a preparation which can
+// overlap with the tunnel handshake, and a commit which switches the traffic
+static const std::string kPrepareRoutingAction = "prepareRouting";
+static const std::string kCommitRoutingAction = "commitRouting";
+static const std::string kAbortRoutingAction = "abortRouting";
+
+// Keeps the routes to the tun device while the App restarts its tunnel process
+static const std::string kHoldRoutingAction = "holdRouting";
+
+// Replaces the list of cgroups whose traffic does not go through Outline
+static const std::string kSetBypassCgroupsAction = "setBypassCgroups";
+
+// Tells the path taken by each of a batch of destinations, for diagnostics
+static const std::string kClassifyDestinationsAction = "classifyDestinations";
+
+// Returns the traffic statistics, optionally (un)subscribing to the events
+static const std::string kGetTrafficStatsAction = "getTrafficStats";
+static const std::string kGetDataPlaneStatsAction = "getDataPlaneStats";
+
+// Returns the flows of the native data plane with the most traffic
+static const std::string kGetTopFlowsAction = "getTopFlows";
+
+// Events sent to the App without a request
+static const std::string kStatusChangedEvent = "statusChanged";
+static const std::string kTrafficStatsEvent = "trafficStats";
+
+// Optional parameter of routing commands to purge connections bound to the previous route
+static const std::string kFlushStaleConnectionsParameter = "flushStaleConnections";
+
+// Optional parameter of configureRouting: "routeDirectly" (default) or "blockTraffic"
+static const std::string kTunnelFailurePolicyParameter = "tunnelFailurePolicy";
+static const std::string kBlockTrafficPolicy = "blockTraffic";
+
+// Optional parameter of configureRouting to keep the local networks out of the tunnel
+static const std::string kBypassLocalNetworksParameter = "bypassLocalNetworks";
+
+// Optional parameter of configureRouting, commitRouting and resetRouting: how
+// many milliseconds the routing may take before it is rolled back
+static const std::string kTimeoutParameter = "timeoutMs";
 
 // Minimum length of JSON input from app
 static const int kJsonInputMinLength = 10;
 
-// The buffer size used to communicate with Outline client
-static const int kChannelBufferSize = 1024;
+// The buffer size used to communicate with Outline client, large enough for a
+// classifyDestinations request of a few thousand addresses
+static const int kChannelBufferSize = 256 * 1024;
+
+// How many written messages keep their buffer for the next ones
+static const size_t kSpareMessages = 4;
 
 /**
- * @brief Try to parse the raw input string as a Json object, and put the parsed object
- *        into `result`. The function returns `false` if `raw_str` is not valid.
- *
- * @param raw_str The input Json string to be parsed into a property tree.
- * @param result The result Boost property tree data structure.
- * @return true `raw_str` is a valid Json and `result` is the parsed property tree.
- * @return false `raw_str` is invalid and `result` is in an invalid state as well.
+ * @brief Copy `text` into `arena`, so that it stays valid until the request is
+ *        answered.
  */
-static bool TryParseJson(const std::string &raw_str, boost::property_tree::ptree &result) {
-  result.clear();
-  try {
-    std::istringstream input{raw_str};
-    boost::property_tree::read_json(input, result);
-    return true;
-  } catch (const std::exception&) {
+static std::string_view CopyToArena(std::pmr::memory_resource *arena, std::string_view text) {
+  auto copy = static_cast<char*>(arena->allocate(text.size(), 1));
+  std::copy(text.begin(), text.end(), copy);
+  return {copy, text.size()};
+}
+
+/**
+ * @brief Concatenate `parts` into a string of `arena`, e.g. a log message.
+ */
+static std::pmr::string Concat(std::pmr::memory_resource *arena,
+                               std::initializer_list<std::string_view> parts) {
+  std::pmr::string result{arena};
+  for (auto part : parts) {
+    result.append(part);
   }
-  return false;
+  return result;
+}
+
+/**
+ * @brief The `"flushed"` member of the response to a routing command, the
+ *        connections purged with `flushStaleConnections`, empty if none.
+ */
+static std::string_view FormatFlushReport(std::pmr::memory_resource *arena,
+                                          const std::optional<FlowFlushReport> &report) {
+  if (!report) {
+    return {};
+  }
+  auto member = Concat(arena, {
+      "\"flushed\":{\"conntrackEntries\":", std::to_string(report->conntrack_entries),
+      ",\"sockets\":", std::to_string(report->sockets),
+      ",\"elapsedUs\":", std::to_string(report->elapsed.count()), "}"});
+  return CopyToArena(arena, member);
+}
+
+/**
+ * @brief The `parameters` member of a request, a null value if it has none.
+ */
+static const JsonValue &GetParameters(const JsonValue &request) {
+  static const JsonValue kNoParameters;
+  auto parameters = request.Find("parameters");
+  return parameters != nullptr ? *parameters : kNoParameters;
+}
+
+/**
+ * @brief Read the optional `tunnelFailurePolicy` parameter of routing commands.
+ */
+static OutlineProxyController::DataPlaneLossPolicy GetDataPlaneLossPolicy(
+    const JsonValue &parameters) {
+  return parameters.GetString(kTunnelFailurePolicyParameter, {}) == kBlockTrafficPolicy
+      ? OutlineProxyController::BLOCK_TRAFFIC_ON_LOSS
+      : OutlineProxyController::ROUTE_DIRECTLY_ON_LOSS;
+}
+
+/**
+ * @brief Read the optional `timeoutMs` parameter of routing commands, zero for
+ *        the default of the controller.
+ */
+static std::chrono::milliseconds GetTimeout(const JsonValue &parameters) {
+  auto timeout = parameters.GetNumber(kTimeoutParameter, 0);
+  return std::chrono::milliseconds{timeout > 0 ? static_cast<int64_t>(timeout) : 0};
 }
 
 OutlineClientSession::OutlineClientSession(
   boost::asio::local::stream_protocol::socket &&channel,
-  std::shared_ptr<OutlineProxyController> outline_proxy_controller)
+  std::shared_ptr<OutlineProxyController> outline_proxy_controller,
+  std::shared_ptr<TunnelWatchdog> tunnel_watchdog,
+  std::shared_ptr<TrafficMonitor> traffic_monitor,
+  std::shared_ptr<TunPump> tun_pump)
   : channel_(std::move(channel)),
-    outline_controller_(outline_proxy_controller)
+    outline_controller_(outline_proxy_controller),
+    tunnel_watchdog_(tunnel_watchdog),
+    traffic_monitor_(traffic_monitor),
+    tun_pump_(tun_pump)
 {
   logger.info("client session started");
 }
 
 OutlineClientSession::~OutlineClientSession() {
+  outline_controller_->removeStatusListener(status_listener_id_);
+  if (stats_listener_id_) {
+    traffic_monitor_->RemoveListener(*stats_listener_id_);
+  }
   logger.info("client session terminated");
 }
 
 boost::asio::awaitable<void> OutlineClientSession::Start() {
   using namespace boost::asio;
 
+  status_listener_id_ = outline_controller_->addStatusListener(
+    [weak_self = weak_from_this()](TunnelStatus status) {
+      if (auto self = weak_self.lock()) {
+        std::ostringstream event;
+        event << "{\"statusCode\": " << static_cast<int>(ErrorCode::kOk)
+              << ",\"connectionStatus\": " << static_cast<int>(status)
+              << ",\"action\": \"" << kStatusChangedEvent << "\"}";
+        self->Send(event.str());
+      }
+    });
+
   try {
     std::string client_command, raw_buffer;
-    boost::property_tree::ptree request_obj;
-    std::ostringstream response;
     for (;;) {
+      // the parsed request, the log messages and the response live there, so
+      // handling the JSON of a request does not need the heap
+      std::pmr::monotonic_buffer_resource arena{request_arena_buffer_.data(),
+                                                request_arena_buffer_.size()};
+      JsonValue request{&arena};
+#if defined(OUTLINE_COUNT_ALLOCATIONS)
+      size_t heap_allocations;
+#endif
       do {
         co_await async_read_until(
           channel_, dynamic_buffer(raw_buffer, kChannelBufferSize), "}", use_awaitable);
+#if defined(OUTLINE_COUNT_ALLOCATIONS)
+        heap_allocations = ThreadHeapAllocations();
+#endif
         client_command.append(raw_buffer);
         raw_buffer.clear();
-      } while (client_command.length() < kJsonInputMinLength || !TryParseJson(client_command, request_obj));
+      } while (client_command.length() < kJsonInputMinLength || !ParseJson(client_command, request));
 
-      logger.debug("handling client request \"" + client_command + "\"...");
-      auto result = RunClientCommand(request_obj);
+      logger.debug(Concat(&arena, {"handling client request \"", client_command, "\"..."}));
+      auto result = co_await RunClientCommand(request, &arena);
 
       // TODO: replace the following code with a json library to handle special characters
-      response << "{\"statusCode\": " << result.status
-               << ",\"returnValue\": \"" << result.result << "\""
-               << ",\"action\": \"" << result.action << "\"}";
-      co_await async_write(channel_, buffer(response.str()), use_awaitable);
-      logger.debug("Wrote back \"" + response.str() + "\" to unix socket");
-
+      char status[16];
+      auto status_end = std::to_chars(std::begin(status), std::end(status), result.status).ptr;
+      std::pmr::string response{&arena};
+      response.append("{\"statusCode\": ").append(status, status_end)
+              .append(",\"returnValue\": \"").append(result.result).append("\"")
+              .append(",\"action\": \"").append(result.action).append("\"");
+      if (!result.extra_members.empty()) {
+        response.append(",").append(result.extra_members);
+      }
+      response.append("}");
+      Send(response);
+
+#if defined(OUTLINE_COUNT_ALLOCATIONS)
+      logger.debug(Concat(&arena, {
+          "served \"", result.action, "\" with ",
+          std::to_string(ThreadHeapAllocations() - heap_allocations), " heap allocation(s)"}));
+#endif
       client_command.clear();
-      response.str(std::string{});
     }
   } catch (const std::exception& e) {
     channel_.close();
   }
 }
 
-OutlineClientSession::CommandResult OutlineClientSession::RunClientCommand(const boost::property_tree::ptree &request) {
-  std::string action, outline_server_ip;
+void OutlineClientSession::Send(std::string_view message) {
+  std::string buffer;
+  if (!spare_messages_.empty()) {
+    buffer = std::move(spare_messages_.back());
+    spare_messages_.pop_back();
+  }
+  buffer.assign(message);
+  outgoing_messages_.push_back(std::move(buffer));
+  if (!is_writing_) {
+    is_writing_ = true;
+    co_spawn(channel_.get_executor(),
+             [self = shared_from_this()]() { return self->WriteOutgoingMessages(); },
+             boost::asio::detached);
+  }
+}
 
-  auto action_iter = request.find("action");
-  if (action_iter == request.not_found()) {
+boost::asio::awaitable<void> OutlineClientSession::WriteOutgoingMessages() {
+  using namespace boost::asio;
+
+  try {
+    while (!outgoing_messages_.empty()) {
+      co_await async_write(channel_, buffer(outgoing_messages_.front()), use_awaitable);
+      write_log_line_.assign("Wrote back \"")
+                     .append(outgoing_messages_.front())
+                     .append("\" to unix socket");
+      logger.debug(write_log_line_);
+      if (spare_messages_.size() < kSpareMessages) {
+        spare_messages_.push_back(std::move(outgoing_messages_.front()));
+      }
+      outgoing_messages_.pop_front();
+    }
+  } catch (const std::exception& e) {
+    logger.warn("failed to write to unix socket: " + std::string(e.what()));
+    outgoing_messages_.clear();
+    channel_.close();
+  }
+  is_writing_ = false;
+}
+
+boost::asio::awaitable<OutlineClientSession::CommandResult>
+OutlineClientSession::RunClientCommand(const JsonValue &request,
+                                       std::pmr::memory_resource *arena) {
+  auto action_value = request.Find("action");
+  if (action_value == nullptr || !action_value->AsString()) {
     logger.error("Invalid input JSON - action doesn't exist");
-    return {static_cast<int>(ErrorCode::kUnexpected), "Invalid JSON", {}};
+    co_return CommandResult{static_cast<int>(ErrorCode::kUnexpected), "Invalid JSON", {}};
   }
 
-  action = boost::lexical_cast<std::string>(request.to_iterator(action_iter)->second.data());
-  logger.debug("handling action \"" + action + "\"");
+  auto action = *action_value->AsString();
+  logger.debug(Concat(arena, {"handling action \"", action, "\""}));
 
+  const auto &parameters = GetParameters(request);
   try {
     if (action == kConfigureRoutingAction) {
-      auto parameters_iter = request.find("parameters");
-      if (parameters_iter == request.not_found()) {
+      if (request.Find("parameters") == nullptr) {
         logger.error("Invalid input JSON - parameters doesn't exist");
-        return {static_cast<int>(ErrorCode::kUnexpected), "Invalid JSON", action};
+        co_return CommandResult{static_cast<int>(ErrorCode::kUnexpected), "Invalid JSON", action};
       }
-      const auto parameters = request.to_iterator(parameters_iter)->second;
-      auto proxyIp_iter = parameters.find("proxyIp");
-      if (proxyIp_iter == parameters.not_found()) {
+      auto proxy_ip = parameters.Find("proxyIp");
+      if (proxy_ip == nullptr || !proxy_ip->AsString()) {
         logger.error("Invalid input JSON - parameters doesn't exist");
-        return {static_cast<int>(ErrorCode::kUnexpected), "Invalid JSON", action};
+        co_return CommandResult{static_cast<int>(ErrorCode::kUnexpected), "Invalid JSON", action};
+      }
+      std::string outline_server_ip{*proxy_ip->AsString()};
+      outline_controller_->setDataPlaneLossPolicy(GetDataPlaneLossPolicy(parameters));
+      outline_controller_->setLocalNetworkBypass(
+          parameters.GetBool(kBypassLocalNetworksParameter, false));
+      auto flushed = co_await outline_controller_->routeThroughOutlineAsync(
+          outline_server_ip, parameters.GetBool(kFlushStaleConnectionsParameter, false),
+          GetTimeout(parameters));
+      logger.info(Concat(arena, {"Configure Routing to ", outline_server_ip, " is done."}));
+      co_return CommandResult{static_cast<int>(ErrorCode::kOk), {}, action,
+                              FormatFlushReport(arena, flushed)};
+    } else if (action == kPrepareRoutingAction) {
+      auto proxy_ip = parameters.Find("proxyIp");
+      if (proxy_ip == nullptr || !proxy_ip->AsString()) {
+        logger.error("Invalid input JSON - proxyIp doesn't exist");
+        co_return CommandResult{static_cast<int>(ErrorCode::kUnexpected), "Invalid JSON", action};
+      }
+      std::string outline_server_ip{*proxy_ip->AsString()};
+      co_await outline_controller_->prepareRoutingAsync(outline_server_ip, GetTimeout(parameters));
+      logger.info(Concat(arena, {"Prepare Routing to ", outline_server_ip, " is done."}));
+      co_return CommandResult{static_cast<int>(ErrorCode::kOk), {}, action};
+    } else if (action == kCommitRoutingAction) {
+      outline_controller_->setDataPlaneLossPolicy(GetDataPlaneLossPolicy(parameters));
+      outline_controller_->setLocalNetworkBypass(
+          parameters.GetBool(kBypassLocalNetworksParameter, false));
+      auto flushed = co_await outline_controller_->commitRoutingAsync(
+          parameters.GetBool(kFlushStaleConnectionsParameter, false), GetTimeout(parameters));
+      logger.info("Commit Routing is done.");
+      co_return CommandResult{static_cast<int>(ErrorCode::kOk), {}, action,
+                              FormatFlushReport(arena, flushed)};
+    } else if (action == kAbortRoutingAction) {
+      co_await outline_controller_->abortRoutingAsync(GetTimeout(parameters));
+      logger.info("Abort Routing is done.");
+      co_return CommandResult{static_cast<int>(ErrorCode::kOk), {}, action};
+    } else if (action == kHoldRoutingAction) {
+      co_await outline_controller_->holdRoutingAsync(GetTimeout(parameters));
+      logger.info("Hold Routing is done.");
+      co_return CommandResult{static_cast<int>(ErrorCode::kOk), {}, action};
+    } else if (action == kSetBypassCgroupsAction) {
+      std::vector<std::string> cgroups;
+      auto cgroups_value = parameters.Find("cgroups");
+      for (const auto &cgroup : cgroups_value ? cgroups_value->elements()
+                                              : std::span<const JsonValue>{}) {
+        cgroups.emplace_back(cgroup.AsString().value_or(""));
+      }
+      auto cgroup_count = cgroups.size();
+      co_await outline_controller_->setBypassCgroupsAsync(std::move(cgroups),
+                                                          GetTimeout(parameters));
+      logger.info(Concat(arena, {"Set ", std::to_string(cgroup_count), " bypassed cgroups done"}));
+      co_return CommandResult{static_cast<int>(ErrorCode::kOk), {}, action};
+    } else if (action == kClassifyDestinationsAction) {
+      std::vector<std::string> destinations;
+      auto destinations_value = parameters.Find("destinations");
+      for (const auto &destination : destinations_value ? destinations_value->elements()
+                                                        : std::span<const JsonValue>{}) {
+        destinations.emplace_back(destination.AsString().value_or(""));
+      }
+      auto destination_count = destinations.size();
+      auto classified = co_await outline_controller_->classifyDestinationsAsync(
+          std::move(destinations), GetTimeout(parameters));
+      std::pmr::string paths{arena};
+      for (const auto &path : classified) {
+        paths.append(paths.empty() ? "" : ",").append(path);
+      }
+      logger.debug(Concat(arena, {"Classify ", std::to_string(destination_count),
+                                  " destinations done"}));
+      co_return CommandResult{static_cast<int>(ErrorCode::kOk), CopyToArena(arena, paths), action};
+    } else if (action == kGetTrafficStatsAction) {
+      auto subscribe = parameters.Find("subscribe");
+      if (subscribe != nullptr && subscribe->AsBool().value_or(false) && !stats_listener_id_) {
+        stats_listener_id_ = traffic_monitor_->AddListener(
+          [weak_self = weak_from_this()](const std::string &stats) {
+            if (auto self = weak_self.lock()) {
+              self->Send("{\"statusCode\": " + std::to_string(static_cast<int>(ErrorCode::kOk)) +
+                         ",\"action\": \"" + kTrafficStatsEvent + "\"," + stats + "}");
+            }
+          });
+      } else if (subscribe != nullptr && !subscribe->AsBool().value_or(true) &&
+                 stats_listener_id_) {
+        traffic_monitor_->RemoveListener(*stats_listener_id_);
+        stats_listener_id_.reset();
+      }
+      co_return CommandResult{static_cast<int>(ErrorCode::kOk), {}, action,
+                              CopyToArena(arena, traffic_monitor_->FormatStats())};
+    } else if (action == kGetDataPlaneStatsAction) {
+      if (!tun_pump_) {
+        co_return CommandResult{static_cast<int>(ErrorCode::kUnexpected),
+                                "No native data plane", action};
       }
-      outline_server_ip =
-          boost::lexical_cast<std::string>(request.to_iterator(proxyIp_iter)->second.data());
-      outline_controller_->routeThroughOutline(outline_server_ip);
-      logger.info("Configure Routing to " + outline_server_ip + " is done.");
-      return {static_cast<int>(ErrorCode::kOk), {}, action};
+      co_return CommandResult{static_cast<int>(ErrorCode::kOk), {}, action,
+                              CopyToArena(arena, tun_pump_->FormatStats())};
+    } else if (action == kGetTopFlowsAction) {
+#if defined(OUTLINE_NATIVE_DATA_PLANE)
+      if (!tun_pump_) {
+        co_return CommandResult{static_cast<int>(ErrorCode::kUnexpected),
+                                "No native data plane", action};
+      }
+      auto limit = std::clamp(parameters.GetNumber("limit", 10), 1.0, 1000.0);
+      auto order = parameters.GetString("orderBy", "bytes") == "packets" ? FlowOrder::kPackets
+                                                                        : FlowOrder::kBytes;
+      auto group_by = parameters.GetString("groupBy", "flow");
+      auto grouping = group_by == "destination" ? FlowGrouping::kDestination
+                      : group_by == "service"   ? FlowGrouping::kService
+                                                : FlowGrouping::kFlow;
+      co_return CommandResult{
+          static_cast<int>(ErrorCode::kOk), {}, action,
+          CopyToArena(arena, tun_pump_->Flows().FormatTopFlows(static_cast<size_t>(limit), order,
+                                                               grouping))};
+#else
+      co_return CommandResult{static_cast<int>(ErrorCode::kUnexpected), "No native data plane",
+                              action};
+#endif
     } else if (action == kResetRoutingAction) {
-      outline_controller_->routeDirectly();
+      auto flushed = co_await outline_controller_->routeDirectlyAsync(
+          parameters.GetBool(kFlushStaleConnectionsParameter, false), GetTimeout(parameters));
       logger.info("Reset Routing done");
-      return {static_cast<int>(ErrorCode::kOk), {}, action};
+      co_return CommandResult{static_cast<int>(ErrorCode::kOk), {}, action,
+                              FormatFlushReport(arena, flushed)};
     } else if (action == kGetDeviceNameAction) {
       logger.info("Get device name done");
-      return {static_cast<int>(ErrorCode::kOk), outline_controller_->getTunDeviceName(), action};
+      co_return CommandResult{static_cast<int>(ErrorCode::kOk),
+                              CopyToArena(arena, outline_controller_->getTunDeviceName()),
+                              action};
+    } else if (action == kRegisterTunnelProcessAction) {
+      auto pid = parameters.Find("pid");
+      if (pid == nullptr || !pid->AsNumber()) {
+        logger.error("Invalid input JSON - pid doesn't exist");
+        co_return CommandResult{static_cast<int>(ErrorCode::kUnexpected), "Invalid JSON", action};
+      }
+      auto tunnel_pid = static_cast<pid_t>(*pid->AsNumber());
+      tunnel_watchdog_->WatchTunnelProcess(tunnel_pid);
+      logger.info(Concat(arena, {"Register tunnel process ", std::to_string(tunnel_pid),
+                                 " done"}));
+      co_return CommandResult{static_cast<int>(ErrorCode::kOk), {}, action};
     } else {
-      logger.error("Invalid action specified in JSON (" + action + ")");
-      return {static_cast<int>(ErrorCode::kUnexpected), "Undefined Action", {}};
+      logger.error(Concat(arena, {"Invalid action specified in JSON (", action, ")"}));
+      co_return CommandResult{static_cast<int>(ErrorCode::kUnexpected), "Undefined Action", {}};
     }
   } catch (const std::system_error& err) {
     logger.error("[" + err.code().message() + "] " + err.what());
     if (err.code().category() == OutlineErrorCategory()) {
       // TODO: add err.what() to give more details to the client
-      return {err.code().value(), {}, action};
+      co_return CommandResult{err.code().value(), {}, action};
     }
-    return {static_cast<int>(ErrorCode::kUnexpected), {}, action};
+    co_return CommandResult{static_cast<int>(ErrorCode::kUnexpected), {}, action};
   }
 }
 
@@ -187,11 +481,24 @@ static void SetOutlineUnixSocketGroupAndOwner(const char* const socket_name,
   ::chmod(socket_name, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 }
 
-OutlineControllerServer::OutlineControllerServer(const std::string& file, uid_t owning_user)
-  : outline_controller_{std::make_shared<OutlineProxyController>()},
+OutlineControllerServer::OutlineControllerServer(const std::string& file, uid_t owning_user,
+                                                 const ProxyControllerOptions& options)
+  : outline_controller_{std::make_shared<OutlineProxyController>(options)},
+    tunnel_watchdog_{},
+    network_monitor_{},
+    traffic_monitor_{},
+    tun_pump_{},
+    traffic_stats_interval_{options.trafficStatsInterval},
     unix_socket_name_{file},
     socket_owner_id_{owning_user}
-{}
+{
+  // started here rather than in Start(), so that a failure stops the daemon
+  if (!options.dataPlaneUpstream.empty()) {
+    tun_pump_ = std::make_shared<TunPump>(outline_controller_->getTunDeviceName(),
+                                          options.dataPlaneUpstream);
+    tun_pump_->Start();
+  }
+}
 
 boost::asio::awaitable<void> OutlineControllerServer::Start() {
   using namespace boost::asio;
@@ -203,10 +510,21 @@ boost::asio::awaitable<void> OutlineControllerServer::Start() {
   stream_protocol::acceptor acceptor{executor, {unix_socket_name_}};
   SetOutlineUnixSocketGroupAndOwner(unix_socket_name_.c_str(), kOutlineGroupName, socket_owner_id_);
 
+  tunnel_watchdog_ = std::make_shared<TunnelWatchdog>(executor, outline_controller_);
+  co_spawn(executor, [watchdog = tunnel_watchdog_]() { return watchdog->Start(); }, detached);
+
+  network_monitor_ = std::make_shared<NetworkMonitor>(executor, outline_controller_);
+  co_spawn(executor, [monitor = network_monitor_]() { return monitor->Start(); }, detached);
+
+  traffic_monitor_ = std::make_shared<TrafficMonitor>(
+      executor, outline_controller_, traffic_stats_interval_);
+  co_spawn(executor, [monitor = traffic_monitor_]() { return monitor->Start(); }, detached);
+
   for (;;) {
     stream_protocol::socket socket{executor};
     if (auto [err] = co_await acceptor.async_accept(socket, as_tuple(use_awaitable)); !err) {
-      auto client_session = std::make_shared<OutlineClientSession>(std::move(socket), outline_controller_);
+      auto client_session = std::make_shared<OutlineClientSession>(
+          std::move(socket), outline_controller_, tunnel_watchdog_, traffic_monitor_, tun_pump_);
 
       // The following lambda capturing client_session is necessary, otherwise client_session
       // will be deleted as soon as our local variable is out of scope (keep in mind that co_spawn
@@ -12,16 +12,28 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <deque>
 #include <memory>
+#include <memory_resource>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include <sys/types.h>
 
 #include <boost/asio/awaitable.hpp>
 #include <boost/asio/local/stream_protocol.hpp>
-#include <boost/property_tree/ptree.hpp>
 
+#include "json_value.h"
+#include "network_monitor.h"
 #include "outline_proxy_controller.h"
+#include "traffic_monitor.h"
+#include "tun_pump.h"
+#include "tunnel_watchdog.h"
 
 #if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
 
@@ -39,9 +51,15 @@ public:
    * 
    * @param channel A socket that the session will be reading from and writing to.
    * @param outline_proxy_controller A worker which can be used to configure the system.
+   * @param tunnel_watchdog The watchdog which the client registers its tunnel process to.
+   * @param traffic_monitor The source of the traffic statistics.
+   * @param tun_pump The native data plane, null when tun2socks moves the packets.
    */
   OutlineClientSession(boost::asio::local::stream_protocol::socket &&channel,
-                       std::shared_ptr<OutlineProxyController> outline_proxy_controller);
+                       std::shared_ptr<OutlineProxyController> outline_proxy_controller,
+                       std::shared_ptr<TunnelWatchdog> tunnel_watchdog,
+                       std::shared_ptr<TrafficMonitor> traffic_monitor,
+                       std::shared_ptr<TunPump> tun_pump);
 
   ~OutlineClientSession();
 
@@ -55,25 +73,51 @@ public:
 
 private:
   /**
-   * @brief Execution result of a client request command.
+   * @brief Execution result of a client request command. The strings are
+   *        constants, or live in the arena of the request.
    */
   struct CommandResult {
     int status;
-    std::string result;
-    std::string action;
+    std::string_view result;
+    std::string_view action;
+    // more JSON members of the response, e.g. `"tun":{...}`
+    std::string_view extra_members = {};
   };
 
   /**
    * @brief interprets the request from the client app and act upon them.
    *
    * @param request The Json object sent by Outline client.
-   * @return CommandResult The result of the command execution.
+   * @param arena The memory of the request, released once it is answered.
+   * @return boost::asio::awaitable<CommandResult> The result of the command
+   *         execution, routing commands are awaited on the controller.
    */
-  CommandResult RunClientCommand(const boost::property_tree::ptree &request);
+  boost::asio::awaitable<CommandResult> RunClientCommand(const JsonValue &request,
+                                                         std::pmr::memory_resource *arena);
+
+  /**
+   * @brief Queue `message` to be written to the client. Messages are written in
+   *        order, so responses and events never interleave.
+   */
+  void Send(std::string_view message);
+
+  boost::asio::awaitable<void> WriteOutgoingMessages();
 
 private:
   boost::asio::local::stream_protocol::socket channel_;
   std::shared_ptr<OutlineProxyController> outline_controller_;
+  std::shared_ptr<TunnelWatchdog> tunnel_watchdog_;
+  std::shared_ptr<TrafficMonitor> traffic_monitor_;
+  std::shared_ptr<TunPump> tun_pump_;
+  std::deque<std::string> outgoing_messages_;
+  // written messages, whose buffers are reused by the next ones
+  std::vector<std::string> spare_messages_;
+  std::string write_log_line_;
+  // the arena of the request being served, larger requests spill to the heap
+  std::array<std::byte, 16 * 1024> request_arena_buffer_;
+  bool is_writing_ = false;
+  int status_listener_id_ = -1;
+  std::optional<int> stats_listener_id_;
 };
 
 /**
@@ -90,8 +134,10 @@ public:
    * @param unix_socket The Unix socket name that we will be listening.
    * @param owning_user The owner uid of the Unix socket (typically it is the
    *                    user who installs Outline).
+   * @param options The settings of the underlying `OutlineProxyController`.
    */
-  OutlineControllerServer(const std::string& unix_socket, uid_t owning_user);
+  OutlineControllerServer(const std::string& unix_socket, uid_t owning_user,
+                          const ProxyControllerOptions& options);
 
 public:
   /**
@@ -103,6 +149,13 @@ public:
 
 private:
   std::shared_ptr<OutlineProxyController> outline_controller_;
+  std::shared_ptr<TunnelWatchdog> tunnel_watchdog_;
+  std::shared_ptr<NetworkMonitor> network_monitor_;
+  std::shared_ptr<TrafficMonitor> traffic_monitor_;
+  // declared after the controller, so it detaches from the tun device before
+  // the controller deletes it
+  std::shared_ptr<TunPump> tun_pump_;
+  std::chrono::milliseconds traffic_stats_interval_;
   std::string unix_socket_name_;
   uid_t socket_owner_id_;
 };
@@ -12,30 +12,41 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <ctime>
 #include <iostream>
+#include <stdexcept>
 
 #include <boost/asio.hpp>
-#include <boost/filesystem.hpp>
+#if !defined(OUTLINE_LEAN_BUILD)
 #include <boost/program_options.hpp>
+#endif
 
 #include <syslog.h>
 #include <unistd.h>
 
+#if defined(OUTLINE_LEAN_BUILD)
+#include "command_line.h"
+#endif
 #include "logger.h"
 #include "outline_controller_server.h"
 
 using namespace outline;
 using namespace std;
+#if defined(OUTLINE_LEAN_BUILD)
+namespace po = outline::command_line;
+#else
 namespace po = boost::program_options;
-namespace fs = boost::filesystem;
+#endif
 
 class ControllerConfig {
  public:
   string socketFilename;
   string loggerFilename;
   uid_t owningUid;
+  ProxyControllerOptions controllerOptions;
 
   bool daemonized = false;
   bool onlyShowHelp = false;
@@ -54,7 +65,30 @@ class ControllerConfig {
        "unix socket filename where controller listen on for commands")
       ("owning-user-id,u", po::value<uid_t>()->default_value(-1),
        "id of the user who owns socket-filename")
-      ("log-filename,l", po::value<string>(), "the filename to store the loggers output");
+      ("log-filename,l", po::value<string>(), "the filename to store the loggers output")
+      ("network-cache-filename,n",
+       po::value<string>()->default_value("/var/lib/outline_proxy_controller/network_profiles"),
+       "the filename to remember known networks in, empty to disable persistence")
+      ("tun-txqueuelen", po::value<uint32_t>()->default_value(0),
+       "transmit queue length of the tun device, 0 to keep the kernel default")
+      ("tun-qdisc", po::value<string>()->default_value(""),
+       "root qdisc of the tun device: fq_codel or cake, empty (the default) keeps the kernel default")
+      ("tun-egress-rate", po::value<uint64_t>()->default_value(0),
+       "shape the traffic into the tunnel to this many kbit/s (needs cake), 0 to disable")
+      ("tun-rps-cpus", po::value<string>()->default_value(""),
+       "CPUs processing the packets received on the tun queues, e.g. 0-3, empty to keep the kernel default")
+      ("tun-xps-cpus", po::value<string>()->default_value(""),
+       "CPUs sending on the tun queues, e.g. 0-3, empty to keep the kernel default")
+      ("tun-align-queues",
+       "create a multi-queue tun device and steer its queue N to the N-th CPU only "
+       "(needs --data-plane-upstream)")
+      ("routing-timeout", po::value<unsigned>()->default_value(10000),
+       "how long configuring or resetting the routing may take, in milliseconds")
+      ("stats-interval", po::value<unsigned>()->default_value(1000),
+       "how often the traffic counters are sampled, in milliseconds (at least 100)")
+      ("data-plane-upstream", po::value<string>()->default_value(""),
+       "forward the packets of the tun device to this UDP address:port, one per datagram, "
+       "instead of leaving them to tun2socks (needs a build with OUTLINE_NATIVE_DATA_PLANE)");
 
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -71,10 +105,10 @@ class ControllerConfig {
       throw std::runtime_error("missing socket-filename argument is mandatory");
     }
 
-    socketFilename = fs::path(vm["socket-filename"].as<string>()).string();
+    socketFilename = vm["socket-filename"].as<string>();
 
     if (vm.count("log-filename")) {
-      loggerFilename = fs::path(vm["log-filename"].as<string>()).string();
+      loggerFilename = vm["log-filename"].as<string>();
       logger.config(true, true, loggerFilename);  // Log to the log file in addition to stderr
     }
 
@@ -83,6 +117,34 @@ class ControllerConfig {
     }
 
     owningUid = vm["owning-user-id"].as<uid_t>();
+
+    controllerOptions.networkProfileCacheFilename = vm["network-cache-filename"].as<string>();
+
+    auto& queueing = controllerOptions.tunQueueingProfile;
+    queueing.transmit_queue_length = vm["tun-txqueuelen"].as<uint32_t>();
+    queueing.qdisc = vm["tun-qdisc"].as<string>();
+    queueing.egress_rate = vm["tun-egress-rate"].as<uint64_t>() * 1000;
+    ValidateQueueingProfile(queueing);
+
+    auto& steering = controllerOptions.tunCpuSteering;
+    if (!vm["tun-rps-cpus"].as<string>().empty()) {
+      steering.receive_cpus = ParseCpuList(vm["tun-rps-cpus"].as<string>());
+    }
+    if (!vm["tun-xps-cpus"].as<string>().empty()) {
+      steering.transmit_cpus = ParseCpuList(vm["tun-xps-cpus"].as<string>());
+    }
+    steering.align_queues = vm.count("tun-align-queues") > 0;
+
+    controllerOptions.routingTimeout =
+        std::chrono::milliseconds{std::max(vm["routing-timeout"].as<unsigned>(), 1u)};
+    controllerOptions.trafficStatsInterval =
+        std::chrono::milliseconds{std::max(vm["stats-interval"].as<unsigned>(), 100u)};
+    controllerOptions.dataPlaneUpstream = vm["data-plane-upstream"].as<string>();
+    if (steering.align_queues && controllerOptions.dataPlaneUpstream.empty()) {
+      // tun2socks opens the device without IFF_MULTI_QUEUE, which fails on a
+      // multi-queue device
+      throw invalid_argument("--tun-align-queues needs the native data plane (--data-plane-upstream)");
+    }
   }
 };
 
@@ -96,7 +158,8 @@ int main(int argc, char* argv[]) {
 
       // Initialise the server. No need to make_shared because io_context.run() will
       // block until all asynchronous operations ended.
-      OutlineControllerServer server{config.socketFilename, config.owningUid};
+      OutlineControllerServer server{config.socketFilename, config.owningUid,
+                                     config.controllerOptions};
       boost::asio::co_spawn(io_context, server.Start(), boost::asio::detached);
 
       io_context.run();
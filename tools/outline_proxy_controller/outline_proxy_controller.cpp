@@ -14,7 +14,10 @@
 
 #include <algorithm>
 #include <array>
+#include <cctype>
+#include <chrono>
 #include <cstdio>
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <map>
@@ -25,16 +28,36 @@
 #include <system_error>
 #include <tuple>
 
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include "flow_flusher.h"
+#include "local_network_bypass.h"
 #include "logger.h"
 #include "outline_error.h"
 #include "outline_proxy_controller.h"
+#include "path_mtu_probe.h"
 
 using namespace std;
 using namespace outline;
 
+// How long a child process (ip, sysctl, nft) may run, unless the deadline
+// of the current operation is closer
+static const std::chrono::seconds kCommandTimeout{10};
+
+// How often we look for a cancellation while a child process runs
+static const std::chrono::milliseconds kCommandPollInterval{50};
+
 /**
  * @brief
  * Create a new child process of `cmd` with arguments `args`, and return its
@@ -52,10 +75,20 @@ static tuple<pid_t, FILE*> safe_popen(const string &filename,
                                       const CommandArguments &args) {
   // pipefd[0] is read-only; pipefd[1] is write-only
   int pipefd[2];
-  if (pipe(pipefd) == -1) {
+  // routing stages fork concurrently, a child must not inherit (and keep
+  // open) the pipe of another command
+  if (pipe2(pipefd, O_CLOEXEC) == -1) {
     throw runtime_error("failed to create pipe for " + filename + " command");
   }
 
+  // argv must start with the command itself, and end with NULL. It is built
+  // before forking, the child of a multi-threaded process must not allocate
+  vector<const char*> subProcArgv{ filename.c_str() };
+  transform(cbegin(args), cend(args),
+            back_inserter(subProcArgv),
+            [](const auto &e) { return e.c_str(); });
+  subProcArgv.push_back(nullptr);
+
   pid_t pid;
   switch (pid = fork()) {
   case -1:
@@ -69,13 +102,8 @@ static tuple<pid_t, FILE*> safe_popen(const string &filename,
     dup2(pipefd[1], STDOUT_FILENO);
     dup2(pipefd[1], STDERR_FILENO);
     close(pipefd[1]);
-
-    // argv must start with the command itself, and end with NULL
-    vector<const char*> subProcArgv{ filename.c_str() };
-    transform(cbegin(args), cend(args),
-              back_inserter(subProcArgv),
-              [](const auto &e) { return e.c_str(); });
-    subProcArgv.push_back(nullptr);
+    // its own process group, so a timeout kills whatever it has spawned too
+    setpgid(0, 0);
 
     // const_cast might mess up on the std::string memory,
     // but it's ok cuz the entire memory space will be replaced soon
@@ -83,6 +111,8 @@ static tuple<pid_t, FILE*> safe_popen(const string &filename,
     _exit(EXIT_FAILURE);
   }
 
+  // the child's process group is set from both sides, whichever runs first
+  setpgid(pid, pid);
   close(pipefd[1]);
   FILE* redirectedStdout = fdopen(pipefd[0], "r");
   if (!redirectedStdout) {
@@ -159,18 +189,95 @@ OutputAndStatus OutlineProxyController::executeCommand(const std::string command
 
   auto [pid, pipe] = safe_popen(commandName.c_str(), received_args);
 
+  // a hung child must not block the controller: it gets kCommandTimeout, or
+  // whatever is left of the current operation, to finish its output
+  auto commandDeadline = chrono::steady_clock::now() + kCommandTimeout;
   array<char, 128> buffer;
   string result;
-  while (!feof(pipe)) {
-    if (fgets(buffer.data(), 128, pipe) != nullptr) result += buffer.data();
+  for (;;) {
+    bool cancelled = currentOperation && currentOperation->cancelled();
+    if (cancelled || chrono::steady_clock::now() >= commandDeadline ||
+        (currentOperation && currentOperation->expired())) {
+      kill(-pid, SIGKILL);
+      safe_pclose(pid, pipe);
+      throw runtime_error("killed " + commandName +
+                          (subCommandName.empty() ? "" : " " + subCommandName) +
+                          (cancelled ? ", the operation is cancelled" : ", it took too long"));
+    }
+
+    // wake up regularly to notice a cancellation
+    pollfd output{fileno(pipe), POLLIN, 0};
+    auto ready = poll(&output, 1, static_cast<int>(kCommandPollInterval.count()));
+    if (ready <= 0) {
+      continue;
+    }
+    auto length = read(output.fd, buffer.data(), buffer.size());
+    if (length < 0 && errno == EINTR) {
+      continue;
+    }
+    if (length <= 0) {
+      break;
+    }
+    result.append(buffer.data(), static_cast<size_t>(length));
   }
 
   return { result, safe_pclose(pid, pipe) };
 }
 
-OutlineProxyController::OutlineProxyController() {
+// Number of networks remembered by the network profile cache
+static const size_t kNetworkProfileCacheCapacity = 16;
+
+// The first line of the DNS configuration we write
+static const std::string kOutlineResolvConfHeader = "# Generated by outline \n";
+
+// What the tunnel adds to a UDP packet: the IPv4 and UDP headers of the packet
+// are replaced by the ones to the server, followed by the shadowsocks salt
+// (up to 32 bytes), the target address (7 bytes for IPv4) and the AEAD tag
+static const uint32_t kTunnelOverhead = 32 + 7 + 16;
+
+// How long to wait for the reply to each path MTU probe
+static const std::chrono::milliseconds kPathMtuProbeTimeout{250};
+
+// The nftables table clamping the MSS on the tun device
+static const std::string kMssClampNftTable = "inet outline_mss";
+
+// Firewall mark of the packets sent by the bypassed cgroups ("OL")
+static const uint32_t kBypassFirewallMark = 0x4f4c;
+
+// Routing table with the default routes used by the bypassed cgroups
+static const uint32_t kBypassRoutingTable = 0x4f4c;
+
+// Priority of the first policy rule of the bypass, the second one follows it
+static const uint32_t kBypassRulePriority = 0x4f4c;
+
+// The nftables table owned by the controller
+static const std::string kBypassNftTable = "inet outline_bypass";
+
+/**
+ * @brief Check a cgroup path relative to the cgroup2 mount, it ends up quoted
+ *        in an nft command so only the characters systemd uses are allowed.
+ */
+static bool IsValidCgroupPath(const std::string& path) {
+  if (path.empty() || path.front() == '/' || path.back() == '/') {
+    return false;
+  }
+  for (auto c : path) {
+    if (!isalnum(static_cast<unsigned char>(c)) && string{"/._-@:+\\"}.find(c) == string::npos) {
+      return false;
+    }
+  }
+  return ("/" + path + "/").find("/../") == string::npos;
+}
+
+OutlineProxyController::OutlineProxyController(const ProxyControllerOptions& options)
+    : tunQueueingProfile(options.tunQueueingProfile),
+      tunCpuSteering(tunInterfaceName, options.tunCpuSteering),
+      networkProfileCache(options.networkProfileCacheFilename, kNetworkProfileCacheCapacity),
+      routingTimeout(options.routingTimeout) {
   addOutlineTunDev();
   setTunDeviceIP();
+  applyTunQueueingProfile();
+  applyTunCpuSteering();
 
   // we try to detect the best interface as early as possible before
   // outline mess up with the routing table. But if we fail, we try
@@ -181,15 +288,18 @@ OutlineProxyController::OutlineProxyController() {
     logger.warn(e.what());
     logger.warn("we could not detect the best interface, will try again at connect");
   }
+  publishUplinkName();
 }
 
 void OutlineProxyController::addOutlineTunDev() {
   if (!outlineTunDeviceExsits()) {
     // first we check if it exists and not try to add it
-    auto tunDeviceAdditionResult = executeIPTunTap({
-      "add", "dev", tunInterfaceName,
-      "mode", "tun"
-    });
+    CommandArguments tunDeviceArguments{"add", "dev", tunInterfaceName, "mode", "tun"};
+    if (tunCpuSteering.profile().align_queues) {
+      // the reader opens one queue per thread
+      tunDeviceArguments.push_back("multi_queue");
+    }
+    auto tunDeviceAdditionResult = executeIPTunTap(tunDeviceArguments);
 
     if (!outlineTunDeviceExsits()) {
       logger.error(tunDeviceAdditionResult.first);
@@ -254,6 +364,32 @@ void OutlineProxyController::setTunDeviceIP() {
   logger.info("successfully added outline gateway routing entry");
 }
 
+void OutlineProxyController::applyTunQueueingProfile() {
+  try {
+    ApplyQueueingProfile(routingSocket, static_cast<int>(if_nametoindex(tunInterfaceName.c_str())),
+                         tunQueueingProfile);
+  } catch (exception& e) {
+    // the tunnel still works, only with more latency under load
+    logger.warn("failed to set up the queueing of " + tunInterfaceName + ": " + e.what());
+    return;
+  }
+  logger.info("queueing of " + tunInterfaceName + " is set up");
+}
+
+void OutlineProxyController::applyTunCpuSteering() {
+  size_t queues;
+  try {
+    queues = tunCpuSteering.Apply();
+  } catch (exception& e) {
+    // the packets are still processed, only on fewer CPUs
+    logger.warn("failed to steer the queues of " + tunInterfaceName + ": " + e.what());
+    return;
+  }
+  if (queues > 0) {
+    logger.info(to_string(queues) + " queue(s) of " + tunInterfaceName + " steered");
+  }
+}
+
 void OutlineProxyController::detectBestInterfaceIndex() {
   // our best guest is the route that outline server already can be reached
   // it is the default gateway if outline is connected or not
@@ -276,7 +412,9 @@ void OutlineProxyController::detectBestInterfaceIndex() {
   }
 }
 
-void OutlineProxyController::routeThroughOutline(std::string outlineServerIP) {
+std::optional<FlowFlushReport> OutlineProxyController::routeThroughOutline(
+    std::string outlineServerIP, bool flushStaleFlows) {
+  std::lock_guard<std::recursive_mutex> lock{operationMutex};
   // Sanity checks
   if (outlineServerIP.empty()) {
     throw std::system_error{
@@ -284,71 +422,695 @@ void OutlineProxyController::routeThroughOutline(std::string outlineServerIP) {
       "Outline Server IP address cannot be empty"};
   }
 
+  if (resumeHeldRouting(outlineServerIP)) {
+    return std::nullopt;
+  }
+
   logger.info("attempting to route through outline server " + outlineServerIP);
 
   // TODO: make sure the routing rule isn't already in the table
   if (routingStatus == ROUTING_THROUGH_OUTLINE) {
     logger.warn("it seems that we are already routing through outline server");
   }
+  if (preparedRouting) {
+    logger.warn("discarding the prepared routing in favor of a full configuration");
+    abortRouting();
+  }
 
+  checkpoint("backing up the DNS setting");
   this->outlineServerIP = outlineServerIP;
+  dataPlaneLost = false;
+
+  std::vector<RouteEntry> defaultRoutes;
+  if (connectPlan && connectPlan->serverIP == outlineServerIP) {
+    backupDNSSetting();
+    defaultRoutes = connectPlan->defaultRoutes;
+    StageGraph connect;
+    bool outdated = false;
+    // the rollback puts back the default routes of the plan as they were
+    addProtectionStages(connect, {routeThroughConnectPlan(connect, outdated)});
+    try {
+      runConnectStages(connect, OUTLINE_PRIORITY_SET_UP);
+      return finishRoutingThroughOutline(defaultRoutes, flushStaleFlows);
+    } catch (std::system_error&) {
+      if (!outdated) {
+        throw;
+      }
+    }
+    // everything has been rolled back, start over detecting the network
+    connectPlan.reset();
+    defaultRoutes.clear();
+  }
 
-  backupDNSSetting();
+  StageGraph connect;
+
+  auto knownNetwork = findCurrentNetworkProfile();
+  backupDNSSettingOnNetwork(knownNetwork);
+  std::optional<StageGraph::StageId> profileRoutes;
+  if (knownNetwork != nullptr) {
+    profileRoutes = routeThroughNetworkProfile(*knownNetwork, connect);
+  }
+  if (profileRoutes) {
+    defaultRoutes = knownNetwork->default_routes;
+    // the rollback puts back the default routes of the profile as they were
+    addProtectionStages(connect, {*profileRoutes});
+    runConnectStages(connect, OUTLINE_PRIORITY_SET_UP);
+  } else {
+    auto serverRoute = connect.Add("adding the route to the outline server",
+                                   [this] { createRouteforOutlineServer(); },
+                                   [this] { deleteOutlineServerRouting(); });
+    auto snapshot = connect.Add("querying the default routes", [this, &defaultRoutes] {
+      try {
+        defaultRoutes = DumpDefaultRoutes(routingSocket);
+      } catch (exception& e) {
+        // we only lose the chance of caching this network
+        logger.warn("failed to query the default routes: " + string(e.what()));
+      }
+    });
+    // the traffic to the outline server must keep its way to the gateway,
+    // and the default route is dropped before adding another one
+    auto gatewayRoute = connect.Add("deleting the default routes",
+                                    [this] { deleteAllDefaultRoutes(); },
+                                    [this] { createDefaultRouteThroughGateway(); },
+                                    {serverRoute, snapshot});
+    auto tunRoute = connect.Add("routing the traffic through the tun device",
+                                [this] { createDefaultRouteThroughTun(); },
+                                [this] { deleteAllDefaultRoutes(); },
+                                {gatewayRoute});
+    addProtectionStages(connect, {tunRoute});
+    runConnectStages(connect, OUTLINE_PRIORITY_SET_UP);
+
+    cacheCurrentNetworkProfile(defaultRoutes);
+  }
 
-  // TODO: add more details when throwing system_error (e.g., use different error
-  // codes, or append detail messages)
+  return finishRoutingThroughOutline(defaultRoutes, flushStaleFlows);
+}
+
+void OutlineProxyController::prepareRouting(std::string outlineServerIP) {
+  std::lock_guard<std::recursive_mutex> lock{operationMutex};
+  if (outlineServerIP.empty()) {
+    throw std::system_error{
+      ErrorCode::kInvalidServerConfiguration,
+      "Outline Server IP address cannot be empty"};
+  }
+  if (preparedRouting) {
+    abortRouting();
+  }
+  if (routingHeld) {
+    // the routes are in place already
+    PreparedRouting prepared;
+    prepared.heldServerIP = outlineServerIP;
+    preparedRouting = std::move(prepared);
+    logger.info("routing is held, nothing to prepare for outline server " + outlineServerIP);
+    return;
+  }
+  if (routingStatus == ROUTING_THROUGH_OUTLINE) {
+    throw std::system_error{
+      ErrorCode::kConfigureSystemProxyFailure,
+      "cannot prepare routing while already routing through outline"};
+  }
+
+  logger.info("preparing to route through outline server " + outlineServerIP);
+  this->outlineServerIP = outlineServerIP;
+
+  PreparedRouting prepared;
   try {
-    createRouteforOutlineServer();
+    auto knownNetwork = findCurrentNetworkProfile();
+    if (knownNetwork != nullptr) {
+      routingGatewayIP = knownNetwork->fingerprint.gateway_ip;
+      clientToServerRoutingInterface = knownNetwork->interface_name;
+      clientLocalIP = knownNetwork->local_ip;
+    } else {
+      detectBestInterfaceIndex();
+    }
+    backupDNSSettingOnNetwork(knownNetwork);
+
+    prepared.defaultRoutes = DumpDefaultRoutes(routingSocket);
+    for (const auto& route : prepared.defaultRoutes) {
+      prepared.commitBatch.Delete(route);
+    }
+    prepared.commitBatch.Add(tunDefaultRoute());
+
+    // the priority route to the outline server goes through the same gateway
+    // as the current default route, so it does not change any traffic yet
+    checkpoint("adding the route to the outline server");
+    RouteBatch serverRoute;
+    serverRoute.Add(outlineServerRoute());
+    serverRoute.Commit(routingSocket);
   } catch (exception& e) {
-    // we can not continue
-    logger.error("failed to create a proirity route to outline proxy: " + string(e.what()));
-    // We failed to make a route through outline proxy. We just remove the flag
-    // indicating DNS is backed up.
+    logger.error("failed to prepare routing through outline: " + string(e.what()));
     resetFailRoutingAttempt(OUTLINE_PRIORITY_SET_UP);
     throw std::system_error{ErrorCode::kConfigureSystemProxyFailure};
   }
 
+  preparedRouting = std::move(prepared);
+  logger.info("routing through outline server " + outlineServerIP + " is prepared");
+}
+
+std::optional<FlowFlushReport> OutlineProxyController::commitRouting(bool flushStaleFlows) {
+  std::lock_guard<std::recursive_mutex> lock{operationMutex};
+  if (!preparedRouting) {
+    throw std::system_error{
+      ErrorCode::kConfigureSystemProxyFailure,
+      "there is no prepared routing to commit"};
+  }
+
+  auto prepared = std::move(*preparedRouting);
+  preparedRouting.reset();
+  if (!prepared.heldServerIP.empty()) {
+    if (!resumeHeldRouting(prepared.heldServerIP)) {
+      throw std::system_error{
+        ErrorCode::kConfigureSystemProxyFailure,
+        "the routing is not held anymore, prepare it again"};
+    }
+    return std::nullopt;
+  }
+  dataPlaneLost = false;
+
+  StageGraph connect;
+  // added by prepareRouting, it is only undone here
+  auto serverRoute = connect.Add("keeping the route to the outline server", [] {},
+                                 [this] { deleteOutlineServerRouting(); });
+  // a failed batch has rolled itself back already
+  bool switched = false;
+  auto tunRoute = connect.Add("switching the traffic to the tun device",
+                              [this, &prepared, &switched] {
+                                prepared.commitBatch.Commit(routingSocket);
+                                switched = true;
+                              },
+                              [this, &prepared, &switched] {
+                                if (switched) {
+                                  prepared.commitBatch.Inverse().Commit(routingSocket);
+                                }
+                              },
+                              {serverRoute});
+  addProtectionStages(connect, {tunRoute});
+  runConnectStages(connect, OUTLINE_PRIORITY_SET_UP);
+
+  cacheCurrentNetworkProfile(prepared.defaultRoutes);
+  return finishRoutingThroughOutline(prepared.defaultRoutes, flushStaleFlows);
+}
+
+void OutlineProxyController::abortRouting() {
+  std::lock_guard<std::recursive_mutex> lock{operationMutex};
+  if (!preparedRouting) {
+    return;
+  }
+  auto heldServerIP = std::move(preparedRouting->heldServerIP);
+  preparedRouting.reset();
+  if (!heldServerIP.empty()) {
+    // nothing was done, the routing stays held
+    return;
+  }
+
   try {
-    deleteAllDefaultRoutes();  // drop the default route before adding another one
+    RouteBatch serverRoute;
+    serverRoute.Delete(outlineServerRoute());
+    serverRoute.Commit(routingSocket);
   } catch (exception& e) {
-    logger.error("failed to remove the default route throw the current default router: " +
-                 string(e.what()));
-    resetFailRoutingAttempt(DEFAULT_GATEWAY_ROUTE_DELETED);
-    throw std::system_error{ErrorCode::kConfigureSystemProxyFailure};
+    logger.warn("unable to delete priority route for outline proxy: " + string(e.what()));
   }
+  resetFailRoutingAttempt(OUTLINE_PRIORITY_SET_UP);
+  logger.info("prepared routing through outline is aborted");
+}
+
+boost::asio::awaitable<std::optional<FlowFlushReport>>
+OutlineProxyController::routeThroughOutlineAsync(std::string outlineServerIP, bool flushStaleFlows,
+                                                 std::chrono::milliseconds timeout) {
+  std::optional<FlowFlushReport> flushed;
+  std::function<void()> operation = [this, outlineServerIP, flushStaleFlows, &flushed] {
+    flushed = routeThroughOutline(outlineServerIP, flushStaleFlows);
+  };
+  co_await runOperation(timeout, std::move(operation));
+  co_return flushed;
+}
 
+boost::asio::awaitable<void> OutlineProxyController::prepareRoutingAsync(
+    std::string outlineServerIP, std::chrono::milliseconds timeout) {
+  std::function<void()> operation = [this, outlineServerIP] { prepareRouting(outlineServerIP); };
+  co_await runOperation(timeout, std::move(operation));
+}
+
+boost::asio::awaitable<std::optional<FlowFlushReport>> OutlineProxyController::commitRoutingAsync(
+    bool flushStaleFlows, std::chrono::milliseconds timeout) {
+  std::optional<FlowFlushReport> flushed;
+  std::function<void()> operation = [this, flushStaleFlows, &flushed] {
+    flushed = commitRouting(flushStaleFlows);
+  };
+  co_await runOperation(timeout, std::move(operation));
+  co_return flushed;
+}
+
+boost::asio::awaitable<void> OutlineProxyController::abortRoutingAsync(
+    std::chrono::milliseconds timeout) {
+  std::function<void()> operation = [this] { abortRouting(); };
+  co_await runOperation(timeout, std::move(operation));
+}
+
+boost::asio::awaitable<void> OutlineProxyController::holdRoutingAsync(
+    std::chrono::milliseconds timeout) {
+  std::function<void()> operation = [this] { holdRouting(); };
+  co_await runOperation(timeout, std::move(operation));
+}
+
+boost::asio::awaitable<std::optional<FlowFlushReport>> OutlineProxyController::routeDirectlyAsync(
+    bool flushStaleFlows, std::chrono::milliseconds timeout) {
+  std::optional<FlowFlushReport> flushed;
+  std::function<void()> operation = [this, flushStaleFlows, &flushed] {
+    flushed = routeDirectly(flushStaleFlows);
+  };
+  co_await runOperation(timeout, std::move(operation));
+  co_return flushed;
+}
+
+boost::asio::awaitable<void> OutlineProxyController::runOperation(
+    std::chrono::milliseconds timeout, std::function<void()> operation) {
+  using namespace boost::asio;
+
+  auto deadline = make_shared<OperationDeadline>(timeout.count() > 0 ? timeout : routingTimeout);
+
+  // the operation does not stop right away, it notices the cancellation at
+  // its next safe point and rolls back before completing
+  auto cancellation = co_await this_coro::cancellation_state;
+  auto slot = cancellation.slot();
+  if (slot.is_connected()) {
+    slot.assign([deadline](cancellation_type) { deadline->Cancel(); });
+  }
+
+  std::exception_ptr failure;
   try {
-    createDefaultRouteThroughTun();
-  } catch (exception& e) {
-    logger.error("failed to route network traffic through outline tun interfacet: ", e.what());
-    resetFailRoutingAttempt(TRAFFIC_ROUTED_THROUGH_TUN);
-    throw std::system_error{ErrorCode::kConfigureSystemProxyFailure};
+    co_await co_spawn(operationWorker, runOnWorker(deadline, std::move(operation)), use_awaitable);
+  } catch (...) {
+    failure = std::current_exception();
   }
+  slot.clear();
+  if (failure) {
+    std::rethrow_exception(failure);
+  }
+}
 
+boost::asio::awaitable<void> OutlineProxyController::runOnWorker(
+    std::shared_ptr<OperationDeadline> deadline, std::function<void()> operation) {
+  std::lock_guard<std::recursive_mutex> lock{operationMutex};
+  currentOperation = deadline;
   try {
-    toggleIPv6(false);
-  } catch (exception& e) {
-    // We are going to fail if we are not able to disable all IPV6 routes.
-    logger.error("possible net traffic leakage. failed to disable IPv6 routes on all interfaces: " +
-                 string(e.what()));
-    resetFailRoutingAttempt(IPV6_ROUTING_FAILED);
-    throw std::system_error{ErrorCode::kConfigureSystemProxyFailure};
+    operation();
+  } catch (...) {
+    currentOperation.reset();
+    publishUplinkName();
+    throw;
+  }
+  currentOperation.reset();
+  publishUplinkName();
+  co_return;
+}
+
+void OutlineProxyController::publishUplinkName() {
+  std::lock_guard<std::mutex> lock{uplinkNameMutex};
+  uplinkName = clientToServerRoutingInterface;
+}
+
+void OutlineProxyController::checkpoint(const std::string& stage) {
+  if (currentOperation) {
+    currentOperation->Check(stage);
+  }
+}
+
+void OutlineProxyController::holdRouting() {
+  std::lock_guard<std::recursive_mutex> lock{operationMutex};
+  if (routingStatus != ROUTING_THROUGH_OUTLINE) {
+    throw std::system_error{
+      ErrorCode::kConfigureSystemProxyFailure,
+      "cannot hold the routing while not routing through outline"};
+  }
+  // `ip tuntap add` made the device persistent, it outlives its readers
+  if (!outlineTunDeviceExsits()) {
+    throw std::system_error{
+      ErrorCode::kConfigureSystemProxyFailure,
+      "cannot hold the routing, " + tunInterfaceName + " is gone"};
+  }
+
+  routingHeld = true;
+  logger.info("holding the routing through " + tunInterfaceName + " until it is configured again");
+}
+
+bool OutlineProxyController::resumeHeldRouting(const std::string& outlineServerIP) {
+  if (!routingHeld) {
+    return false;
   }
+  if (routingStatus != ROUTING_THROUGH_OUTLINE) {
+    routingHeld = false;
+    return false;
+  }
+
+  if (outlineServerIP != this->outlineServerIP) {
+    // the new server is reached through the same gateway; add its route
+    // before removing the old one so the tunnel is never routed into itself
+    RouteBatch serverRoutes;
+    auto previousServerRoute = outlineServerRoute();
+    this->outlineServerIP = outlineServerIP;
+    serverRoutes.Add(outlineServerRoute());
+    serverRoutes.Delete(previousServerRoute);
+    try {
+      serverRoutes.Commit(routingSocket);
+    } catch (exception& e) {
+      this->outlineServerIP = previousServerRoute.destination;
+      logger.error("failed to move the priority route to outline server " + outlineServerIP +
+                   ": " + e.what());
+      throw std::system_error{ErrorCode::kConfigureSystemProxyFailure};
+    }
+    routeClassifierOutdated = true;
+    if (connectPlan) {
+      compileConnectPlan(connectPlan->defaultRoutes);
+    }
+
+    try {
+      adjustTunnelMtu();
+    } catch (exception& e) {
+      logger.warn("failed to adjust the MTU of " + tunInterfaceName + ": " + string(e.what()));
+    }
+  }
+
+  routingHeld = false;
+  logger.info("resumed the held routing through outline server " + outlineServerIP);
 
   try {
-    enforceGloballyReachableDNS();
+    updateLocalNetworkRoutes();
+  } catch (exception& e) {
+    logger.warn("failed to route the local networks through the gateway: " + string(e.what()));
+  }
+  // the new reader may have attached a different set of queues
+  applyTunCpuSteering();
+  return true;
+}
 
+void OutlineProxyController::addProtectionStages(StageGraph& graph,
+                                                 const std::vector<StageGraph::StageId>& tunRoute) {
+  // disabling IPv6 runs alongside the route operations, while the queries to
+  // the outline DNS server must not go out through the gateway before the
+  // traffic is routed into the tun device.
+  // Failing to disable IPv6 leaks traffic; a DNS server which is not
+  // globally reachable might still work, but leaves the user vulnerable to
+  // DNS poisoning, so either failure reverses everything
+  graph.Add("disabling IPv6", [this] { toggleIPv6(false); }, [this] { toggleIPv6(true); });
+  graph.Add("setting the outline DNS server", [this] { enforceGloballyReachableDNS(); },
+            [this] { restoreDNSSetting(); }, tunRoute);
+}
+
+void OutlineProxyController::runConnectStages(StageGraph& graph,
+                                              OutlineConnectionStage failedStage) {
+  try {
+    graph.Run(stageWorkers, [this](const std::string& stage) { checkpoint(stage); });
   } catch (exception& e) {
-    // this might not break routing through outline if the DNS is in the same
-    // internal network or is a globally reachable. Notheless the user is
-    // vulnerable to DNS poisening so we are going to reverse everthing
-    logger.error("failed to enforce outline DNS server: ", e.what());
-    resetFailRoutingAttempt(OUTLINE_DNS_SET);
+    logger.error("failed to route through outline: " + string(e.what()));
+    // the rollback must not be cut short by the deadline of the operation
+    currentOperation.reset();
+    graph.Rollback();
+    resetFailRoutingAttempt(failedStage);
     throw std::system_error{ErrorCode::kConfigureSystemProxyFailure};
   }
+}
 
+std::optional<FlowFlushReport> OutlineProxyController::finishRoutingThroughOutline(
+    const std::vector<RouteEntry>& defaultRoutes, bool flushStaleFlows) {
   routingStatus = ROUTING_THROUGH_OUTLINE;
+  routeClassifierOutdated = true;
   logger.info("successfully routing through the outline server");
+
+  // nothing is rolled back from here on, the remaining steps are best effort
+  // and a hung command in them is only bounded by kCommandTimeout
+  currentOperation.reset();
+
+  // ready for the disconnection, and the next connection to this server
+  compileConnectPlan(defaultRoutes);
+
+  try {
+    updateBypassRoutes(defaultRoutes);
+  } catch (exception& e) {
+    // the bypassed cgroups fall back to the tunnel, nothing leaks
+    logger.warn("failed to route the bypassed cgroups through the gateway: " + string(e.what()));
+  }
+
+  try {
+    updateLocalNetworkRoutes();
+  } catch (exception& e) {
+    // the local networks are still reachable through the tunnel
+    logger.warn("failed to route the local networks through the gateway: " + string(e.what()));
+  }
+
+  try {
+    adjustTunnelMtu();
+  } catch (exception& e) {
+    logger.warn("failed to adjust the MTU of " + tunInterfaceName + ": " + string(e.what()));
+  }
+
+  try {
+    installMssClamp();
+  } catch (exception& e) {
+    logger.warn("failed to clamp the TCP MSS on " + tunInterfaceName + ": " + string(e.what()));
+  }
+
+  // the reader has attached all its queues by now
+  applyTunCpuSteering();
+
+  if (!flushStaleFlows) {
+    return std::nullopt;
+  }
+  // tun2socks is connected to the outline server through the gateway as well
+  return this->flushStaleFlows(clientLocalIP, outlineServerIP);
+}
+
+const NetworkProfile* OutlineProxyController::findCurrentNetworkProfile() {
+  try {
+    return networkProfileCache.FindCurrent(DumpNeighbours(routingSocket));
+  } catch (exception& e) {
+    logger.warn("failed to query the neighbour table: " + string(e.what()));
+    return nullptr;
+  }
+}
+
+std::optional<StageGraph::StageId> OutlineProxyController::routeThroughNetworkProfile(
+    const NetworkProfile& profile, StageGraph& graph) {
+  const auto fingerprint = profile.fingerprint;
+  RouteBatch batch;
+  try {
+    // somebody might have changed the default routes since we have been here
+    auto defaultRoutes = DumpDefaultRoutes(routingSocket);
+    if (!std::is_permutation(defaultRoutes.begin(), defaultRoutes.end(),
+                             profile.default_routes.begin(), profile.default_routes.end())) {
+      throw runtime_error("the default routes have changed");
+    }
+
+    routingGatewayIP = fingerprint.gateway_ip;
+    clientToServerRoutingInterface = profile.interface_name;
+    clientLocalIP = profile.local_ip;
+    batch = connectBatch(profile.default_routes);
+  } catch (exception& e) {
+    logger.warn("the cached profile of the network via " + fingerprint.gateway_ip +
+                " is outdated: " + e.what());
+    networkProfileCache.Evict(fingerprint);
+    // make sure the gateway is detected again
+    routingGatewayIP.clear();
+    return std::nullopt;
+  }
+
+  // a failed batch has rolled itself back already
+  auto switched = std::make_shared<bool>(false);
+  auto commit = [this, batch, fingerprint, switched] {
+    try {
+      batch.Commit(routingSocket);
+    } catch (...) {
+      networkProfileCache.Evict(fingerprint);
+      routingGatewayIP.clear();
+      throw;
+    }
+    *switched = true;
+    logger.info("routed through outline with the cached profile of the network via " +
+                fingerprint.gateway_ip);
+  };
+  auto undo = [this, inverse = batch.Inverse(), switched] {
+    if (*switched) {
+      inverse.Commit(routingSocket);
+    }
+  };
+  return graph.Add("routing the traffic through the tun device", std::move(commit),
+                   std::move(undo));
+}
+
+RouteBatch OutlineProxyController::connectBatch(const std::vector<RouteEntry>& defaultRoutes) {
+  RouteBatch batch;
+  batch.Add(outlineServerRoute());
+  for (const auto& route : defaultRoutes) {
+    batch.Delete(route);
+  }
+  batch.Add(tunDefaultRoute());
+  return batch;
+}
+
+void OutlineProxyController::compileConnectPlan(std::vector<RouteEntry> defaultRoutes) {
+  connectPlan.reset();
+  if (outlineServerIP.empty() || routingGatewayIP.empty() ||
+      clientToServerRoutingInterface.empty() || defaultRoutes.empty()) {
+    return;
+  }
+
+  try {
+    auto batch = connectBatch(defaultRoutes);
+    connectPlan = ConnectPlan{outlineServerIP, routingGatewayIP,
+                              clientToServerRoutingInterface, clientLocalIP,
+                              std::move(defaultRoutes), {outlineServerRoute(), tunDefaultRoute()},
+                              CompiledRouteBatch{batch}, CompiledRouteBatch{batch.Inverse()}};
+  } catch (exception& e) {
+    logger.warn("failed to compile the connect plan: " + string(e.what()));
+  }
+}
+
+StageGraph::StageId OutlineProxyController::routeThroughConnectPlan(StageGraph& graph,
+                                                                   bool& outdated) {
+  // a failed batch has rolled itself back already
+  auto switched = std::make_shared<bool>(false);
+  auto commit = [this, &outdated, switched] {
+    try {
+      connectPlan->connect.Commit(routingSocket);
+    } catch (exception& e) {
+      logger.warn("the connect plan via " + connectPlan->gatewayIP + " is outdated: " + e.what());
+      outdated = true;
+      throw;
+    }
+    *switched = true;
+    routingGatewayIP = connectPlan->gatewayIP;
+    clientToServerRoutingInterface = connectPlan->interfaceName;
+    clientLocalIP = connectPlan->localIP;
+    logger.info("routed through outline with the connect plan via " + routingGatewayIP);
+  };
+  auto undo = [this, switched] {
+    if (*switched) {
+      connectPlan->disconnect.Commit(routingSocket);
+    }
+  };
+  return graph.Add("routing the traffic through the tun device", std::move(commit),
+                   std::move(undo));
+}
+
+bool OutlineProxyController::routeDirectlyThroughConnectPlan() {
+  if (!connectPlan || connectPlan->serverIP != outlineServerIP ||
+      connectPlan->gatewayIP != routingGatewayIP) {
+    return false;
+  }
+
+  try {
+    connectPlan->disconnect.Commit(routingSocket);
+  } catch (exception& e) {
+    logger.warn("the connect plan via " + connectPlan->gatewayIP + " is outdated: " + e.what());
+    connectPlan.reset();
+    return false;
+  }
+  return true;
+}
+
+void OutlineProxyController::validateConnectPlan() {
+  if (!connectPlan) {
+    return;
+  }
+
+  std::vector<RouteEntry> routes;
+  try {
+    routes = DumpRoutes(routingSocket);
+  } catch (exception& e) {
+    logger.warn("failed to query the routes: " + string(e.what()));
+    connectPlan.reset();
+    return;
+  }
+
+  bool valid;
+  if (routingStatus == ROUTING_THROUGH_OUTLINE) {
+    // the disconnect batch deletes these, the interface of the tun default
+    // route is left to the kernel
+    valid = std::all_of(connectPlan->connectedRoutes.begin(), connectPlan->connectedRoutes.end(),
+                        [&routes](const RouteEntry& expected) {
+      return std::any_of(routes.begin(), routes.end(), [&expected](RouteEntry route) {
+        if (expected.interface_index == 0) {
+          route.interface_index = 0;
+        }
+        return route == expected;
+      });
+    });
+  } else {
+    // the connect batch deletes exactly these
+    routes.erase(std::remove_if(routes.begin(), routes.end(),
+                                [](const auto& route) { return route.prefix_length != 0; }),
+                 routes.end());
+    valid = std::is_permutation(routes.begin(), routes.end(),
+                                connectPlan->defaultRoutes.begin(),
+                                connectPlan->defaultRoutes.end());
+  }
+  if (!valid) {
+    logger.info("the routes have changed, dropping the connect plan via " +
+                connectPlan->gatewayIP);
+    connectPlan.reset();
+  }
+}
+
+RouteEntry OutlineProxyController::outlineServerRoute() {
+  return {outlineServerIP, 32, routingGatewayIP,
+          static_cast<int>(if_nametoindex(clientToServerRoutingInterface.c_str())),
+          static_cast<uint32_t>(stoul(c_proxy_priority_metric))};
+}
+
+RouteEntry OutlineProxyController::tunDefaultRoute() {
+  return {"", 0, tunInterfaceRouterIp, 0,
+          static_cast<uint32_t>(stoul(c_normal_traffic_priority_metric))};
+}
+
+void OutlineProxyController::backupDNSSettingOnNetwork(const NetworkProfile* knownNetwork) {
+  backupDNSSetting();
+  if (knownNetwork != nullptr && DNSSettingBackedup &&
+      backedupResolveConf.str().rfind(kOutlineResolvConfHeader, 0) == 0) {
+    // the last session did not restore the DNS configuration (e.g. we crashed),
+    // the one we backed up on this network is better than ours
+    logger.warn("resolv.conf is still generated by outline, using the backup of this network");
+    backedupResolveConf.str(knownNetwork->resolv_conf);
+    backedupResolveConfHeader.str(knownNetwork->resolv_conf_head);
+  }
+}
+
+void OutlineProxyController::cacheCurrentNetworkProfile(const std::vector<RouteEntry>& defaultRoutes) {
+  if (defaultRoutes.empty() || clientToServerRoutingInterface.empty() || clientLocalIP.empty()) {
+    return;
+  }
+  for (const auto& route : defaultRoutes) {
+    if (route.gateway.empty()) {
+      // e.g. point-to-point or multipath uplinks, nothing to fingerprint
+      return;
+    }
+  }
+
+  NetworkProfile profile;
+  profile.fingerprint.interface_index =
+      static_cast<int>(if_nametoindex(clientToServerRoutingInterface.c_str()));
+  profile.fingerprint.gateway_ip = routingGatewayIP;
+  try {
+    for (const auto& neighbour : DumpNeighbours(routingSocket)) {
+      if (neighbour.interface_index == profile.fingerprint.interface_index &&
+          neighbour.address == routingGatewayIP) {
+        profile.fingerprint.gateway_mac = neighbour.link_address;
+      }
+    }
+  } catch (exception& e) {
+    logger.warn("failed to query the neighbour table: " + string(e.what()));
+  }
+  if (profile.fingerprint.interface_index == 0 || profile.fingerprint.gateway_mac.empty()) {
+    return;
+  }
+
+  profile.interface_name = clientToServerRoutingInterface;
+  profile.local_ip = clientLocalIP;
+  profile.default_routes = defaultRoutes;
+  if (DNSSettingBackedup) {
+    profile.resolv_conf = backedupResolveConf.str();
+    profile.resolv_conf_head = backedupResolveConfHeader.str();
+  }
+  networkProfileCache.Store(std::move(profile));
 }
 
 void OutlineProxyController::backupDNSSetting() {
@@ -464,17 +1226,15 @@ void OutlineProxyController::toggleIPv6(bool IPv6Status) {
 
   std::string IPv6Disabled = (IPv6Status) ? "0" : "1";
 
-  auto sysctlResultAll = executeSysctl({
-    "-w", "net.ipv6.conf.all.disable_ipv6=" + IPv6Disabled
-  });
-
-  auto sysctlResultDefault = executeSysctl({
-    "-w", "net.ipv6.conf.default.disable_ipv6=" + IPv6Disabled
+  // a single process sets both, it fails if either cannot be set
+  auto sysctlResult = executeSysctl({
+    "-w",
+    "net.ipv6.conf.all.disable_ipv6=" + IPv6Disabled,
+    "net.ipv6.conf.default.disable_ipv6=" + IPv6Disabled
   });
 
-  if (!isSuccessful(sysctlResultAll) || !isSuccessful(sysctlResultDefault)) {
-    logger.error(sysctlResultAll.first);
-    logger.error(sysctlResultDefault.first);
+  if (!isSuccessful(sysctlResult)) {
+    logger.error(sysctlResult.first);
     throw runtime_error("failed to toggle systemwide ipv6 status");
   }
 }
@@ -486,7 +1246,7 @@ void OutlineProxyController::enforceGloballyReachableDNS() {
   try {
     std::ofstream resolveConfFile("/etc/resolv.conf");
 
-    resolveConfFile << "# Generated by outline \n";
+    resolveConfFile << kOutlineResolvConfHeader;
     resolveConfFile << "nameserver " + outlineDNSServer + "\n";
 
     // doing dns over tcp instead
@@ -517,22 +1277,42 @@ void OutlineProxyController::enforceGloballyReachableDNS() {
 }
 
 void OutlineProxyController::resetFailRoutingAttempt(OutlineConnectionStage failedStage) {
+  // the rollback must not be cut short by the deadline of the operation
+  currentOperation.reset();
+
+  // every step is attempted even if the previous one failed, e.g. because
+  // a cancelled operation stopped before that stage was reached
+  auto attempt = [](const char* step, auto&& action) {
+    try {
+      action();
+    } catch (exception& e) {
+      logger.warn("rollback: failed to " + string(step) + ": " + e.what());
+    }
+  };
+
   switch (failedStage) {
     case OUTLINE_DNS_SET:
-      restoreDNSSetting();
+      attempt("restore the DNS setting", [this] { restoreDNSSetting(); });
+      attempt("enable IPv6", [this] { toggleIPv6(true); });
 
     case IPV6_ROUTING_FAILED:
+      // the default route through the tun device is in place
+      attempt("delete the default route through the tun device",
+              [this] { deleteAllDefaultRoutes(); });
+
     case TRAFFIC_ROUTED_THROUGH_TUN:
     case DEFAULT_GATEWAY_ROUTE_DELETED:
       // We need to delete the priority path to the default gateway
       // plus make sure default route to the gateway is there.
-      createDefaultRouteThroughGateway();
-      deleteOutlineServerRouting();
+      attempt("restore the default route", [this] { createDefaultRouteThroughGateway(); });
+      attempt("delete the route to the outline server", [this] { deleteOutlineServerRouting(); });
 
     case OUTLINE_PRIORITY_SET_UP:
       // we just need to forget that we have backed up DNS
       // in case DNS setting changes before our next attempt
       DNSSettingBackedup = false;
+      backedupResolveConf.str(std::string{});
+      backedupResolveConfHeader.str(std::string{});
 
     default:
       // we basically have to do nothing in other cases
@@ -546,53 +1326,150 @@ OutputAndStatus OutlineProxyController::executeSysctl(const CommandArguments &ar
   return executeCommand(sysctlCommand, "", args);
 }
 
-void OutlineProxyController::routeDirectly() {
+OutputAndStatus OutlineProxyController::executeNft(const CommandArguments &args) {
+  return executeCommand(nftCommand, "", args);
+}
+
+std::optional<FlowFlushReport> OutlineProxyController::routeDirectly(bool flushStaleFlows) {
+  std::lock_guard<std::recursive_mutex> lock{operationMutex};
+  // a half dismantled routing is worse than a late one, so once started the
+  // teardown runs to completion
+  checkpoint("dismantling the routing");
+  currentOperation.reset();
+
+  if (preparedRouting) {
+    abortRouting();
+  }
+  routingHeld = false;
+
   logger.info("attempting to dismantle routing through outline server");
   if (routingStatus == ROUTING_THROUGH_DEFAULT_GATEWAY) {
     logger.warn("it does not seem that we are routing through outline server");
   }
 
+  // the connect plan restores the routes in a single batch
+  bool routesRestored =
+      routingStatus == ROUTING_THROUGH_OUTLINE && routeDirectlyThroughConnectPlan();
+
+  bool gatewayKnown = true;
   try {
     // before deleting all route make sure that we have kept track of default
     // router info.
-    if (routingGatewayIP.empty()) {
+    if (!routesRestored && routingGatewayIP.empty()) {
       logger.warn("default routing gateway is unknown");
       detectBestInterfaceIndex();
     }
-
-    deleteAllDefaultRoutes();
   } catch (exception& e) {
     logger.error("failed to delete the route through outline proxy " + string(e.what()));
-    // this might be because our route got deleted, we are going to add the
-    // original default route nonetheless
+    gatewayKnown = false;
   }
 
-  try {
-    createDefaultRouteThroughGateway();
-  } catch (exception& e) {
-    logger.error("failed to make a default route through the network gateway: " + string(e.what()));
+  // every stage is best effort, only the default routes and the route to the
+  // outline server depend on each other; the bypass table is emptied after
+  // them as both use routingSocket
+  StageGraph disconnect;
+  std::vector<StageGraph::StageId> routeStages;
+  if (!routesRestored) {
+    auto tunRoute = disconnect.Add("deleting the default routes", [this, gatewayKnown] {
+      try {
+        if (gatewayKnown) {
+          deleteAllDefaultRoutes();
+        }
+      } catch (exception& e) {
+        logger.error("failed to delete the route through outline proxy " + string(e.what()));
+        // this might be because our route got deleted, we are going to add the
+        // original default route nonetheless
+      }
+    });
+    auto gatewayRoute = disconnect.Add("restoring the default route", [this] {
+      try {
+        createDefaultRouteThroughGateway();
+      } catch (exception& e) {
+        logger.error("failed to make a default route through the network gateway: " +
+                     string(e.what()));
+      }
+    }, {}, {tunRoute});
+    routeStages.push_back(disconnect.Add("deleting the route to the outline server", [this] {
+      try {
+        deleteOutlineServerRouting();
+      } catch (exception& e) {
+        logger.warn("unable to delete priority route for outline proxy: " + string(e.what()));
+      }
+    }, {}, {gatewayRoute}));
   }
+  disconnect.Add("enabling IPv6", [this] {
+    try {
+      toggleIPv6(true);
+    } catch (exception& e) {
+      logger.error("failed to enable IPv6 for all interfaces:" + string(e.what()));
+    }
+  });
+  disconnect.Add("restoring the DNS setting", [this] {
+    try {
+      restoreDNSSetting();
+    } catch (exception& e) {
+      logger.warn("unable restoring DNS configuration " + string(e.what()));
+    }
+  });
+  disconnect.Add("emptying the bypass routing table", [this] {
+    try {
+      updateBypassRoutes({});
+    } catch (exception& e) {
+      logger.warn("failed to empty the bypass routing table: " + string(e.what()));
+    }
+  }, {}, routeStages);
+  // steered again by the next connection, once the reader attached its queues
+  disconnect.Add("restoring the steering of the tun queues", [this] { tunCpuSteering.Restore(); });
+  disconnect.Run(stageWorkers);
 
-  try {
-    deleteOutlineServerRouting();
-  } catch (exception& e) {
-    logger.warn("unable to delete priority route for outline proxy: " + string(e.what()));
+  if (!routesRestored && !outlineServerIP.empty()) {
+    try {
+      compileConnectPlan(DumpDefaultRoutes(routingSocket));
+    } catch (exception& e) {
+      logger.warn("failed to query the default routes: " + string(e.what()));
+    }
   }
 
+  routingStatus = ROUTING_THROUGH_DEFAULT_GATEWAY;
+  routeClassifierOutdated = true;
+
   try {
-    toggleIPv6(true);
+    updateLocalNetworkRoutes();
   } catch (exception& e) {
-    logger.error("failed to enable IPv6 for all interfaces:" + string(e.what()));
+    logger.warn("failed to delete the local network routes: " + string(e.what()));
   }
 
   try {
-    restoreDNSSetting();
+    removeMssClamp();
   } catch (exception& e) {
-    logger.warn("unable restoring DNS configuration " + string(e.what()));
+    logger.warn("failed to remove the TCP MSS clamp: " + string(e.what()));
   }
 
-  routingStatus = ROUTING_THROUGH_DEFAULT_GATEWAY;
   logger.info("now routing through the network default gateway");
+
+  if (!flushStaleFlows) {
+    return std::nullopt;
+  }
+  return this->flushStaleFlows(tunInterfaceIp, "");
+}
+
+std::optional<FlowFlushReport> OutlineProxyController::flushStaleFlows(
+    const std::string& staleSourceIP, const std::string& preservedPeerIP) {
+  if (staleSourceIP.empty()) {
+    logger.warn("unknown source address of the previous route, no connection is flushed");
+    return std::nullopt;
+  }
+
+  try {
+    auto report = FlushStaleFlows(staleSourceIP, preservedPeerIP);
+    logger.info("flushed " + to_string(report.conntrack_entries) + " conntrack entries and " +
+                to_string(report.sockets) + " sockets bound to " + staleSourceIP + " in " +
+                to_string(report.elapsed.count()) + "us");
+    return report;
+  } catch (exception& e) {
+    logger.warn("failed to flush connections bound to " + staleSourceIP + ": " + e.what());
+    return std::nullopt;
+  }
 }
 
 void OutlineProxyController::createDefaultRouteThroughGateway() {
@@ -645,8 +1522,8 @@ void OutlineProxyController::restoreDNSSetting() {
       logger.warn(e.what());
     }
 
-    backedupResolveConf.clear();
-    backedupResolveConfHeader.clear();
+    backedupResolveConf.str(std::string{});
+    backedupResolveConfHeader.str(std::string{});
     DNSSettingBackedup = false;
   }
 }
@@ -658,10 +1535,11 @@ void OutlineProxyController::getIntefraceMetric() {}
 void OutlineProxyController::deleteOutlineTunDev() {
   if (outlineTunDeviceExsits()) {
     try {
-      OutputAndStatus tunDeviceAdditionResult = executeIPTunTap({
-        "del", "dev", tunInterfaceName,
-        "mode", "tun"
-      });
+      CommandArguments tunDeviceArguments{"del", "dev", tunInterfaceName, "mode", "tun"};
+      if (tunCpuSteering.profile().align_queues) {
+        tunDeviceArguments.push_back("multi_queue");
+      }
+      OutputAndStatus tunDeviceAdditionResult = executeIPTunTap(tunDeviceArguments);
     } catch (exception& e) {
       logger.warn("failed to delete outline tun interface: " + string(e.what()));
     }
@@ -678,7 +1556,417 @@ OutputAndStatus OutlineProxyController::executeIPAddress(const CommandArguments
 
 std::string OutlineProxyController::getTunDeviceName() { return tunInterfaceName; }
 
+std::string OutlineProxyController::getUplinkInterfaceName() {
+  std::lock_guard<std::mutex> lock{uplinkNameMutex};
+  return uplinkName;
+}
+
+void OutlineProxyController::setLocalNetworkBypass(bool enabled) {
+  localNetworkBypass = enabled;
+}
+
+boost::asio::awaitable<void> OutlineProxyController::handleNetworkChange() {
+  std::function<void()> operation = [this] {
+    routeClassifierOutdated = true;
+    validateConnectPlan();
+    if (routingStatus != ROUTING_THROUGH_OUTLINE) {
+      return;
+    }
+
+    try {
+      updateLocalNetworkRoutes();
+    } catch (exception& e) {
+      logger.warn("failed to update the local network routes: " + string(e.what()));
+    }
+
+    try {
+      adjustTunnelMtu();
+    } catch (exception& e) {
+      logger.warn("failed to adjust the MTU of " + tunInterfaceName + ": " + string(e.what()));
+    }
+  };
+  try {
+    co_await runOperation(std::chrono::milliseconds{0}, std::move(operation));
+  } catch (exception& e) {
+    logger.warn("failed to handle the network change: " + string(e.what()));
+  }
+}
+
+void OutlineProxyController::adjustTunnelMtu() {
+  auto uplinkIndex = static_cast<int>(if_nametoindex(clientToServerRoutingInterface.c_str()));
+  if (uplinkIndex == 0) {
+    throw runtime_error("unknown uplink interface \"" + clientToServerRoutingInterface + "\"");
+  }
+  auto uplinkMtu = GetInterfaceMtu(routingSocket, uplinkIndex);
+
+  // a new address or MTU on the uplink most likely means a new network
+  auto probeKey = outlineServerIP + " via " + routingGatewayIP + " dev " +
+                  clientToServerRoutingInterface + " mtu " + to_string(uplinkMtu);
+  for (const auto& address : DumpAddresses(routingSocket)) {
+    if (address.interface_index == uplinkIndex) {
+      probeKey += " src " + address.address;
+    }
+  }
+
+  uint64_t generation;
+  {
+    std::lock_guard<std::mutex> lock{tunnelMtuMutex};
+    if (probeKey == tunnelMtuProbeKey) {
+      return;
+    }
+    tunnelMtuProbeKey = probeKey;
+    generation = ++tunnelMtuProbeGeneration;
+  }
+
+  // the bisection takes seconds against a server dropping ICMP, so it runs
+  // on its own thread: the tun device keeps its MTU until the probe is done
+  boost::asio::post(mtuProbeWorker, [this, generation, uplinkMtu,
+                                     serverIP = outlineServerIP,
+                                     uplinkName = clientToServerRoutingInterface] {
+    try {
+      auto pathMtu = ProbePathMtu(serverIP, uplinkName, uplinkMtu, kPathMtuProbeTimeout);
+      std::lock_guard<std::mutex> lock{tunnelMtuMutex};
+      if (generation != tunnelMtuProbeGeneration) {
+        // the uplink has changed again, a newer probe is on its way
+        return;
+      }
+      if (!pathMtu) {
+        logger.warn("outline server does not answer ICMP echo requests, assuming a path MTU of " +
+                    to_string(uplinkMtu));
+      }
+      auto tunMtu = std::max(pathMtu.value_or(uplinkMtu), kMinimumIPv4Mtu + kTunnelOverhead) -
+                    kTunnelOverhead;
+      // routingSocket belongs to the operations
+      NetlinkSocket rtnl{NETLINK_ROUTE};
+      SetInterfaceMtu(rtnl, static_cast<int>(if_nametoindex(tunInterfaceName.c_str())), tunMtu);
+      logger.info("path MTU to the outline server is " +
+                  (pathMtu ? to_string(*pathMtu) : string{"unknown"}) + ", MTU of " +
+                  tunInterfaceName + " set to " + to_string(tunMtu));
+    } catch (exception& e) {
+      logger.warn("failed to adjust the MTU of " + tunInterfaceName + ": " + string(e.what()));
+      // probed again at the next network change
+      std::lock_guard<std::mutex> lock{tunnelMtuMutex};
+      if (generation == tunnelMtuProbeGeneration) {
+        tunnelMtuProbeKey.clear();
+      }
+    }
+  });
+}
+
+void OutlineProxyController::installMssClamp() {
+  std::ostringstream ruleset;
+  ruleset << "add table " << kMssClampNftTable << "\n"
+          << "delete table " << kMssClampNftTable << "\n"
+          << "add table " << kMssClampNftTable << "\n"
+          << "add chain " << kMssClampNftTable
+          << " postrouting { type filter hook postrouting priority mangle; }\n"
+          << "add rule " << kMssClampNftTable << " postrouting oifname \"" << tunInterfaceName
+          << "\" tcp flags syn tcp option maxseg size set rt mtu\n";
+
+  auto result = executeNft({ ruleset.str() });
+  if (!isSuccessful(result)) {
+    logger.error(result.first);
+    throw runtime_error("failed to install the nftables rules of the MSS clamp");
+  }
+  mssClampInstalled = true;
+}
+
+void OutlineProxyController::removeMssClamp() {
+  if (!mssClampInstalled) {
+    return;
+  }
+
+  auto result = executeNft({ "delete table " + kMssClampNftTable });
+  if (!isSuccessful(result)) {
+    logger.error(result.first);
+    throw runtime_error("failed to delete the nftables rules of the MSS clamp");
+  }
+  mssClampInstalled = false;
+}
+
+void OutlineProxyController::updateLocalNetworkRoutes() {
+  const auto metric = static_cast<uint32_t>(stoul(c_local_network_priority_metric));
+
+  std::vector<RouteEntry> desiredRoutes;
+  if (localNetworkBypass && routingStatus == ROUTING_THROUGH_OUTLINE) {
+    desiredRoutes = ComputeLocalNetworkRoutes(
+        DumpAddresses(routingSocket),
+        static_cast<int>(if_nametoindex(clientToServerRoutingInterface.c_str())),
+        routingGatewayIP, metric);
+  }
+
+  auto delta = RouteBatch::Delta(FilterLocalNetworkRoutes(DumpRoutes(routingSocket), metric),
+                                 desiredRoutes);
+  if (!delta.empty()) {
+    delta.Commit(routingSocket);
+    logger.info("applied " + to_string(delta.size()) + " changes to the local network routes");
+  }
+}
+
+std::vector<std::string> OutlineProxyController::classifyDestinations(
+    const std::vector<std::string>& destinations) {
+  std::lock_guard<std::recursive_mutex> lock{operationMutex};
+  if (routeClassifierOutdated) {
+    try {
+      routeClassifier.Rebuild(DumpRoutes(routingSocket), DumpAddresses(routingSocket),
+                              static_cast<int>(if_nametoindex(tunInterfaceName.c_str())));
+    } catch (exception& e) {
+      logger.error("failed to mirror the routing table: " + string(e.what()));
+      throw std::system_error{ErrorCode::kUnexpected};
+    }
+    routeClassifierOutdated = false;
+  }
+
+  std::vector<uint32_t> addresses(destinations.size());
+  std::vector<bool> isValid(destinations.size());
+  for (size_t i = 0; i < destinations.size(); i++) {
+    in_addr parsed{};
+    isValid[i] = inet_pton(AF_INET, destinations[i].c_str(), &parsed) == 1;
+    addresses[i] = ntohl(parsed.s_addr);
+  }
+
+  std::vector<RoutePath> paths(destinations.size());
+  routeClassifier.Classify(addresses.data(), paths.data(), paths.size());
+
+  std::vector<std::string> results;
+  results.reserve(paths.size());
+  for (size_t i = 0; i < paths.size(); i++) {
+    results.push_back(isValid[i] ? RoutePathName(paths[i]) : "invalid");
+  }
+  return results;
+}
+
+boost::asio::awaitable<std::vector<std::string>> OutlineProxyController::classifyDestinationsAsync(
+    std::vector<std::string> destinations, std::chrono::milliseconds timeout) {
+  std::vector<std::string> results;
+  std::function<void()> operation = [this, &destinations, &results] {
+    results = classifyDestinations(destinations);
+  };
+  co_await runOperation(timeout, std::move(operation));
+  co_return results;
+}
+
+void OutlineProxyController::setBypassCgroups(const std::vector<std::string>& cgroupPaths) {
+  std::lock_guard<std::recursive_mutex> lock{operationMutex};
+  std::vector<std::string> paths;
+  for (auto path : cgroupPaths) {
+    // "/system.slice/" and "system.slice" are the same cgroup
+    path.erase(0, path.find_first_not_of('/'));
+    path.erase(path.find_last_not_of('/') + 1);
+    if (!IsValidCgroupPath(path)) {
+      throw std::system_error{ErrorCode::kUnexpected, "invalid cgroup path \"" + path + "\""};
+    }
+    paths.push_back(path);
+  }
+
+  auto previousCgroups = std::move(bypassCgroups);
+  bypassCgroups = std::move(paths);
+  try {
+    if (!bypassCgroups.empty()) {
+      installBypassRules();
+    } else if (!previousCgroups.empty()) {
+      removeBypassRules();
+    }
+  } catch (exception& e) {
+    logger.error("failed to update the bypassed cgroups: " + string(e.what()));
+    bypassCgroups = std::move(previousCgroups);
+    throw std::system_error{ErrorCode::kConfigureSystemProxyFailure};
+  }
+  logger.info(to_string(bypassCgroups.size()) + " cgroups bypass outline");
+}
+
+boost::asio::awaitable<void> OutlineProxyController::setBypassCgroupsAsync(
+    std::vector<std::string> cgroupPaths, std::chrono::milliseconds timeout) {
+  std::function<void()> operation = [this, cgroupPaths = std::move(cgroupPaths)] {
+    setBypassCgroups(cgroupPaths);
+  };
+  co_await runOperation(timeout, std::move(operation));
+}
+
+void OutlineProxyController::installBypassRules() {
+  // the table is replaced in a single nft transaction, so the previous list
+  // stays in effect until the new one is complete
+  const auto mark = to_string(kBypassFirewallMark);
+  std::ostringstream ruleset;
+  ruleset << "add table " << kBypassNftTable << "\n"
+          << "delete table " << kBypassNftTable << "\n"
+          << "add table " << kBypassNftTable << "\n"
+          // a route chain re-routes the packets whose mark it has changed
+          << "add chain " << kBypassNftTable
+          << " output { type route hook output priority mangle; }\n"
+          << "add chain " << kBypassNftTable
+          << " postrouting { type nat hook postrouting priority srcnat; }\n";
+  for (const auto& path : bypassCgroups) {
+    auto level = std::count(path.begin(), path.end(), '/') + 1;
+    ruleset << "add rule " << kBypassNftTable << " output socket cgroupv2 level " << level
+            << " \"" << path << "\" meta mark set " << mark << "\n";
+  }
+  // sockets which picked the tun device address before being re-routed
+  ruleset << "add rule " << kBypassNftTable << " postrouting meta mark " << mark
+          << " ip saddr " << tunInterfaceIp << " oifname != \"" << tunInterfaceName
+          << "\" masquerade\n";
+
+  auto result = executeNft({ ruleset.str() });
+  if (!isSuccessful(result)) {
+    logger.error(result.first);
+    throw runtime_error("failed to install the nftables rules of the bypass");
+  }
+
+  // the policy rules do not depend on the list, (re)install them all the same
+  const auto priority = to_string(kBypassRulePriority);
+  const auto nextPriority = to_string(kBypassRulePriority + 1);
+  executeIPCommand({ "rule", "del", "priority", priority });
+  executeIPCommand({ "rule", "del", "priority", nextPriority });
+
+  auto mainRuleResult = executeIPCommand({
+    "rule", "add", "fwmark", mark,
+    "lookup", "main", "suppress_prefixlength", "0",
+    "priority", priority
+  });
+  auto bypassRuleResult = executeIPCommand({
+    "rule", "add", "fwmark", mark,
+    "lookup", to_string(kBypassRoutingTable),
+    "priority", nextPriority
+  });
+  if (!isSuccessful(mainRuleResult) || !isSuccessful(bypassRuleResult)) {
+    logger.error(mainRuleResult.first);
+    logger.error(bypassRuleResult.first);
+    throw runtime_error("failed to add the policy rules of the bypass");
+  }
+}
+
+void OutlineProxyController::removeBypassRules() {
+  executeIPCommand({ "rule", "del", "priority", to_string(kBypassRulePriority) });
+  executeIPCommand({ "rule", "del", "priority", to_string(kBypassRulePriority + 1) });
+
+  auto result = executeNft({ "delete table " + kBypassNftTable });
+  if (!isSuccessful(result)) {
+    logger.error(result.first);
+    throw runtime_error("failed to delete the nftables rules of the bypass");
+  }
+}
+
+void OutlineProxyController::updateBypassRoutes(const std::vector<RouteEntry>& defaultRoutes) {
+  // the kernel drops the routes of an interface going down, so the stale ones
+  // are deleted on a best effort basis
+  RouteBatch staleRoutes;
+  for (const auto& route : bypassRoutes) {
+    staleRoutes.Delete(route);
+  }
+  bypassRoutes.clear();
+  if (!staleRoutes.empty()) {
+    auto requests = staleRoutes.Compile();
+    routingSocket.RequestBatch(requests);
+  }
+
+  RouteBatch routes;
+  std::vector<RouteEntry> newRoutes;
+  for (auto route : defaultRoutes) {
+    route.table = kBypassRoutingTable;
+    routes.Add(route);
+    newRoutes.push_back(std::move(route));
+  }
+  if (!routes.empty()) {
+    routes.Commit(routingSocket);
+    bypassRoutes = std::move(newRoutes);
+  }
+}
+
+void OutlineProxyController::setDataPlaneLossPolicy(DataPlaneLossPolicy policy) {
+  dataPlaneLossPolicy = policy;
+}
+
+boost::asio::awaitable<void> OutlineProxyController::handleDataPlaneLoss() {
+  // decided and torn down on the worker like a resetRouting request, the
+  // caller's executor keeps running meanwhile and notifies the listeners
+  std::optional<TunnelStatus> status;
+  std::function<void()> operation = [this, &status] {
+    if (routingStatus != ROUTING_THROUGH_OUTLINE || dataPlaneLost) {
+      return;
+    }
+
+    dataPlaneLost = true;
+    if (routingHeld) {
+      logger.info("the reader of " + tunInterfaceName +
+                  " is gone while the routing is held, traffic is dropped until it is back");
+      status = TunnelStatus::kReconnecting;
+      return;
+    }
+    if (dataPlaneLossPolicy == BLOCK_TRAFFIC_ON_LOSS) {
+      logger.warn("nobody is reading from " + tunInterfaceName +
+                  " anymore, keeping the routes to block the traffic");
+      status = TunnelStatus::kReconnecting;
+      return;
+    }
+    logger.warn("nobody is reading from " + tunInterfaceName +
+                " anymore, falling back to the network default gateway");
+    routeDirectly(false);
+    status = TunnelStatus::kDisconnected;
+  };
+  try {
+    co_await runOperation(std::chrono::milliseconds{0}, std::move(operation));
+  } catch (exception& e) {
+    logger.error("failed to fall back to the network default gateway: " + string(e.what()));
+    co_return;
+  }
+  if (status) {
+    notifyStatusChanged(*status);
+  }
+}
+
+boost::asio::awaitable<void> OutlineProxyController::handleDataPlaneRecovery() {
+  bool recovered = false;
+  std::function<void()> operation = [this, &recovered] {
+    if (routingStatus != ROUTING_THROUGH_OUTLINE || !dataPlaneLost) {
+      return;
+    }
+
+    dataPlaneLost = false;
+    logger.info("a reader is attached to " + tunInterfaceName + " again");
+    applyTunCpuSteering();
+    recovered = true;
+  };
+  try {
+    co_await runOperation(std::chrono::milliseconds{0}, std::move(operation));
+  } catch (exception& e) {
+    logger.warn("failed to handle the return of the reader: " + string(e.what()));
+    co_return;
+  }
+  if (recovered) {
+    notifyStatusChanged(TunnelStatus::kConnected);
+  }
+}
+
+int OutlineProxyController::addStatusListener(StatusListener listener) {
+  auto listenerId = nextStatusListenerId++;
+  statusListeners.emplace(listenerId, std::move(listener));
+  return listenerId;
+}
+
+void OutlineProxyController::removeStatusListener(int listenerId) {
+  statusListeners.erase(listenerId);
+}
+
+void OutlineProxyController::notifyStatusChanged(TunnelStatus status) {
+  for (const auto& [listenerId, listener] : statusListeners) {
+    listener(status);
+  }
+}
+
 OutlineProxyController::~OutlineProxyController() {
+  // let the running operation finish before undoing it
+  operationWorker.join();
+  // a pending probe would resize the tun device once it is gone
+  mtuProbeWorker.stop();
+  mtuProbeWorker.join();
   if (routingStatus == ROUTING_THROUGH_OUTLINE) routeDirectly();
+  if (!bypassCgroups.empty()) {
+    try {
+      removeBypassRules();
+    } catch (exception& e) {
+      logger.warn(e.what());
+    }
+  }
+  tunCpuSteering.Restore();
   deleteOutlineTunDev();
 }
@@ -14,6 +14,13 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <utility>
@@ -21,14 +28,56 @@
 
 #include <cstdlib>
 
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/thread_pool.hpp>
+
+#include "cpu_steering.h"
+#include "flow_flusher.h"
+#include "netlink_socket.h"
+#include "network_profile_cache.h"
+#include "operation_deadline.h"
+#include "route_classifier.h"
+#include "routing_table.h"
+#include "stage_graph.h"
+#include "traffic_control.h"
+
 namespace outline {
 
 typedef std::pair<std::string, uint8_t> OutputAndStatus;
 typedef std::vector<std::string> CommandArguments;
 
+/**
+ * @brief The tunnel status reported to the client in `statusChanged` events.
+ * @remarks The values are copied from "/src/www/app/tunnel.ts".
+ */
+enum class TunnelStatus {
+  kConnected = 0,
+  kDisconnected = 1,
+  kReconnecting = 2,
+};
+
+/**
+ * @brief Settings of OutlineProxyController given on the command line.
+ */
+struct ProxyControllerOptions {
+  // where the profiles of known networks are persisted, empty to keep them in memory
+  std::string networkProfileCacheFilename;
+  // how packets queue up on the tun device
+  QueueingProfile tunQueueingProfile;
+  // which CPUs process the packets of the tun queues
+  CpuSteeringProfile tunCpuSteering;
+  // how often the traffic counters are sampled for the clients
+  std::chrono::milliseconds trafficStatsInterval{1000};
+  // how long the awaitable routing operations may take unless told otherwise
+  std::chrono::milliseconds routingTimeout{10000};
+  // where the native data plane forwards the packets of the tun device, empty
+  // to leave them to an external tun2socks
+  std::string dataPlaneUpstream;
+};
+
 class OutlineProxyController {
  public:
-  OutlineProxyController();
+  explicit OutlineProxyController(const ProxyControllerOptions& options = {});
 
   /**
    * the destructor:
@@ -41,15 +90,109 @@ class OutlineProxyController {
 
   /**
    *  set the routing table so user traffic get routed though outline
+   *
+   *  if flushStaleFlows is set, connections still bound to the default
+   *  gateway are purged afterwards so applications reconnect through outline,
+   *  and what has been purged is returned
    */
-  void routeThroughOutline(std::string outlineServerIP);
+  std::optional<FlowFlushReport> routeThroughOutline(std::string outlineServerIP,
+                                                     bool flushStaleFlows = false);
 
   /**
    *
    * set up the routing table in a way that it route directly through defualt gateway
    *
+   * if flushStaleFlows is set, connections still bound to the tun device are
+   * purged afterwards so applications reconnect through the default gateway,
+   * and what has been purged is returned
+   *
+   */
+  std::optional<FlowFlushReport> routeDirectly(bool flushStaleFlows = false);
+
+  /**
+   * first half of routeThroughOutline, meant to overlap with the tunnel
+   * handshake: does everything that does not affect the traffic yet (detect
+   * the gateway, snapshot the routes and DNS setting, build the route batch,
+   * add the priority route to the outline server)
+   */
+  void prepareRouting(std::string outlineServerIP);
+
+  /**
+   * second half of routeThroughOutline: switches the traffic to the tun device
+   * with the route batch built by prepareRouting in a single netlink round trip
+   */
+  std::optional<FlowFlushReport> commitRouting(bool flushStaleFlows = false);
+
+  /**
+   * discards whatever prepareRouting did, no-op if nothing is prepared
+   */
+  void abortRouting();
+
+  /**
+   * awaitable versions of routeThroughOutline, prepareRouting, commitRouting,
+   * abortRouting, holdRouting and routeDirectly.
+   * the operation runs on the worker thread of the controller, one at a time,
+   * so the caller's executor keeps serving other sessions. once `timeout`
+   * (the routingTimeout option if zero) has elapsed or the awaiting coroutine
+   * is cancelled through its cancellation slot, the operation stops at its
+   * next safe point, killing a child process that is still running, rolls
+   * back the stages it went through and throws kConfigureSystemProxyFailure.
+   * a teardown is only cancellable before it has started
+   */
+  boost::asio::awaitable<std::optional<FlowFlushReport>> routeThroughOutlineAsync(
+      std::string outlineServerIP, bool flushStaleFlows, std::chrono::milliseconds timeout);
+  boost::asio::awaitable<void> prepareRoutingAsync(std::string outlineServerIP,
+                                                   std::chrono::milliseconds timeout);
+  boost::asio::awaitable<std::optional<FlowFlushReport>> commitRoutingAsync(
+      bool flushStaleFlows, std::chrono::milliseconds timeout);
+  boost::asio::awaitable<void> abortRoutingAsync(std::chrono::milliseconds timeout);
+  boost::asio::awaitable<void> holdRoutingAsync(std::chrono::milliseconds timeout);
+  boost::asio::awaitable<std::optional<FlowFlushReport>> routeDirectlyAsync(
+      bool flushStaleFlows, std::chrono::milliseconds timeout);
+
+  /**
+   * keeps the routes into the tun device while the client restarts its
+   * tunnel process: until a reader attaches again the traffic is dropped by
+   * the (persistent) tun device instead of leaking, whatever the data plane
+   * loss policy. the next routeThroughOutline, or prepareRouting and
+   * commitRouting, takes the routing over as it is, only swapping the route
+   * to the outline server if it has changed. routeDirectly ends the hold too
+   */
+  void holdRouting();
+
+  /**
+   * keeps the traffic of the processes in the given cgroup v2 paths (relative
+   * to the cgroup2 mount, e.g. "system.slice/backup.service") out of the
+   * tunnel, replacing the previous list. an empty list removes the bypass.
+   * the cgroups must exist, and the rest of the routing state is untouched
+   */
+  void setBypassCgroups(const std::vector<std::string>& cgroupPaths);
+  boost::asio::awaitable<void> setBypassCgroupsAsync(std::vector<std::string> cgroupPaths,
+                                                     std::chrono::milliseconds timeout);
+
+  /**
+   * keeps the traffic to the local networks (link-local, and the private
+   * ranges behind the local router) out of the tunnel. takes effect at the
+   * next routeThroughOutline/commitRouting. may be called from any thread
+   */
+  void setLocalNetworkBypass(bool enabled);
+
+  /**
+   * called by the network monitor when addresses or routes have changed,
+   * brings the local network routes up to date on the worker thread
+   */
+  boost::asio::awaitable<void> handleNetworkChange();
+
+  /**
+   * tells which path the traffic to each destination takes: "tunnel",
+   * "direct", "local" or "unreachable" ("invalid" for malformed addresses).
+   * answered from a mirror of the routing table, rebuilt after the routes or
+   * addresses have changed. the awaitable version runs on the worker thread,
+   * after the routing operation in progress if any
    */
-  void routeDirectly();
+  std::vector<std::string> classifyDestinations(const std::vector<std::string>& destinations);
+  boost::asio::awaitable<std::vector<std::string>> classifyDestinationsAsync(
+      std::vector<std::string> destinations, std::chrono::milliseconds timeout);
 
   /**
    *
@@ -58,6 +201,51 @@ class OutlineProxyController {
    */
   std::string getTunDeviceName();
 
+  /**
+   * Returns the name of the interface leading to the outline server, empty
+   * until it has been detected, as of the last completed operation. Does not
+   * wait for the operation in progress
+   */
+  std::string getUplinkInterfaceName();
+
+  // what to do when the process reading from the tun device is gone
+  enum DataPlaneLossPolicy {
+    // fall back to the default gateway, traffic is no longer protected
+    ROUTE_DIRECTLY_ON_LOSS,
+    // keep routing into the tun device, so traffic is dropped instead of leaked
+    BLOCK_TRAFFIC_ON_LOSS
+  };
+
+  // may be called from any thread, like setLocalNetworkBypass
+  void setDataPlaneLossPolicy(DataPlaneLossPolicy policy);
+
+  bool isRoutingThroughOutline() { return routingStatus == ROUTING_THROUGH_OUTLINE; }
+
+  /**
+   * called by the watchdog when nobody reads from the tun device anymore
+   * (tun2socks crashed), applies the data plane loss policy. the decision
+   * and the fall back to the default gateway run on the worker thread, as
+   * routeDirectlyAsync, and the listeners are told the new status once they
+   * have completed, on the caller's executor
+   */
+  boost::asio::awaitable<void> handleDataPlaneLoss();
+
+  /**
+   * called by the watchdog when a reader attaches to the tun device again,
+   * runs on the worker thread like handleDataPlaneLoss
+   */
+  boost::asio::awaitable<void> handleDataPlaneRecovery();
+
+  typedef std::function<void(TunnelStatus)> StatusListener;
+
+  /**
+   * registers a listener which is notified whenever the tunnel status changes
+   * on its own (i.e. not as the result of a client request). Returns an id to
+   * be used with removeStatusListener.
+   */
+  int addStatusListener(StatusListener listener);
+  void removeStatusListener(int listenerId);
+
  private:
   // this enum is representing different stage of outing and "de"routing
   // through outline proxy server. And is used for exmaple in undoing
@@ -75,7 +263,11 @@ class OutlineProxyController {
   enum OutlineConnectionStatus {
     ROUTING_THROUGH_OUTLINE,
     ROUTING_THROUGH_DEFAULT_GATEWAY
-  } routingStatus;
+  };
+  // written by the operations, read from any thread
+  std::atomic<OutlineConnectionStatus> routingStatus{ROUTING_THROUGH_DEFAULT_GATEWAY};
+
+  void notifyStatusChanged(TunnelStatus status);
   /**
    * auxilary function to check the status code of a command
    */
@@ -98,6 +290,18 @@ class OutlineProxyController {
 
   void setTunDeviceIP();
 
+  /**
+   * sets the transmit queue length and the qdisc of the tun device, so a
+   * saturated tunnel does not add latency to every other flow
+   */
+  void applyTunQueueingProfile();
+
+  /**
+   * steers the packets of the tun queues attached so far to the configured
+   * CPUs, keeping the previous masks to restore them on teardown
+   */
+  void applyTunCpuSteering();
+
   /**
    *  Should be called before changing DNS setting to backup the DNS
    *  setting to restore after.
@@ -122,6 +326,27 @@ class OutlineProxyController {
    */
   void resetFailRoutingAttempt(OutlineConnectionStage failedStage);
 
+  /**
+   * runs `operation` on the worker thread under `timeout`, see
+   * routeThroughOutlineAsync
+   */
+  boost::asio::awaitable<void> runOperation(std::chrono::milliseconds timeout,
+                                            std::function<void()> operation);
+  boost::asio::awaitable<void> runOnWorker(std::shared_ptr<OperationDeadline> deadline,
+                                           std::function<void()> operation);
+
+  /**
+   * copies clientToServerRoutingInterface for getUplinkInterfaceName, once an
+   * operation is over
+   */
+  void publishUplinkName();
+
+  /**
+   * a safe point of the current operation before `stage`, throws if the
+   * operation has been cancelled or has timed out
+   */
+  void checkpoint(const std::string& stage);
+
   /**
    * exectues a shell command and returns the stdout
    */
@@ -136,6 +361,7 @@ class OutlineProxyController {
   OutputAndStatus executeIPAddress(const CommandArguments &args);
 
   OutputAndStatus executeSysctl(const CommandArguments &args);
+  OutputAndStatus executeNft(const CommandArguments &args);
 
   void detectBestInterfaceIndex();
   void processRoutingTable();
@@ -157,6 +383,137 @@ class OutlineProxyController {
 
   void toggleIPv6(bool IPv6Status);
 
+  /**
+   * looks up the network we are currently connected to in the network profile
+   * cache, using the neighbour table only. returns nullptr for unknown networks
+   */
+  const NetworkProfile* findCurrentNetworkProfile();
+
+  /**
+   * adds to graph the stage replacing the default routes by the routes
+   * through outline according to a cached network profile, in a single
+   * netlink batch, and undone by the inverse batch. returns nothing (and
+   * changes nothing) if the profile does not match the routing table anymore
+   */
+  std::optional<StageGraph::StageId> routeThroughNetworkProfile(const NetworkProfile& profile,
+                                                                StageGraph& graph);
+
+  /**
+   * remembers the network we have just detected, so the next connection to it
+   * does not need to detect it again
+   */
+  void cacheCurrentNetworkProfile(const std::vector<RouteEntry>& defaultRoutes);
+
+  /**
+   * the route changes switching the defaultRoutes of the current gateway to
+   * the tun device, with the route to the outline server first
+   */
+  RouteBatch connectBatch(const std::vector<RouteEntry>& defaultRoutes);
+
+  /**
+   * compiles the connect plan of the current outline server and gateway, so
+   * the next connection or disconnection only sends a prebuilt batch
+   */
+  void compileConnectPlan(std::vector<RouteEntry> defaultRoutes);
+
+  /**
+   * adds to graph the stage routing through outline by sending the batch of
+   * the connect plan for the current server, undone by the compiled inverse
+   * batch. outdated is set if the stage fails because the routing table does
+   * not match the plan anymore
+   */
+  StageGraph::StageId routeThroughConnectPlan(StageGraph& graph, bool& outdated);
+
+  /**
+   * routes directly by sending the inverse batch of the connect plan. returns
+   * false (and changes nothing) if there is no plan for the current server
+   * and gateway or the routing table does not match it anymore
+   */
+  bool routeDirectlyThroughConnectPlan();
+
+  /**
+   * drops the connect plan if the routes it relies on have changed
+   */
+  void validateConnectPlan();
+
+  /**
+   * backs up the DNS setting, falling back to the backup cached for
+   * knownNetwork if the current one is still generated by outline
+   */
+  void backupDNSSettingOnNetwork(const NetworkProfile* knownNetwork);
+
+  /**
+   * adds the stages disabling IPv6 and enforcing outline DNS to a connection;
+   * the DNS stage waits for tunRoute, the stage routing the traffic into the
+   * tun device if the graph has one
+   */
+  void addProtectionStages(StageGraph& graph,
+                           const std::vector<StageGraph::StageId>& tunRoute = {});
+
+  /**
+   * runs a connection graph on the stage workers; if a stage fails, undoes
+   * the completed ones, resets the attempt from failedStage and throws
+   */
+  void runConnectStages(StageGraph& graph, OutlineConnectionStage failedStage);
+
+  /**
+   * marks the routing as going through outline and runs the best effort
+   * steps, the common tail of routeThroughOutline and commitRouting
+   */
+  std::optional<FlowFlushReport> finishRoutingThroughOutline(
+      const std::vector<RouteEntry>& defaultRoutes, bool flushStaleFlows);
+
+  /**
+   * the cgroup bypass marks the packets of bypassed sockets in nftables and
+   * steers the marked packets with two policy rules: first the main table
+   * without its default routes (so the LAN and the outline server stay
+   * reachable), then the bypass table holding the default routes we have
+   * replaced by the tun device. the bypass table is only filled while we
+   * route through outline, otherwise marked packets fall through to main.
+   */
+  void installBypassRules();
+  void removeBypassRules();
+
+  /**
+   * applies the difference between the local network routes installed in the
+   * main table and the ones the current uplink calls for (none unless the
+   * bypass is enabled and we route through outline)
+   */
+  void updateLocalNetworkRoutes();
+
+  /**
+   * probes the path MTU to the outline server through the uplink and sets
+   * the MTU of the tun device so that the packets encapsulated by the tunnel
+   * fit in it. only probes again if the uplink has changed since last time.
+   * returns once the probe is started, it runs on mtuProbeWorker
+   */
+  void adjustTunnelMtu();
+
+  /**
+   * clamps the MSS of the TCP connections going through the tun device to
+   * its MTU, for the hosts we route for (their MSS ignores our tun MTU)
+   */
+  void installMssClamp();
+  void removeMssClamp();
+
+  /**
+   * replaces the routes of the bypass table by the given default routes, an
+   * empty list just empties it
+   */
+  void updateBypassRoutes(const std::vector<RouteEntry>& defaultRoutes);
+
+  RouteEntry outlineServerRoute();
+  RouteEntry tunDefaultRoute();
+
+  /**
+   * deletes conntrack entries and destroys sockets originated from
+   * staleSourceIP, except the ones towards preservedPeerIP. failures are
+   * only logged as the routing itself has already been switched, and nothing
+   * is returned then
+   */
+  std::optional<FlowFlushReport> flushStaleFlows(const std::string& staleSourceIP,
+                                                 const std::string& preservedPeerIP);
+
   void getIntefraceMetric();
 
   // utility functions
@@ -179,9 +536,11 @@ class OutlineProxyController {
   const std::string IPLinkSubCommand = "link";
   const std::string IPTunTapSubCommand = "tuntap";
   const std::string sysctlCommand = "/usr/sbin/sysctl";
+  const std::string nftCommand = "/usr/sbin/nft";
 
   const std::string c_normal_traffic_priority_metric = "10";
   const std::string c_proxy_priority_metric = "5";
+  const std::string c_local_network_priority_metric = "7";
 
   // TODO: Configure these values at runtime.
   std::string tunInterfaceName = "outline-tun0";
@@ -189,10 +548,43 @@ class OutlineProxyController {
   std::string tunInterfaceRouterIp = "10.0.85.2";
   std::string outlineServerIP;
   std::string outlineDNSServer = "9.9.9.9";
+  QueueingProfile tunQueueingProfile;
+  CpuSteering tunCpuSteering;
 
   std::string clientLocalIP;
   std::string routingGatewayIP;
   std::string clientToServerRoutingInterface;
+  // clientToServerRoutingInterface as of the last operation, for
+  // getUplinkInterfaceName
+  std::mutex uplinkNameMutex;
+  std::string uplinkName;
+
+  NetlinkSocket routingSocket{NETLINK_ROUTE};
+  NetworkProfileCache networkProfileCache;
+
+  // what prepareRouting has computed for commitRouting
+  struct PreparedRouting {
+    std::vector<RouteEntry> defaultRoutes;
+    RouteBatch commitBatch;
+    // set instead when the routing is held, commitRouting resumes it
+    std::string heldServerIP;
+  };
+  std::optional<PreparedRouting> preparedRouting;
+
+  // the route batches of a connection to outlineServerIP through the current
+  // gateway, compiled once and replayed until a network change outdates them
+  struct ConnectPlan {
+    std::string serverIP;
+    std::string gatewayIP;
+    std::string interfaceName;
+    std::string localIP;
+    // the routes replaced while connected, and the routes replacing them
+    std::vector<RouteEntry> defaultRoutes;
+    std::vector<RouteEntry> connectedRoutes;
+    CompiledRouteBatch connect;
+    CompiledRouteBatch disconnect;
+  };
+  std::optional<ConnectPlan> connectPlan;
 
   // TODO [vmon] We have to keep track of connect request so if we receive two
   // consequective connect request we have to disconnect first. So we don't
@@ -204,10 +596,53 @@ class OutlineProxyController {
   std::stringstream backedupResolveConfHeader;
   bool DNSSettingBackedup = false;
 
+  std::atomic<DataPlaneLossPolicy> dataPlaneLossPolicy{ROUTE_DIRECTLY_ON_LOSS};
+  bool dataPlaneLost = false;
+  bool routingHeld = false;
+
+  /**
+   * takes over the held routing for the given outline server, returns false
+   * if the routing is not held
+   */
+  bool resumeHeldRouting(const std::string& outlineServerIP);
+
+  std::atomic<bool> localNetworkBypass{false};
+
+  // the uplink (and server) the tun device MTU was last probed for, and the
+  // number of the last probe, shared with the probe thread
+  std::mutex tunnelMtuMutex;
+  std::string tunnelMtuProbeKey;
+  uint64_t tunnelMtuProbeGeneration = 0;
+  bool mssClampInstalled = false;
+
+  RouteClassifier routeClassifier;
+  bool routeClassifierOutdated = true;
+
+  // cgroup v2 paths whose traffic does not go through outline
+  std::vector<std::string> bypassCgroups;
+  // what updateBypassRoutes has put into the bypass table
+  std::vector<RouteEntry> bypassRoutes;
+
+  std::map<int, StatusListener> statusListeners;
+  int nextStatusListenerId = 0;
+
   // storing different route inorder to delete them later
   std::string throughGatewayRoute;
   std::string throughOutlineTunDeviceRoute;
   std::string outlineProxyThroughGatewayRoute;
+
+  // held by whoever uses the controller, the worker thread included
+  std::recursive_mutex operationMutex;
+  // the deadline of the awaitable operation being run, if any
+  std::shared_ptr<OperationDeadline> currentOperation;
+  std::chrono::milliseconds routingTimeout;
+  // the independent stages of a routing operation run on these, at most the
+  // route to the server, the route snapshot, IPv6 and DNS at once
+  boost::asio::thread_pool stageWorkers{4};
+  // runs the awaitable operations, one at a time
+  boost::asio::thread_pool operationWorker{1};
+  // runs the path MTU probes, one at a time
+  boost::asio::thread_pool mtuProbeWorker{1};
 };
 
 }  // namespace outline
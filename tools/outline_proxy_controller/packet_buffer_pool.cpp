@@ -0,0 +1,307 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "packet_buffer_pool.h"
+
+using namespace outline;
+
+namespace outline::detail {
+
+/**
+ * @brief The header of a pooled buffer, followed by its headroom and data.
+ */
+struct alignas(64) PacketBuffer {
+  std::atomic<uint32_t> references;
+  uint32_t capacity;
+  PacketBufferPool::ThreadCache *owner;
+  PacketBuffer *next;
+  int size_class;
+
+  uint8_t *memory() { return reinterpret_cast<uint8_t *>(this + 1); }
+};
+
+}  // namespace outline::detail
+
+using detail::PacketBuffer;
+
+static const size_t kSlabSize = 2 * 1024 * 1024;
+static const size_t kSizeClassCapacity[] = {PacketBufferPool::kSmallCapacity,
+                                            PacketBufferPool::kLargeCapacity};
+
+// MPOL_PREFERRED of <linux/mempolicy.h>, which conflicts with <numaif.h>
+static const int kPreferredNodePolicy = 1;
+
+struct PacketBufferPool::ThreadCache {
+  struct SizeClass {
+    // only touched by the owning thread
+    PacketBuffer *free = nullptr;
+    // pushed by the other threads, taken whole by the owning thread
+    std::atomic<PacketBuffer *> returned{nullptr};
+  };
+
+  uint64_t pool_id;
+  int node;
+  SizeClass size_classes[2];
+  // set when the owning thread exits, until another thread adopts the cache
+  std::atomic<bool> orphaned{false};
+};
+
+namespace {
+
+/**
+ * @brief The caches of the calling thread, one per pool, orphaned when the
+ *        thread exits.
+ */
+struct LocalCaches {
+  std::vector<std::pair<uint64_t, std::shared_ptr<PacketBufferPool::ThreadCache>>> caches;
+
+  ~LocalCaches() {
+    for (auto &[pool_id, cache] : caches) {
+      cache->orphaned.store(true, std::memory_order_release);
+    }
+  }
+
+  PacketBufferPool::ThreadCache *Find(uint64_t pool_id) const {
+    for (auto &[id, cache] : caches) {
+      if (id == pool_id) {
+        return cache.get();
+      }
+    }
+    return nullptr;
+  }
+};
+
+thread_local LocalCaches local_caches;
+
+std::atomic<uint64_t> next_pool_id{1};
+
+}  // namespace
+
+static int CurrentNode() {
+  unsigned cpu = 0;
+  unsigned node = 0;
+  if (::syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+    return -1;
+  }
+  return static_cast<int>(node);
+}
+
+//#region PacketSlice Implementation
+
+PacketSlice::PacketSlice(const PacketSlice &other)
+    : buffer_{other.buffer_}, offset_{other.offset_}, length_{other.length_} {
+  if (buffer_ != nullptr) {
+    buffer_->references.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+PacketSlice::PacketSlice(PacketSlice &&other) noexcept
+    : buffer_{std::exchange(other.buffer_, nullptr)},
+      offset_{std::exchange(other.offset_, 0)},
+      length_{std::exchange(other.length_, 0)} {}
+
+PacketSlice &PacketSlice::operator=(PacketSlice other) noexcept {
+  std::swap(buffer_, other.buffer_);
+  std::swap(offset_, other.offset_);
+  std::swap(length_, other.length_);
+  return *this;
+}
+
+PacketSlice::~PacketSlice() {
+  Reset();
+}
+
+uint8_t *PacketSlice::data() const {
+  return buffer_ != nullptr ? buffer_->memory() + offset_ : nullptr;
+}
+
+size_t PacketSlice::tailroom() const {
+  if (buffer_ == nullptr) {
+    return 0;
+  }
+  return PacketBufferPool::kHeadroom + buffer_->capacity - offset_ - length_;
+}
+
+uint8_t *PacketSlice::Prepend(size_t length) {
+  if (buffer_ == nullptr || length > offset_) {
+    throw std::length_error("not enough headroom to prepend " + std::to_string(length) +
+                            " bytes");
+  }
+  offset_ -= static_cast<uint32_t>(length);
+  length_ += static_cast<uint32_t>(length);
+  return data();
+}
+
+void PacketSlice::Resize(size_t size) {
+  if (buffer_ == nullptr || size > length_ + tailroom()) {
+    throw std::length_error("cannot resize a packet slice to " + std::to_string(size) +
+                            " bytes");
+  }
+  length_ = static_cast<uint32_t>(size);
+}
+
+PacketSlice PacketSlice::Slice(size_t offset, size_t length) const {
+  if (offset > length_ || length > length_ - offset) {
+    throw std::out_of_range("slice out of the packet");
+  }
+  if (buffer_ == nullptr) {
+    return {};
+  }
+  buffer_->references.fetch_add(1, std::memory_order_relaxed);
+  return PacketSlice{buffer_, offset_ + static_cast<uint32_t>(offset),
+                     static_cast<uint32_t>(length)};
+}
+
+bool PacketSlice::unique() const {
+  return buffer_ != nullptr && buffer_->references.load(std::memory_order_acquire) == 1;
+}
+
+void PacketSlice::Reset() {
+  if (buffer_ != nullptr) {
+    PacketBufferPool::Release(buffer_);
+    buffer_ = nullptr;
+    offset_ = 0;
+    length_ = 0;
+  }
+}
+
+//#endregion PacketSlice Implementation
+
+//#region PacketBufferPool Implementation
+
+PacketBufferPool::PacketBufferPool() : id_{next_pool_id.fetch_add(1)} {}
+
+PacketBufferPool::~PacketBufferPool() {
+  for (auto &[address, size] : slabs_) {
+    ::munmap(address, size);
+  }
+}
+
+PacketSlice PacketBufferPool::Allocate(size_t size) {
+  if (size > kLargeCapacity) {
+    throw std::length_error("packets are at most " + std::to_string(kLargeCapacity) + " bytes");
+  }
+  int size_class = size <= kSmallCapacity ? 0 : 1;
+  auto &cache = LocalCache();
+  auto &buffers = cache.size_classes[size_class];
+
+  auto buffer = buffers.free;
+  if (buffer == nullptr) {
+    buffer = buffers.returned.exchange(nullptr, std::memory_order_acquire);
+  }
+  if (buffer == nullptr) {
+    buffer = NewSlab(cache, size_class);
+  }
+  buffers.free = buffer->next;
+  buffer->references.store(1, std::memory_order_relaxed);
+  return PacketSlice{buffer, kHeadroom, static_cast<uint32_t>(size)};
+}
+
+size_t PacketBufferPool::slab_count() const {
+  std::lock_guard<std::mutex> lock{slabs_mutex_};
+  return slabs_.size();
+}
+
+PacketBufferPool::ThreadCache &PacketBufferPool::LocalCache() {
+  if (auto cache = local_caches.Find(id_)) {
+    return *cache;
+  }
+
+  auto node = CurrentNode();
+  std::shared_ptr<ThreadCache> cache;
+  {
+    std::lock_guard<std::mutex> lock{slabs_mutex_};
+    for (auto &orphan : caches_) {
+      if (orphan->node == node && orphan->orphaned.load(std::memory_order_acquire)) {
+        orphan->orphaned.store(false, std::memory_order_relaxed);
+        cache = orphan;
+        break;
+      }
+    }
+    if (!cache) {
+      cache = std::make_shared<ThreadCache>();
+      cache->pool_id = id_;
+      cache->node = node;
+      caches_.push_back(cache);
+    }
+  }
+  local_caches.caches.emplace_back(id_, cache);
+  return *cache;
+}
+
+PacketBuffer *PacketBufferPool::NewSlab(ThreadCache &cache, int size_class) {
+  auto slab = ::mmap(nullptr, kSlabSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+  if (slab == MAP_FAILED) {
+    throw std::bad_alloc{};
+  }
+  if (cache.node >= 0 && cache.node < 64) {
+    // best effort: the first touch below would place the pages there anyway,
+    // unless the thread migrates in the meantime
+    unsigned long nodes = 1UL << cache.node;
+    ::syscall(SYS_mbind, slab, kSlabSize, kPreferredNodePolicy, &nodes, sizeof(nodes) * 8 + 1, 0);
+  }
+  {
+    std::lock_guard<std::mutex> lock{slabs_mutex_};
+    slabs_.emplace_back(slab, kSlabSize);
+  }
+
+  auto capacity = kSizeClassCapacity[size_class];
+  auto stride = (sizeof(PacketBuffer) + kHeadroom + capacity + alignof(PacketBuffer) - 1) /
+                alignof(PacketBuffer) * alignof(PacketBuffer);
+  PacketBuffer *head = nullptr;
+  for (auto offset = (kSlabSize / stride - 1) * stride;; offset -= stride) {
+    auto buffer = new (static_cast<uint8_t *>(slab) + offset) PacketBuffer;
+    buffer->references.store(0, std::memory_order_relaxed);
+    buffer->capacity = static_cast<uint32_t>(capacity);
+    buffer->owner = &cache;
+    buffer->size_class = size_class;
+    buffer->next = head;
+    head = buffer;
+    if (offset == 0) {
+      break;
+    }
+  }
+  return head;
+}
+
+void PacketBufferPool::Release(PacketBuffer *buffer) {
+  if (buffer->references.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+  auto owner = buffer->owner;
+  auto &buffers = owner->size_classes[buffer->size_class];
+  if (local_caches.Find(owner->pool_id) == owner) {
+    buffer->next = buffers.free;
+    buffers.free = buffer;
+    return;
+  }
+  // only the owner takes the list, and whole, so there is no ABA problem
+  auto head = buffers.returned.load(std::memory_order_relaxed);
+  do {
+    buffer->next = head;
+  } while (!buffers.returned.compare_exchange_weak(head, buffer, std::memory_order_release,
+                                                   std::memory_order_relaxed));
+}
+
+//#endregion PacketBufferPool Implementation
@@ -0,0 +1,150 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace outline {
+
+class PacketBufferPool;
+
+namespace detail {
+struct PacketBuffer;
+}
+
+/**
+ * @brief A refcounted view of a part of a pooled packet buffer. Copies and
+ *        sub-slices share the buffer without copying the bytes, and the last
+ *        one to go returns the buffer to its pool, from any thread.
+ */
+class PacketSlice {
+public:
+  PacketSlice() = default;
+  PacketSlice(const PacketSlice &other);
+  PacketSlice(PacketSlice &&other) noexcept;
+  PacketSlice &operator=(PacketSlice other) noexcept;
+  ~PacketSlice();
+
+  uint8_t *data() const;
+  size_t size() const { return length_; }
+  bool empty() const { return length_ == 0; }
+  explicit operator bool() const { return buffer_ != nullptr; }
+
+  /**
+   * @brief The free bytes in front of the slice, for encapsulation headers,
+   *        and after it.
+   */
+  size_t headroom() const { return offset_; }
+  size_t tailroom() const;
+
+  /**
+   * @brief Extend the slice by `length` bytes into the headroom.
+   *
+   * The bytes in front of the slice are shared with the other slices of the
+   * buffer, so only the last layer to wrap a packet should prepend to it.
+   *
+   * @return uint8_t* The new start of the slice.
+   */
+  uint8_t *Prepend(size_t length);
+
+  /**
+   * @brief Extend or shrink the end of the slice, within the buffer.
+   */
+  void Resize(size_t size);
+
+  /**
+   * @brief The `length` bytes at `offset` of this slice, sharing the buffer.
+   *        The only slice of a slice without a buffer is another one.
+   */
+  PacketSlice Slice(size_t offset, size_t length) const;
+
+  /**
+   * @brief Whether no other slice shares the buffer.
+   */
+  bool unique() const;
+
+  void Reset();
+
+private:
+  friend class PacketBufferPool;
+
+  PacketSlice(detail::PacketBuffer *buffer, uint32_t offset, uint32_t length)
+      : buffer_{buffer}, offset_{offset}, length_{length} {}
+
+  detail::PacketBuffer *buffer_ = nullptr;
+  // from the start of the headroom of the buffer
+  uint32_t offset_ = 0;
+  uint32_t length_ = 0;
+};
+
+/**
+ * @brief Packet buffers carved out of 2 MiB slabs, in two sizes: MTU sized
+ *        and 64 KiB (for GSO/GRO super packets), both with `kHeadroom` free
+ *        bytes in front for encapsulation headers.
+ *
+ * Each thread allocates from its own cache, whose slabs are bound to the NUMA
+ * node of the CPU it runs on, without any lock. A buffer released by its
+ * owning thread goes back to its free list, and one released by another
+ * thread is pushed onto a lock-free list of the owner, which takes it whole
+ * when its free list runs dry. The cache of an exited thread is adopted by the
+ * next thread which starts allocating.
+ *
+ * All the slices must be released before the pool is destroyed.
+ */
+class PacketBufferPool {
+public:
+  static constexpr size_t kHeadroom = 128;
+  static constexpr size_t kSmallCapacity = 2048;
+  static constexpr size_t kLargeCapacity = 64 * 1024;
+
+  PacketBufferPool();
+  ~PacketBufferPool();
+
+  PacketBufferPool(const PacketBufferPool &) = delete;
+  PacketBufferPool &operator=(const PacketBufferPool &) = delete;
+
+  /**
+   * @brief A slice of `size` bytes (at most `kLargeCapacity`) with
+   *        `kHeadroom` bytes in front of it, from the cache of the calling
+   *        thread.
+   */
+  PacketSlice Allocate(size_t size);
+
+  /**
+   * @brief The number of slabs mapped so far.
+   */
+  size_t slab_count() const;
+
+  struct ThreadCache;
+
+private:
+  friend class PacketSlice;
+
+  ThreadCache &LocalCache();
+  detail::PacketBuffer *NewSlab(ThreadCache &cache, int size_class);
+  static void Release(detail::PacketBuffer *buffer);
+
+  const uint64_t id_;
+  mutable std::mutex slabs_mutex_;
+  std::vector<std::pair<void *, size_t>> slabs_;
+  std::vector<std::shared_ptr<ThreadCache>> caches_;
+};
+
+}  // namespace outline
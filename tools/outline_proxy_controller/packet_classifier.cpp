@@ -0,0 +1,291 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <tuple>
+
+#include <arpa/inet.h>
+
+#include "ethernet_frame.h"
+#include "packet_classifier.h"
+
+using namespace outline;
+using frame::Load16;
+using frame::Load32;
+
+static const uint8_t kTcpProtocol = 6;
+static const uint8_t kUdpProtocol = 17;
+static const uint8_t kHopByHopHeader = 0;
+static const uint8_t kRoutingHeader = 43;
+static const uint8_t kFragmentHeader = 44;
+static const uint8_t kDestinationOptionsHeader = 60;
+// how many IPv6 extension headers are skipped to find the transport protocol
+static const int kMaxExtensionHeaders = 8;
+
+static const uint16_t kIpv4DefaultClass = 0;
+static const uint16_t kIpv6DefaultClass = 1;
+
+namespace outline {
+
+const char *PacketVerdictName(PacketVerdict verdict) {
+  switch (verdict) {
+    case PacketVerdict::kTunnel:
+      return "tunnel";
+    case PacketVerdict::kBypass:
+      return "bypass";
+    case PacketVerdict::kDrop:
+      return "drop";
+    case PacketVerdict::kInterceptDns:
+      return "interceptDns";
+  }
+  return "unknown";
+}
+
+}  // namespace outline
+
+/**
+ * @brief Whether the first `length` bits of `a` and `b` are equal.
+ */
+static bool PrefixEqual(const uint8_t *a, const uint8_t *b, uint8_t length) {
+  auto bytes = length / 8;
+  if (!std::equal(a, a + bytes, b)) {
+    return false;
+  }
+  auto bits = length % 8;
+  return bits == 0 || ((a[bytes] ^ b[bytes]) & (0xff << (8 - bits))) == 0;
+}
+
+static void ParseIpv4(std::span<const uint8_t> packet, FlowTuples &tuples, size_t i) {
+  auto header_length = static_cast<size_t>(packet[0] & 0x0f) * 4;
+  if (header_length < 20 || header_length > packet.size()) {
+    return;
+  }
+  tuples.version[i] = 4;
+  tuples.protocol[i] = packet[9];
+  tuples.source_v4[i] = Load32(&packet[12]);
+  tuples.destination_v4[i] = Load32(&packet[16]);
+  auto later_fragment = (Load16(&packet[6]) & 0x1fff) != 0;
+  if ((packet[9] == kTcpProtocol || packet[9] == kUdpProtocol) && !later_fragment &&
+      packet.size() >= header_length + 4) {
+    tuples.source_port[i] = Load16(&packet[header_length]);
+    tuples.destination_port[i] = Load16(&packet[header_length + 2]);
+  }
+}
+
+static void ParseIpv6(std::span<const uint8_t> packet, FlowTuples &tuples, size_t i) {
+  if (packet.size() < 40) {
+    return;
+  }
+  auto next_header = packet[6];
+  size_t offset = 40;
+  auto later_fragment = false;
+  for (int headers = 0; headers < kMaxExtensionHeaders; headers++) {
+    if (next_header == kHopByHopHeader || next_header == kRoutingHeader ||
+        next_header == kDestinationOptionsHeader) {
+      if (offset + 2 > packet.size()) {
+        return;
+      }
+      next_header = packet[offset];
+      offset += (static_cast<size_t>(packet[offset + 1]) + 1) * 8;
+    } else if (next_header == kFragmentHeader) {
+      if (offset + 8 > packet.size()) {
+        return;
+      }
+      next_header = packet[offset];
+      later_fragment = (Load16(&packet[offset + 2]) & 0xfff8) != 0;
+      offset += 8;
+    } else {
+      break;
+    }
+  }
+  tuples.version[i] = 6;
+  tuples.protocol[i] = next_header;
+  std::copy_n(&packet[8], 16, tuples.source_v6[i].begin());
+  std::copy_n(&packet[24], 16, tuples.destination_v6[i].begin());
+  if ((next_header == kTcpProtocol || next_header == kUdpProtocol) && !later_fragment &&
+      packet.size() >= offset + 4) {
+    tuples.source_port[i] = Load16(&packet[offset]);
+    tuples.destination_port[i] = Load16(&packet[offset + 2]);
+  }
+}
+
+//#region PacketClassifier Implementation
+
+PacketClassifier::PacketClassifier(PacketVerdict default_verdict)
+    : default_verdict_{default_verdict}, ipv4_classes_{kIpv4DefaultClass} {
+  Rebuild({});
+}
+
+void PacketClassifier::Rebuild(const std::vector<ClassifierRule> &rules) {
+  struct ParsedRule {
+    bool ipv6;
+    std::array<uint8_t, 16> network;
+    uint8_t length;
+    PortRule port_rule;
+  };
+
+  std::vector<ParsedRule> parsed;
+  for (const auto &rule : rules) {
+    ParsedRule entry{};
+    entry.ipv6 = rule.network.find(':') != std::string::npos;
+    if (::inet_pton(entry.ipv6 ? AF_INET6 : AF_INET, rule.network.c_str(),
+                    entry.network.data()) != 1) {
+      throw std::invalid_argument("invalid network " + rule.network);
+    }
+    if (rule.prefix_length > (entry.ipv6 ? 128 : 32) || rule.first_port > rule.last_port) {
+      throw std::invalid_argument("invalid prefix length or port range for " + rule.network);
+    }
+    entry.length = rule.prefix_length;
+    // clear the host bits
+    for (size_t bit = entry.length; bit < 128; bit++) {
+      entry.network[bit / 8] &= static_cast<uint8_t>(~(0x80 >> (bit % 8)));
+    }
+    entry.port_rule = {rule.protocol, rule.first_port, rule.last_port, rule.verdict};
+    parsed.push_back(entry);
+  }
+  // the most specific prefixes first, then in the order listed
+  std::stable_sort(parsed.begin(), parsed.end(),
+                   [](const auto &a, const auto &b) { return a.length > b.length; });
+
+  std::map<std::tuple<bool, std::array<uint8_t, 16>, uint8_t>, uint16_t> class_ids{
+      {{false, {}, 0}, kIpv4DefaultClass}, {{true, {}, 0}, kIpv6DefaultClass}};
+  for (const auto &rule : parsed) {
+    auto id = static_cast<uint16_t>(class_ids.size());
+    if (class_ids.size() > UINT16_MAX) {
+      throw std::invalid_argument("too many distinct networks in the classifier rules");
+    }
+    class_ids.emplace(std::make_tuple(rule.ipv6, rule.network, rule.length), id);
+  }
+
+  std::vector<std::tuple<bool, std::array<uint8_t, 16>, uint8_t>> classes(class_ids.size());
+  for (const auto &[key, id] : class_ids) {
+    classes[id] = key;
+  }
+  class_offsets_.clear();
+  port_rules_.clear();
+  for (const auto &[ipv6, network, length] : classes) {
+    class_offsets_.push_back(static_cast<uint32_t>(port_rules_.size()));
+    for (const auto &rule : parsed) {
+      if (rule.ipv6 != ipv6 || rule.length > length ||
+          !PrefixEqual(rule.network.data(), network.data(), rule.length)) {
+        continue;
+      }
+      port_rules_.push_back(rule.port_rule);
+      // a rule for any protocol and any port hides the less specific ones
+      if (rule.port_rule.protocol == 0 && rule.port_rule.first_port == 0 &&
+          rule.port_rule.last_port == 65535) {
+        break;
+      }
+    }
+  }
+  class_offsets_.push_back(static_cast<uint32_t>(port_rules_.size()));
+
+  std::vector<PrefixTrie::Prefix> ipv4_prefixes;
+  ipv6_prefixes_.clear();
+  for (size_t id = 0; id < classes.size(); id++) {
+    const auto &[ipv6, network, length] = classes[id];
+    if (length == 0) {
+      continue;
+    }
+    if (ipv6) {
+      ipv6_prefixes_.push_back({network, length, static_cast<uint16_t>(id)});
+    } else {
+      ipv4_prefixes.push_back({Load32(network.data()), length, static_cast<uint16_t>(id)});
+    }
+  }
+  std::stable_sort(ipv6_prefixes_.begin(), ipv6_prefixes_.end(),
+                   [](const auto &a, const auto &b) { return a.length > b.length; });
+  ipv4_classes_ = PrefixTrie::Build(std::move(ipv4_prefixes), kIpv4DefaultClass);
+}
+
+void PacketClassifier::Parse(std::span<const std::span<const uint8_t>> packets,
+                             FlowTuples &tuples) {
+  if (packets.size() > FlowTuples::kCapacity) {
+    throw std::invalid_argument("too many packets for a batch");
+  }
+  tuples.count = packets.size();
+  for (size_t i = 0; i < packets.size(); i++) {
+    tuples.version[i] = 0;
+    tuples.protocol[i] = 0;
+    tuples.source_port[i] = 0;
+    tuples.destination_port[i] = 0;
+    // looked up for every packet of the batch
+    tuples.destination_v4[i] = 0;
+    const auto &packet = packets[i];
+    if (packet.empty()) {
+      continue;
+    }
+    switch (packet[0] >> 4) {
+      case 4:
+        ParseIpv4(packet, tuples, i);
+        break;
+      case 6:
+        ParseIpv6(packet, tuples, i);
+        break;
+    }
+  }
+}
+
+void PacketClassifier::Classify(const FlowTuples &tuples, PacketVerdict *verdicts) const {
+  std::array<uint16_t, FlowTuples::kCapacity> class_ids;
+  ipv4_classes_.LookupBatch(tuples.destination_v4.data(), class_ids.data(), tuples.count);
+  for (size_t i = 0; i < tuples.count; i++) {
+    switch (tuples.version[i]) {
+      case 4:
+        verdicts[i] = Decide(class_ids[i], tuples.protocol[i], tuples.destination_port[i]);
+        break;
+      case 6:
+        verdicts[i] = Decide(LookupIpv6(tuples.destination_v6[i]), tuples.protocol[i],
+                             tuples.destination_port[i]);
+        break;
+      default:
+        verdicts[i] = PacketVerdict::kDrop;
+    }
+  }
+}
+
+void PacketClassifier::Classify(std::span<const std::span<const uint8_t>> packets,
+                                PacketVerdict *verdicts) const {
+  FlowTuples tuples;
+  for (size_t first = 0; first < packets.size(); first += FlowTuples::kCapacity) {
+    auto batch = packets.subspan(first, std::min(FlowTuples::kCapacity, packets.size() - first));
+    Parse(batch, tuples);
+    Classify(tuples, verdicts + first);
+  }
+}
+
+PacketVerdict PacketClassifier::Decide(uint16_t class_id, uint8_t protocol, uint16_t port) const {
+  auto first = port_rules_.begin() + class_offsets_[class_id];
+  auto last = port_rules_.begin() + class_offsets_[class_id + 1];
+  for (auto rule = first; rule != last; rule++) {
+    if ((rule->protocol == 0 || rule->protocol == protocol) && port >= rule->first_port &&
+        port <= rule->last_port) {
+      return rule->verdict;
+    }
+  }
+  return default_verdict_;
+}
+
+uint16_t PacketClassifier::LookupIpv6(const std::array<uint8_t, 16> &address) const {
+  for (const auto &prefix : ipv6_prefixes_) {
+    if (PrefixEqual(prefix.network.data(), address.data(), prefix.length)) {
+      return prefix.class_id;
+    }
+  }
+  return kIpv6DefaultClass;
+}
+
+//#endregion PacketClassifier Implementation
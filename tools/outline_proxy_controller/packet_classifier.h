@@ -0,0 +1,150 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "prefix_trie.h"
+
+namespace outline {
+
+/**
+ * @brief What the data plane does with a packet.
+ */
+enum class PacketVerdict : uint8_t {
+  kTunnel = 0,
+  kBypass = 1,
+  kDrop = 2,
+  kInterceptDns = 3,
+};
+
+const char *PacketVerdictName(PacketVerdict verdict);
+
+/**
+ * @brief A rule of the classifier: the packets to `network`/`prefix_length`
+ *        (IPv4 or IPv6), of `protocol` (any if 0) and to a destination port
+ *        within [`first_port`, `last_port`], get `verdict`.
+ *
+ * Among the rules matching a packet, the one with the longest prefix wins,
+ * then the first one listed.
+ */
+struct ClassifierRule {
+  std::string network;
+  uint8_t prefix_length = 0;
+  uint8_t protocol = 0;
+  uint16_t first_port = 0;
+  uint16_t last_port = 65535;
+  PacketVerdict verdict = PacketVerdict::kTunnel;
+};
+
+/**
+ * @brief The 5-tuples of a batch of IP packets, one array per field so that
+ *        every stage of the classification streams through one of them.
+ */
+struct FlowTuples {
+  static constexpr size_t kCapacity = 64;
+
+  size_t count = 0;
+  // 4 or 6, or 0 if the packet could not be parsed
+  std::array<uint8_t, kCapacity> version;
+  // the transport protocol, after the IPv6 extension headers
+  std::array<uint8_t, kCapacity> protocol;
+  // 0 without a TCP or UDP header, e.g. in a later fragment
+  std::array<uint16_t, kCapacity> source_port;
+  std::array<uint16_t, kCapacity> destination_port;
+  // IPv4 addresses in host byte order
+  std::array<uint32_t, kCapacity> source_v4;
+  std::array<uint32_t, kCapacity> destination_v4;
+  std::array<std::array<uint8_t, 16>, kCapacity> source_v6;
+  std::array<std::array<uint8_t, 16>, kCapacity> destination_v6;
+};
+
+/**
+ * @brief Decides per packet, for the native data plane, between the tunnel,
+ *        the bypass, dropping and the DNS interception, out of tables built
+ *        once from the rules.
+ *
+ * Every distinct prefix of the rules is a class, with the port ranges of the
+ * rules covering it, most specific first. The IPv4 classes are looked up in a
+ * PrefixTrie, a batch at a time, and the IPv6 classes by scanning their
+ * prefixes from the longest; the port ranges of the class then pick the
+ * verdict.
+ */
+class PacketClassifier {
+public:
+  /**
+   * @param default_verdict The verdict of the packets matching no rule.
+   */
+  explicit PacketClassifier(PacketVerdict default_verdict = PacketVerdict::kTunnel);
+
+  /**
+   * @brief Replace the rules.
+   *
+   * @throw std::invalid_argument If a network or a prefix length is invalid.
+   */
+  void Rebuild(const std::vector<ClassifierRule> &rules);
+
+  /**
+   * @brief Parse up to `FlowTuples::kCapacity` IP packets (without link layer
+   *        header, as read from a tun device).
+   */
+  static void Parse(std::span<const std::span<const uint8_t>> packets, FlowTuples &tuples);
+
+  /**
+   * @brief The verdicts of the parsed packets; those which could not be
+   *        parsed are dropped.
+   */
+  void Classify(const FlowTuples &tuples, PacketVerdict *verdicts) const;
+
+  /**
+   * @brief Parse and classify any number of packets, a batch at a time.
+   */
+  void Classify(std::span<const std::span<const uint8_t>> packets,
+                PacketVerdict *verdicts) const;
+
+private:
+  struct PortRule {
+    uint8_t protocol;
+    uint16_t first_port;
+    uint16_t last_port;
+    PacketVerdict verdict;
+  };
+
+  struct Ipv6Prefix {
+    std::array<uint8_t, 16> network;
+    uint8_t length;
+    uint16_t class_id;
+  };
+
+  PacketVerdict Decide(uint16_t class_id, uint8_t protocol, uint16_t port) const;
+  uint16_t LookupIpv6(const std::array<uint8_t, 16> &address) const;
+
+  const PacketVerdict default_verdict_;
+  PrefixTrie ipv4_classes_;
+  // longest first
+  std::vector<Ipv6Prefix> ipv6_prefixes_;
+  // the port rules of each class, from `class_offsets_[id]` to
+  // `class_offsets_[id + 1]`; classes 0 and 1 match every IPv4 and IPv6
+  // address
+  std::vector<uint32_t> class_offsets_;
+  std::vector<PortRule> port_rules_;
+};
+
+}  // namespace outline
@@ -0,0 +1,285 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+namespace outline {
+
+inline constexpr size_t kCacheLineSize = 64;
+
+struct PacketQueueStats {
+  uint64_t enqueued = 0;
+  uint64_t dequeued = 0;
+  // rejected because the queue was full
+  uint64_t dropped = 0;
+};
+
+namespace detail {
+
+inline size_t CheckedQueueCapacity(size_t capacity) {
+  if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+    throw std::invalid_argument("the capacity of a packet queue must be a power of 2");
+  }
+  return capacity;
+}
+
+}  // namespace detail
+
+/**
+ * @brief A bounded lock-free queue between one producer thread and one
+ *        consumer thread.
+ *
+ * A full queue drops what is pushed (and counts it) instead of blocking or
+ * growing. Each side caches the index of the other one, so it only touches
+ * the other side's cache line when the queue looks full or empty.
+ */
+template <typename T> class SpscPacketQueue {
+public:
+  explicit SpscPacketQueue(size_t capacity)
+      : mask_{detail::CheckedQueueCapacity(capacity) - 1},
+        items_{std::make_unique<T[]>(capacity)} {}
+
+  SpscPacketQueue(const SpscPacketQueue &) = delete;
+  SpscPacketQueue &operator=(const SpscPacketQueue &) = delete;
+
+  size_t capacity() const { return mask_ + 1; }
+
+  /**
+   * @brief Producer side. Enqueue `item`, or drop it if the queue is full.
+   *
+   * @return bool Whether `item` was moved into the queue.
+   */
+  bool Push(T &&item) { return PushBatch(&item, 1) == 1; }
+
+  /**
+   * @brief Producer side. Enqueue as many of the `count` items as fit, in
+   *        order, and count the others as dropped.
+   *
+   * @return size_t The number of leading items moved into the queue; the
+   *         others are left untouched.
+   */
+  size_t PushBatch(T *items, size_t count) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail + count - producer_head_ > capacity()) {
+      producer_head_ = head_.load(std::memory_order_acquire);
+    }
+    auto pushed = std::min(count, capacity() - (tail - producer_head_));
+    for (size_t i = 0; i < pushed; i++) {
+      items_[(tail + i) & mask_] = std::move(items[i]);
+    }
+    tail_.store(tail + pushed, std::memory_order_release);
+    if (pushed < count) {
+      dropped_.fetch_add(count - pushed, std::memory_order_relaxed);
+    }
+    return pushed;
+  }
+
+  /**
+   * @brief Consumer side.
+   *
+   * @return bool Whether an item was moved into `item`.
+   */
+  bool Pop(T &item) { return PopBatch(&item, 1) == 1; }
+
+  /**
+   * @brief Consumer side. Move up to `count` items, in order, into `items`.
+   *
+   * @return size_t The number of items moved.
+   */
+  size_t PopBatch(T *items, size_t count) {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (consumer_tail_ - head < count) {
+      consumer_tail_ = tail_.load(std::memory_order_acquire);
+    }
+    auto popped = std::min(count, consumer_tail_ - head);
+    for (size_t i = 0; i < popped; i++) {
+      items[i] = std::move(items_[(head + i) & mask_]);
+    }
+    head_.store(head + popped, std::memory_order_release);
+    return popped;
+  }
+
+  /**
+   * @brief Safe to call from any thread, the counters are sampled one by one.
+   */
+  PacketQueueStats Stats() const {
+    return {tail_.load(std::memory_order_relaxed), head_.load(std::memory_order_relaxed),
+            dropped_.load(std::memory_order_relaxed)};
+  }
+
+private:
+  const size_t mask_;
+  const std::unique_ptr<T[]> items_;
+
+  // written by the consumer only
+  alignas(kCacheLineSize) std::atomic<size_t> head_{0};
+  size_t consumer_tail_ = 0;
+  // written by the producer only
+  alignas(kCacheLineSize) std::atomic<size_t> tail_{0};
+  size_t producer_head_ = 0;
+  std::atomic<uint64_t> dropped_{0};
+};
+
+/**
+ * @brief A bounded lock-free queue from any number of producer threads to one
+ *        consumer thread.
+ *
+ * Every slot carries a sequence number (as in Dmitry Vyukov's bounded MPMC
+ * queue): a producer claims a slot by advancing the shared tail with a
+ * compare-and-swap, fills it, then publishes it through its sequence number,
+ * so a slow producer never blocks the others from claiming the next slots. A
+ * batch claims a contiguous run of slots with a single compare-and-swap. The
+ * consumer stops at the first slot not yet published.
+ *
+ * A full queue drops what is pushed (and counts it) instead of blocking or
+ * growing.
+ */
+template <typename T> class MpscPacketQueue {
+public:
+  explicit MpscPacketQueue(size_t capacity)
+      : mask_{detail::CheckedQueueCapacity(capacity) - 1},
+        slots_{std::make_unique<Slot[]>(capacity)} {
+    for (size_t i = 0; i < capacity; i++) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  MpscPacketQueue(const MpscPacketQueue &) = delete;
+  MpscPacketQueue &operator=(const MpscPacketQueue &) = delete;
+
+  size_t capacity() const { return mask_ + 1; }
+
+  /**
+   * @brief Producer side, from any thread. Enqueue `item`, or drop it if the
+   *        queue is full.
+   *
+   * @return bool Whether `item` was moved into the queue.
+   */
+  bool Push(T &&item) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      auto &slot = slots_[tail & mask_];
+      auto lag = static_cast<intptr_t>(slot.sequence.load(std::memory_order_acquire) - tail);
+      if (lag == 0) {
+        if (tail_.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) {
+          slot.item = std::move(item);
+          slot.sequence.store(tail + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (lag < 0) {
+        // the consumer has not freed the slot from the previous lap yet
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      } else {
+        tail = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * @brief Producer side, from any thread. Enqueue as many of the `count`
+   *        items as fit, in order and contiguously, and count the others as
+   *        dropped.
+   *
+   * @return size_t The number of leading items moved into the queue; the
+   *         others are left untouched.
+   */
+  size_t PushBatch(T *items, size_t count) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    size_t claimed;
+    do {
+      // the consumer frees the slots in order before advancing its head, so
+      // every slot before the head is free
+      auto head = head_.load(std::memory_order_acquire);
+      claimed = std::min(count, capacity() - std::min(capacity(), tail - head));
+      if (claimed == 0) {
+        break;
+      }
+    } while (!tail_.compare_exchange_weak(tail, tail + claimed, std::memory_order_relaxed));
+
+    for (size_t i = 0; i < claimed; i++) {
+      auto &slot = slots_[(tail + i) & mask_];
+      slot.item = std::move(items[i]);
+      slot.sequence.store(tail + i + 1, std::memory_order_release);
+    }
+    if (claimed < count) {
+      dropped_.fetch_add(count - claimed, std::memory_order_relaxed);
+    }
+    return claimed;
+  }
+
+  /**
+   * @brief Consumer side.
+   *
+   * @return bool Whether an item was moved into `item`.
+   */
+  bool Pop(T &item) { return PopBatch(&item, 1) == 1; }
+
+  /**
+   * @brief Consumer side. Move up to `count` published items, in order, into
+   *        `items`.
+   *
+   * @return size_t The number of items moved.
+   */
+  size_t PopBatch(T *items, size_t count) {
+    auto head = head_.load(std::memory_order_relaxed);
+    size_t popped = 0;
+    for (; popped < count; popped++) {
+      auto &slot = slots_[(head + popped) & mask_];
+      if (slot.sequence.load(std::memory_order_acquire) != head + popped + 1) {
+        break;
+      }
+      items[popped] = std::move(slot.item);
+      slot.sequence.store(head + popped + capacity(), std::memory_order_release);
+    }
+    if (popped > 0) {
+      head_.store(head + popped, std::memory_order_release);
+    }
+    return popped;
+  }
+
+  /**
+   * @brief Safe to call from any thread, the counters are sampled one by one.
+   *        `enqueued` includes the slots claimed but not yet published.
+   */
+  PacketQueueStats Stats() const {
+    return {tail_.load(std::memory_order_relaxed), head_.load(std::memory_order_relaxed),
+            dropped_.load(std::memory_order_relaxed)};
+  }
+
+private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    T item;
+  };
+
+  const size_t mask_;
+  const std::unique_ptr<Slot[]> slots_;
+
+  // written by the consumer only
+  alignas(kCacheLineSize) std::atomic<size_t> head_{0};
+  // shared by the producers
+  alignas(kCacheLineSize) std::atomic<size_t> tail_{0};
+  alignas(kCacheLineSize) std::atomic<uint64_t> dropped_{0};
+};
+
+}  // namespace outline
@@ -0,0 +1,217 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "internet_checksum.h"
+#include "path_mtu_probe.h"
+
+using namespace outline;
+
+// The bisection stops after this many probes even if it has not converged
+static const int kMaximumProbes = 12;
+
+namespace {
+
+enum class ProbeResult {
+  kReply,
+  kTooBig,
+  kLost,
+};
+
+/**
+ * @brief A raw ICMP socket bound to the uplink, closed on destruction.
+ */
+class EchoSocket {
+public:
+  EchoSocket(const std::string &destination, const std::string &interface_name)
+    : fd_{::socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_ICMP)},
+      identifier_{static_cast<uint16_t>(::getpid())}
+  {
+    if (fd_ < 0) {
+      throw std::system_error{errno, std::generic_category(), "failed to open ICMP socket"};
+    }
+    destination_.sin_family = AF_INET;
+    if (::inet_pton(AF_INET, destination.c_str(), &destination_.sin_addr) != 1) {
+      ::close(fd_);
+      throw std::invalid_argument("invalid IPv4 address \"" + destination + "\"");
+    }
+
+    // set DF, without being limited by the path MTU the kernel has cached
+    int discovery = IP_PMTUDISC_PROBE;
+    if (::setsockopt(fd_, SOL_SOCKET, SO_BINDTODEVICE,
+                     interface_name.c_str(), interface_name.size()) != 0 ||
+        ::setsockopt(fd_, IPPROTO_IP, IP_MTU_DISCOVER, &discovery, sizeof(discovery)) != 0) {
+      auto error = errno;
+      ::close(fd_);
+      throw std::system_error{error, std::generic_category(), "failed to set up ICMP socket"};
+    }
+  }
+
+  ~EchoSocket() {
+    ::close(fd_);
+  }
+
+  EchoSocket(const EchoSocket&) = delete;
+  EchoSocket& operator=(const EchoSocket&) = delete;
+
+  /**
+   * @brief Send an echo request of `packet_size` bytes (IPv4 header included)
+   *        and wait for its fate.
+   *
+   * @param next_hop_mtu Set to the MTU reported by a "fragmentation needed" error.
+   */
+  ProbeResult Probe(uint32_t packet_size, std::chrono::milliseconds timeout,
+                    uint32_t &next_hop_mtu) {
+    std::vector<uint8_t> request(packet_size - sizeof(iphdr), 0);
+    icmphdr header{};
+    header.type = ICMP_ECHO;
+    header.un.echo.id = htons(identifier_);
+    header.un.echo.sequence = htons(++sequence_);
+    std::memcpy(request.data(), &header, sizeof(header));
+    header.checksum = htons(checksum::Compute(request.data(), request.size()));
+    std::memcpy(request.data(), &header, sizeof(header));
+
+    if (::sendto(fd_, request.data(), request.size(), 0,
+                 reinterpret_cast<const sockaddr*>(&destination_), sizeof(destination_)) < 0) {
+      // EMSGSIZE: larger than the interface MTU
+      return errno == EMSGSIZE ? ProbeResult::kTooBig : ProbeResult::kLost;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    for (;;) {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+      pollfd readable{fd_, POLLIN, 0};
+      if (remaining.count() <= 0 || ::poll(&readable, 1, static_cast<int>(remaining.count())) <= 0) {
+        return ProbeResult::kLost;
+      }
+
+      std::array<uint8_t, 2048> response;
+      auto received = ::recv(fd_, response.data(), response.size(), 0);
+      if (received <= 0) {
+        continue;
+      }
+      auto result = Match(response.data(), static_cast<size_t>(received), next_hop_mtu);
+      if (result) {
+        return *result;
+      }
+    }
+  }
+
+private:
+  /**
+   * @brief Tell whether a received datagram answers the last probe: either
+   *        its echo reply, or an error quoting it.
+   */
+  std::optional<ProbeResult> Match(const uint8_t *packet, size_t length, uint32_t &next_hop_mtu) {
+    // raw sockets receive the IPv4 header as well
+    if (length < sizeof(iphdr)) {
+      return std::nullopt;
+    }
+    auto header_length = static_cast<size_t>(packet[0] & 0x0f) * 4;
+    if (length < header_length + sizeof(icmphdr)) {
+      return std::nullopt;
+    }
+    icmphdr icmp;
+    std::memcpy(&icmp, packet + header_length, sizeof(icmp));
+
+    if (icmp.type == ICMP_ECHOREPLY) {
+      if (ntohs(icmp.un.echo.id) == identifier_ && ntohs(icmp.un.echo.sequence) == sequence_) {
+        return ProbeResult::kReply;
+      }
+      return std::nullopt;
+    }
+    if (icmp.type != ICMP_DEST_UNREACH || icmp.code != ICMP_FRAG_NEEDED) {
+      return std::nullopt;
+    }
+
+    // the error quotes our IPv4 header and the beginning of our echo request
+    auto quoted = packet + header_length + sizeof(icmphdr);
+    auto quoted_length = length - header_length - sizeof(icmphdr);
+    if (quoted_length < sizeof(iphdr)) {
+      return std::nullopt;
+    }
+    auto quoted_header_length = static_cast<size_t>(quoted[0] & 0x0f) * 4;
+    if (quoted_length < quoted_header_length + sizeof(icmphdr)) {
+      return std::nullopt;
+    }
+    icmphdr quoted_icmp;
+    std::memcpy(&quoted_icmp, quoted + quoted_header_length, sizeof(quoted_icmp));
+    if (quoted_icmp.type != ICMP_ECHO || ntohs(quoted_icmp.un.echo.id) != identifier_ ||
+        ntohs(quoted_icmp.un.echo.sequence) != sequence_) {
+      return std::nullopt;
+    }
+    next_hop_mtu = ntohs(icmp.un.frag.mtu);
+    return ProbeResult::kTooBig;
+  }
+
+private:
+  int fd_;
+  sockaddr_in destination_{};
+  uint16_t identifier_;
+  uint16_t sequence_ = 0;
+};
+
+}  // namespace
+
+namespace outline {
+
+std::optional<uint32_t> ProbePathMtu(const std::string &destination,
+                                     const std::string &interface_name,
+                                     uint32_t interface_mtu,
+                                     std::chrono::milliseconds timeout) {
+  EchoSocket socket{destination, interface_name};
+
+  uint32_t next_hop_mtu = 0;
+  if (interface_mtu <= kMinimumIPv4Mtu ||
+      socket.Probe(kMinimumIPv4Mtu, timeout, next_hop_mtu) != ProbeResult::kReply) {
+    return std::nullopt;
+  }
+
+  // invariant: `lower` is known to get through, anything above `upper` is not
+  uint32_t lower = kMinimumIPv4Mtu, upper = interface_mtu, candidate = interface_mtu;
+  for (int probes = 1; lower < upper && probes < kMaximumProbes; probes++) {
+    next_hop_mtu = 0;
+    if (socket.Probe(candidate, timeout, next_hop_mtu) == ProbeResult::kReply) {
+      lower = candidate;
+      candidate = lower + (upper - lower + 1) / 2;
+    } else {
+      upper = candidate - 1;
+      if (next_hop_mtu > lower && next_hop_mtu <= upper) {
+        // a router told us, most likely right
+        upper = next_hop_mtu;
+        candidate = next_hop_mtu;
+      } else {
+        candidate = lower + (upper - lower + 1) / 2;
+      }
+    }
+  }
+  return lower;
+}
+
+}  // namespace outline
@@ -0,0 +1,48 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace outline {
+
+// Every IPv4 host must accept datagrams of this size
+constexpr uint32_t kMinimumIPv4Mtu = 576;
+
+/**
+ * @brief Find the largest IPv4 packet which reaches `destination` through
+ *        `interface_name` without being fragmented, by sending ICMP echo
+ *        requests with the DF bit set and bisecting between the sizes which
+ *        get a reply and the ones which do not.
+ *
+ * The full interface MTU is tried right after the minimum size, so a clean
+ * path costs two round trips. A "fragmentation needed" error narrows the
+ * search to the MTU it reports. Needs CAP_NET_RAW.
+ *
+ * @param interface_mtu The upper bound of the search.
+ * @param timeout How long to wait for the reply to each probe.
+ * @return std::optional<uint32_t> The path MTU, or nullopt if `destination`
+ *         does not even answer a minimum sized echo request.
+ * @throw std::system_error The ICMP socket cannot be set up.
+ */
+std::optional<uint32_t> ProbePathMtu(const std::string &destination,
+                                     const std::string &interface_name,
+                                     uint32_t interface_mtu,
+                                     std::chrono::milliseconds timeout);
+
+}  // namespace outline
@@ -0,0 +1,86 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+
+#include "prefix_trie.h"
+
+using namespace outline;
+
+// How many addresses ahead LookupBatch prefetches the root entry
+static const size_t kPrefetchDistance = 8;
+
+static uint32_t PrefixMask(uint8_t length) {
+  return length == 0 ? 0 : ~uint32_t{0} << (32 - length);
+}
+
+PrefixTrie::PrefixTrie(uint16_t default_value)
+  : root_(size_t{1} << 16, default_value)
+{}
+
+PrefixTrie PrefixTrie::Build(std::vector<Prefix> prefixes, uint16_t default_value) {
+  // shorter prefixes first, so the longer ones are expanded over them
+  std::stable_sort(prefixes.begin(), prefixes.end(),
+                   [](const auto &a, const auto &b) { return a.length < b.length; });
+
+  PrefixTrie trie{default_value};
+  for (const auto &prefix : prefixes) {
+    trie.Insert(prefix);
+  }
+  return trie;
+}
+
+void PrefixTrie::LookupBatch(const uint32_t *addresses, uint16_t *values, size_t count) const {
+  for (size_t i = 0; i < count; i++) {
+    if (i + kPrefetchDistance < count) {
+      __builtin_prefetch(&root_[addresses[i + kPrefetchDistance] >> 16]);
+    }
+    values[i] = Lookup(addresses[i]);
+  }
+}
+
+void PrefixTrie::Insert(const Prefix &prefix) {
+  const auto length = std::min<uint8_t>(prefix.length, 32);
+  const auto network = prefix.network & PrefixMask(length);
+
+  if (length <= 16) {
+    auto first = root_.begin() + (network >> 16);
+    std::fill(first, first + (size_t{1} << (16 - length)), prefix.value);
+    return;
+  }
+
+  auto chunk = ExpandEntry(root_, network >> 16);
+  if (length <= 24) {
+    auto first = chunks_.begin() + (chunk << 8) + ((network >> 8) & 0xff);
+    std::fill(first, first + (size_t{1} << (24 - length)), prefix.value);
+    return;
+  }
+
+  chunk = ExpandEntry(chunks_, (chunk << 8) + ((network >> 8) & 0xff));
+  auto first = chunks_.begin() + (chunk << 8) + (network & 0xff);
+  std::fill(first, first + (size_t{1} << (32 - length)), prefix.value);
+}
+
+uint32_t PrefixTrie::ExpandEntry(std::vector<uint32_t> &table, size_t entry_index) {
+  auto entry = table[entry_index];
+  if (entry & kChunkFlag) {
+    return entry & ~kChunkFlag;
+  }
+
+  auto chunk = static_cast<uint32_t>(chunks_.size() >> 8);
+  // may reallocate `table` when it is `chunks_`, so index it again afterwards
+  chunks_.resize(chunks_.size() + 256, entry);
+  table[entry_index] = kChunkFlag | chunk;
+  return chunk;
+}
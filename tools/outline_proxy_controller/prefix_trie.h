@@ -0,0 +1,89 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace outline {
+
+/**
+ * @brief A longest-prefix-match table of IPv4 prefixes in the DIR-16-8-8
+ *        layout: a 2^16 entry root indexed by the top 16 bits of the address,
+ *        whose entries either hold the value or point to a 256 entry chunk
+ *        for the next 8 bits, and so on. A lookup is at most three dependent
+ *        loads and never branches on the prefix length.
+ *
+ * Prefixes are expanded at build time, so the table is immutable: rebuild it
+ * when the prefixes change. Addresses are in host byte order.
+ */
+class PrefixTrie {
+public:
+  struct Prefix {
+    uint32_t network;
+    uint8_t length;
+    uint16_t value;
+  };
+
+  /**
+   * @brief A table mapping every address to `default_value`.
+   */
+  explicit PrefixTrie(uint16_t default_value = 0);
+
+  /**
+   * @brief Build a table out of `prefixes`. Among prefixes of the same length
+   *        covering an address, the last one wins.
+   */
+  static PrefixTrie Build(std::vector<Prefix> prefixes, uint16_t default_value = 0);
+
+  uint16_t Lookup(uint32_t address) const {
+    auto entry = root_[address >> 16];
+    if (entry & kChunkFlag) {
+      entry = chunks_[((entry & ~kChunkFlag) << 8) | ((address >> 8) & 0xff)];
+      if (entry & kChunkFlag) {
+        entry = chunks_[((entry & ~kChunkFlag) << 8) | (address & 0xff)];
+      }
+    }
+    return static_cast<uint16_t>(entry);
+  }
+
+  /**
+   * @brief Look up `count` addresses at once, prefetching the root entries
+   *        ahead so the loads of independent lookups overlap.
+   */
+  void LookupBatch(const uint32_t *addresses, uint16_t *values, size_t count) const;
+
+  size_t memory_usage() const {
+    return (root_.size() + chunks_.size()) * sizeof(uint32_t);
+  }
+
+private:
+  static constexpr uint32_t kChunkFlag = 0x80000000;
+
+  void Insert(const Prefix &prefix);
+
+  /**
+   * @brief Turn the entry at `entry_index` of `table` into a chunk if it is
+   *        a value (the chunk inherits the value), and return the chunk index.
+   */
+  uint32_t ExpandEntry(std::vector<uint32_t> &table, size_t entry_index);
+
+private:
+  std::vector<uint32_t> root_;
+  std::vector<uint32_t> chunks_;
+};
+
+}  // namespace outline
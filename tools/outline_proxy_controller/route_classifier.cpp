@@ -0,0 +1,76 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+
+#include <arpa/inet.h>
+
+#include "route_classifier.h"
+
+using namespace outline;
+
+static uint32_t ParseHostOrderAddress(const std::string &address) {
+  in_addr parsed{};
+  ::inet_pton(AF_INET, address.c_str(), &parsed);
+  return ntohl(parsed.s_addr);
+}
+
+namespace outline {
+
+const char *RoutePathName(RoutePath path) {
+  switch (path) {
+    case RoutePath::kDirect:
+      return "direct";
+    case RoutePath::kTunnel:
+      return "tunnel";
+    case RoutePath::kLocal:
+      return "local";
+    default:
+      return "unreachable";
+  }
+}
+
+}  // namespace outline
+
+void RouteClassifier::Rebuild(const std::vector<RouteEntry> &routes,
+                              const std::vector<AddressEntry> &addresses,
+                              int tun_interface_index) {
+  // among routes to the same prefix the kernel picks the lowest metric, which
+  // has to come last for PrefixTrie
+  auto sorted_routes = routes;
+  std::stable_sort(sorted_routes.begin(), sorted_routes.end(),
+                   [](const auto &a, const auto &b) { return a.metric > b.metric; });
+
+  std::vector<PrefixTrie::Prefix> prefixes;
+  for (const auto &route : sorted_routes) {
+    auto path = route.interface_index == tun_interface_index ? RoutePath::kTunnel
+                                                             : RoutePath::kDirect;
+    prefixes.push_back({route.destination.empty() ? 0 : ParseHostOrderAddress(route.destination),
+                        route.prefix_length, static_cast<uint16_t>(path)});
+  }
+
+  // what the local table would answer before the main one is even looked at
+  prefixes.push_back({0x7f000000, 8, static_cast<uint16_t>(RoutePath::kLocal)});
+  for (const auto &address : addresses) {
+    prefixes.push_back({ParseHostOrderAddress(address.address), 32,
+                        static_cast<uint16_t>(RoutePath::kLocal)});
+  }
+
+  trie_ = PrefixTrie::Build(std::move(prefixes), static_cast<uint16_t>(RoutePath::kUnreachable));
+}
+
+void RouteClassifier::Classify(const uint32_t *addresses, RoutePath *paths, size_t count) const {
+  static_assert(sizeof(RoutePath) == sizeof(uint16_t));
+  trie_.LookupBatch(addresses, reinterpret_cast<uint16_t*>(paths), count);
+}
@@ -0,0 +1,68 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "prefix_trie.h"
+#include "routing_table.h"
+
+namespace outline {
+
+/**
+ * @brief Where the traffic to a destination goes.
+ */
+enum class RoutePath : uint16_t {
+  kUnreachable = 0,
+  kDirect = 1,
+  kTunnel = 2,
+  kLocal = 3,
+};
+
+/**
+ * @brief The name of `path` as reported to the client.
+ */
+const char *RoutePathName(RoutePath path);
+
+/**
+ * @brief Answers which path the traffic to a destination takes, mirroring
+ *        the main routing table in a PrefixTrie instead of asking the kernel
+ *        one address at a time.
+ */
+class RouteClassifier {
+public:
+  /**
+   * @brief Replace the mirrored table.
+   *
+   * @param routes The routes of the main table.
+   * @param addresses The addresses of this host.
+   * @param tun_interface_index The interface whose routes lead into the tunnel.
+   */
+  void Rebuild(const std::vector<RouteEntry> &routes,
+               const std::vector<AddressEntry> &addresses,
+               int tun_interface_index);
+
+  /**
+   * @brief Classify `count` addresses in host byte order.
+   */
+  void Classify(const uint32_t *addresses, RoutePath *paths, size_t count) const;
+
+private:
+  PrefixTrie trie_;
+};
+
+}  // namespace outline
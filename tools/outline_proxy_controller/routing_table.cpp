@@ -0,0 +1,363 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <arpa/inet.h>
+#include <linux/neighbour.h>
+#include <linux/rtnetlink.h>
+
+#include "routing_table.h"
+
+using namespace outline;
+
+static uint32_t ParseIPv4Address(const std::string &address) {
+  in_addr parsed{};
+  if (::inet_pton(AF_INET, address.c_str(), &parsed) != 1) {
+    throw std::invalid_argument("invalid IPv4 address \"" + address + "\"");
+  }
+  return parsed.s_addr;
+}
+
+static std::string FormatIPv4Address(const void *data) {
+  char buffer[INET_ADDRSTRLEN];
+  ::inet_ntop(AF_INET, data, buffer, sizeof(buffer));
+  return buffer;
+}
+
+/**
+ * @brief The payload of RTA_MULTIPATH: an `rtnexthop` per hop, each followed
+ *        by its gateway attribute.
+ */
+static std::string EncodeNextHops(const std::vector<RouteNextHop> &next_hops) {
+  std::string payload;
+  for (const auto &next_hop : next_hops) {
+    rtnexthop header{};
+    header.rtnh_len = static_cast<unsigned short>(
+        RTNH_LENGTH(next_hop.gateway.empty() ? 0 : RTA_SPACE(sizeof(uint32_t))));
+    header.rtnh_hops = next_hop.hops;
+    header.rtnh_ifindex = next_hop.interface_index;
+    payload.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (!next_hop.gateway.empty()) {
+      rtattr gateway{};
+      gateway.rta_len = RTA_LENGTH(sizeof(uint32_t));
+      gateway.rta_type = RTA_GATEWAY;
+      auto address = ParseIPv4Address(next_hop.gateway);
+      payload.append(reinterpret_cast<const char*>(&gateway), sizeof(gateway));
+      payload.append(reinterpret_cast<const char*>(&address), sizeof(address));
+    }
+  }
+  return payload;
+}
+
+static std::vector<RouteNextHop> DecodeNextHops(const void *data, size_t length) {
+  std::vector<RouteNextHop> next_hops;
+  auto header = static_cast<const rtnexthop*>(data);
+  while (length >= sizeof(rtnexthop) && header->rtnh_len >= sizeof(rtnexthop) &&
+         header->rtnh_len <= length) {
+    RouteNextHop next_hop;
+    next_hop.interface_index = header->rtnh_ifindex;
+    next_hop.hops = header->rtnh_hops;
+    ForEachNetlinkAttribute(RTNH_DATA(header), header->rtnh_len - RTNH_LENGTH(0),
+                            [&](uint16_t type, const void *value, size_t value_length) {
+      if (type == RTA_GATEWAY && value_length == sizeof(uint32_t)) {
+        next_hop.gateway = FormatIPv4Address(value);
+      }
+    });
+    next_hops.push_back(std::move(next_hop));
+    auto aligned = std::min<size_t>(RTNH_ALIGN(header->rtnh_len), length);
+    length -= aligned;
+    header = reinterpret_cast<const rtnexthop*>(reinterpret_cast<const char*>(header) + aligned);
+  }
+  return next_hops;
+}
+
+static NetlinkMessage MakeRouteMessage(bool is_addition, const RouteEntry &route) {
+  NetlinkMessage msg{
+    static_cast<uint16_t>(is_addition ? RTM_NEWROUTE : RTM_DELROUTE),
+    static_cast<uint16_t>(is_addition ? (NLM_F_CREATE | NLM_F_EXCL) : 0)};
+
+  rtmsg header{};
+  header.rtm_family = AF_INET;
+  header.rtm_dst_len = route.prefix_length;
+  // tables beyond 255 only fit into the attribute
+  header.rtm_table = route.table < 256 ? route.table : RT_TABLE_UNSPEC;
+  header.rtm_type = RTN_UNICAST;
+  // a deletion matches the route whatever its protocol and scope, as `ip route del`
+  header.rtm_protocol = is_addition ? route.protocol : RTPROT_UNSPEC;
+  header.rtm_scope = is_addition ? route.scope : static_cast<uint8_t>(RT_SCOPE_NOWHERE);
+  msg.AppendHeader(header);
+
+  if (route.table >= 256) {
+    msg.AddAttribute(RTA_TABLE, route.table);
+  }
+  if (route.prefix_length > 0) {
+    msg.AddAttribute(RTA_DST, ParseIPv4Address(route.destination));
+  }
+  if (!route.gateway.empty()) {
+    msg.AddAttribute(RTA_GATEWAY, ParseIPv4Address(route.gateway));
+  }
+  if (route.interface_index > 0) {
+    msg.AddAttribute(RTA_OIF, static_cast<uint32_t>(route.interface_index));
+  }
+  if (route.metric > 0) {
+    msg.AddAttribute(RTA_PRIORITY, route.metric);
+  }
+  if (!route.preferred_source.empty()) {
+    msg.AddAttribute(RTA_PREFSRC, ParseIPv4Address(route.preferred_source));
+  }
+  if (!route.next_hops.empty()) {
+    auto next_hops = EncodeNextHops(route.next_hops);
+    msg.AddAttribute(RTA_MULTIPATH, next_hops.data(), next_hops.size());
+  }
+  return msg;
+}
+
+//#region RouteBatch Implementation
+
+void RouteBatch::Add(const RouteEntry &route) {
+  operations_.push_back({true, route});
+}
+
+void RouteBatch::Delete(const RouteEntry &route) {
+  operations_.push_back({false, route});
+}
+
+RouteBatch RouteBatch::Delta(const std::vector<RouteEntry> &current,
+                             const std::vector<RouteEntry> &desired) {
+  auto contains = [](const std::vector<RouteEntry> &routes, const RouteEntry &route) {
+    return std::find(routes.begin(), routes.end(), route) != routes.end();
+  };
+
+  RouteBatch delta;
+  for (const auto &route : current) {
+    if (!contains(desired, route)) {
+      delta.Delete(route);
+    }
+  }
+  for (const auto &route : desired) {
+    if (!contains(current, route)) {
+      delta.Add(route);
+    }
+  }
+  return delta;
+}
+
+RouteBatch RouteBatch::Inverse() const {
+  RouteBatch inverse;
+  for (auto it = operations_.rbegin(); it != operations_.rend(); ++it) {
+    inverse.operations_.push_back({!it->is_addition, it->route});
+  }
+  return inverse;
+}
+
+std::vector<NetlinkMessage> RouteBatch::Compile() const {
+  std::vector<NetlinkMessage> requests;
+  requests.reserve(operations_.size());
+  for (const auto &operation : operations_) {
+    requests.push_back(MakeRouteMessage(operation.is_addition, operation.route));
+  }
+  return requests;
+}
+
+void RouteBatch::Commit(NetlinkSocket &rtnl) const {
+  CompiledRouteBatch{*this}.Commit(rtnl);
+}
+
+//#endregion RouteBatch Implementation
+
+//#region CompiledRouteBatch Implementation
+
+CompiledRouteBatch::CompiledRouteBatch(const RouteBatch &batch)
+    : requests_(batch.Compile()), reverts_(batch.Inverse().Compile()) {
+  // the inverse runs backwards
+  std::reverse(reverts_.begin(), reverts_.end());
+}
+
+void CompiledRouteBatch::Commit(NetlinkSocket &rtnl) {
+  auto results = rtnl.RequestBatch(requests_);
+
+  // the successful operations are reverted in reverse order
+  std::vector<NetlinkMessage> rollback;
+  int first_error = 0;
+  for (size_t i = results.size(); i-- > 0;) {
+    if (results[i] == 0) {
+      rollback.push_back(reverts_[i]);
+    } else {
+      first_error = results[i];
+    }
+  }
+  if (first_error == 0) {
+    return;
+  }
+
+  if (!rollback.empty()) {
+    rtnl.RequestBatch(rollback);
+  }
+  throw std::system_error{first_error, std::generic_category(), "failed to apply route batch"};
+}
+
+//#endregion CompiledRouteBatch Implementation
+
+namespace outline {
+
+std::vector<RouteEntry> DumpRoutes(NetlinkSocket &rtnl) {
+  std::vector<RouteEntry> routes;
+
+  NetlinkMessage request{RTM_GETROUTE, NLM_F_DUMP};
+  rtmsg header{};
+  header.rtm_family = AF_INET;
+  request.AppendHeader(header);
+
+  rtnl.Request(request, [&](const nlmsghdr &msg) {
+    auto route_header = static_cast<const rtmsg*>(NLMSG_DATA(&msg));
+    if (msg.nlmsg_type != RTM_NEWROUTE || route_header->rtm_type != RTN_UNICAST) {
+      return;
+    }
+
+    RouteEntry route;
+    route.prefix_length = route_header->rtm_dst_len;
+    route.protocol = route_header->rtm_protocol;
+    route.scope = route_header->rtm_scope;
+    uint32_t table = route_header->rtm_table;
+    ForEachNetlinkAttribute<rtmsg>(msg, [&](uint16_t type, const void *data, size_t length) {
+      if (type == RTA_TABLE && length == sizeof(uint32_t)) {
+        std::memcpy(&table, data, sizeof(table));
+      } else if (type == RTA_DST && length == sizeof(uint32_t)) {
+        route.destination = FormatIPv4Address(data);
+      } else if (type == RTA_GATEWAY && length == sizeof(uint32_t)) {
+        route.gateway = FormatIPv4Address(data);
+      } else if (type == RTA_OIF && length == sizeof(uint32_t)) {
+        uint32_t interface_index;
+        std::memcpy(&interface_index, data, sizeof(interface_index));
+        route.interface_index = static_cast<int>(interface_index);
+      } else if (type == RTA_PRIORITY && length == sizeof(uint32_t)) {
+        std::memcpy(&route.metric, data, sizeof(route.metric));
+      } else if (type == RTA_PREFSRC && length == sizeof(uint32_t)) {
+        route.preferred_source = FormatIPv4Address(data);
+      } else if (type == RTA_MULTIPATH) {
+        route.next_hops = DecodeNextHops(data, length);
+      }
+    });
+    if (table == RT_TABLE_MAIN) {
+      routes.push_back(std::move(route));
+    }
+  });
+  return routes;
+}
+
+std::vector<RouteEntry> DumpDefaultRoutes(NetlinkSocket &rtnl) {
+  auto routes = DumpRoutes(rtnl);
+  routes.erase(std::remove_if(routes.begin(), routes.end(),
+                              [](const auto &route) { return route.prefix_length != 0; }),
+               routes.end());
+  return routes;
+}
+
+std::vector<AddressEntry> DumpAddresses(NetlinkSocket &rtnl) {
+  std::vector<AddressEntry> addresses;
+
+  NetlinkMessage request{RTM_GETADDR, NLM_F_DUMP};
+  ifaddrmsg header{};
+  header.ifa_family = AF_INET;
+  request.AppendHeader(header);
+
+  rtnl.Request(request, [&](const nlmsghdr &msg) {
+    if (msg.nlmsg_type != RTM_NEWADDR) {
+      return;
+    }
+    auto address_header = static_cast<const ifaddrmsg*>(NLMSG_DATA(&msg));
+    ForEachNetlinkAttribute<ifaddrmsg>(msg, [&](uint16_t type, const void *data, size_t length) {
+      if (type == IFA_LOCAL && length == sizeof(uint32_t)) {
+        addresses.push_back({static_cast<int>(address_header->ifa_index),
+                             FormatIPv4Address(data), address_header->ifa_prefixlen});
+      }
+    });
+  });
+  return addresses;
+}
+
+uint32_t GetInterfaceMtu(NetlinkSocket &rtnl, int interface_index) {
+  NetlinkMessage request{RTM_GETLINK, 0};
+  ifinfomsg header{};
+  header.ifi_family = AF_UNSPEC;
+  header.ifi_index = interface_index;
+  request.AppendHeader(header);
+
+  uint32_t mtu = 0;
+  rtnl.Request(request, [&](const nlmsghdr &msg) {
+    if (msg.nlmsg_type != RTM_NEWLINK) {
+      return;
+    }
+    ForEachNetlinkAttribute<ifinfomsg>(msg, [&](uint16_t type, const void *data, size_t length) {
+      if (type == IFLA_MTU && length == sizeof(uint32_t)) {
+        std::memcpy(&mtu, data, sizeof(mtu));
+      }
+    });
+  });
+  if (mtu == 0) {
+    throw std::runtime_error("unknown MTU of interface " + std::to_string(interface_index));
+  }
+  return mtu;
+}
+
+void SetInterfaceMtu(NetlinkSocket &rtnl, int interface_index, uint32_t mtu) {
+  NetlinkMessage request{RTM_NEWLINK, 0};
+  ifinfomsg header{};
+  header.ifi_family = AF_UNSPEC;
+  header.ifi_index = interface_index;
+  request.AppendHeader(header);
+  request.AddAttribute(IFLA_MTU, mtu);
+  rtnl.Request(request);
+}
+
+std::vector<NeighbourEntry> DumpNeighbours(NetlinkSocket &rtnl) {
+  std::vector<NeighbourEntry> neighbours;
+
+  NetlinkMessage request{RTM_GETNEIGH, NLM_F_DUMP};
+  ndmsg header{};
+  header.ndm_family = AF_INET;
+  request.AppendHeader(header);
+
+  rtnl.Request(request, [&](const nlmsghdr &msg) {
+    auto neighbour_header = static_cast<const ndmsg*>(NLMSG_DATA(&msg));
+    if (msg.nlmsg_type != RTM_NEWNEIGH ||
+        (neighbour_header->ndm_state & (NUD_INCOMPLETE | NUD_FAILED | NUD_NOARP))) {
+      return;
+    }
+
+    NeighbourEntry neighbour{neighbour_header->ndm_ifindex, {}, {}};
+    ForEachNetlinkAttribute<ndmsg>(msg, [&](uint16_t type, const void *data, size_t length) {
+      if (type == NDA_DST && length == sizeof(uint32_t)) {
+        neighbour.address = FormatIPv4Address(data);
+      } else if (type == NDA_LLADDR && length == 6) {
+        auto mac = static_cast<const unsigned char*>(data);
+        char buffer[18];
+        std::snprintf(buffer, sizeof(buffer), "%02x:%02x:%02x:%02x:%02x:%02x",
+                      mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+        neighbour.link_address = buffer;
+      }
+    });
+    if (!neighbour.address.empty() && !neighbour.link_address.empty()) {
+      neighbours.push_back(std::move(neighbour));
+    }
+  });
+  return neighbours;
+}
+
+}  // namespace outline
@@ -0,0 +1,182 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <linux/rtnetlink.h>
+
+#include "netlink_socket.h"
+
+namespace outline {
+
+/**
+ * @brief A next hop of a multipath route.
+ */
+struct RouteNextHop {
+  std::string gateway;
+  int interface_index = 0;
+  // the weight minus 1
+  uint8_t hops = 0;
+
+  bool operator==(const RouteNextHop&) const = default;
+};
+
+/**
+ * @brief An IPv4 route, of the main routing table unless told otherwise.
+ *        A dumped route keeps the attributes needed to add it back as it was.
+ */
+struct RouteEntry {
+  // Empty for the default route
+  std::string destination;
+  uint8_t prefix_length = 0;
+  std::string gateway;
+  int interface_index = 0;
+  uint32_t metric = 0;
+  uint32_t table = RT_TABLE_MAIN;
+  // RTA_PREFSRC, empty if the kernel picks the source address
+  std::string preferred_source{};
+  // who installed the route, RTPROT_BOOT is what `ip route add` uses
+  uint8_t protocol = RTPROT_BOOT;
+  // RT_SCOPE_LINK for the routes to directly connected destinations
+  uint8_t scope = RT_SCOPE_UNIVERSE;
+  // the next hops of a multipath route (RTA_MULTIPATH), which has no gateway
+  // nor interface of its own
+  std::vector<RouteNextHop> next_hops{};
+
+  bool operator==(const RouteEntry&) const = default;
+};
+
+/**
+ * @brief An IPv4 entry of the neighbour (ARP) table.
+ */
+struct NeighbourEntry {
+  int interface_index;
+  std::string address;
+  // Formatted as "aa:bb:cc:dd:ee:ff"
+  std::string link_address;
+};
+
+/**
+ * @brief An IPv4 address configured on an interface.
+ */
+struct AddressEntry {
+  int interface_index;
+  std::string address;
+  uint8_t prefix_length;
+};
+
+/**
+ * @brief A list of route changes which is sent to the kernel in one go.
+ */
+class RouteBatch {
+public:
+  void Add(const RouteEntry &route);
+  void Delete(const RouteEntry &route);
+
+  bool empty() const { return operations_.empty(); }
+  size_t size() const { return operations_.size(); }
+
+  /**
+   * @brief The batch turning the set of routes `current` into `desired`,
+   *        leaving the routes they have in common alone.
+   */
+  static RouteBatch Delta(const std::vector<RouteEntry> &current,
+                          const std::vector<RouteEntry> &desired);
+
+  /**
+   * @brief The batch undoing this one: every operation reverted, in reverse order.
+   */
+  RouteBatch Inverse() const;
+
+  /**
+   * @brief Serialize the operations into netlink requests, ready to be sent.
+   */
+  std::vector<NetlinkMessage> Compile() const;
+
+  /**
+   * @brief Apply the whole batch with a single `sendmsg`. If any operation fails,
+   *        the ones which succeeded are reverted before throwing.
+   *
+   * @throw std::system_error The error of the first failed operation.
+   */
+  void Commit(NetlinkSocket &rtnl) const;
+
+private:
+  struct Operation {
+    bool is_addition;
+    RouteEntry route;
+  };
+
+  std::vector<Operation> operations_;
+};
+
+/**
+ * @brief A RouteBatch serialized ahead of time, so that applying it only costs
+ *        sending the prebuilt requests.
+ */
+class CompiledRouteBatch {
+public:
+  explicit CompiledRouteBatch(const RouteBatch &batch);
+
+  size_t size() const { return requests_.size(); }
+
+  /**
+   * @brief Apply the whole batch with a single `sendmsg`. If any operation fails,
+   *        the ones which succeeded are reverted before throwing.
+   *
+   * @throw std::system_error The error of the first failed operation.
+   */
+  void Commit(NetlinkSocket &rtnl);
+
+private:
+  std::vector<NetlinkMessage> requests_;
+  // reverts_[i] undoes requests_[i]
+  std::vector<NetlinkMessage> reverts_;
+};
+
+/**
+ * @brief Query all IPv4 unicast routes of the main routing table.
+ */
+std::vector<RouteEntry> DumpRoutes(NetlinkSocket &rtnl);
+
+/**
+ * @brief Query all IPv4 default routes of the main routing table.
+ */
+std::vector<RouteEntry> DumpDefaultRoutes(NetlinkSocket &rtnl);
+
+/**
+ * @brief Query the IPv4 addresses of all interfaces.
+ */
+std::vector<AddressEntry> DumpAddresses(NetlinkSocket &rtnl);
+
+/**
+ * @brief Query the MTU of an interface.
+ */
+uint32_t GetInterfaceMtu(NetlinkSocket &rtnl, int interface_index);
+
+/**
+ * @brief Change the MTU of an interface.
+ */
+void SetInterfaceMtu(NetlinkSocket &rtnl, int interface_index, uint32_t mtu);
+
+/**
+ * @brief Query the IPv4 neighbour table, skipping incomplete and failed entries.
+ */
+std::vector<NeighbourEntry> DumpNeighbours(NetlinkSocket &rtnl);
+
+}  // namespace outline
@@ -0,0 +1,117 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+
+#include <boost/asio/post.hpp>
+
+#include "logger.h"
+#include "stage_graph.h"
+
+using namespace outline;
+
+StageGraph::StageId StageGraph::Add(std::string name, Action run, Action undo,
+                                    std::vector<StageId> dependencies) {
+  StageId id = stages_.size();
+  for (auto dependency : dependencies) {
+    if (dependency >= id) {
+      throw std::invalid_argument("stage \"" + name + "\" depends on a later stage");
+    }
+    stages_[dependency].dependents.push_back(id);
+  }
+  stages_.push_back({std::move(name), std::move(run), std::move(undo), {}, dependencies.size()});
+  return id;
+}
+
+void StageGraph::Run(boost::asio::thread_pool &pool,
+                     const std::function<void(const std::string&)> &precondition) {
+  std::mutex mutex;
+  std::condition_variable finished;
+  size_t running = 0, completed = 0;
+  std::exception_ptr failure;
+
+  // called with `mutex` held
+  std::function<void(StageId)> start = [&](StageId id) {
+    running++;
+    boost::asio::post(pool, [&, id] {
+      std::exception_ptr error;
+      bool started = false;
+      try {
+        if (precondition) {
+          precondition(stages_[id].name);
+        }
+        started = true;
+        stages_[id].run();
+      } catch (...) {
+        error = std::current_exception();
+      }
+
+      std::lock_guard<std::mutex> lock{mutex};
+      running--;
+      if (started) {
+        finished_.push_back(id);
+      }
+      if (error) {
+        logger.error("stage \"" + stages_[id].name + "\" failed");
+        if (!failure) {
+          failure = error;
+        }
+      } else {
+        completed++;
+        for (auto dependent : stages_[id].dependents) {
+          if (--stages_[dependent].pending_dependencies == 0 && !failure) {
+            start(dependent);
+          }
+        }
+      }
+      if (running == 0) {
+        finished.notify_all();
+      }
+    });
+  };
+
+  std::unique_lock<std::mutex> lock{mutex};
+  for (StageId id = 0; id < stages_.size(); id++) {
+    if (stages_[id].pending_dependencies == 0) {
+      start(id);
+    }
+  }
+  finished.wait(lock, [&] { return running == 0; });
+
+  if (failure) {
+    std::rethrow_exception(failure);
+  }
+  if (completed != stages_.size()) {
+    throw std::logic_error("some stages never became ready");
+  }
+}
+
+void StageGraph::Rollback() {
+  for (auto it = finished_.rbegin(); it != finished_.rend(); ++it) {
+    const auto &stage = stages_[*it];
+    if (!stage.undo) {
+      continue;
+    }
+    try {
+      stage.undo();
+    } catch (const std::exception &e) {
+      logger.warn("failed to undo \"" + stage.name + "\": " + e.what());
+    }
+  }
+  finished_.clear();
+}
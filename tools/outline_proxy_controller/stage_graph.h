@@ -0,0 +1,81 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <boost/asio/thread_pool.hpp>
+
+namespace outline {
+
+/**
+ * @brief A small dependency graph of blocking setup stages. The stages whose
+ *        dependencies are done run concurrently on a thread pool, so a
+ *        sequence takes as long as its critical path. When a stage fails the
+ *        stages which have not started are skipped, and `Rollback` undoes the
+ *        failed and the completed ones in the reverse order of completion,
+ *        which is always compatible with the dependencies.
+ */
+class StageGraph {
+public:
+  typedef std::function<void()> Action;
+  typedef size_t StageId;
+
+  /**
+   * @param name What the stage does, for the logs.
+   * @param run The stage itself, throws on failure.
+   * @param undo Reverts what `run` did, even partially; may be empty.
+   * @param dependencies Stages which must complete before this one starts.
+   */
+  StageId Add(std::string name, Action run, Action undo = {},
+              std::vector<StageId> dependencies = {});
+
+  /**
+   * @brief Run the stages on `pool` and wait until they have all completed,
+   *        or until the ones which were running when a stage failed are done.
+   *
+   * @param precondition Called with the name of each stage right before it
+   *        starts; if it throws, the stage fails without having run.
+   * @throw The exception of the first stage which failed.
+   */
+  void Run(boost::asio::thread_pool &pool,
+           const std::function<void(const std::string&)> &precondition = {});
+
+  /**
+   * @brief Undo the stages which ran, on the calling thread, in the reverse
+   *        order of their completion. Failures are logged, not thrown.
+   */
+  void Rollback();
+
+private:
+  struct Stage {
+    std::string name;
+    Action run;
+    Action undo;
+    std::vector<StageId> dependents;
+    size_t pending_dependencies = 0;
+  };
+
+  std::vector<Stage> stages_;
+  // the stages which ran (including the failed ones), in completion order
+  std::vector<StageId> finished_;
+};
+
+}  // namespace outline
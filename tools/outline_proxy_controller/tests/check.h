@@ -0,0 +1,38 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// Like assert, but kept in the Release builds the tests are compiled as
+#define CHECK(condition)                                                                    \
+  do {                                                                                      \
+    if (!(condition)) {                                                                     \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);    \
+      std::exit(1);                                                                         \
+    }                                                                                       \
+  } while (false)
+
+#define CHECK_THROWS(statement, exception_type) \
+  do {                                          \
+    bool thrown = false;                        \
+    try {                                       \
+      statement;                                \
+    } catch (const exception_type &) {          \
+      thrown = true;                            \
+    }                                           \
+    CHECK(thrown && #statement);                \
+  } while (false)
@@ -0,0 +1,319 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <string_view>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "check.h"
+#include "dhcp_responder.h"
+#include "internet_checksum.h"
+#include "tap_device.h"
+
+using namespace outline;
+
+static const MacAddress kClientMac = {0x02, 0, 0, 0, 0, 0x11};
+static const MacAddress kServerMac = {0x02, 0, 0, 0, 0, 0x99};
+static const uint32_t kClientAddress = 0x0a000002;
+static const uint32_t kServerAddress = 0x0a0000fe;
+static const uint32_t kTransactionId = 0xdeadbeef;
+
+// the offsets of the fields of a DHCP message in an Ethernet frame
+static const size_t kIpHeader = 14;
+static const size_t kUdpHeader = 34;
+static const size_t kDhcpOp = 42;
+static const size_t kDhcpTransactionId = 46;
+static const size_t kDhcpClientAddress = 54;
+static const size_t kDhcpYourAddress = 58;
+static const size_t kDhcpClientMac = 70;
+static const size_t kDhcpMagicCookie = 278;
+static const size_t kDhcpOptions = 282;
+
+static const uint8_t kBootRequest = 1;
+static const uint8_t kBootReply = 2;
+static const uint8_t kDiscover = 1;
+static const uint8_t kOffer = 2;
+static const uint8_t kRequest = 3;
+static const uint8_t kAck = 5;
+static const uint8_t kNak = 6;
+static const uint8_t kInform = 8;
+
+static const int kFuzzFrames = 200'000;
+static const int kTapTimeoutMs = 2000;
+
+static DhcpResponderConfig Config() {
+  DhcpResponderConfig config;
+  config.client_mac = kClientMac;
+  config.server_mac = kServerMac;
+  config.client_address = kClientAddress;
+  config.server_address = kServerAddress;
+  config.netmask = 0xffffff00;
+  // the router and the DNS server
+  config.extra_options = {3, 4, 10, 0, 0, 1, 6, 4, 1, 1, 1, 1};
+  return config;
+}
+
+/**
+ * @brief A broadcast DHCP message of `type` from `mac`, as a client sends it.
+ */
+static std::vector<uint8_t> ClientMessage(uint8_t type, uint32_t client_address = 0,
+                                          const MacAddress &mac = kClientMac) {
+  // a pad, the parameter request list and the message type
+  const uint8_t options[] = {0, 55, 2, 1, 3, 53, 1, type, 255};
+  std::vector<uint8_t> frame(kDhcpOptions + sizeof(options), 0);
+  std::memcpy(&frame[frame::kEthDestination], kBroadcastMac.data(), 6);
+  std::memcpy(&frame[frame::kEthSource], mac.data(), 6);
+  frame::Store16(&frame[frame::kEthType], frame::kEthTypeIpv4);
+
+  frame[kIpHeader] = 0x45;
+  frame[kIpHeader + 8] = 64;
+  frame[kIpHeader + 9] = IPPROTO_UDP;
+  frame::Store32(&frame[kIpHeader + 16], 0xffffffff);
+  frame::Store16(&frame[kUdpHeader], 68);
+  frame::Store16(&frame[kUdpHeader + 2], 67);
+
+  frame[kDhcpOp] = kBootRequest;
+  frame[kDhcpOp + 1] = 1;
+  frame[kDhcpOp + 2] = 6;
+  frame::Store32(&frame[kDhcpTransactionId], kTransactionId);
+  frame::Store32(&frame[kDhcpClientAddress], client_address);
+  std::memcpy(&frame[kDhcpClientMac], mac.data(), 6);
+  frame::Store32(&frame[kDhcpMagicCookie], 0x63825363);
+  std::memcpy(&frame[kDhcpOptions], options, sizeof(options));
+
+  frame::Store16(&frame[kIpHeader + 2], static_cast<uint16_t>(frame.size() - kIpHeader));
+  frame::Store16(&frame[kUdpHeader + 4], static_cast<uint16_t>(frame.size() - kUdpHeader));
+  return frame;
+}
+
+static int MessageType(std::span<const uint8_t> reply) {
+  for (size_t i = kDhcpOptions; i + 2 < reply.size() && reply[i] != 255;
+       i += 2 + reply[i + 1]) {
+    if (reply[i] == 53) {
+      return reply[i + 2];
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Check the headers and the checksums of a reply to a message whose
+ *        transaction id is `transaction_id`.
+ */
+static void CheckReply(std::span<const uint8_t> reply, const uint8_t *transaction_id) {
+  CHECK(reply.size() >= kDhcpOptions + 4);
+  CHECK(checksum::Compute(&reply[kIpHeader], 20) == 0);
+  auto udp_length = static_cast<uint16_t>(reply.size() - kUdpHeader);
+  auto sum = checksum::Accumulate(
+      &reply[kUdpHeader], udp_length,
+      checksum::PseudoHeaderV4(&reply[kIpHeader + 12], &reply[kIpHeader + 16], IPPROTO_UDP,
+                               udp_length));
+  CHECK(checksum::Finish(sum) == 0);
+  CHECK(reply[kDhcpOp] == kBootReply);
+  CHECK(std::memcmp(&reply[kDhcpTransactionId], transaction_id, 4) == 0);
+}
+
+static void CheckReply(std::span<const uint8_t> reply) {
+  uint8_t transaction_id[4];
+  frame::Store32(transaction_id, kTransactionId);
+  CheckReply(reply, transaction_id);
+}
+
+static void TestRoundTrips() {
+  std::vector<uint8_t> buffer(DhcpResponder::kMaxReplySize);
+  DhcpResponder responder{Config()};
+
+  // a request before any discover is refused
+  auto nak = responder.Handle(ClientMessage(kRequest), buffer);
+  CHECK(nak.action == DhcpAction::kReply);
+  CheckReply(nak.reply);
+  CHECK(MessageType(nak.reply) == kNak);
+
+  auto offer = responder.Handle(ClientMessage(kDiscover), buffer);
+  CHECK(offer.action == DhcpAction::kReply);
+  CheckReply(offer.reply);
+  CHECK(MessageType(offer.reply) == kOffer);
+  CHECK(frame::Load32(&offer.reply[kDhcpYourAddress]) == kClientAddress);
+  CHECK(std::memcmp(&offer.reply[frame::kEthSource], kServerMac.data(), 6) == 0);
+  // the message type, server identifier, lease time, netmask, extra options
+  // and end options
+  CHECK(offer.reply.size() == kDhcpOptions + 3 + 6 + 6 + 6 + 12 + 1);
+
+  auto ack = responder.Handle(ClientMessage(kRequest), buffer);
+  CHECK(ack.action == DhcpAction::kReply);
+  CheckReply(ack.reply);
+  CHECK(MessageType(ack.reply) == kAck);
+  CHECK(frame::Load32(&ack.reply[kDhcpYourAddress]) == kClientAddress);
+
+  // renewing the leased address
+  CHECK(MessageType(responder.Handle(ClientMessage(kRequest, kClientAddress), buffer).reply) ==
+        kAck);
+  // asking for another one
+  for (int i = 0; i < 3; i++) {
+    CHECK(MessageType(responder.Handle(ClientMessage(kRequest, 0x0a000009), buffer).reply) ==
+          kNak);
+  }
+  // after 3 bad requests the client must discover again, like with the driver
+  CHECK(MessageType(responder.Handle(ClientMessage(kRequest), buffer).reply) == kNak);
+}
+
+static void TestIgnoredFrames() {
+  std::vector<uint8_t> buffer(DhcpResponder::kMaxReplySize);
+  DhcpResponder responder{Config()};
+
+  auto other_client = ClientMessage(kDiscover, 0, {0x02, 0, 0, 0, 0, 0x12});
+  CHECK(responder.Handle(other_client, buffer).action == DhcpAction::kPass);
+  CHECK(responder.Handle(ClientMessage(kInform), buffer).action == DhcpAction::kDrop);
+
+  auto truncated = ClientMessage(kDiscover);
+  truncated.resize(100);
+  CHECK(responder.Handle(truncated, buffer).action == DhcpAction::kPass);
+  auto no_options = ClientMessage(kDiscover);
+  no_options.resize(kDhcpOptions);
+  CHECK(responder.Handle(no_options, buffer).action == DhcpAction::kDrop);
+  auto other_port = ClientMessage(kDiscover);
+  frame::Store16(&other_port[kUdpHeader + 2], 69);
+  CHECK(responder.Handle(other_port, buffer).action == DhcpAction::kPass);
+  auto tcp = ClientMessage(kDiscover);
+  tcp[kIpHeader + 9] = IPPROTO_TCP;
+  CHECK(responder.Handle(tcp, buffer).action == DhcpAction::kPass);
+
+  auto config = Config();
+  config.extra_options.resize(DhcpResponder::kOptionsCapacity + 1);
+  CHECK_THROWS(DhcpResponder{config}, std::invalid_argument);
+}
+
+// Mutated, truncated and random frames, each in a buffer of its exact size
+// for the sanitizers, never get an invalid reply.
+static void TestMalformedFrames() {
+  std::vector<uint8_t> buffer(DhcpResponder::kMaxReplySize);
+  DhcpResponder responder{Config()};
+  std::mt19937 random{7};
+  for (int i = 0; i < kFuzzFrames; i++) {
+    auto frame = ClientMessage(random() % 2 ? kDiscover : kRequest);
+    if (random() % 4 == 0) {
+      frame.resize(random() % frame.size());
+    }
+    for (unsigned flips = random() % 8; flips > 0 && !frame.empty(); flips--) {
+      frame[random() % frame.size()] = static_cast<uint8_t>(random());
+    }
+    if (random() % 8 == 0) {
+      for (int j = 0; j < 40; j++) {
+        frame.push_back(static_cast<uint8_t>(random()));
+      }
+    }
+    if (random() % 16 == 0) {
+      frame.resize(random() % 600);
+      for (auto &byte : frame) {
+        byte = static_cast<uint8_t>(random());
+      }
+    }
+    std::vector<uint8_t> exact{frame};
+    auto result = responder.Handle(exact, buffer);
+    if (result.action == DhcpAction::kReply) {
+      CheckReply(result.reply, &exact[kDhcpTransactionId]);
+    }
+  }
+}
+
+/**
+ * @brief Answers the frames the adapter sends into `device` until one gets a
+ *        reply, as the driver does.
+ */
+static void ServeOneReply(tap::TapDevice &device, DhcpResponder &responder) {
+  std::vector<uint8_t> buffer(DhcpResponder::kMaxReplySize);
+  for (auto frame = device.Read(kTapTimeoutMs); !frame.empty();
+       frame = device.Read(kTapTimeoutMs)) {
+    auto result = responder.Handle(frame, buffer);
+    if (result.action == DhcpAction::kReply) {
+      device.Write(result.reply);
+      return;
+    }
+  }
+  CHECK(!"no DHCP request from the adapter");
+}
+
+/**
+ * @brief The next DHCP reply the adapter receives, skipping the other frames.
+ */
+static std::vector<uint8_t> ReceiveReply(tap::PacketSocket &client) {
+  for (auto frame = client.Receive(kTapTimeoutMs); !frame.empty();
+       frame = client.Receive(kTapTimeoutMs)) {
+    if (frame.size() > kDhcpOptions &&
+        frame::Load16(&frame[frame::kEthType]) == frame::kEthTypeIpv4 &&
+        frame[kIpHeader + 9] == IPPROTO_UDP && frame::Load16(&frame[kUdpHeader + 2]) == 68) {
+      return frame;
+    }
+  }
+  CHECK(!"no DHCP reply to the adapter");
+  return {};
+}
+
+// A client leasing its address through a TAP device, the responder playing
+// the driver on the other side: the requests go out of the adapter through
+// an AF_PACKET socket, and the replies written into the TAP device come back
+// to it through the kernel.
+static void TestTapLease() {
+  tap::TapDevice device{"dhcp-tap0"};
+  tap::PacketSocket client{device};
+  auto config = Config();
+  config.client_mac = device.mac();
+  DhcpResponder responder{config};
+
+  client.Send(ClientMessage(kDiscover, 0, device.mac()));
+  ServeOneReply(device, responder);
+  auto offer = ReceiveReply(client);
+  CheckReply(offer);
+  CHECK(MessageType(offer) == kOffer);
+  CHECK(frame::Load32(&offer[kDhcpYourAddress]) == kClientAddress);
+  CHECK(frame::MacEqual(&offer[kDhcpClientMac], device.mac()));
+
+  client.Send(ClientMessage(kRequest, 0, device.mac()));
+  ServeOneReply(device, responder);
+  auto ack = ReceiveReply(client);
+  CheckReply(ack);
+  CHECK(MessageType(ack) == kAck);
+  CHECK(frame::Load32(&ack[kDhcpYourAddress]) == kClientAddress);
+}
+
+int main(int argc, char *argv[]) {
+  // the round trip through a TAP device, as root
+  if (argc > 1 && std::string_view{argv[1]} == "--tap") {
+    if (!tap::EnterNetworkNamespace()) {
+      return tap::kSkipped;
+    }
+    try {
+      TestTapLease();
+    } catch (const std::exception &e) {
+      std::fprintf(stderr, "%s\n", e.what());
+      return 1;
+    }
+    std::printf("DHCP responder through a TAP device ok\n");
+    return 0;
+  }
+
+  TestRoundTrips();
+  TestIgnoredFrames();
+  TestMalformedFrames();
+  std::printf("DHCP responder ok\n");
+  return 0;
+}
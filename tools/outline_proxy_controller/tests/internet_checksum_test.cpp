@@ -0,0 +1,190 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include <arpa/inet.h>
+
+#include "check.h"
+#include "internet_checksum.h"
+
+using namespace outline;
+
+namespace cs = outline::checksum;
+
+// An IPv4 header whose checksum is 0xb861
+static const uint8_t kIpv4Header[20] = {0x45, 0x00, 0x00, 0x73, 0x00, 0x00, 0x40,
+                                        0x00, 0x40, 0x11, 0x00, 0x00, 0xc0, 0xa8,
+                                        0x00, 0x01, 0xc0, 0xa8, 0x00, 0xc7};
+
+/**
+ * @brief The checksum summed a byte at a time, as the tap-windows6 driver does.
+ */
+static uint16_t ReferenceChecksum(const uint8_t *data, size_t length, uint32_t sum = 0) {
+  for (size_t i = 0; i < length; i += 2) {
+    sum += static_cast<uint32_t>(data[i] << 8) + (i + 1 < length ? data[i + 1] : 0);
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return static_cast<uint16_t>(~sum);
+}
+
+static std::vector<uint8_t> RandomBytes(size_t length, std::mt19937 &random) {
+  std::vector<uint8_t> bytes(length);
+  for (auto &byte : bytes) {
+    byte = static_cast<uint8_t>(random());
+  }
+  return bytes;
+}
+
+static void TestRfc1071Vectors() {
+  // the example of RFC 1071 section 3, summing to 0xddf2
+  const uint8_t rfc1071[] = {0x00, 0x01, 0xf2, 0x03, 0xf4, 0xf5, 0xf6, 0xf7};
+  CHECK(cs::Compute(rfc1071, sizeof(rfc1071)) == 0x220d);
+
+  uint8_t header[20];
+  std::memcpy(header, kIpv4Header, sizeof(header));
+  CHECK(cs::Compute(header, sizeof(header)) == 0xb861);
+  header[10] = 0xb8;
+  header[11] = 0x61;
+  CHECK(cs::Compute(header, sizeof(header)) == 0);
+}
+
+// Every kernel the CPU supports matches the reference at every alignment and
+// odd length, and over the lengths where the 16-bit folding saturates.
+static void TestKernels(std::mt19937 &random) {
+  if (!cs::IsSupported(cs::Kernel::kNeon)) {
+    const uint8_t data[2] = {1, 2};
+    CHECK_THROWS(cs::Accumulate(cs::Kernel::kNeon, data, sizeof(data)), std::invalid_argument);
+  }
+
+  auto data = RandomBytes(70000, random);
+  std::vector<uint8_t> ones(65536, 0xff);
+  for (auto kernel : {cs::Kernel::kScalar, cs::Kernel::kSse2, cs::Kernel::kAvx2,
+                      cs::Kernel::kNeon}) {
+    if (!cs::IsSupported(kernel)) {
+      continue;
+    }
+    for (size_t offset = 0; offset < 8; offset++) {
+      for (size_t length = 0; length < 600; length++) {
+        CHECK(cs::Finish(cs::Accumulate(kernel, data.data() + offset, length)) ==
+              ReferenceChecksum(data.data() + offset, length));
+      }
+    }
+    for (size_t length : {1500, 9000, 65535, 65536, 69997}) {
+      CHECK(cs::Finish(cs::Accumulate(kernel, data.data() + 3, length)) ==
+            ReferenceChecksum(data.data() + 3, length));
+    }
+    CHECK(cs::Finish(cs::Accumulate(kernel, ones.data(), ones.size())) ==
+          ReferenceChecksum(ones.data(), ones.size()));
+  }
+}
+
+static void TestPartialSums(std::mt19937 &random) {
+  auto data = RandomBytes(1501, random);
+  for (size_t split = 0; split < data.size(); split += 2) {
+    auto sum = cs::Accumulate(data.data(), split);
+    sum = cs::Accumulate(data.data() + split, data.size() - split, sum);
+    CHECK(cs::Finish(sum) == ReferenceChecksum(data.data(), data.size()));
+  }
+}
+
+static void TestPseudoHeaders(std::mt19937 &random) {
+  const uint16_t length = 333;
+  auto udp = RandomBytes(length, random);
+  udp[6] = udp[7] = 0;
+
+  const uint8_t source[4] = {10, 0, 85, 2};
+  const uint8_t destination[4] = {8, 8, 8, 8};
+  const uint8_t pseudo_header[12] = {10, 0, 85, 2, 8, 8, 8, 8, 0, IPPROTO_UDP, length >> 8,
+                                     length & 0xff};
+  auto checksum = cs::Finish(
+      cs::Accumulate(udp.data(), udp.size(), cs::PseudoHeaderV4(source, destination,
+                                                                IPPROTO_UDP, length)));
+  CHECK(checksum == ReferenceChecksum(udp.data(), udp.size(),
+                                      ~ReferenceChecksum(pseudo_header, 12) & 0xffff));
+  // the segment with its checksum sums to 0
+  udp[6] = static_cast<uint8_t>(checksum >> 8);
+  udp[7] = static_cast<uint8_t>(checksum);
+  CHECK(cs::Finish(cs::Accumulate(udp.data(), udp.size(),
+                                  cs::PseudoHeaderV4(source, destination, IPPROTO_UDP,
+                                                     length))) == 0);
+
+  auto source6 = RandomBytes(16, random);
+  auto destination6 = RandomBytes(16, random);
+  uint8_t pseudo_header6[40] = {};
+  std::memcpy(pseudo_header6, source6.data(), 16);
+  std::memcpy(pseudo_header6 + 16, destination6.data(), 16);
+  pseudo_header6[34] = length >> 8;
+  pseudo_header6[35] = length & 0xff;
+  pseudo_header6[39] = IPPROTO_ICMPV6;
+  CHECK(cs::Finish(cs::Accumulate(udp.data(), udp.size(),
+                                  cs::PseudoHeaderV6(source6.data(), destination6.data(),
+                                                     IPPROTO_ICMPV6, length))) ==
+        ReferenceChecksum(udp.data(), udp.size(), ~ReferenceChecksum(pseudo_header6, 40) & 0xffff));
+}
+
+// The incremental updates of RFC 1624 match a full recomputation, for the
+// rewrite of a source address and the decrement of a TTL.
+static void TestRfc1624Updates(std::mt19937 &random) {
+  for (int round = 0; round < 10000; round++) {
+    uint8_t header[20];
+    std::memcpy(header, kIpv4Header, sizeof(header));
+    header[8] = static_cast<uint8_t>(random());
+    for (int i = 12; i < 20; i++) {
+      header[i] = static_cast<uint8_t>(random());
+    }
+    auto checksum = cs::Compute(header, sizeof(header));
+
+    uint32_t old_source;
+    std::memcpy(&old_source, header + 12, 4);
+    uint32_t new_source = random();
+    std::memcpy(header + 12, &new_source, 4);
+    auto expected = cs::Compute(header, sizeof(header));
+    CHECK(cs::Update32(checksum, ntohl(old_source), ntohl(new_source)) == expected);
+
+    auto old_word = static_cast<uint16_t>(header[8] << 8 | header[9]);
+    header[8]--;
+    auto new_word = static_cast<uint16_t>(header[8] << 8 | header[9]);
+    CHECK(cs::Update16(expected, old_word, new_word) == cs::Compute(header, sizeof(header)));
+
+    auto packet = RandomBytes(64, random);
+    auto old_address = RandomBytes(16, random);
+    auto new_address = RandomBytes(16, random);
+    std::memcpy(packet.data() + 8, old_address.data(), 16);
+    auto before = cs::Compute(packet.data(), packet.size());
+    std::memcpy(packet.data() + 8, new_address.data(), 16);
+    auto updated = cs::Update(before, old_address.data(), new_address.data(), 16);
+    auto recomputed = cs::Compute(packet.data(), packet.size());
+    // 0x0000 and 0xffff are both zero in one's complement
+    CHECK(updated == recomputed || (updated ^ recomputed) == 0xffff);
+  }
+}
+
+int main() {
+  std::mt19937 random{1};
+  TestRfc1071Vectors();
+  TestKernels(random);
+  TestPartialSums(random);
+  TestPseudoHeaders(random);
+  TestRfc1624Updates(random);
+  std::printf("internet checksums ok, active kernel %s\n", cs::KernelName(cs::ActiveKernel()));
+  return 0;
+}
@@ -0,0 +1,350 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "internet_checksum.h"
+#include "neighbor_responder.h"
+#include "tap_device.h"
+
+using namespace outline;
+
+static const MacAddress kAdapterMac = {0x02, 0, 0, 0, 0, 0x11};
+static const MacAddress kGatewayMac = {0x02, 0, 0, 0, 0, 0xfe};
+static const uint32_t kNetwork = 0x0a000000;
+static const uint32_t kAdapterAddress = 0x0a000002;
+static const uint32_t kGatewayAddress = 0x0a000001;
+static const Ipv6Address kGatewayAddress6 = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0,
+                                             0,    0,    0,    0,    0, 0, 0, 1};
+static const Ipv6Address kAdapterAddress6 = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0,
+                                             0,    0,    0,    0,    0, 0, 0, 2};
+
+// the offsets of the fields of an ARP message in an Ethernet frame
+static const size_t kArpOperation = 20;
+static const size_t kArpSenderMac = 22;
+static const size_t kArpSenderAddress = 28;
+static const size_t kArpTargetAddress = 38;
+static const size_t kArpFrameSize = 42;
+static const uint16_t kArpRequest = 1;
+static const uint16_t kArpReply = 2;
+
+// and of a neighbor solicitation or advertisement
+static const size_t kIpv6HopLimit = 21;
+static const size_t kIpv6Source = 22;
+static const size_t kIpv6Destination = 38;
+static const size_t kIcmpv6 = 54;
+static const size_t kIcmpv6Checksum = 56;
+static const size_t kNeighborFlags = 58;
+static const size_t kNeighborTarget = 62;
+static const size_t kNeighborOption = 78;
+static const size_t kNeighborFrameSize = 86;
+static const uint8_t kNeighborSolicitation = 135;
+static const uint8_t kNeighborAdvertisement = 136;
+static const uint8_t kSolicitedOverrideFlags = 0x60;
+static const uint8_t kOverrideFlag = 0x20;
+
+static const int kFuzzFrames = 200'000;
+static const int kTapTimeoutMs = 2000;
+
+static std::vector<uint8_t> ArpRequest(uint32_t sender, uint32_t target,
+                                       const MacAddress &destination = kBroadcastMac) {
+  std::vector<uint8_t> frame(kArpFrameSize, 0);
+  std::memcpy(&frame[frame::kEthDestination], destination.data(), 6);
+  std::memcpy(&frame[frame::kEthSource], kAdapterMac.data(), 6);
+  frame::Store16(&frame[frame::kEthType], frame::kEthTypeArp);
+  frame::Store16(&frame[14], 1);
+  frame::Store16(&frame[16], frame::kEthTypeIpv4);
+  frame[18] = 6;
+  frame[19] = 4;
+  frame::Store16(&frame[kArpOperation], kArpRequest);
+  std::memcpy(&frame[kArpSenderMac], kAdapterMac.data(), 6);
+  frame::Store32(&frame[kArpSenderAddress], sender);
+  frame::Store32(&frame[kArpTargetAddress], target);
+  return frame;
+}
+
+static uint16_t Icmpv6Checksum(std::span<const uint8_t> frame) {
+  auto length = static_cast<uint32_t>(frame.size() - kIcmpv6);
+  return checksum::Finish(checksum::Accumulate(
+      &frame[kIcmpv6], length,
+      checksum::PseudoHeaderV6(&frame[kIpv6Source], &frame[kIpv6Destination], IPPROTO_ICMPV6,
+                               length)));
+}
+
+/**
+ * @brief A neighbor solicitation for `target`, to its solicited-node
+ *        multicast address or to the gateway itself.
+ */
+static std::vector<uint8_t> NeighborSolicitation(const Ipv6Address &source,
+                                                 const Ipv6Address &target, bool multicast) {
+  std::vector<uint8_t> frame(kNeighborFrameSize, 0);
+  Ipv6Address destination = target;
+  if (multicast) {
+    destination = {0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0xff, target[13], target[14],
+                   target[15]};
+    frame[0] = 0x33;
+    frame[1] = 0x33;
+    std::memcpy(&frame[2], &destination[12], 4);
+  } else {
+    std::memcpy(&frame[frame::kEthDestination], kGatewayMac.data(), 6);
+  }
+  std::memcpy(&frame[frame::kEthSource], kAdapterMac.data(), 6);
+  frame::Store16(&frame[frame::kEthType], frame::kEthTypeIpv6);
+
+  frame[14] = 0x60;
+  frame::Store16(&frame[18], static_cast<uint16_t>(kNeighborFrameSize - kIcmpv6));
+  frame[20] = IPPROTO_ICMPV6;
+  frame[kIpv6HopLimit] = 255;
+  std::memcpy(&frame[kIpv6Source], source.data(), 16);
+  std::memcpy(&frame[kIpv6Destination], destination.data(), 16);
+
+  frame[kIcmpv6] = kNeighborSolicitation;
+  std::memcpy(&frame[kNeighborTarget], target.data(), 16);
+  // the source link-layer address option
+  frame[kNeighborOption] = 1;
+  frame[kNeighborOption + 1] = 1;
+  std::memcpy(&frame[kNeighborOption + 2], kAdapterMac.data(), 6);
+  frame::Store16(&frame[kIcmpv6Checksum], Icmpv6Checksum(frame));
+  return frame;
+}
+
+static NeighborResponder MakeResponder() {
+  NeighborResponder responder{kAdapterMac};
+  responder.AddIpv4Network(kNetwork, 24, kGatewayMac);
+  responder.AddIpv6Address(kGatewayAddress6, kGatewayMac);
+  return responder;
+}
+
+static void CheckNeighborAdvertisement(std::span<const uint8_t> reply) {
+  CHECK(reply.size() == kNeighborFrameSize);
+  CHECK(reply[kIcmpv6] == kNeighborAdvertisement);
+  CHECK(reply[kIpv6HopLimit] == 255);
+  CHECK(Icmpv6Checksum(reply) == 0);
+}
+
+static void TestTable() {
+  NeighborResponder responder{kAdapterMac};
+  CHECK_THROWS(responder.AddIpv4Network(kNetwork, 33, kGatewayMac), std::invalid_argument);
+  Ipv6Address multicast{0xff, 0x02};
+  CHECK_THROWS(responder.AddIpv6Address(multicast, kGatewayMac), std::invalid_argument);
+  for (uint32_t i = 0; i < NeighborResponder::kMaxEntries; i++) {
+    responder.AddIpv4Network(i << 8, 24, kGatewayMac);
+  }
+  CHECK_THROWS(responder.AddIpv4Network(kNetwork, 8, kGatewayMac), std::length_error);
+}
+
+static void TestArpReplies() {
+  std::vector<uint8_t> buffer(NeighborResponder::kMaxReplySize);
+  auto responder = MakeResponder();
+
+  auto reply = responder.Handle(ArpRequest(kAdapterAddress, kGatewayAddress), buffer);
+  CHECK(reply.size() == kArpFrameSize);
+  CHECK(frame::Load16(&reply[kArpOperation]) == kArpReply);
+  CHECK(std::memcmp(&reply[frame::kEthDestination], kAdapterMac.data(), 6) == 0);
+  CHECK(std::memcmp(&reply[kArpSenderMac], kGatewayMac.data(), 6) == 0);
+  CHECK(frame::Load32(&reply[kArpSenderAddress]) == kGatewayAddress);
+  CHECK(frame::Load32(&reply[kArpTargetAddress]) == kAdapterAddress);
+
+  // every address of the network, also to refresh an entry by unicast
+  CHECK(responder.Handle(ArpRequest(kAdapterAddress, 0x0a000063, kGatewayMac), buffer).size() ==
+        kArpFrameSize);
+  // padded to the minimum Ethernet frame
+  auto padded = ArpRequest(kAdapterAddress, kGatewayAddress);
+  padded.resize(60);
+  CHECK(responder.Handle(padded, buffer).size() == kArpFrameSize);
+
+  // a gratuitous ARP, another network, a request to another host
+  CHECK(responder.Handle(ArpRequest(kAdapterAddress, kAdapterAddress), buffer).empty());
+  CHECK(responder.Handle(ArpRequest(kAdapterAddress, 0x0b000001), buffer).empty());
+  // an RFC 5227 probe of the adapter's address, or of another one, and a
+  // sender outside the network
+  CHECK(responder.Handle(ArpRequest(0, kAdapterAddress), buffer).empty());
+  CHECK(responder.Handle(ArpRequest(0, kGatewayAddress), buffer).empty());
+  CHECK(responder.Handle(ArpRequest(0x0b000002, kGatewayAddress), buffer).empty());
+  CHECK(responder.Handle(ArpRequest(kAdapterAddress, kGatewayAddress, {0x02, 0, 0, 0, 0, 0x33}),
+                         buffer)
+            .empty());
+}
+
+static void TestNeighborAdvertisements() {
+  std::vector<uint8_t> buffer(NeighborResponder::kMaxReplySize);
+  auto responder = MakeResponder();
+
+  auto reply =
+      responder.Handle(NeighborSolicitation(kAdapterAddress6, kGatewayAddress6, true), buffer);
+  CheckNeighborAdvertisement(reply);
+  CHECK(reply[kNeighborFlags] == kSolicitedOverrideFlags);
+  CHECK(std::memcmp(&reply[frame::kEthDestination], kAdapterMac.data(), 6) == 0);
+  CHECK(std::memcmp(&reply[kIpv6Destination], kAdapterAddress6.data(), 16) == 0);
+  CHECK(std::memcmp(&reply[kNeighborTarget], kGatewayAddress6.data(), 16) == 0);
+  // the target link-layer address option
+  CHECK(reply[kNeighborOption] == 2);
+  CHECK(std::memcmp(&reply[kNeighborOption + 2], kGatewayMac.data(), 6) == 0);
+
+  CheckNeighborAdvertisement(
+      responder.Handle(NeighborSolicitation(kAdapterAddress6, kGatewayAddress6, false), buffer));
+
+  // duplicate address detection, from the unspecified address, is answered
+  // to all the nodes, unsolicited
+  auto dad = responder.Handle(NeighborSolicitation(Ipv6Address{}, kGatewayAddress6, true), buffer);
+  CheckNeighborAdvertisement(dad);
+  CHECK(dad[kNeighborFlags] == kOverrideFlag);
+  CHECK(dad[frame::kEthDestination] == 0x33);
+  CHECK(dad[kIpv6Destination] == 0xff);
+
+  auto bad_checksum = NeighborSolicitation(kAdapterAddress6, kGatewayAddress6, true);
+  bad_checksum[kIcmpv6Checksum + 1] ^= 1;
+  CHECK(responder.Handle(bad_checksum, buffer).empty());
+  auto forwarded = NeighborSolicitation(kAdapterAddress6, kGatewayAddress6, true);
+  forwarded[kIpv6HopLimit] = 64;
+  CHECK(responder.Handle(forwarded, buffer).empty());
+  CHECK(responder.Handle(NeighborSolicitation(kAdapterAddress6, kAdapterAddress6, true), buffer)
+            .empty());
+  auto other_adapter = NeighborSolicitation(kAdapterAddress6, kGatewayAddress6, true);
+  other_adapter[frame::kEthSource + 5] = 0x12;
+  CHECK(responder.Handle(other_adapter, buffer).empty());
+}
+
+// Mutated, truncated and random frames, each in a buffer of its exact size
+// for the sanitizers, never get an invalid reply.
+static void TestMalformedFrames() {
+  std::vector<uint8_t> buffer(NeighborResponder::kMaxReplySize);
+  auto responder = MakeResponder();
+  std::mt19937 random{3};
+  for (int i = 0; i < kFuzzFrames; i++) {
+    auto frame = random() % 2
+                     ? ArpRequest(kAdapterAddress, kNetwork | (random() & 0x1ff))
+                     : NeighborSolicitation(kAdapterAddress6, kGatewayAddress6, random() % 2);
+    if (random() % 4 == 0) {
+      frame.resize(random() % frame.size());
+    }
+    for (unsigned flips = random() % 6; flips > 0 && !frame.empty(); flips--) {
+      frame[random() % frame.size()] = static_cast<uint8_t>(random());
+    }
+    if (random() % 16 == 0) {
+      frame.resize(random() % 200);
+      for (auto &byte : frame) {
+        byte = static_cast<uint8_t>(random());
+      }
+    }
+    std::vector<uint8_t> exact{frame};
+    auto reply = responder.Handle(exact, buffer);
+    if (reply.size() == kNeighborFrameSize) {
+      CheckNeighborAdvertisement(reply);
+    } else if (!reply.empty()) {
+      CHECK(reply.size() == kArpFrameSize);
+      CHECK(frame::Load16(&reply[kArpOperation]) == kArpReply);
+    }
+  }
+}
+
+/**
+ * @brief Sends a datagram from the adapter to `address` of `family`, which
+ *        the kernel holds until it resolves the MAC address of `address`.
+ */
+static void SendDatagram(int family, const sockaddr *address, socklen_t address_length) {
+  int fd = ::socket(family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  tap::ThrowIf(fd < 0, "failed to create a UDP socket");
+  auto sent = ::sendto(fd, "x", 1, 0, address, address_length);
+  ::close(fd);
+  tap::ThrowIf(sent != 1, "failed to send a datagram");
+}
+
+/**
+ * @brief Answers the frames the adapter sends into `device`, as the driver
+ *        does, until it sends a packet of `ether_type` to the MAC address of
+ *        the gateway: the kernel resolved the gateway from a reply.
+ */
+static void ServeUntilResolved(tap::TapDevice &device, const NeighborResponder &responder,
+                               uint16_t ether_type) {
+  std::vector<uint8_t> buffer(NeighborResponder::kMaxReplySize);
+  bool replied = false;
+  for (auto frame = device.Read(kTapTimeoutMs); !frame.empty();
+       frame = device.Read(kTapTimeoutMs)) {
+    auto reply = responder.Handle(frame, buffer);
+    if (!reply.empty()) {
+      device.Write(reply);
+      replied = true;
+    } else if (frame.size() > frame::kEthHeaderSize &&
+               frame::Load16(&frame[frame::kEthType]) == ether_type &&
+               frame::MacEqual(&frame[frame::kEthDestination], kGatewayMac)) {
+      CHECK(replied);
+      return;
+    }
+  }
+  CHECK(!"the adapter did not resolve the gateway");
+}
+
+// The kernel resolving the gateway through a TAP device, with ARP and with
+// IPv6 neighbor discovery, the responder playing the driver on the other
+// side.
+static void TestTapResolution() {
+  tap::TapDevice device{"nd-tap0"};
+  device.AddIpv4Address(kAdapterAddress, 24);
+  device.AddIpv6Address(kAdapterAddress6, 64);
+  NeighborResponder responder{device.mac()};
+  responder.AddIpv4Network(kNetwork, 24, kGatewayMac);
+  responder.AddIpv6Address(kGatewayAddress6, kGatewayMac);
+
+  sockaddr_in gateway{};
+  gateway.sin_family = AF_INET;
+  gateway.sin_port = htons(9);
+  gateway.sin_addr.s_addr = htonl(kGatewayAddress);
+  SendDatagram(AF_INET, reinterpret_cast<sockaddr *>(&gateway), sizeof(gateway));
+  ServeUntilResolved(device, responder, frame::kEthTypeIpv4);
+
+  sockaddr_in6 gateway6{};
+  gateway6.sin6_family = AF_INET6;
+  gateway6.sin6_port = htons(9);
+  std::memcpy(&gateway6.sin6_addr, kGatewayAddress6.data(), kGatewayAddress6.size());
+  SendDatagram(AF_INET6, reinterpret_cast<sockaddr *>(&gateway6), sizeof(gateway6));
+  ServeUntilResolved(device, responder, frame::kEthTypeIpv6);
+}
+
+int main(int argc, char *argv[]) {
+  // the resolutions through a TAP device, as root
+  if (argc > 1 && std::string_view{argv[1]} == "--tap") {
+    if (!tap::EnterNetworkNamespace()) {
+      return tap::kSkipped;
+    }
+    try {
+      TestTapResolution();
+    } catch (const std::exception &e) {
+      std::fprintf(stderr, "%s\n", e.what());
+      return 1;
+    }
+    std::printf("neighbor responder through a TAP device ok\n");
+    return 0;
+  }
+
+  TestTable();
+  TestArpReplies();
+  TestNeighborAdvertisements();
+  TestMalformedFrames();
+  std::printf("neighbor responder ok\n");
+  return 0;
+}
@@ -0,0 +1,169 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "packet_buffer_pool.h"
+
+using namespace outline;
+
+// several slabs of small buffers
+static const size_t kManyBuffers = 10000;
+
+static void TestBounds() {
+  PacketBufferPool pool;
+  CHECK_THROWS(pool.Allocate(PacketBufferPool::kLargeCapacity + 1), std::length_error);
+
+  auto packet = pool.Allocate(1500);
+  CHECK(packet && packet.size() == 1500);
+  CHECK(packet.headroom() == PacketBufferPool::kHeadroom);
+  CHECK(packet.tailroom() == PacketBufferPool::kSmallCapacity - 1500);
+  std::memset(packet.data(), 0xab, packet.size());
+
+  // an encapsulation header
+  auto start = packet.data();
+  CHECK(packet.Prepend(20) == start - 20);
+  CHECK(packet.size() == 1520 && packet.headroom() == PacketBufferPool::kHeadroom - 20);
+  CHECK(packet.data()[20] == 0xab);
+  CHECK_THROWS(packet.Prepend(PacketBufferPool::kHeadroom), std::length_error);
+  CHECK(packet.Prepend(PacketBufferPool::kHeadroom - 20) != nullptr);
+  CHECK(packet.headroom() == 0);
+
+  auto capacity = packet.size() + packet.tailroom();
+  CHECK(capacity == PacketBufferPool::kHeadroom + PacketBufferPool::kSmallCapacity);
+  packet.Resize(capacity);
+  CHECK(packet.tailroom() == 0);
+  CHECK_THROWS(packet.Resize(capacity + 1), std::length_error);
+  packet.Resize(10);
+  CHECK(packet.size() == 10);
+
+  auto large = pool.Allocate(PacketBufferPool::kSmallCapacity + 1);
+  CHECK(large.tailroom() ==
+        PacketBufferPool::kLargeCapacity - PacketBufferPool::kSmallCapacity - 1);
+
+  auto slice = large.Slice(100, 200);
+  CHECK(slice.data() == large.data() + 100 && slice.size() == 200);
+  CHECK(large.Slice(large.size(), 0).empty());
+  CHECK_THROWS(large.Slice(large.size(), 1), std::out_of_range);
+  CHECK_THROWS(large.Slice(1, large.size()), std::out_of_range);
+  CHECK_THROWS(slice.Slice(0, 201), std::out_of_range);
+
+  // a slice without a buffer
+  PacketSlice none;
+  CHECK(!none && none.empty() && none.data() == nullptr);
+  CHECK(!none.Slice(0, 0));
+  CHECK_THROWS(none.Slice(0, 1), std::out_of_range);
+  CHECK_THROWS(none.Prepend(1), std::length_error);
+  CHECK_THROWS(none.Resize(1), std::length_error);
+  CHECK(!none.unique());
+}
+
+// The buffer goes back to the pool with the last of its slices, and is the
+// next one allocated.
+static void TestReferences() {
+  PacketBufferPool pool;
+  auto packet = pool.Allocate(100);
+  auto memory = packet.data();
+  CHECK(packet.unique());
+
+  auto copy = packet;
+  auto slice = packet.Slice(10, 20);
+  CHECK(!packet.unique() && !copy.unique());
+  auto moved = std::move(copy);
+  CHECK(!copy && moved.data() == memory);
+
+  packet.Reset();
+  moved.Reset();
+  CHECK(slice.unique());
+  CHECK(pool.Allocate(100).data() != memory);
+  slice = PacketSlice{};
+  CHECK(pool.Allocate(100).data() == memory);
+
+  for (int i = 0; i < 100000; i++) {
+    auto buffer = pool.Allocate(i % 2 ? 1500 : 9000);
+    buffer.data()[0] = 1;
+  }
+  CHECK(pool.slab_count() == 2);
+}
+
+// The buffers released by another thread go back to the thread which
+// allocated them, which reuses them before mapping another slab.
+static void TestCrossThreadReturn() {
+  PacketBufferPool pool;
+  std::vector<PacketSlice> packets;
+  size_t slabs = 0;
+  std::thread owner{[&] {
+    for (size_t i = 0; i < kManyBuffers; i++) {
+      packets.push_back(pool.Allocate(1500));
+    }
+    slabs = pool.slab_count();
+    std::thread releaser{[&] { packets.clear(); }};
+    releaser.join();
+    for (size_t i = 0; i < kManyBuffers; i++) {
+      packets.push_back(pool.Allocate(1500));
+    }
+    CHECK(pool.slab_count() == slabs);
+    packets.clear();
+  }};
+  owner.join();
+  CHECK(slabs > 1);
+}
+
+// The cache of an exited thread, with the buffers released after it exited,
+// is adopted by the next thread instead of mapping slabs again.
+static void TestOrphanAdoption() {
+  PacketBufferPool pool;
+  std::vector<PacketSlice> packets;
+  std::thread first{[&] {
+    for (size_t i = 0; i < kManyBuffers; i++) {
+      packets.push_back(pool.Allocate(1500));
+    }
+  }};
+  first.join();
+  auto slabs = pool.slab_count();
+  packets.clear();
+
+  std::thread second{[&] {
+    for (size_t i = 0; i < kManyBuffers; i++) {
+      packets.push_back(pool.Allocate(1500));
+    }
+    packets.clear();
+  }};
+  second.join();
+  CHECK(pool.slab_count() == slabs);
+
+  // two live threads do not share a cache
+  std::thread third{[&] {
+    auto packet = pool.Allocate(1500);
+    std::thread fourth{[&] { auto other = pool.Allocate(1500); }};
+    fourth.join();
+  }};
+  third.join();
+  CHECK(pool.slab_count() == slabs + 1);
+}
+
+int main() {
+  TestBounds();
+  TestReferences();
+  TestCrossThreadReturn();
+  TestOrphanAdoption();
+  std::printf("packet buffer pool ok\n");
+  return 0;
+}
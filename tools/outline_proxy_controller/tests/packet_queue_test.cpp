@@ -0,0 +1,141 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "packet_buffer_pool.h"
+#include "packet_queue.h"
+
+using namespace outline;
+
+// the producer in the high bits of a stress test item, its sequence below
+static const int kProducerShift = 40;
+static const uint64_t kSequenceMask = (uint64_t{1} << kProducerShift) - 1;
+static const uint64_t kStressItems = 1'000'000;
+
+template <typename Queue> static void TestOrderAndDrops() {
+  CHECK_THROWS(Queue{6}, std::invalid_argument);
+  CHECK_THROWS(Queue{0}, std::invalid_argument);
+
+  Queue queue{8};
+  CHECK(queue.capacity() == 8);
+  for (uint64_t i = 0; i < 8; i++) {
+    CHECK(queue.Push(uint64_t{i}));
+  }
+  CHECK(!queue.Push(uint64_t{99}));
+
+  uint64_t popped[16];
+  CHECK(queue.PopBatch(popped, 3) == 3);
+  CHECK(popped[0] == 0 && popped[1] == 1 && popped[2] == 2);
+
+  // only the first 3 fit, the wrapped around slots
+  uint64_t pushed[5] = {8, 9, 10, 11, 12};
+  CHECK(queue.PushBatch(pushed, 5) == 3);
+  CHECK(queue.PopBatch(popped, 16) == 8);
+  for (uint64_t i = 0; i < 8; i++) {
+    CHECK(popped[i] == i + 3);
+  }
+  CHECK(!queue.Pop(popped[0]));
+
+  auto stats = queue.Stats();
+  CHECK(stats.enqueued == 11);
+  CHECK(stats.dequeued == 11);
+  CHECK(stats.dropped == 3);
+}
+
+// Each producer pushes its sequence in batches, the consumer checks that
+// what it pops of each producer is in order, and that nothing is lost but
+// what was counted as dropped.
+template <typename Queue> static void TestStress(int producers, size_t batch) {
+  Queue queue{256};
+  std::atomic<int> running{producers};
+  std::vector<std::thread> threads;
+  for (int producer = 0; producer < producers; producer++) {
+    threads.emplace_back([&queue, &running, producer, batch] {
+      uint64_t items[64];
+      for (uint64_t next = 0; next < kStressItems;) {
+        auto count = std::min<uint64_t>(batch, kStressItems - next);
+        for (size_t i = 0; i < count; i++) {
+          items[i] = static_cast<uint64_t>(producer) << kProducerShift | (next + i);
+        }
+        if (queue.PushBatch(items, count) < count) {
+          std::this_thread::yield();
+        }
+        next += count;
+      }
+      running--;
+    });
+  }
+
+  std::vector<int64_t> last(producers, -1);
+  uint64_t popped = 0;
+  uint64_t items[64];
+  for (;;) {
+    bool done = running == 0;
+    auto count = queue.PopBatch(items, 64);
+    for (size_t i = 0; i < count; i++) {
+      auto producer = items[i] >> kProducerShift;
+      auto sequence = static_cast<int64_t>(items[i] & kSequenceMask);
+      CHECK(producer < static_cast<uint64_t>(producers));
+      CHECK(sequence > last[producer]);
+      last[producer] = sequence;
+    }
+    popped += count;
+    if (count == 0) {
+      if (done) {
+        break;
+      }
+      std::this_thread::yield();
+    }
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  auto stats = queue.Stats();
+  CHECK(stats.dequeued == popped);
+  CHECK(stats.enqueued == popped);
+  CHECK(stats.enqueued + stats.dropped == kStressItems * static_cast<uint64_t>(producers));
+}
+
+static void TestMoveOnlyItems() {
+  PacketBufferPool pool;
+  MpscPacketQueue<PacketSlice> queue{4};
+  auto slice = pool.Allocate(100);
+  CHECK(queue.Push(std::move(slice)));
+  CHECK(!slice);
+  PacketSlice popped;
+  CHECK(queue.Pop(popped));
+  CHECK(popped && popped.size() == 100);
+}
+
+int main() {
+  TestOrderAndDrops<SpscPacketQueue<uint64_t>>();
+  TestOrderAndDrops<MpscPacketQueue<uint64_t>>();
+  for (size_t batch : {1, 32}) {
+    TestStress<SpscPacketQueue<uint64_t>>(1, batch);
+    TestStress<MpscPacketQueue<uint64_t>>(1, batch);
+    TestStress<MpscPacketQueue<uint64_t>>(4, batch);
+  }
+  TestMoveOnlyItems();
+  std::printf("packet queues ok\n");
+  return 0;
+}
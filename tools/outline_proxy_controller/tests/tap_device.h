@@ -0,0 +1,232 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/if_packet.h>
+#include <linux/if_tun.h>
+#include <linux/ipv6.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "ethernet_frame.h"
+
+// A TAP device for the tests exchanging frames with the kernel, in a network
+// namespace of their own. They need root and are skipped without it.
+namespace tap {
+
+// ctest's SKIP_RETURN_CODE of these tests
+inline constexpr int kSkipped = 77;
+
+/**
+ * @return bool Whether this process now has a network namespace of its own,
+ *         with the loopback device only.
+ */
+inline bool EnterNetworkNamespace() {
+  if (::unshare(CLONE_NEWNET) != 0) {
+    std::printf("skipped: no network namespace of our own: %s\n", std::strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+inline void ThrowIf(bool failed, const char *what) {
+  if (failed) {
+    throw std::system_error{errno, std::generic_category(), what};
+  }
+}
+
+/**
+ * @brief Waits up to `timeout_ms` for `fd` to be readable.
+ */
+inline bool WaitReadable(int fd, int timeout_ms) {
+  pollfd readable{fd, POLLIN, 0};
+  return ::poll(&readable, 1, timeout_ms) == 1;
+}
+
+/**
+ * @brief A TAP device, up. The test plays the driver through `fd()`, and the
+ *        kernel side of the device is the adapter.
+ */
+class TapDevice {
+public:
+  explicit TapDevice(const char *name) : name_{name} {
+    fd_ = ::open("/dev/net/tun", O_RDWR | O_CLOEXEC);
+    ThrowIf(fd_ < 0, "failed to open /dev/net/tun");
+    ifreq request{};
+    std::strncpy(request.ifr_name, name, IFNAMSIZ - 1);
+    request.ifr_flags = IFF_TAP | IFF_NO_PI;
+    ThrowIf(::ioctl(fd_, TUNSETIFF, &request) < 0, "failed to create the TAP device");
+
+    control_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    ThrowIf(control_ < 0, "failed to create a control socket");
+    ThrowIf(::ioctl(control_, SIOCGIFHWADDR, &request) < 0, "failed to read the MAC address");
+    std::memcpy(mac_.data(), request.ifr_hwaddr.sa_data, mac_.size());
+    ThrowIf(::ioctl(control_, SIOCGIFFLAGS, &request) < 0, "failed to read the link flags");
+    request.ifr_flags |= IFF_UP;
+    ThrowIf(::ioctl(control_, SIOCSIFFLAGS, &request) < 0, "failed to bring the TAP device up");
+    index_ = static_cast<int>(::if_nametoindex(name));
+  }
+  ~TapDevice() {
+    ::close(control_);
+    ::close(fd_);
+  }
+  TapDevice(const TapDevice &) = delete;
+  TapDevice &operator=(const TapDevice &) = delete;
+
+  int fd() const { return fd_; }
+  int index() const { return index_; }
+  const std::string &name() const { return name_; }
+  const outline::MacAddress &mac() const { return mac_; }
+
+  /**
+   * @brief Give the adapter `address`/`prefix_length`, in host byte order.
+   */
+  void AddIpv4Address(uint32_t address, int prefix_length) {
+    ifreq request{};
+    std::strncpy(request.ifr_name, name_.c_str(), IFNAMSIZ - 1);
+    auto &ipv4 = *reinterpret_cast<sockaddr_in *>(&request.ifr_addr);
+    ipv4.sin_family = AF_INET;
+    ipv4.sin_addr.s_addr = htonl(address);
+    ThrowIf(::ioctl(control_, SIOCSIFADDR, &request) < 0, "failed to set the IPv4 address");
+    ipv4.sin_addr.s_addr = htonl(prefix_length == 0 ? 0 : ~uint32_t{0} << (32 - prefix_length));
+    ThrowIf(::ioctl(control_, SIOCSIFNETMASK, &request) < 0, "failed to set the netmask");
+  }
+
+  /**
+   * @brief Give the adapter `address`/`prefix_length`, usable at once: the
+   *        duplicate address detection is turned off first.
+   */
+  void AddIpv6Address(const std::array<uint8_t, 16> &address, int prefix_length) {
+    auto dad_path = "/proc/sys/net/ipv6/conf/" + name_ + "/accept_dad";
+    int dad = ::open(dad_path.c_str(), O_WRONLY | O_CLOEXEC);
+    ThrowIf(dad < 0, "failed to open the duplicate address detection setting");
+    auto written = ::write(dad, "0", 1);
+    ::close(dad);
+    ThrowIf(written != 1, "failed to turn off duplicate address detection");
+
+    int control = ::socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    ThrowIf(control < 0, "failed to create an IPv6 control socket");
+    in6_ifreq request{};
+    std::memcpy(&request.ifr6_addr, address.data(), address.size());
+    request.ifr6_prefixlen = static_cast<uint32_t>(prefix_length);
+    request.ifr6_ifindex = index_;
+    auto result = ::ioctl(control, SIOCSIFADDR, &request);
+    ::close(control);
+    ThrowIf(result < 0, "failed to set the IPv6 address");
+  }
+
+  /**
+   * @brief The next frame the adapter sends, or an empty one after
+   *        `timeout_ms`.
+   */
+  std::vector<uint8_t> Read(int timeout_ms) {
+    std::vector<uint8_t> frame(2048);
+    if (!WaitReadable(fd_, timeout_ms)) {
+      return {};
+    }
+    auto length = ::read(fd_, frame.data(), frame.size());
+    ThrowIf(length < 0, "failed to read the TAP device");
+    frame.resize(static_cast<size_t>(length));
+    return frame;
+  }
+
+  void Write(std::span<const uint8_t> frame) {
+    ThrowIf(::write(fd_, frame.data(), frame.size()) != static_cast<ssize_t>(frame.size()),
+            "failed to write the TAP device");
+  }
+
+private:
+  std::string name_;
+  int fd_ = -1;
+  int control_ = -1;
+  int index_ = 0;
+  outline::MacAddress mac_{};
+};
+
+/**
+ * @brief An AF_PACKET socket sending and receiving raw frames as the adapter
+ *        of `device`, like a DHCP client does.
+ */
+class PacketSocket {
+public:
+  explicit PacketSocket(const TapDevice &device) : index_{device.index()} {
+    fd_ = ::socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, htons(ETH_P_ALL));
+    ThrowIf(fd_ < 0, "failed to create a packet socket");
+    sockaddr_ll address{};
+    address.sll_family = AF_PACKET;
+    address.sll_protocol = htons(ETH_P_ALL);
+    address.sll_ifindex = index_;
+    ThrowIf(::bind(fd_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0,
+            "failed to bind the packet socket");
+  }
+  ~PacketSocket() { ::close(fd_); }
+  PacketSocket(const PacketSocket &) = delete;
+  PacketSocket &operator=(const PacketSocket &) = delete;
+
+  void Send(std::span<const uint8_t> frame) {
+    sockaddr_ll address{};
+    address.sll_family = AF_PACKET;
+    address.sll_ifindex = index_;
+    address.sll_halen = 6;
+    std::memcpy(address.sll_addr, &frame[outline::frame::kEthDestination], 6);
+    ThrowIf(::sendto(fd_, frame.data(), frame.size(), 0, reinterpret_cast<sockaddr *>(&address),
+                     sizeof(address)) != static_cast<ssize_t>(frame.size()),
+            "failed to send a frame");
+  }
+
+  /**
+   * @brief The next frame the adapter receives, leaving out the ones it sends,
+   *        or an empty one after `timeout_ms`.
+   */
+  std::vector<uint8_t> Receive(int timeout_ms) {
+    std::vector<uint8_t> frame(2048);
+    while (WaitReadable(fd_, timeout_ms)) {
+      sockaddr_ll address{};
+      socklen_t address_length = sizeof(address);
+      auto length = ::recvfrom(fd_, frame.data(), frame.size(), 0,
+                               reinterpret_cast<sockaddr *>(&address), &address_length);
+      ThrowIf(length < 0, "failed to receive a frame");
+      if (address.sll_pkttype != PACKET_OUTGOING) {
+        frame.resize(static_cast<size_t>(length));
+        return frame;
+      }
+    }
+    return {};
+  }
+
+private:
+  int index_;
+  int fd_ = -1;
+};
+
+}  // namespace tap
@@ -0,0 +1,75 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdexcept>
+
+#include <linux/pkt_sched.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+
+#include "traffic_control.h"
+
+using namespace outline;
+
+static const std::string kFqCodelQdisc = "fq_codel";
+static const std::string kCakeQdisc = "cake";
+
+namespace outline {
+
+void ValidateQueueingProfile(const QueueingProfile &profile) {
+  if (!profile.qdisc.empty() && profile.qdisc != kFqCodelQdisc && profile.qdisc != kCakeQdisc) {
+    throw std::invalid_argument("unsupported qdisc \"" + profile.qdisc + "\"");
+  }
+  if (profile.egress_rate > 0 && profile.qdisc != kCakeQdisc) {
+    // fq_codel has no shaper of its own
+    throw std::invalid_argument("egress shaping needs the " + kCakeQdisc + " qdisc");
+  }
+}
+
+void ApplyQueueingProfile(NetlinkSocket &rtnl, int interface_index, const QueueingProfile &profile) {
+  ValidateQueueingProfile(profile);
+
+  if (profile.transmit_queue_length > 0) {
+    NetlinkMessage request{RTM_NEWLINK, 0};
+    ifinfomsg header{};
+    header.ifi_family = AF_UNSPEC;
+    header.ifi_index = interface_index;
+    request.AppendHeader(header);
+    request.AddAttribute(IFLA_TXQLEN, profile.transmit_queue_length);
+    rtnl.Request(request);
+  }
+
+  if (profile.qdisc.empty()) {
+    return;
+  }
+
+  // what `tc qdisc replace dev <interface> root <qdisc>` sends
+  NetlinkMessage request{RTM_NEWQDISC, NLM_F_CREATE | NLM_F_REPLACE};
+  tcmsg header{};
+  header.tcm_family = AF_UNSPEC;
+  header.tcm_ifindex = interface_index;
+  header.tcm_parent = TC_H_ROOT;
+  request.AppendHeader(header);
+  request.AddStringAttribute(TCA_KIND, profile.qdisc);
+
+  auto options = request.BeginNested(TCA_OPTIONS);
+  if (profile.qdisc == kCakeQdisc && profile.egress_rate > 0) {
+    // cake wants bytes per second
+    request.AddAttribute(TCA_CAKE_BASE_RATE64, static_cast<uint64_t>(profile.egress_rate / 8));
+  }
+  request.EndNested(options);
+  rtnl.Request(request);
+}
+
+}  // namespace outline
@@ -0,0 +1,52 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "netlink_socket.h"
+
+namespace outline {
+
+/**
+ * @brief How packets queue up on their way out of an interface. With the
+ *        defaults of a tun device (a queue of 500 packets), a bulk transfer
+ *        saturating the tunnel delays every other flow by the whole queue;
+ *        see benchmarks/tun_queueing_benchmark.
+ */
+struct QueueingProfile {
+  // The transmit queue length of the device, 0 to keep the current one
+  uint32_t transmit_queue_length = 0;
+  // "fq_codel", "cake", or empty to keep the current root qdisc
+  std::string qdisc{};
+  // Egress shaping in bits per second, 0 for none (needs the cake shaper)
+  uint64_t egress_rate = 0;
+};
+
+/**
+ * @brief Check that the kernel can be asked for `profile`.
+ *
+ * @throw std::invalid_argument Unknown qdisc, or shaping without cake.
+ */
+void ValidateQueueingProfile(const QueueingProfile &profile);
+
+/**
+ * @brief Set the transmit queue length and replace the root qdisc of an
+ *        interface with rtnetlink requests.
+ */
+void ApplyQueueingProfile(NetlinkSocket &rtnl, int interface_index, const QueueingProfile &profile);
+
+}  // namespace outline
@@ -0,0 +1,118 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cmath>
+#include <sstream>
+
+#include <net/if.h>
+
+#include <boost/asio.hpp>
+
+#include "logger.h"
+#include "traffic_monitor.h"
+
+using namespace outline;
+
+// How fast the rates follow the counters, longer is smoother
+static const std::chrono::seconds kRateTimeConstant{2};
+
+static void FormatInterfaceStats(std::ostream &output, const std::string &name,
+                                 const TrafficRateEstimator &estimator) {
+  output << "\"" << name << "\":{";
+  for (size_t i = 0; i < kTrafficCounterCount; i++) {
+    auto counter_name = TrafficCounterName(static_cast<TrafficCounter>(i));
+    output << (i == 0 ? "" : ",")
+           << "\"" << counter_name << "\":" << estimator.counters()[i] << ","
+           << "\"" << counter_name << "PerSecond\":" << std::llround(estimator.rates()[i]);
+  }
+  output << "}";
+}
+
+TrafficMonitor::TrafficMonitor(boost::asio::any_io_executor executor,
+                               std::shared_ptr<OutlineProxyController> outline_proxy_controller,
+                               std::chrono::milliseconds interval)
+  : executor_{std::move(executor)},
+    outline_controller_{std::move(outline_proxy_controller)},
+    interval_{interval},
+    rtnl_{NETLINK_ROUTE},
+    tun_rates_{kRateTimeConstant},
+    uplink_rates_{kRateTimeConstant}
+{}
+
+boost::asio::awaitable<void> TrafficMonitor::Start() {
+  using namespace boost::asio;
+
+  steady_timer timer{executor_};
+  auto next_sample = std::chrono::steady_clock::now();
+  for (;;) {
+    try {
+      Sample();
+    } catch (const std::exception &e) {
+      logger.warn("failed to sample the traffic counters: " + std::string(e.what()));
+    }
+
+    // a fixed schedule, whatever time the sampling and the listeners took
+    next_sample += interval_;
+    timer.expires_at(next_sample);
+    co_await timer.async_wait(use_awaitable);
+  }
+}
+
+void TrafficMonitor::Sample() {
+  auto uplink_name = outline_controller_->getUplinkInterfaceName();
+  if (uplink_name != uplink_name_) {
+    uplink_rates_.Reset();
+    uplink_name_ = uplink_name;
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  const auto interfaces = DumpInterfaceCounters(rtnl_);
+  auto update = [&](const std::string &name, TrafficRateEstimator &estimator) {
+    auto counters = interfaces.find(static_cast<int>(::if_nametoindex(name.c_str())));
+    if (counters != interfaces.end()) {
+      estimator.Update(counters->second, now);
+    }
+  };
+  update(outline_controller_->getTunDeviceName(), tun_rates_);
+  if (!uplink_name_.empty()) {
+    update(uplink_name_, uplink_rates_);
+  }
+
+  if (!listeners_.empty()) {
+    auto stats = FormatStats();
+    for (const auto &[listener_id, listener] : listeners_) {
+      listener(stats);
+    }
+  }
+}
+
+std::string TrafficMonitor::FormatStats() const {
+  std::ostringstream stats;
+  FormatInterfaceStats(stats, "tun", tun_rates_);
+  if (!uplink_name_.empty()) {
+    stats << ",";
+    FormatInterfaceStats(stats, "uplink", uplink_rates_);
+  }
+  return stats.str();
+}
+
+int TrafficMonitor::AddListener(StatsListener listener) {
+  auto listener_id = next_listener_id_++;
+  listeners_.emplace(listener_id, std::move(listener));
+  return listener_id;
+}
+
+void TrafficMonitor::RemoveListener(int listener_id) {
+  listeners_.erase(listener_id);
+}
@@ -0,0 +1,83 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/awaitable.hpp>
+
+#include "netlink_socket.h"
+#include "outline_proxy_controller.h"
+#include "traffic_stats.h"
+
+namespace outline {
+
+/**
+ * @brief Samples the counters of the tun device and of the uplink at a fixed
+ *        interval, and keeps their smoothed rates for the clients.
+ */
+class TrafficMonitor {
+public:
+  TrafficMonitor(boost::asio::any_io_executor executor,
+                 std::shared_ptr<OutlineProxyController> outline_proxy_controller,
+                 std::chrono::milliseconds interval);
+
+public:
+  /**
+   * @brief Start sampling asynchronously.
+   *
+   * @return boost::asio::awaitable<void> A co_awaitable C++20 coroutine.
+   */
+  boost::asio::awaitable<void> Start();
+
+  /**
+   * @brief The latest counters and rates, formatted as the JSON members
+   *        `"tun":{...},"uplink":{...}` (uplink only once it is known).
+   */
+  std::string FormatStats() const;
+
+  typedef std::function<void(const std::string&)> StatsListener;
+
+  /**
+   * @brief Register a listener called with `FormatStats()` after each sample.
+   *
+   * @return int The id to pass to `RemoveListener`.
+   */
+  int AddListener(StatsListener listener);
+  void RemoveListener(int listener_id);
+
+private:
+  void Sample();
+
+private:
+  boost::asio::any_io_executor executor_;
+  std::shared_ptr<OutlineProxyController> outline_controller_;
+  std::chrono::milliseconds interval_;
+  NetlinkSocket rtnl_;
+
+  TrafficRateEstimator tun_rates_;
+  TrafficRateEstimator uplink_rates_;
+  std::string uplink_name_;
+
+  std::map<int, StatsListener> listeners_;
+  int next_listener_id_ = 0;
+};
+
+}  // namespace outline
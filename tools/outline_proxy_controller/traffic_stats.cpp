@@ -0,0 +1,105 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cmath>
+#include <cstring>
+
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+
+#include "traffic_stats.h"
+
+using namespace outline;
+
+namespace outline {
+
+const char *TrafficCounterName(TrafficCounter counter) {
+  static const char *const kNames[kTrafficCounterCount] = {
+    "receivedBytes",
+    "sentBytes",
+    "receivedPackets",
+    "sentPackets",
+    "receiveDrops",
+    "sendDrops",
+    "receiveErrors",
+    "sendErrors",
+  };
+  return counter < kTrafficCounterCount ? kNames[counter] : "";
+}
+
+std::unordered_map<int, InterfaceCounters> DumpInterfaceCounters(NetlinkSocket &rtnl) {
+  std::unordered_map<int, InterfaceCounters> interfaces;
+
+  NetlinkMessage request{RTM_GETLINK, NLM_F_DUMP};
+  ifinfomsg header{};
+  header.ifi_family = AF_UNSPEC;
+  request.AppendHeader(header);
+
+  rtnl.Request(request, [&](const nlmsghdr &msg) {
+    if (msg.nlmsg_type != RTM_NEWLINK) {
+      return;
+    }
+    auto link = static_cast<const ifinfomsg*>(NLMSG_DATA(&msg));
+    ForEachNetlinkAttribute<ifinfomsg>(msg, [&](uint16_t type, const void *data, size_t length) {
+      if (type != IFLA_STATS64 || length < sizeof(rtnl_link_stats64)) {
+        return;
+      }
+      rtnl_link_stats64 stats;
+      std::memcpy(&stats, data, sizeof(stats));
+      interfaces[link->ifi_index] = {
+        stats.rx_bytes, stats.tx_bytes,
+        stats.rx_packets, stats.tx_packets,
+        stats.rx_dropped, stats.tx_dropped,
+        stats.rx_errors, stats.tx_errors,
+      };
+    });
+  });
+  return interfaces;
+}
+
+}  // namespace outline
+
+//#region TrafficRateEstimator Implementation
+
+TrafficRateEstimator::TrafficRateEstimator(std::chrono::milliseconds time_constant)
+  : time_constant_{time_constant}
+{}
+
+void TrafficRateEstimator::Update(const InterfaceCounters &counters,
+                                  std::chrono::steady_clock::time_point now) {
+  if (last_update_) {
+    std::chrono::duration<double> elapsed = now - *last_update_;
+    if (elapsed.count() > 0) {
+      auto weight = 1 - std::exp(-elapsed.count() / time_constant_.count());
+      for (size_t i = 0; i < kTrafficCounterCount; i++) {
+        // a counter going backwards has been reset, skip this sample
+        if (counters[i] >= counters_[i]) {
+          auto rate = static_cast<double>(counters[i] - counters_[i]) / elapsed.count();
+          rates_[i] += weight * (rate - rates_[i]);
+        }
+      }
+    }
+  }
+  counters_ = counters;
+  last_update_ = now;
+}
+
+void TrafficRateEstimator::Reset() {
+  last_update_.reset();
+  counters_ = {};
+  rates_ = {};
+}
+
+//#endregion TrafficRateEstimator Implementation
@@ -0,0 +1,83 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+
+#include "netlink_socket.h"
+
+namespace outline {
+
+/**
+ * @brief The counters of `rtnl_link_stats64` we report.
+ */
+enum TrafficCounter : size_t {
+  kReceivedBytes,
+  kSentBytes,
+  kReceivedPackets,
+  kSentPackets,
+  kReceiveDrops,
+  kSendDrops,
+  kReceiveErrors,
+  kSendErrors,
+  kTrafficCounterCount,
+};
+
+/**
+ * @brief The camelCase name of a counter, as reported to the client.
+ */
+const char *TrafficCounterName(TrafficCounter counter);
+
+typedef std::array<uint64_t, kTrafficCounterCount> InterfaceCounters;
+typedef std::array<double, kTrafficCounterCount> InterfaceRates;
+
+/**
+ * @brief Query the counters of all interfaces, indexed by interface index,
+ *        with a single RTM_GETLINK dump.
+ */
+std::unordered_map<int, InterfaceCounters> DumpInterfaceCounters(NetlinkSocket &rtnl);
+
+/**
+ * @brief Smooths the per second rates of the counters of one interface with
+ *        an exponentially weighted moving average, so that the weight of a
+ *        sample does not depend on how regularly samples are taken.
+ */
+class TrafficRateEstimator {
+public:
+  explicit TrafficRateEstimator(std::chrono::milliseconds time_constant);
+
+  void Update(const InterfaceCounters &counters, std::chrono::steady_clock::time_point now);
+
+  /**
+   * @brief Forget the history, e.g. when the interface has changed.
+   */
+  void Reset();
+
+  const InterfaceCounters &counters() const { return counters_; }
+  const InterfaceRates &rates() const { return rates_; }
+
+private:
+  std::chrono::duration<double> time_constant_;
+  std::optional<std::chrono::steady_clock::time_point> last_update_;
+  InterfaceCounters counters_{};
+  InterfaceRates rates_{};
+};
+
+}  // namespace outline
@@ -0,0 +1,415 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <linux/if_tun.h>
+#include <net/if.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "tun_pump.h"
+
+#if defined(OUTLINE_NATIVE_DATA_PLANE)
+#include "io_uring_queue.h"
+#endif
+
+using namespace outline;
+
+static int AttachTunQueue(const std::string &tun_name) {
+  int fd = ::open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::system_error{errno, std::generic_category(), "failed to open /dev/net/tun"};
+  }
+  ifreq request{};
+  std::strncpy(request.ifr_name, tun_name.c_str(), IFNAMSIZ - 1);
+  request.ifr_flags = IFF_TUN | IFF_NO_PI;
+  if (::ioctl(fd, TUNSETIFF, &request) < 0 && errno == EINVAL) {
+    // the device was created with multiple queues (--tun-align-queues)
+    request.ifr_flags |= IFF_MULTI_QUEUE;
+    if (::ioctl(fd, TUNSETIFF, &request) == 0) {
+      return fd;
+    }
+  } else {
+    return fd;
+  }
+  auto err = errno;
+  ::close(fd);
+  throw std::system_error{err, std::generic_category(), "failed to attach to " + tun_name};
+}
+
+static int ConnectUpstream(const std::string &upstream) {
+  auto colon = upstream.rfind(':');
+  if (colon == std::string::npos || colon == 0 || colon + 1 == upstream.size()) {
+    throw std::invalid_argument("invalid data plane upstream \"" + upstream + "\"");
+  }
+  auto host = upstream.substr(0, colon);
+  if (host.front() == '[' && host.back() == ']') {
+    host = host.substr(1, host.size() - 2);
+  }
+  auto port = upstream.substr(colon + 1);
+
+  addrinfo hints{};
+  hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+  hints.ai_socktype = SOCK_DGRAM;
+  addrinfo *address = nullptr;
+  if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &address) != 0) {
+    throw std::invalid_argument("invalid data plane upstream \"" + upstream + "\"");
+  }
+  int fd = ::socket(address->ai_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0 || ::connect(fd, address->ai_addr, address->ai_addrlen) < 0) {
+    auto err = errno;
+    ::freeaddrinfo(address);
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    throw std::system_error{err, std::generic_category(), "failed to connect to " + upstream};
+  }
+  ::freeaddrinfo(address);
+  return fd;
+}
+
+#if defined(OUTLINE_NATIVE_DATA_PLANE)
+// the flows accounted at most, about 7 MiB
+static const size_t kFlowCapacity = 64 * 1024;
+static const uint32_t kFlowIdleTimeoutSeconds = 120;
+#endif
+
+//#region TunPump Implementation
+
+TunPump::TunPump(const std::string &tun_name, const std::string &upstream)
+    : tun_name_{tun_name}
+#if defined(OUTLINE_NATIVE_DATA_PLANE)
+    , flows_{kFlowCapacity, 1, kFlowIdleTimeoutSeconds}
+#endif
+{
+  upstream_fd_ = ConnectUpstream(upstream);
+  try {
+    tun_fd_ = AttachTunQueue(tun_name);
+  } catch (...) {
+    ::close(upstream_fd_);
+    throw;
+  }
+  stop_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (stop_fd_ < 0) {
+    auto err = errno;
+    ::close(tun_fd_);
+    ::close(upstream_fd_);
+    throw std::system_error{err, std::generic_category(), "failed to create an eventfd"};
+  }
+}
+
+TunPump::~TunPump() {
+  Stop();
+  engine_.reset();
+  ::close(stop_fd_);
+  ::close(tun_fd_);
+  ::close(upstream_fd_);
+}
+
+void TunPump::Stop() {
+  if (thread_.joinable()) {
+    uint64_t one = 1;
+    if (::write(stop_fd_, &one, sizeof(one)) != sizeof(one)) {
+      logger.warn("failed to stop the data plane: " + std::string{std::strerror(errno)});
+    }
+    thread_.join();
+    logger.info("native data plane on " + tun_name_ + " stopped");
+  }
+}
+
+TunPumpStats TunPump::Stats() const {
+  TunPumpStats stats;
+  stats.upstream_packets = upstream_packets_.load(std::memory_order_relaxed);
+  stats.upstream_bytes = upstream_bytes_.load(std::memory_order_relaxed);
+  stats.downstream_packets = downstream_packets_.load(std::memory_order_relaxed);
+  stats.downstream_bytes = downstream_bytes_.load(std::memory_order_relaxed);
+  stats.dropped_packets = dropped_packets_.load(std::memory_order_relaxed);
+  timespec cpu_time;
+  if (thread_.joinable() && ::clock_gettime(cpu_clock_, &cpu_time) == 0) {
+    stats.cpu_seconds = static_cast<double>(cpu_time.tv_sec) + cpu_time.tv_nsec / 1e9;
+  }
+  return stats;
+}
+
+std::string TunPump::FormatStats() const {
+  auto stats = Stats();
+  char cpu_seconds[32];
+  std::snprintf(cpu_seconds, sizeof(cpu_seconds), "%.6f", stats.cpu_seconds);
+  return "\"dataPlane\":{\"upstreamPackets\":" + std::to_string(stats.upstream_packets) +
+         ",\"upstreamBytes\":" + std::to_string(stats.upstream_bytes) +
+         ",\"downstreamPackets\":" + std::to_string(stats.downstream_packets) +
+         ",\"downstreamBytes\":" + std::to_string(stats.downstream_bytes) +
+         ",\"droppedPackets\":" + std::to_string(stats.dropped_packets) +
+         ",\"cpuSeconds\":" + cpu_seconds + "}";
+}
+
+#if defined(OUTLINE_NATIVE_DATA_PLANE)
+
+// IORING_OP_READ_MULTISHOT of Linux 6.7, missing from older headers; on older
+// kernels the tun device is read with one IORING_OP_READ at a time instead
+static const uint8_t kOpReadMultishot = 49;
+
+static const unsigned kQueueEntries = 256;
+// per direction; a buffer holds a whole packet of the tun device (MTU <= 2048)
+static const uint16_t kBufferCount = 256;
+static const size_t kBufferSize = 2048;
+
+static const uint16_t kFromTunGroup = 0;
+static const uint16_t kFromUpstreamGroup = 1;
+// the fixed buffer index of the memory of kFromUpstreamGroup
+static const uint16_t kFromUpstreamFixedBuffer = 1;
+
+// the operation in the low bits of the user_data, the buffer id above
+enum Operation : uint64_t {
+  kReadTun = 1,
+  kSendUpstream,
+  kReceiveUpstream,
+  kWriteTun,
+  kReadStop,
+};
+
+static uint64_t UserData(Operation operation, uint16_t buffer_id = 0) {
+  return operation | (static_cast<uint64_t>(buffer_id) << 32);
+}
+
+// the packets of a batch of completions, in buffers not recycled before the
+// next submission
+struct PendingPackets {
+  std::array<std::span<const uint8_t>, FlowTuples::kCapacity> packets;
+  size_t count = 0;
+};
+
+struct TunPump::Engine {
+  IoUringQueue queue{kQueueEntries};
+  ProvidedBufferRing from_tun{queue, kFromTunGroup, kBufferCount, kBufferSize};
+  ProvidedBufferRing from_upstream{queue, kFromUpstreamGroup, kBufferCount, kBufferSize};
+  bool multishot_read = true;
+  // a read or receive ran out of buffers, rearm it once one is recycled
+  bool tun_read_starved = false;
+  bool upstream_receive_starved = false;
+  bool running = true;
+  uint64_t stop_value = 0;
+  PendingPackets sent;
+  PendingPackets received;
+  FlowTuples tuples;
+
+  io_uring_sqe *NextSqe() {
+    auto sqe = queue.GetSqe();
+    if (sqe == nullptr) {
+      queue.Submit(0);
+      sqe = queue.GetSqe();
+    }
+    return sqe;
+  }
+};
+
+void TunPump::Start() {
+  if (thread_.joinable()) {
+    return;
+  }
+  engine_ = std::make_unique<Engine>();
+  iovec fixed_buffers[2] = {engine_->from_tun.Memory(), engine_->from_upstream.Memory()};
+  engine_->queue.RegisterBuffers(fixed_buffers, 2);
+
+  ArmTunRead();
+  ArmUpstreamReceive();
+  auto sqe = engine_->NextSqe();
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = stop_fd_;
+  sqe->addr = reinterpret_cast<uint64_t>(&engine_->stop_value);
+  sqe->len = sizeof(engine_->stop_value);
+  sqe->user_data = UserData(kReadStop);
+
+  thread_ = std::thread{[this]() { Run(); }};
+  if (::pthread_getcpuclockid(thread_.native_handle(), &cpu_clock_) != 0) {
+    cpu_clock_ = CLOCK_THREAD_CPUTIME_ID;
+  }
+  logger.info("native data plane on " + tun_name_ + " started");
+}
+
+void TunPump::ArmTunRead() {
+  auto sqe = engine_->NextSqe();
+  sqe->opcode = engine_->multishot_read ? kOpReadMultishot : uint8_t{IORING_OP_READ};
+  sqe->fd = tun_fd_;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kFromTunGroup;
+  // the packets are not at a position of the tun device
+  sqe->off = static_cast<uint64_t>(-1);
+  sqe->user_data = UserData(kReadTun);
+}
+
+void TunPump::ArmUpstreamReceive() {
+  auto sqe = engine_->NextSqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->fd = upstream_fd_;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kFromUpstreamGroup;
+  sqe->user_data = UserData(kReceiveUpstream);
+}
+
+void TunPump::Run() {
+  try {
+    while (engine_->running) {
+      engine_->from_tun.Publish();
+      engine_->from_upstream.Publish();
+      engine_->queue.Submit(1);
+      engine_->queue.ForEachCompletion([this](const io_uring_cqe &cqe) {
+        HandleCompletion(cqe.user_data, cqe.res, cqe.flags);
+      });
+      AccountFlows(FlowDirection::kSent);
+      AccountFlows(FlowDirection::kReceived);
+      flows_.GetShard(0).Expire(FlowTable::Now());
+    }
+  } catch (const std::exception &e) {
+    logger.error("native data plane failed: " + std::string{e.what()});
+  }
+}
+
+void TunPump::AccountFlows(FlowDirection direction) {
+  auto &engine = *engine_;
+  auto &pending = direction == FlowDirection::kSent ? engine.sent : engine.received;
+  if (pending.count == 0) {
+    return;
+  }
+  std::array<uint32_t, FlowTuples::kCapacity> bytes;
+  for (size_t i = 0; i < pending.count; i++) {
+    bytes[i] = static_cast<uint32_t>(pending.packets[i].size());
+  }
+  PacketClassifier::Parse({pending.packets.data(), pending.count}, engine.tuples);
+  flows_.GetShard(0).AccountBatch(engine.tuples, bytes.data(), direction, FlowTable::Now());
+  pending.count = 0;
+}
+
+void TunPump::HandleCompletion(uint64_t user_data, int32_t result, uint32_t flags) {
+  auto &engine = *engine_;
+  auto operation = static_cast<Operation>(user_data & 0xffffffff);
+  auto buffer_id = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+  bool more = (flags & IORING_CQE_F_MORE) != 0;
+
+  switch (operation) {
+  case kReadTun:
+    if (result > 0 && (flags & IORING_CQE_F_BUFFER)) {
+      auto sqe = engine.NextSqe();
+      sqe->opcode = IORING_OP_SEND;
+      sqe->fd = upstream_fd_;
+      sqe->addr = reinterpret_cast<uint64_t>(engine.from_tun.Buffer(buffer_id));
+      sqe->len = static_cast<uint32_t>(result);
+      sqe->user_data = UserData(kSendUpstream, buffer_id);
+      engine.sent.packets[engine.sent.count++] = {
+          engine.from_tun.Buffer(buffer_id), static_cast<size_t>(result)};
+      if (engine.sent.count == FlowTuples::kCapacity) {
+        AccountFlows(FlowDirection::kSent);
+      }
+    } else if (result == -ENOBUFS) {
+      engine.tun_read_starved = true;
+      return;
+    } else if (engine.multishot_read && (result == -EINVAL || result == -EOPNOTSUPP)) {
+      logger.info("multishot reads are not supported, reading " + tun_name_ + " one at a time");
+      engine.multishot_read = false;
+    } else if (result < 0 && result != -EAGAIN && result != -EINTR) {
+      logger.error("stopped reading " + tun_name_ + ": " + std::strerror(-result));
+      return;
+    }
+    if (!more) {
+      ArmTunRead();
+    }
+    break;
+
+  case kSendUpstream:
+    engine.from_tun.Recycle(static_cast<uint16_t>(user_data >> 32));
+    if (result < 0) {
+      dropped_packets_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      upstream_packets_.fetch_add(1, std::memory_order_relaxed);
+      upstream_bytes_.fetch_add(static_cast<uint64_t>(result), std::memory_order_relaxed);
+    }
+    if (engine.tun_read_starved) {
+      engine.tun_read_starved = false;
+      ArmTunRead();
+    }
+    break;
+
+  case kReceiveUpstream:
+    if (result > 0 && (flags & IORING_CQE_F_BUFFER)) {
+      auto sqe = engine.NextSqe();
+      sqe->opcode = IORING_OP_WRITE_FIXED;
+      sqe->fd = tun_fd_;
+      sqe->addr = reinterpret_cast<uint64_t>(engine.from_upstream.Buffer(buffer_id));
+      sqe->len = static_cast<uint32_t>(result);
+      sqe->buf_index = kFromUpstreamFixedBuffer;
+      sqe->off = static_cast<uint64_t>(-1);
+      sqe->user_data = UserData(kWriteTun, buffer_id);
+      engine.received.packets[engine.received.count++] = {
+          engine.from_upstream.Buffer(buffer_id), static_cast<size_t>(result)};
+      if (engine.received.count == FlowTuples::kCapacity) {
+        AccountFlows(FlowDirection::kReceived);
+      }
+    } else if (result == -ENOBUFS) {
+      engine.upstream_receive_starved = true;
+      return;
+    } else if (result < 0) {
+      // e.g. ECONNREFUSED until the upstream listens
+      dropped_packets_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (!more) {
+      ArmUpstreamReceive();
+    }
+    break;
+
+  case kWriteTun:
+    engine.from_upstream.Recycle(static_cast<uint16_t>(user_data >> 32));
+    if (result < 0) {
+      dropped_packets_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      downstream_packets_.fetch_add(1, std::memory_order_relaxed);
+      downstream_bytes_.fetch_add(static_cast<uint64_t>(result), std::memory_order_relaxed);
+    }
+    if (engine.upstream_receive_starved) {
+      engine.upstream_receive_starved = false;
+      ArmUpstreamReceive();
+    }
+    break;
+
+  case kReadStop:
+    engine.running = false;
+    break;
+  }
+}
+
+#else  // defined(OUTLINE_NATIVE_DATA_PLANE)
+
+struct TunPump::Engine {};
+
+void TunPump::Start() {
+  throw std::system_error{ENOTSUP, std::generic_category(),
+                          "built without the native data plane (OUTLINE_NATIVE_DATA_PLANE)"};
+}
+
+#endif  // defined(OUTLINE_NATIVE_DATA_PLANE)
+
+//#endregion TunPump Implementation
@@ -0,0 +1,122 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+
+#if defined(OUTLINE_NATIVE_DATA_PLANE)
+#include "flow_table.h"
+#endif
+
+namespace outline {
+
+struct TunPumpStats {
+  // read from the tun device and sent upstream
+  uint64_t upstream_packets = 0;
+  uint64_t upstream_bytes = 0;
+  // received from upstream and written to the tun device
+  uint64_t downstream_packets = 0;
+  uint64_t downstream_bytes = 0;
+  // failed to be sent upstream or written to the tun device
+  uint64_t dropped_packets = 0;
+  // the CPU time used by the pump thread
+  double cpu_seconds = 0;
+};
+
+/**
+ * @brief The native data plane: moves the IP packets between a queue of the
+ *        tun device and a datagram upstream, one packet per UDP datagram, on
+ *        a dedicated thread, in place of an external tun2socks.
+ *
+ * The thread is driven by io_uring: a multishot read of the tun device and a
+ * multishot receive of the upstream socket fill buffers provided through
+ * buffer rings, and the writes to the tun device use these buffers registered
+ * as fixed buffers. The operations prepared while handling a batch of
+ * completions are submitted together with the wait for the next batch, and
+ * the packets of the batch are then accounted to their flows.
+ *
+ * Only available when built with `OUTLINE_NATIVE_DATA_PLANE`, otherwise
+ * `Start` throws.
+ */
+class TunPump {
+public:
+  /**
+   * @param tun_name The tun device to attach a queue of.
+   * @param upstream The numeric "address:port" (or "[address]:port") of the
+   *                 upstream, which must not be routed through the tun device.
+   */
+  TunPump(const std::string &tun_name, const std::string &upstream);
+  ~TunPump();
+
+  TunPump(const TunPump &) = delete;
+  TunPump &operator=(const TunPump &) = delete;
+
+  /**
+   * @brief Set up the io_uring and start the pump thread.
+   */
+  void Start();
+  void Stop();
+
+  TunPumpStats Stats() const;
+
+  /**
+   * @brief The stats formatted as the JSON member `"dataPlane":{...}`.
+   */
+  std::string FormatStats() const;
+
+#if defined(OUTLINE_NATIVE_DATA_PLANE)
+  /**
+   * @brief The packets and bytes of each flow moved by the pump, read from the
+   *        tun device (sent) or written to it (received).
+   */
+  const FlowTable &Flows() const { return flows_; }
+#endif
+
+private:
+  struct Engine;
+
+  void Run();
+  void HandleCompletion(uint64_t user_data, int32_t result, uint32_t flags);
+  void ArmTunRead();
+  void ArmUpstreamReceive();
+#if defined(OUTLINE_NATIVE_DATA_PLANE)
+  void AccountFlows(FlowDirection direction);
+#endif
+
+  std::string tun_name_;
+  int tun_fd_ = -1;
+  int upstream_fd_ = -1;
+  int stop_fd_ = -1;
+  std::unique_ptr<Engine> engine_;
+  std::thread thread_;
+  clockid_t cpu_clock_ = CLOCK_THREAD_CPUTIME_ID;
+
+  std::atomic<uint64_t> upstream_packets_{0};
+  std::atomic<uint64_t> upstream_bytes_{0};
+  std::atomic<uint64_t> downstream_packets_{0};
+  std::atomic<uint64_t> downstream_bytes_{0};
+  std::atomic<uint64_t> dropped_packets_{0};
+#if defined(OUTLINE_NATIVE_DATA_PLANE)
+  // written by the pump thread only
+  FlowTable flows_;
+#endif
+};
+
+}  // namespace outline
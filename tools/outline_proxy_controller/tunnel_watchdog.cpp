@@ -0,0 +1,123 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <system_error>
+
+#include <linux/rtnetlink.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <boost/asio.hpp>
+
+#include "logger.h"
+#include "netlink_socket.h"
+#include "tunnel_watchdog.h"
+
+using namespace outline;
+
+// IFF_LOWER_UP of <linux/if.h>, which cannot be included along with <net/if.h> used by asio
+static const unsigned int kLinkHasCarrier = 0x10000;
+
+TunnelWatchdog::TunnelWatchdog(boost::asio::any_io_executor executor,
+                               std::shared_ptr<OutlineProxyController> outline_proxy_controller)
+  : executor_{std::move(executor)},
+    outline_controller_{std::move(outline_proxy_controller)}
+{}
+
+boost::asio::awaitable<void> TunnelWatchdog::Start() {
+  using namespace boost::asio;
+
+  const auto tun_name = outline_controller_->getTunDeviceName();
+  try {
+    NetlinkSocket link_monitor{NETLINK_ROUTE, RTMGRP_LINK};
+
+    // the descriptor takes the ownership of the fd it is given
+    posix::stream_descriptor link_events{executor_, ::dup(link_monitor.fd())};
+    for (;;) {
+      co_await link_events.async_wait(posix::descriptor_base::wait_read, use_awaitable);
+      link_monitor.ReceivePending([&](const nlmsghdr &msg) {
+        if (msg.nlmsg_type != RTM_NEWLINK && msg.nlmsg_type != RTM_DELLINK) {
+          return;
+        }
+        bool is_tun = false;
+        ForEachNetlinkAttribute<ifinfomsg>(msg, [&](uint16_t type, const void *data, size_t length) {
+          if (type == IFLA_IFNAME) {
+            auto name = static_cast<const char*>(data);
+            is_tun = tun_name == std::string(name, ::strnlen(name, length));
+          }
+        });
+        if (is_tun) {
+          auto link = static_cast<const ifinfomsg*>(NLMSG_DATA(&msg));
+          OnCarrierChanged(msg.nlmsg_type == RTM_NEWLINK && (link->ifi_flags & kLinkHasCarrier));
+        }
+      });
+    }
+  } catch (const std::exception &e) {
+    logger.error("tun device watchdog stopped: " + std::string(e.what()));
+  }
+}
+
+void TunnelWatchdog::OnCarrierChanged(bool has_carrier) {
+  using namespace boost::asio;
+
+  if (has_carrier_ == has_carrier) {
+    return;
+  }
+  has_carrier_ = has_carrier;
+  logger.debug(outline_controller_->getTunDeviceName() +
+               (has_carrier ? " has a reader attached" : " lost its last reader"));
+  if (has_carrier) {
+    co_spawn(executor_,
+             [controller = outline_controller_]() { return controller->handleDataPlaneRecovery(); },
+             detached);
+  } else {
+    co_spawn(executor_,
+             [controller = outline_controller_]() { return controller->handleDataPlaneLoss(); },
+             detached);
+  }
+}
+
+void TunnelWatchdog::WatchTunnelProcess(pid_t pid) {
+  using namespace boost::asio;
+
+  int pidfd = static_cast<int>(::syscall(SYS_pidfd_open, pid, 0));
+  if (pidfd < 0) {
+    throw std::system_error{errno, std::generic_category(),
+                            "failed to open pidfd of process " + std::to_string(pid)};
+  }
+
+  // closing the previous descriptor aborts its pending wait
+  tunnel_process_ = std::make_unique<posix::stream_descriptor>(executor_, pidfd);
+  auto generation = ++tunnel_process_generation_;
+  co_spawn(executor_, WaitForTunnelProcess(generation), detached);
+  logger.info("watching tunnel process " + std::to_string(pid));
+}
+
+boost::asio::awaitable<void> TunnelWatchdog::WaitForTunnelProcess(uint64_t generation) {
+  using namespace boost::asio;
+
+  // a pidfd becomes readable once the process terminates
+  auto [err] = co_await tunnel_process_->async_wait(
+      posix::descriptor_base::wait_read, as_tuple(use_awaitable));
+  if (err || generation != tunnel_process_generation_) {
+    co_return;
+  }
+
+  logger.warn("tunnel process terminated");
+  tunnel_process_.reset();
+  co_await outline_controller_->handleDataPlaneLoss();
+}
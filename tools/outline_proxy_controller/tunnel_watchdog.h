@@ -0,0 +1,75 @@
+// Copyright 2022 The Outline Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+#include <sys/types.h>
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+#include "outline_proxy_controller.h"
+
+namespace outline {
+
+/**
+ * @brief Watches the data plane (the tun2socks process reading from the tun
+ *        device) and tells the controller as soon as it is gone, so the traffic
+ *        is not blackholed until the client notices.
+ *
+ * Two signals are used:
+ *   - The carrier (`IFF_LOWER_UP`) of the tun device, which the kernel drops
+ *     when the last queue file descriptor is closed.
+ *   - Optionally, a pidfd of the tunnel process registered by the client.
+ */
+class TunnelWatchdog {
+public:
+  TunnelWatchdog(boost::asio::any_io_executor executor,
+                 std::shared_ptr<OutlineProxyController> outline_proxy_controller);
+
+public:
+  /**
+   * @brief Start watching the carrier of the tun device asynchronously.
+   *
+   * @return boost::asio::awaitable<void> A co_awaitable C++20 coroutine.
+   */
+  boost::asio::awaitable<void> Start();
+
+  /**
+   * @brief Watch the tunnel process `pid` as well, replacing any process
+   *        registered before.
+   *
+   * @throw std::system_error `pid` cannot be watched.
+   */
+  void WatchTunnelProcess(pid_t pid);
+
+private:
+  boost::asio::awaitable<void> WaitForTunnelProcess(uint64_t generation);
+  void OnCarrierChanged(bool has_carrier);
+
+private:
+  boost::asio::any_io_executor executor_;
+  std::shared_ptr<OutlineProxyController> outline_controller_;
+  std::optional<bool> has_carrier_;
+
+  std::unique_ptr<boost::asio::posix::stream_descriptor> tunnel_process_;
+  uint64_t tunnel_process_generation_ = 0;
+};
+
+}  // namespace outline